@@ -0,0 +1,444 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/atomic.h"
+#include "src/dumb_buffer.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/plane_alloc.h"
+#include "src/trace.h"
+#include "src/writeback.h"
+
+// build: gcc capture_fb.c src/writeback.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/damage.c src/format.c src/pixel.c src/tiling.c src/mode.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o capture_fb -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./capture_fb [device] [--frames 120] [--record out.raw] [--tolerance 1] [--no-check]
+//        needs a writeback connector: vkms, or the fake backend as fake:1280x720@60,writeback
+
+#define CAPTURE_BUFFERS 3
+#define OVERLAY_SIZE 192
+#define OVERLAY_BORDER 8
+#define CURSOR_SIZE 64
+
+/*
+    Golden-image test of plane placement. A background on the primary
+    plane, a translucent square on an overlay and an arrow on the cursor
+    plane move around the screen, partly off it at times. Every frame is
+    captured through the writeback connector, i.e. as the display engine
+    blended it, and compared pixel by pixel with the same frame blended on
+    the CPU from the layer positions. The golden images are computed, not
+    stored, so any mode works. Any mismatch fails the run.
+
+    --record writes the captures as raw frames, straight from the capture
+    buffers. Each is also a dma-buf (capture_buffer.dmabuf_fd) for an
+    encoder that imports it instead.
+
+    vkms blends in 16 bits per channel and rounds differently from
+    src/pixel.c, --tolerance is the per channel difference still accepted.
+    The fake backend matches exactly.
+*/
+
+struct layer_buffer
+{
+    struct drm_mode_create_dumb create_dumb;
+    void *map;
+    uint32_t fb_id;
+    const struct plane_info *plane; // NULL when the device has no plane for it
+};
+
+// where the overlay and cursor are in a frame, both wrap around the screen
+// and spend some frames hanging off its edges
+static void layer_positions(uint64_t frame, const drmModeModeInfo *mode, int32_t *overlay_x, int32_t *overlay_y,
+                            int32_t *cursor_x, int32_t *cursor_y)
+{
+    int32_t w = mode->hdisplay, h = mode->vdisplay;
+    *overlay_x = (int32_t)(frame * 7 % (uint64_t)(w + OVERLAY_SIZE)) - OVERLAY_SIZE / 2;
+    *overlay_y = (int32_t)(frame * 5 % (uint64_t)(h + OVERLAY_SIZE)) - OVERLAY_SIZE / 2;
+    *cursor_x = w - CURSOR_SIZE / 2 - (int32_t)(frame * 11 % (uint64_t)(w + CURSOR_SIZE));
+    *cursor_y = (int32_t)(frame * 3 % (uint64_t)(h + CURSOR_SIZE)) - CURSOR_SIZE / 2;
+}
+
+// every pixel different from its neighbours, so a plane off by one shows
+static void draw_background(uint32_t *map, uint32_t pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *row = (uint32_t *)((uint8_t *)map + (size_t)y * pitch);
+        for (uint32_t x = 0; x < width; x++)
+            row[x] = 0xFF000000 | (x * 255 / width) << 16 | (y * 255 / height) << 8 | ((x ^ y) & 0xFF);
+    }
+}
+
+// premultiplied: an opaque border around a half transparent fill with an
+// opaque diagonal, so a mirrored or rotated plane shows too
+static void draw_overlay(uint32_t *map, uint32_t pitch)
+{
+    for (uint32_t y = 0; y < OVERLAY_SIZE; y++)
+    {
+        uint32_t *row = (uint32_t *)((uint8_t *)map + (size_t)y * pitch);
+        for (uint32_t x = 0; x < OVERLAY_SIZE; x++)
+        {
+            int border = x < OVERLAY_BORDER || y < OVERLAY_BORDER || x >= OVERLAY_SIZE - OVERLAY_BORDER ||
+                         y >= OVERLAY_SIZE - OVERLAY_BORDER;
+            if (border || x == y)
+                row[x] = 0xFFFFFFFF;
+            else
+                row[x] = 0x80000000 | (x * 0x80 / OVERLAY_SIZE) << 16 | 0x40 << 8 | (y * 0x80 / OVERLAY_SIZE);
+        }
+    }
+}
+
+// an opaque arrow pointing up left, the rest fully transparent
+static void draw_cursor(uint32_t *map, uint32_t pitch)
+{
+    for (uint32_t y = 0; y < CURSOR_SIZE; y++)
+    {
+        uint32_t *row = (uint32_t *)((uint8_t *)map + (size_t)y * pitch);
+        for (uint32_t x = 0; x < CURSOR_SIZE; x++)
+            row[x] = x <= y / 2 ? (x == y / 2 ? 0xFF000000 : 0xFFF0F0F0) : 0;
+    }
+}
+
+// src over the part of ref it covers at (x, y), what the planes do
+static void blend_clipped(uint32_t *ref, uint32_t width, uint32_t height, const struct layer_buffer *layer,
+                          int32_t x, int32_t y)
+{
+    int32_t w = (int32_t)layer->create_dumb.width, h = (int32_t)layer->create_dumb.height;
+    int32_t x0 = x > 0 ? x : 0, y0 = y > 0 ? y : 0;
+    int32_t x1 = x + w < (int32_t)width ? x + w : (int32_t)width;
+    int32_t y1 = y + h < (int32_t)height ? y + h : (int32_t)height;
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    const uint8_t *src = (const uint8_t *)layer->map + (size_t)(y0 - y) * layer->create_dumb.pitch + (size_t)(x0 - x) * 4;
+    pixel_blend(ref + (size_t)y0 * width + x0, width * 4, src, layer->create_dumb.pitch, (uint32_t)(x1 - x0),
+                (uint32_t)(y1 - y0));
+}
+
+// the reference image of a frame, on the CPU, in ref (width * 4 pitch)
+static void render_reference(uint32_t *ref, const drmModeModeInfo *mode, const struct layer_buffer *layers,
+                             uint64_t frame)
+{
+    int32_t overlay_x, overlay_y, cursor_x, cursor_y;
+    layer_positions(frame, mode, &overlay_x, &overlay_y, &cursor_x, &cursor_y);
+
+    pixel_blit(ref, mode->hdisplay * 4, layers[0].map, layers[0].create_dumb.pitch, mode->hdisplay, mode->vdisplay);
+    if (layers[1].plane)
+        blend_clipped(ref, mode->hdisplay, mode->vdisplay, &layers[1], overlay_x, overlay_y);
+    if (layers[2].plane)
+        blend_clipped(ref, mode->hdisplay, mode->vdisplay, &layers[2], cursor_x, cursor_y);
+}
+
+// pixels of the capture further than tolerance from ref in any colour
+// channel, the first one is reported. the X/A byte is not compared
+static uint64_t compare(const struct capture_buffer *capture, const uint32_t *ref, uint32_t width, uint32_t height,
+                        int tolerance)
+{
+    uint64_t mismatches = 0;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint32_t *row = (const uint32_t *)((const uint8_t *)capture->map + (size_t)y * capture->create_dumb.pitch);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint32_t got = row[x], want = ref[(size_t)y * width + x];
+            int bad = 0;
+            for (int shift = 0; shift < 24; shift += 8)
+                bad |= abs((int)(got >> shift & 0xFF) - (int)(want >> shift & 0xFF)) > tolerance;
+            if (bad && !mismatches++)
+                printf("Frame %llu: first mismatch at %u,%u: captured %06X, expected %06X\n",
+                       (unsigned long long)capture->frame, x, y, got & 0xFFFFFF, want & 0xFFFFFF);
+        }
+    }
+    return mismatches;
+}
+
+// raw rows without the pitch padding, ffmpeg reads them as -f rawvideo -pixel_format bgr0
+static int record(FILE *out, const struct capture_buffer *capture, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t *row = (const uint8_t *)capture->map + (size_t)y * capture->create_dumb.pitch;
+        if (fwrite(row, 4, width, out) != width)
+            return -EIO;
+    }
+    return 0;
+}
+
+static int create_layer(int drm_fd, struct layer_buffer *layer, uint32_t format, uint32_t width, uint32_t height)
+{
+    layer->create_dumb.width = width;
+    layer->create_dumb.height = height;
+    return create_dumb_buffer_format(drm_fd, format, &layer->create_dumb, &layer->map, &layer->fb_id);
+}
+
+static const struct plane_info *find_plane(const struct plane_table *planes, int crtc_index, uint32_t type,
+                                           uint32_t format)
+{
+    for (int i = 0; i < planes->count; i++)
+    {
+        const struct plane_info *plane = &planes->planes[i];
+        if (plane->type == type && (plane->possible_crtcs & (1u << crtc_index)) &&
+            plane_supports_format(plane, format, DRM_FORMAT_MOD_LINEAR))
+            return plane;
+    }
+    return NULL;
+}
+
+static void on_flip(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us, void *data)
+{
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL;
+    const char *record_path = NULL;
+    int frames = 120;
+    int tolerance = 1;
+    int check = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            record_path = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-check") == 0)
+            check = 0;
+        else
+            device = argv[i];
+    }
+    if (frames < 1 || tolerance < 0)
+    {
+        fprintf(stderr, "usage: %s [device] [--frames N] [--record FILE] [--tolerance N] [--no-check]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    trace_init();
+
+    int drm_fd = kms_open(device);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    if (atomic_init(drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+    {
+        perror("drmModeGetResources failed");
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0 &&
+            connector->connector_type != DRM_MODE_CONNECTOR_WRITEBACK)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        fprintf(stderr, "No active connector found.\n");
+        drmModeFreeResources(resources);
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeModeInfo mode = *mode_pick(connector);
+    uint32_t crtc_id = resources->crtcs[0];
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_table planes;
+    if (atomic_get_crtc_props(drm_fd, crtc_id, &crtc_props) ||
+        atomic_get_connector_props(drm_fd, connector->connector_id, &connector_props) ||
+        plane_table_load(drm_fd, &planes))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector/plane properties\n");
+        return EXIT_FAILURE;
+    }
+
+    struct writeback wb;
+    int ret = writeback_init(&wb, drm_fd, crtc_id, mode.hdisplay, mode.vdisplay, CAPTURE_BUFFERS);
+    if (ret)
+    {
+        fprintf(stderr, "No writeback connector for CRTC %u: %s\n", crtc_id, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+
+    // the usual stacking: primary at the bottom, cursor on top
+    int crtc_index = plane_table_crtc_index(&planes, crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+    struct layer_buffer layers[3] = {0};
+    layers[0].plane = find_plane(&planes, crtc_index, DRM_PLANE_TYPE_PRIMARY, DRM_FORMAT_XRGB8888);
+    layers[1].plane = find_plane(&planes, crtc_index, DRM_PLANE_TYPE_OVERLAY, DRM_FORMAT_ARGB8888);
+    layers[2].plane = find_plane(&planes, crtc_index, DRM_PLANE_TYPE_CURSOR, DRM_FORMAT_ARGB8888);
+    if (!layers[0].plane || create_layer(drm_fd, &layers[0], DRM_FORMAT_XRGB8888, mode.hdisplay, mode.vdisplay) ||
+        create_layer(drm_fd, &layers[1], DRM_FORMAT_ARGB8888, OVERLAY_SIZE, OVERLAY_SIZE) ||
+        create_layer(drm_fd, &layers[2], DRM_FORMAT_ARGB8888, CURSOR_SIZE, CURSOR_SIZE))
+    {
+        fprintf(stderr, "Cannot set up the layers\n");
+        return EXIT_FAILURE;
+    }
+    draw_background(layers[0].map, layers[0].create_dumb.pitch, mode.hdisplay, mode.vdisplay);
+    draw_overlay(layers[1].map, layers[1].create_dumb.pitch);
+    draw_cursor(layers[2].map, layers[2].create_dumb.pitch);
+
+    printf("Mode %s %.3f Hz, capturing %.4s through connector %u, primary%s%s, dma-buf export %s\n", mode.name,
+           mode_refresh_mhz(&mode) / 1000.0, (const char *)&wb.format, wb.props.connector_id,
+           layers[1].plane ? " + overlay" : "", layers[2].plane ? " + cursor" : "",
+           wb.buffers[0].dmabuf_fd >= 0 ? "yes" : "no");
+
+    FILE *out = NULL;
+    if (record_path)
+    {
+        out = fopen(record_path, "wb");
+        if (!out)
+        {
+            perror("Cannot open the recording");
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint32_t *ref = check ? malloc((size_t)mode.hdisplay * mode.vdisplay * 4) : NULL;
+    if (check && !ref)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    // the first frame comes with a modeset, the connector joins in it
+    struct atomic_req req;
+    atomic_req_init(&req);
+    uint32_t mode_blob_id = 0;
+    if (atomic_set_mode(drm_fd, &req, &crtc_props, &connector_props, &mode, &mode_blob_id))
+        return EXIT_FAILURE;
+    uint32_t commit_flags = ATOMIC_FLIP_FLAGS | DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, on_flip, NULL);
+
+    uint64_t frame = 0, checked = 0, failed = 0;
+    int status = EXIT_SUCCESS;
+
+    for (;;)
+    {
+        struct capture_buffer *capture;
+        while (writeback_wait(&wb, 0, &capture) == 0)
+        {
+            if (check)
+            {
+                render_reference(ref, &mode, layers, capture->frame);
+                uint64_t mismatches = compare(capture, ref, mode.hdisplay, mode.vdisplay, tolerance);
+                if (mismatches)
+                {
+                    printf("Frame %llu: %llu pixels differ\n", (unsigned long long)capture->frame,
+                           (unsigned long long)mismatches);
+                    failed++;
+                }
+                checked++;
+            }
+            if (out && record(out, capture, mode.hdisplay, mode.vdisplay))
+            {
+                perror("Recording failed");
+                fclose(out);
+                out = NULL;
+                status = EXIT_FAILURE;
+            }
+            writeback_release(&wb, capture);
+        }
+
+        if (!loop.flip_pending && frame < (uint64_t)frames)
+        {
+            int32_t overlay_x, overlay_y, cursor_x, cursor_y;
+            layer_positions(frame, &mode, &overlay_x, &overlay_y, &cursor_x, &cursor_y);
+            atomic_set_plane(&req, &layers[0].plane->props, crtc_id, layers[0].fb_id, 0, 0, mode.hdisplay,
+                             mode.vdisplay, 0, 0, mode.hdisplay << 16, mode.vdisplay << 16);
+            if (layers[1].plane)
+                atomic_set_plane(&req, &layers[1].plane->props, crtc_id, layers[1].fb_id, overlay_x, overlay_y,
+                                 OVERLAY_SIZE, OVERLAY_SIZE, 0, 0, OVERLAY_SIZE << 16, OVERLAY_SIZE << 16);
+            if (layers[2].plane)
+                atomic_set_plane(&req, &layers[2].plane->props, crtc_id, layers[2].fb_id, cursor_x, cursor_y,
+                                 CURSOR_SIZE, CURSOR_SIZE, 0, 0, CURSOR_SIZE << 16, CURSOR_SIZE << 16);
+            writeback_queue(&wb, &req, frame, &commit_flags);
+
+            ret = atomic_commit(drm_fd, &req, commit_flags, &loop);
+            writeback_committed(&wb, ret);
+            if (ret)
+            {
+                fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+                status = EXIT_FAILURE;
+                break;
+            }
+            frame_loop_begin_flip(&loop);
+            commit_flags = ATOMIC_FLIP_FLAGS;
+            frame++;
+        }
+
+        // done once every frame is shown and every capture is in
+        int fence_fd = writeback_fence_fd(&wb);
+        if (!loop.flip_pending && fence_fd < 0)
+            break;
+
+        struct pollfd fds[2] = {{.fd = drm_fd, .events = POLLIN}, {.fd = fence_fd, .events = POLLIN}};
+        if (poll(fds, 2, 1000) <= 0)
+        {
+            fprintf(stderr, "No flip or capture within a second\n");
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+            frame_loop_dispatch(&loop, 0);
+    }
+    frame_loop_wait_idle(&loop);
+
+    printf("%llu frames shown, %llu captured, %llu missed", (unsigned long long)frame,
+           (unsigned long long)wb.captured, (unsigned long long)wb.missed);
+    if (check)
+        printf(", %llu checked, %llu mismatched", (unsigned long long)checked, (unsigned long long)failed);
+    printf("\n");
+    if (out)
+    {
+        fclose(out);
+        printf("ffmpeg -f rawvideo -pixel_format bgr0 -video_size %ux%u -framerate %.3f -i %s\n", mode.hdisplay,
+               mode.vdisplay, mode_refresh_mhz(&mode) / 1000.0, record_path);
+    }
+    if (check && (failed || !checked))
+        status = EXIT_FAILURE;
+    trace_finish();
+
+    free(ref);
+    writeback_destroy(&wb);
+    for (int i = 0; i < 3; i++)
+        destroy_dumb_buffer(drm_fd, &layers[i].create_dumb, layers[i].map, layers[i].fb_id);
+    plane_table_free(&planes);
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    kms_close(drm_fd);
+
+    return status;
+}
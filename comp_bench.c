@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <drm_fourcc.h>
+
+#include "src/compositor.h"
+#include "src/pixel.h"
+#include "src/tiling.h"
+#include "src/trace.h"
+
+// build: gcc -O2 comp_bench.c src/compositor.c src/thread_pool.c src/pixel.c src/tiling.c src/damage.c src/format.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o comp_bench -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./comp_bench [threads] [frames]
+
+#define DEFAULT_FRAMES 200
+#define LAYER_COUNT 6
+
+/*
+    Headless benchmark for the software compositor. No DRM device is opened,
+    every frame is rendered into plain malloc'd memory, so this runs anywhere
+    and measures only the CPU side of the fallback path.
+
+    Each output size is rendered with a full-screen opaque image, a solid
+    panel, two alpha-blended windows, a translucent solid and a small cursor
+    sized image, once with full damage and once with a single moving window.
+
+    Every size is rendered linear and in each tiled layout of tiling.h.
+    Whether the tiled frames are right is tests/tiling_test's job, this only
+    times them.
+*/
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// premultiplied gradient so blended layers do real work
+static uint32_t *make_image(uint32_t w, uint32_t h, uint8_t alpha)
+{
+    uint32_t *pixels = aligned_alloc(64, (size_t)w * h * 4);
+    if (!pixels)
+        return NULL;
+
+    for (uint32_t y = 0; y < h; y++)
+    {
+        for (uint32_t x = 0; x < w; x++)
+        {
+            uint32_t r = (x * 255 / w) * alpha / 255;
+            uint32_t g = (y * 255 / h) * alpha / 255;
+            uint32_t b = ((x + y) & 0xFF) * alpha / 255;
+            pixels[(size_t)y * w + x] = ((uint32_t)alpha << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+    return pixels;
+}
+
+static void run(struct compositor *comp, uint32_t width, uint32_t height, int frames)
+{
+    static const uint64_t layouts[] = {DRM_FORMAT_MOD_LINEAR, I915_FORMAT_MOD_X_TILED, I915_FORMAT_MOD_Y_TILED};
+    uint32_t pitch = width * 4;
+    uint32_t alloc_w = width, alloc_h = height;
+    tiling_align(tiling_info_get(I915_FORMAT_MOD_Y_TILED), 4, &alloc_w, &alloc_h);
+    tiling_align(tiling_info_get(I915_FORMAT_MOD_X_TILED), 4, &alloc_w, &alloc_h);
+    uint8_t *dst = aligned_alloc(64, (size_t)alloc_w * alloc_h * 4);
+    uint32_t win_w = width / 3, win_h = height / 3;
+    uint32_t *background = make_image(width, height, 0xFF);
+    uint32_t *window = make_image(win_w, win_h, 0xC0);
+    uint32_t *cursor = make_image(64, 64, 0xFF);
+    if (!dst || !background || !window || !cursor)
+    {
+        perror("Failed to allocate benchmark buffers");
+        goto out;
+    }
+
+    struct comp_layer layers[LAYER_COUNT] = {
+        {.type = COMP_LAYER_IMAGE, .w = width, .h = height, .pixels = background, .pitch = pitch},
+        {.type = COMP_LAYER_SOLID, .w = width, .h = height / 12, .color = 0xFF202020},
+        {.type = COMP_LAYER_BLEND, .x = 100, .y = 100, .w = win_w, .h = win_h, .pixels = window, .pitch = win_w * 4},
+        {.type = COMP_LAYER_BLEND, .x = (int32_t)(width / 2), .y = (int32_t)(height / 3), .w = win_w, .h = win_h,
+         .pixels = window, .pitch = win_w * 4},
+        {.type = COMP_LAYER_SOLID, .x = (int32_t)(width / 4), .y = (int32_t)(height / 2), .w = width / 4,
+         .h = height / 4, .color = 0x80400000},
+        {.type = COMP_LAYER_IMAGE, .x = 10, .y = 10, .w = 64, .h = 64, .pixels = cursor, .pitch = 64 * 4},
+    };
+
+    for (int l = 0; l < 3; l++)
+    {
+        const struct tiling_info *info = tiling_info_get(layouts[l]);
+        uint32_t dst_w = width, dst_h = height;
+        tiling_align(info, 4, &dst_w, &dst_h);
+        uint32_t dst_pitch = dst_w * 4;
+        layers[2].x = 100;
+
+        // full redraw
+        compositor_render_tiled(comp, layers, LAYER_COUNT, dst, dst_pitch, layouts[l], width, height, NULL);
+        double start = now_ms();
+        for (int i = 0; i < frames; i++)
+            compositor_render_tiled(comp, layers, LAYER_COUNT, dst, dst_pitch, layouts[l], width, height, NULL);
+        double full = (now_ms() - start) / frames;
+
+        // one window moving, damage is its old and new position
+        struct damage damage;
+        damage_init(&damage, (int32_t)width, (int32_t)height);
+        start = now_ms();
+        for (int i = 0; i < frames; i++)
+        {
+            damage_clear(&damage);
+            damage_add(&damage, layers[2].x, layers[2].y, (int32_t)win_w, (int32_t)win_h);
+            layers[2].x = 100 + (i * 8) % (int32_t)(width / 2);
+            damage_add(&damage, layers[2].x, layers[2].y, (int32_t)win_w, (int32_t)win_h);
+            compositor_render_tiled(comp, layers, LAYER_COUNT, dst, dst_pitch, layouts[l], width, height, &damage);
+        }
+        double partial = (now_ms() - start) / frames;
+
+        printf("%ux%u %s: full %.3f ms/frame (%.0f fps), moving window %.3f ms/frame\n", width, height, info->name,
+               full, 1000.0 / full, partial);
+    }
+
+out:
+    free(dst);
+    free(background);
+    free(window);
+    free(cursor);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 0;
+    int frames = argc > 2 ? atoi(argv[2]) : DEFAULT_FRAMES;
+    if (frames <= 0)
+        frames = DEFAULT_FRAMES;
+
+    // PLANES_TRACE=1 adds per-frame composite percentiles to the averages
+    trace_init();
+
+    struct compositor comp;
+    if (compositor_init(&comp, threads, 0, 0))
+        return 1;
+
+    printf("compositor: %d threads, %ux%u tiles, %s kernels, %d frames\n",
+           thread_pool_size(comp.pool), comp.tile_w, comp.tile_h, pixel_kernels_get()->name, frames);
+
+    run(&comp, 1920, 1080, frames);
+    run(&comp, 3840, 2160, frames);
+
+    compositor_destroy(&comp);
+    trace_finish();
+    return 0;
+}
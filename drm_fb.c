@@ -1,6 +1,7 @@
 // modules for lib drm
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <drm_fourcc.h>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -10,38 +11,61 @@
 #include <string.h>
 #include <sys/ioctl.h> // For ioctl
 #include <sys/mman.h>  // For mmap
+#include <time.h>
+
+#include "src/damage.h"
+#include "src/format.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/swapchain.h"
+#include "src/trace.h"
+
+// build: gcc drm_fb.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/pixel.c src/tiling.c src/damage.c src/format.c src/mode.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o drm_fb -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./drm_fb [device] [XRGB8888|RGB565|XRGB2101010]
+
+#define SWAPCHAIN_BUFFERS 3
+#define RUN_SECONDS 5
+#define SQUARE_SIZE 128
+#define COLOR_BACKGROUND 0xFF0000FF // Blue
+#define COLOR_SQUARE 0xFFFFFFFF     // White
 
 /*
     SUMMARY OF THE PROGRAM
     ----------------------
-    1. We open the DRM device (display), normally card0 but here card1, with its permissions.
+    1. We open the DRM device (display), the first card with a connected output unless one is given
+       ("fbdev:/dev/fb0" drives a legacy framebuffer the same way, flipping by panning).
     2. We get the resources of that DRM fbs, CRTCs, Connectors & Encoders
     3. We select a available DRM Connector
-    4. We create a dumb buffer
-    5. Map the dumb buffer
-    6. Setup a frame buffer for the dumb buffer so the DRM can use it
+    4. We create a swapchain of dumb buffers, in XRGB8888 unless another format is given
+    5. Map the dumb buffers
+    6. Setup a frame buffer for each dumb buffer so the DRM can use it
     7. GET & SET the CRTC Configuration
-    8. Draw to the buffer
-    9. Perform page flip
+    8. Draw to a free buffer while the last flip is still pending
+    9. Perform page flip and wait for the flip event on the drm fd
     10. Clena up.
 */
 
-int main()
+int main(int argc, char **argv)
 {
-    // Open the DRM device
-    const int drm_fd = open("/dev/dri/card1", O_RDWR | O_CLOEXEC);
+    // PLANES_TRACE=1 prints frame timing stats at exit, a path also writes a Chrome trace
+    trace_init();
+
+    // Open the DRM device: a node, "auto", "driver:NAME", "fbdev" or "fake" (see src/kms.h)
+    const int drm_fd = kms_open(argc > 1 ? argv[1] : NULL);
     if (drm_fd < 0)
     {
-        perror("Failed to open DRM device");
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
         return -1;
     }
 
     // Query available resources
-    drmModeRes *resources = drmModeGetResources(drm_fd);
+    drmModeRes *resources = kms_get_resources(drm_fd);
     if (!resources)
     {
         perror("drmModeGetResources failed");
-        close(drm_fd);
+        kms_close(drm_fd);
         return -1;
     }
     else
@@ -56,7 +80,7 @@ int main()
     drmModeConnector *connector = NULL;
     for (int i = 0; i < resources->count_connectors; i++)
     {
-        connector = drmModeGetConnector(drm_fd, resources->connectors[i]);
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
         if (connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
         {
             break;
@@ -69,75 +93,202 @@ int main()
     {
         fprintf(stderr, "No active connector found.\n");
         drmModeFreeResources(resources);
-        close(drm_fd);
+        kms_close(drm_fd);
         return -1;
     }
 
-    // Create a dumb buffer
-    struct drm_mode_create_dumb create_dumb = {0};
-    create_dumb.width = connector->modes[0].hdisplay;
-    create_dumb.height = connector->modes[0].vdisplay;
-    create_dumb.bpp = 32;
-
-    ioctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_dumb);
-
-    void *buffer_map;
-    struct drm_mode_map_dumb map_dumb = {0};
-    map_dumb.handle = create_dumb.handle;
-    ioctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb);
-
-    buffer_map = mmap(0, create_dumb.size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd, map_dumb.offset);
+    // RGB565 halves what the display has to fetch per frame, 2101010 is for deep colour panels.
+    // devices that prefer 16 bpp (small panels, 565 fbdevs) get RGB565 unless told otherwise
+    uint64_t depth = 0;
+    const struct format_info *format = format_info_get(DRM_FORMAT_XRGB8888);
+    if (kms_get_cap(drm_fd, DRM_CAP_DUMB_PREFERRED_DEPTH, &depth) == 0 && depth == 16)
+        format = format_info_get(DRM_FORMAT_RGB565);
+    if (argc > 2)
+    {
+        format = format_info_by_name(argv[2]);
+        if (!format || format->plane_count != 1)
+        {
+            fprintf(stderr, "Unsupported format %s\n", argv[2]);
+            drmModeFreeConnector(connector);
+            drmModeFreeResources(resources);
+            kms_close(drm_fd);
+            return -1;
+        }
+    }
 
-    int ret;
-    uint32_t fb_id;
+    // $PLANES_MODE picks the mode, the preferred one by default
+    drmModeModeInfo mode = *mode_pick(connector);
 
-    // Set up a framebuffer for the dumb buffer
-    ret = drmModeAddFB(drm_fd, create_dumb.width, create_dumb.height, 24, create_dumb.bpp, create_dumb.pitch, create_dumb.handle, &fb_id);
+    // Create a swapchain, each buffer is a dumb buffer with its own framebuffer.
+    // fbdev only has room for as many buffers as the virtual screen holds, two will do
+    struct swapchain sc;
+    int ret = swapchain_init(&sc, drm_fd, SWAPCHAIN_BUFFERS, mode.hdisplay, mode.vdisplay, format->format);
+    if (ret == -ENOSPC)
+    {
+        printf("Falling back to double buffering\n");
+        ret = swapchain_init(&sc, drm_fd, 2, mode.hdisplay, mode.vdisplay, format->format);
+    }
     if (ret)
     {
-        fprintf(stderr, "Cannot create framebuffer (%d): %m\n", errno);
+        drmModeFreeConnector(connector);
+        drmModeFreeResources(resources);
+        kms_close(drm_fd);
         return -1;
     }
 
     // Configure the CRTC
-    drmModeCrtc *crtc = drmModeGetCrtc(drm_fd, resources->crtcs[0]);
+    drmModeCrtc *crtc = kms_get_crtc(drm_fd, resources->crtcs[0]);
     if (!crtc)
     {
         fprintf(stderr, "Cannot get CRTC (%d): %m\n", errno);
         return -1;
     }
 
-    ret = drmModeSetCrtc(drm_fd, crtc->crtc_id, fb_id, 0, 0, &connector->connector_id, 1, &connector->modes[0]);
-    if (ret)
+    // other formats are drawn in XRGB8888 into a shadow frame, each buffer
+    // then gets the rects it is missing converted from there
+    void *shadow = NULL;
+    uint32_t shadow_pitch = mode.hdisplay * 4;
+    if (format->format != DRM_FORMAT_XRGB8888)
     {
-        fprintf(stderr, "Cannot set CRTC for connector (%d): %m\n", errno);
-        return -1;
+        shadow = malloc((size_t)shadow_pitch * mode.vdisplay);
+        if (!shadow)
+        {
+            perror("Cannot allocate shadow frame");
+            return -1;
+        }
+        printf("Rendering to %s through a shadow frame (%s kernels)\n", format->name, format_kernels_get()->name);
     }
 
-    uint32_t *pixels = (uint32_t *)buffer_map;
-    uint32_t color = 0xFF0000FF; // Blue
-
-    for (size_t i = 0; i < (create_dumb.size / sizeof(uint32_t)); i++)
+    // the first buffer is shown by the modeset itself, so it goes straight to front
+    struct sc_buffer *buf = swapchain_acquire(&sc);
+    if (shadow)
+    {
+        pixel_fill(shadow, shadow_pitch, buf->create_dumb.width, buf->create_dumb.height, COLOR_BACKGROUND);
+        format_convert_rect(format->format, buf->map, buf->create_dumb.pitch, shadow, shadow_pitch, 0, 0,
+                            buf->create_dumb.width, buf->create_dumb.height);
+    }
+    else
     {
-        pixels[i] = color;
+        pixel_fill(buf->map, buf->create_dumb.pitch, buf->create_dumb.width, buf->create_dumb.height, COLOR_BACKGROUND);
     }
+    swapchain_queue(&sc, buf, NULL);
+    swapchain_submit(&sc, swapchain_next_ready(&sc));
 
-    // Page flip
-    ret = drmModePageFlip(drm_fd, crtc->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, NULL);
+    ret = kms_set_crtc(drm_fd, crtc->crtc_id, buf->fb_id, 0, 0, &connector->connector_id, 1, &mode);
     if (ret)
     {
-        fprintf(stderr, "Cannot flip CRTC for connector (%d): %m\n", errno);
+        fprintf(stderr, "Cannot set CRTC for connector (%d): %m\n", errno);
         return -1;
     }
-    sleep(5);
+    swapchain_flip_done(&sc);
+
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, NULL, NULL);
+    frame_loop_add_swapchain(&loop, &sc);
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t frame = 0;
+
+    // a square bouncing across the screen, only the area it covers changes per frame
+    struct damage frame_damage;
+    damage_init(&frame_damage, buf->create_dumb.width, buf->create_dumb.height);
+    int32_t square_x = 0;
+    int32_t square_y = (buf->create_dumb.height - SQUARE_SIZE) / 2;
+    int32_t square_range = buf->create_dumb.width - SQUARE_SIZE;
+
+    while (1)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - start.tv_sec >= RUN_SECONDS)
+            break;
+
+        // render ahead into any buffer that is neither on screen nor queued for the next vblank
+        buf = swapchain_acquire(&sc);
+        if (buf)
+        {
+            struct drm_mode_create_dumb *dumb = &buf->create_dumb;
+            uint64_t render_start = trace_begin();
+            damage_clear(&frame_damage);
+
+            void *target = shadow ? shadow : buf->map;
+            uint32_t target_pitch = shadow ? shadow_pitch : dumb->pitch;
+
+            // copy the stale rects over from the newest frame, then erase the old square.
+            // the shadow frame is always the newest frame, nothing to copy there.
+            if (!shadow)
+                swapchain_repair(&sc, buf);
+            if (!shadow && !damage_is_empty(&buf->damage))
+            {
+                pixel_fill(buf->map, dumb->pitch, dumb->width, dumb->height, COLOR_BACKGROUND);
+                damage_add_all(&frame_damage);
+            }
+            else
+            {
+                pixel_fill_rect(target, target_pitch, square_x, square_y, SQUARE_SIZE, SQUARE_SIZE, COLOR_BACKGROUND);
+                damage_add(&frame_damage, square_x, square_y, SQUARE_SIZE, SQUARE_SIZE);
+            }
+
+            int32_t pos = (frame * 8) % (2 * square_range);
+            square_x = pos < square_range ? pos : 2 * square_range - pos;
+            pixel_fill_rect(target, target_pitch, square_x, square_y, SQUARE_SIZE, SQUARE_SIZE, COLOR_SQUARE);
+            damage_add(&frame_damage, square_x, square_y, SQUARE_SIZE, SQUARE_SIZE);
+
+            if (shadow)
+            {
+                damage_union(&buf->damage, &frame_damage);
+                for (int i = 0; i < buf->damage.count; i++)
+                {
+                    const struct drm_mode_rect *r = &buf->damage.rects[i];
+                    format_convert_rect(format->format, buf->map, dumb->pitch, shadow, shadow_pitch, r->x1, r->y1,
+                                        r->x2 - r->x1, r->y2 - r->y1);
+                }
+            }
+
+            swapchain_queue(&sc, buf, &frame_damage);
+            trace_end("render", render_start, frame);
+            frame++;
+        }
+
+        // Page flip, the flip event comes back on the drm fd with the loop as user data
+        if (!loop.flip_pending)
+        {
+            struct sc_buffer *next = swapchain_next_ready(&sc);
+            if (next)
+            {
+                // on drivers that upload the fb (udl, gud, ...) only the dirty rects are sent
+                uint64_t flip_start = trace_begin();
+                damage_dirty_fb(drm_fd, next->fb_id, &sc.submit_damage);
+                ret = kms_page_flip(drm_fd, crtc->crtc_id, next->fb_id, DRM_MODE_PAGE_FLIP_EVENT, &loop);
+                trace_end("flip", flip_start, next->fb_id);
+                if (ret)
+                {
+                    fprintf(stderr, "Cannot flip CRTC for connector (%d): %m\n", errno);
+                    swapchain_cancel(&sc, next);
+                    break;
+                }
+                swapchain_submit(&sc, next);
+                frame_loop_begin_flip(&loop);
+            }
+        }
+
+        // keep rendering while a buffer is free, otherwise sleep until the next flip
+        int timeout = swapchain_can_acquire(&sc) ? 0 : -1;
+        if (frame_loop_dispatch(&loop, timeout) < 0)
+            break;
+    }
+
+    frame_loop_wait_idle(&loop);
+    frame_histogram_print(&loop.hist, stdout);
+    trace_finish();
 
     // Clean up
-    munmap(buffer_map, create_dumb.size);
-    drmModeRmFB(drm_fd, fb_id);
+    swapchain_destroy(&sc);
+    free(shadow);
     drmModeFreeConnector(connector);
     drmModeFreeCrtc(crtc);
     drmModeFreeResources(resources);
-    close(drm_fd);
+    kms_close(drm_fd);
 
     return 0;
 }
@@ -0,0 +1,92 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/kms.h"
+#include "src/topology.h"
+
+// build: gcc kms_info.c src/topology.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c -o kms_info -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./kms_info [device] [--watch]
+
+/*
+    Prints the device's CRTCs, encoders, connectors and planes with all their
+    properties as one JSON object (src/topology.c), the ioctl count included.
+
+    With --watch it stays running and prints the connectors again every time
+    a hotplug uevent changes one of them.
+*/
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL;
+    int watch = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--watch") == 0)
+            watch = 1;
+        else
+            device = argv[i];
+    }
+
+    int drm_fd = kms_open(device);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    // planes and their properties are only all visible with these two caps
+    kms_set_client_cap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+    kms_set_client_cap(drm_fd, DRM_CLIENT_CAP_ATOMIC, 1);
+
+    struct topology topo;
+    int ret = topology_init(&topo, drm_fd);
+    if (ret)
+    {
+        fprintf(stderr, "Cannot read the KMS topology: %s\n", strerror(-ret));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+    topology_dump_json(&topo, stdout);
+
+    if (watch)
+    {
+        int uevent_fd = topology_uevent_open();
+        if (uevent_fd < 0)
+        {
+            fprintf(stderr, "Cannot listen for uevents: %s\n", strerror(-uevent_fd));
+            topology_free(&topo);
+            kms_close(drm_fd);
+            return EXIT_FAILURE;
+        }
+
+        struct pollfd pfd = {.fd = uevent_fd, .events = POLLIN};
+        while (poll(&pfd, 1, -1) >= 0 || errno == EINTR)
+        {
+            uint64_t before = topo.ioctls;
+            int changed = topology_handle_uevents(&topo, uevent_fd);
+            if (changed < 0)
+            {
+                fprintf(stderr, "Refresh failed: %s\n", strerror(-changed));
+                break;
+            }
+            if (changed)
+            {
+                fprintf(stderr, "%d connectors changed, %llu ioctls\n", changed,
+                        (unsigned long long)(topo.ioctls - before));
+                topology_dump_json(&topo, stdout);
+                fflush(stdout);
+            }
+        }
+        close(uevent_fd);
+    }
+
+    topology_free(&topo);
+    kms_close(drm_fd);
+    return EXIT_SUCCESS;
+}
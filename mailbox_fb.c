@@ -0,0 +1,356 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "src/atomic.h"
+#include "src/frame_loop.h"
+#include "src/frame_queue.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/plane_alloc.h"
+#include "src/swapchain.h"
+#include "src/trace.h"
+
+// build: gcc mailbox_fb.c src/frame_queue.c src/mode.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/damage.c src/format.c src/pixel.c src/tiling.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o mailbox_fb -lpthread -lm $(pkg-config --cflags --libs libdrm)
+// usage: ./mailbox_fb [device] [--threads 2] [--cost 150]
+//        cost is the render time of one frame in percent of the refresh interval
+
+#define RENDER_BUFFERS SWAPCHAIN_MAX_BUFFERS
+#define MAX_RENDERERS 8
+#define RUN_SECONDS 5
+#define BAR_WIDTH 64
+
+/*
+    Render threads and a present thread. Each renderer draws whole frames
+    into its own buffers, as fast as it can, and hands them over through
+    its src/frame_queue.h rings. The main thread owns the DRM fd and on
+    every free vblank commits the newest frame any renderer has finished,
+    older ones go back unshown (mailbox). A frame that takes longer than
+    a refresh interval to draw then only costs latency, not vblanks, as
+    long as there are enough renderers: with --cost 150 one thread fills
+    about two vblanks in three, two threads fill every one.
+*/
+
+struct renderer
+{
+    pthread_t thread;
+    struct frame_queue queue;
+    struct swapchain buffers; // only the buffers, the queues track who has them
+    uint64_t cost_ns;
+    uint64_t rendered;
+};
+
+struct presenter
+{
+    struct renderer *renderers;
+    int front;   // renderer and buffer on screen, -1 before the first flip
+    uint32_t front_buffer;
+    int pending; // the same for the commit in flight
+    uint32_t pending_buffer;
+    uint64_t pending_ready_ns;
+    uint64_t presented;
+    uint64_t latency_ns; // ready to flip, summed
+    uint64_t latency_max_ns;
+};
+
+static uint64_t next_frame = 1; // shared by the renderers
+static int stop;
+
+// a colour per frame and a bar that moves 8 pixels a frame, then busy work
+// until the frame has cost cost_ns
+static void render_frame(struct sc_buffer *buf, uint64_t frame, uint64_t start_ns, uint64_t cost_ns)
+{
+    uint32_t width = buf->create_dumb.width, height = buf->create_dumb.height;
+    uint32_t color = 0xFF000000 | (frame * 5 & 0xFF) << 16 | (frame * 3 & 0xFF) << 8 | 0x40;
+    uint32_t bar = (uint32_t)(frame * 8 % (width > BAR_WIDTH ? width - BAR_WIDTH : 1));
+    pixel_fill(buf->map, buf->create_dumb.pitch, width, height, color);
+    pixel_fill_rect(buf->map, buf->create_dumb.pitch, bar, 0, BAR_WIDTH, height, 0xFFFFFFFF);
+
+    while (trace_now() - start_ns < cost_ns)
+        ;
+}
+
+static void *render_thread(void *data)
+{
+    struct renderer *r = data;
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+    {
+        // every buffer is queued or on screen: the presenter is behind, wait for one back
+        int index = frame_queue_acquire(&r->queue, 100);
+        if (index == -ETIMEDOUT || index == -EINTR)
+            continue;
+        if (index < 0)
+            break;
+
+        uint64_t frame = __atomic_fetch_add(&next_frame, 1, __ATOMIC_RELAXED);
+        uint64_t start = trace_begin();
+        render_frame(&r->buffers.buffers[index], frame, trace_now(), r->cost_ns);
+        trace_end("render", start, (uint32_t)frame);
+        r->rendered++;
+
+        if (frame_queue_submit(&r->queue, (uint32_t)index, frame, trace_now()) < 0)
+            break;
+    }
+    return NULL;
+}
+
+// the frame that was on screen is off it now, its renderer may draw into it again
+static void on_flip(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us, void *data)
+{
+    struct presenter *p = data;
+    if (p->front >= 0)
+        frame_queue_release(&p->renderers[p->front].queue, p->front_buffer);
+    p->front = p->pending;
+    p->front_buffer = p->pending_buffer;
+    p->pending = -1;
+
+    uint64_t latency = flip_us * 1000 > p->pending_ready_ns ? flip_us * 1000 - p->pending_ready_ns : 0;
+    p->latency_ns += latency;
+    if (latency > p->latency_max_ns)
+        p->latency_max_ns = latency;
+    p->presented++;
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL;
+    int threads = 2;
+    int cost_percent = 150;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cost") == 0 && i + 1 < argc)
+            cost_percent = atoi(argv[++i]);
+        else
+            device = argv[i];
+    }
+    if (threads < 1 || threads > MAX_RENDERERS || cost_percent < 0)
+    {
+        fprintf(stderr, "usage: %s [device] [--threads 1-%d] [--cost percent]\n", argv[0], MAX_RENDERERS);
+        return EXIT_FAILURE;
+    }
+
+    trace_init();
+
+    int drm_fd = kms_open(device);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    if (atomic_init(drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+    {
+        perror("drmModeGetResources failed");
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        fprintf(stderr, "No active connector found.\n");
+        drmModeFreeResources(resources);
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeModeInfo mode = *mode_pick(connector);
+    uint32_t crtc_id = resources->crtcs[0];
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_table planes;
+    if (atomic_get_crtc_props(drm_fd, crtc_id, &crtc_props) ||
+        atomic_get_connector_props(drm_fd, connector->connector_id, &connector_props) ||
+        plane_table_load(drm_fd, &planes))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector/plane properties\n");
+        return EXIT_FAILURE;
+    }
+
+    int crtc_index = plane_table_crtc_index(&planes, crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+    struct plane_info *primary = NULL;
+    for (int i = 0; i < planes.count && !primary; i++)
+    {
+        if (planes.planes[i].type == DRM_PLANE_TYPE_PRIMARY && (planes.planes[i].possible_crtcs & (1u << crtc_index)))
+            primary = &planes.planes[i];
+    }
+    if (!primary)
+    {
+        fprintf(stderr, "No primary plane for CRTC %u\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+
+    // every buffer is created here, the render threads never touch the DRM fd
+    uint64_t period_ns = 1000000000000ull / mode_refresh_mhz(&mode);
+    struct renderer renderers[MAX_RENDERERS] = {0};
+    struct frame_queue *queues[MAX_RENDERERS];
+    for (int i = 0; i < threads; i++)
+    {
+        renderers[i].cost_ns = period_ns * (uint64_t)cost_percent / 100;
+        if (swapchain_init(&renderers[i].buffers, drm_fd, RENDER_BUFFERS, mode.hdisplay, mode.vdisplay,
+                           DRM_FORMAT_XRGB8888) ||
+            frame_queue_init(&renderers[i].queue, RENDER_BUFFERS))
+        {
+            fprintf(stderr, "Cannot set up renderer %d\n", i);
+            return EXIT_FAILURE;
+        }
+        queues[i] = &renderers[i].queue;
+    }
+    printf("Mode %s %.3f Hz, %d render threads, %.1f ms per frame\n", mode.name, mode_refresh_mhz(&mode) / 1000.0,
+           threads, renderers[0].cost_ns / 1e6);
+
+    // the first frame comes with a modeset
+    struct atomic_req req;
+    atomic_req_init(&req);
+    uint32_t mode_blob_id = 0;
+    if (atomic_set_mode(drm_fd, &req, &crtc_props, &connector_props, &mode, &mode_blob_id))
+        return EXIT_FAILURE;
+    uint32_t commit_flags = ATOMIC_FLIP_FLAGS | DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+    struct presenter presenter = {.renderers = renderers, .front = -1, .pending = -1};
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, on_flip, &presenter);
+
+    // the present thread sleeps on flip events and on renderers that got
+    // ahead of an idle CRTC
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = drm_fd};
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drm_fd, &event))
+    {
+        perror("epoll setup failed");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        event.data.fd = renderers[i].queue.ready_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, renderers[i].queue.ready_fd, &event);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&renderers[i].thread, NULL, render_thread, &renderers[i]))
+        {
+            fprintf(stderr, "Cannot start render thread %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t end_ns = trace_now() + RUN_SECONDS * 1000000000ull;
+    uint64_t shown_frame = 0;
+    int ret;
+
+    while (trace_now() < end_ns)
+    {
+        struct epoll_event events[MAX_RENDERERS + 1];
+        int n = epoll_wait(epoll_fd, events, MAX_RENDERERS + 1, 100);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait failed");
+            break;
+        }
+        // a renderer's doorbell is level-triggered, left set it would wake
+        // this loop over and over until the flip in flight completes
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == drm_fd)
+                frame_loop_dispatch(&loop, 0);
+            for (int r = 0; r < threads && events[i].data.fd != drm_fd; r++)
+            {
+                if (events[i].data.fd == renderers[r].queue.ready_fd)
+                    frame_queue_ack(&renderers[r].queue);
+            }
+        }
+
+        // one commit per vblank, with whatever is newest once the CRTC is free
+        if (loop.flip_pending)
+            continue;
+
+        struct frame_entry entry;
+        int q = frame_queue_pick(queues, threads, shown_frame, &entry);
+        if (q < 0)
+            continue;
+
+        struct sc_buffer *buf = &renderers[q].buffers.buffers[entry.buffer];
+        atomic_set_plane(&req, &primary->props, crtc_id, buf->fb_id, 0, 0, mode.hdisplay, mode.vdisplay,
+                         0, 0, mode.hdisplay << 16, mode.vdisplay << 16);
+        ret = atomic_commit(drm_fd, &req, commit_flags, &loop);
+        if (ret)
+        {
+            fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+            frame_queue_release(&renderers[q].queue, entry.buffer);
+            break;
+        }
+        presenter.pending = q;
+        presenter.pending_buffer = entry.buffer;
+        presenter.pending_ready_ns = entry.ready_ns;
+        shown_frame = entry.frame;
+        frame_loop_begin_flip(&loop);
+        commit_flags = ATOMIC_FLIP_FLAGS;
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < threads; i++)
+        pthread_join(renderers[i].thread, NULL);
+    frame_loop_wait_idle(&loop);
+
+    uint64_t rendered = 0, replaced = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        rendered += renderers[i].rendered;
+        replaced += renderers[i].queue.replaced;
+    }
+    printf("%llu frames rendered, %llu presented, %llu replaced by a newer one\n", (unsigned long long)rendered,
+           (unsigned long long)presenter.presented, (unsigned long long)replaced);
+    if (presenter.presented)
+        printf("Ready to flip: avg %.2f ms, max %.2f ms\n", presenter.latency_ns / 1e6 / presenter.presented,
+               presenter.latency_max_ns / 1e6);
+    frame_histogram_print(&loop.hist, stdout);
+    trace_finish();
+
+    close(epoll_fd);
+    for (int i = 0; i < threads; i++)
+    {
+        frame_queue_destroy(&renderers[i].queue);
+        swapchain_destroy(&renderers[i].buffers);
+    }
+    plane_table_free(&planes);
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    kms_close(drm_fd);
+
+    return EXIT_SUCCESS;
+}
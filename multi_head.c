@@ -0,0 +1,117 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "src/atomic.h"
+#include "src/damage.h"
+#include "src/kms.h"
+#include "src/output.h"
+#include "src/pixel.h"
+#include "src/trace.h"
+
+// build: gcc multi_head.c src/output.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/pixel.c src/tiling.c src/damage.c src/format.c src/mode.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o multi_head -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./multi_head [device]
+//        ./multi_head fake:1920x1080@60,1280x720@30,1024x768@75
+
+#define RUN_SECONDS 5
+#define SQUARE_SIZE 128
+#define COLOR_BACKGROUND 0xFF202020
+
+/*
+    Every connected display shows its own bouncing square, each drawn by its
+    own thread at its own refresh rate (src/output.c).
+
+    vkms only has several outputs when they are set up through its configfs
+    interface (recent kernels), without it the fake backend with one mode
+    per output is the way to try this on one machine.
+*/
+
+static const uint32_t square_colors[OUTPUT_MAX] = {
+    0xFFFFFFFF, 0xFFFF4040, 0xFF40FF40, 0xFF4040FF, 0xFFFFFF40, 0xFF40FFFF, 0xFFFF40FF, 0xFFC0C0C0,
+};
+
+// per output, only ever touched by that output's render thread
+struct square
+{
+    int32_t x;
+    uint32_t frame;
+};
+
+static void render(struct output *out, struct sc_buffer *buf, struct damage *frame_damage, void *data)
+{
+    struct square *square = &((struct square *)data)[out->index];
+    struct drm_mode_create_dumb *dumb = &buf->create_dumb;
+    int32_t y = ((int32_t)dumb->height - SQUARE_SIZE) / 2;
+    int32_t range = (int32_t)dumb->width - SQUARE_SIZE;
+
+    // erase the old square, or draw everything when the buffer is stale
+    if (!damage_is_empty(&buf->damage))
+    {
+        pixel_fill(buf->map, dumb->pitch, dumb->width, dumb->height, COLOR_BACKGROUND);
+        damage_add_all(frame_damage);
+    }
+    else
+    {
+        pixel_fill_rect(buf->map, dumb->pitch, square->x, y, SQUARE_SIZE, SQUARE_SIZE, COLOR_BACKGROUND);
+        damage_add(frame_damage, square->x, y, SQUARE_SIZE, SQUARE_SIZE);
+    }
+
+    int32_t pos = range > 0 ? (int32_t)(square->frame * 8 % (uint32_t)(2 * range)) : 0;
+    square->x = pos < range ? pos : 2 * range - pos;
+    square->frame++;
+    pixel_fill_rect(buf->map, dumb->pitch, square->x, y, SQUARE_SIZE, SQUARE_SIZE, square_colors[out->index]);
+    damage_add(frame_damage, square->x, y, SQUARE_SIZE, SQUARE_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    // PLANES_TRACE=1 prints render/commit timings per thread at exit
+    trace_init();
+
+    int drm_fd = kms_open(argc > 1 ? argv[1] : NULL);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    if (atomic_init(drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    struct output_manager mgr;
+    int count = output_manager_probe(&mgr, drm_fd);
+    if (count <= 0)
+    {
+        fprintf(stderr, "No output could be set up\n");
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+    printf("Driving %d outputs\n", count);
+
+    struct square squares[OUTPUT_MAX];
+    memset(squares, 0, sizeof(squares));
+    int ret = output_manager_start(&mgr, render, squares);
+    if (ret)
+    {
+        output_manager_destroy(&mgr);
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    sleep(RUN_SECONDS);
+    output_manager_stop(&mgr);
+
+    output_manager_print(&mgr, stdout);
+    trace_finish();
+
+    output_manager_destroy(&mgr);
+    kms_close(drm_fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,575 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "src/atomic.h"
+#include "src/dumb_buffer.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/plane_alloc.h"
+
+// build: gcc -O2 planes_bench.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/pixel.c src/tiling.c src/damage.c src/format.c src/mode.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o planes_bench -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./planes_bench [device] [--json out.json] [--baseline planes_bench_baseline.json] [--tolerance 0.25] [--retries 0]
+
+#define MIN_RUN_MS 200
+#define MIN_RUNS 5
+#define MAX_RUNS 4096
+#define DUMB_RUNS 50
+#define COMMIT_RUNS 500
+#define FLIP_RUNS 60
+#define MAX_RESULTS 32
+#define DEFAULT_DEVICE "fake:1920x1080@60"
+
+/*
+    Regression benchmark for the paths every program here sits on:
+
+      fill_*   pixel_fill into cached (malloc) memory and into a dumb
+               buffer map, which is write-combined on real drivers
+      blit_*   a cached shadow frame copied into a dumb buffer map
+      dumb_*   DRM_IOCTL_MODE_CREATE_DUMB, the mmap and AddFB2 of a 1080p buffer
+      commit_* a TEST_ONLY commit and a nonblocking flip commit of the
+               primary plane, and the share of vblanks that got a new frame
+               when flipping back to back
+
+    Every number is the median of its runs. Results go to stdout and, with
+    --json, to a file in the same format the baseline is kept in. With
+    --baseline each result is compared against the stored one and the run
+    fails if any got worse by more than its tolerance (the one stored with
+    the baseline entry, --tolerance otherwise). --retries N measures
+    everything again, up to N times, while results regress; a regression
+    has to show up in every run to fail, a single descheduled run on a
+    busy machine does not.
+
+    The numbers only mean something against a baseline from the same
+    machine and backend. A baseline whose device or pixel kernel set differs
+    from this run's is skipped, not compared; refresh planes_bench_baseline.json by writing the
+    JSON output over it (the bench-baseline target in CMakeLists.txt).
+*/
+
+struct result
+{
+    char name[32];
+    const char *unit;
+    double value;
+    int higher_is_better;
+    double tolerance; // relative, 0 takes the command line one
+};
+
+struct bench
+{
+    struct result results[MAX_RESULTS];
+    int count;
+};
+
+static const struct
+{
+    const char *name;
+    uint32_t width;
+    uint32_t height;
+} sizes[] = {
+    {"720p", 1280, 720},
+    {"1080p", 1920, 1080},
+    {"4k", 3840, 2160},
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t median(uint64_t *samples, int count)
+{
+    qsort(samples, (size_t)count, sizeof(*samples), compare_u64);
+    return samples[count / 2];
+}
+
+static void add_result(struct bench *b, const char *name, const char *unit, double value, int higher_is_better,
+                       double tolerance)
+{
+    if (b->count == MAX_RESULTS)
+        return;
+
+    struct result *r = &b->results[b->count++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->unit = unit;
+    r->value = value;
+    r->higher_is_better = higher_is_better;
+    r->tolerance = tolerance;
+    printf("  %-22s %10.3f %s\n", name, value, unit);
+}
+
+// the bandwidth of writing a width x height frame, median over at least MIN_RUN_MS
+static double frame_gbps(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width,
+                         uint32_t height)
+{
+    static uint64_t samples[MAX_RUNS];
+    int runs = 0;
+    uint64_t start = now_ns();
+
+    while (runs < MAX_RUNS && (runs < MIN_RUNS || now_ns() - start < MIN_RUN_MS * 1000000ull))
+    {
+        uint64_t t = now_ns();
+        if (src)
+            pixel_blit(dst, dst_pitch, src, src_pitch, width, height);
+        else
+            pixel_fill(dst, dst_pitch, width, height, 0xFF000000 | (uint32_t)runs * 0x010203);
+        samples[runs++] = now_ns() - t;
+    }
+
+    uint64_t ns = median(samples, runs);
+    return ns ? (double)width * height * 4 / ns : 0;
+}
+
+static int bench_pixels(struct bench *b, int drm_fd)
+{
+    char name[32];
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        uint32_t w = sizes[i].width, h = sizes[i].height, pitch = w * 4;
+        void *cached = aligned_alloc(64, (size_t)pitch * h);
+        struct drm_mode_create_dumb create_dumb = {.width = w, .height = h, .bpp = 32};
+        void *map;
+        uint32_t fb_id;
+
+        if (!cached || create_dumb_buffer(drm_fd, &create_dumb, &map, &fb_id))
+        {
+            free(cached);
+            return -ENOMEM;
+        }
+        pixel_fill(cached, pitch, w, h, 0xFF204060);
+
+        snprintf(name, sizeof(name), "fill_cached_%s", sizes[i].name);
+        add_result(b, name, "GB/s", frame_gbps(cached, pitch, NULL, 0, w, h), 1, 0);
+        snprintf(name, sizeof(name), "fill_dumb_%s", sizes[i].name);
+        add_result(b, name, "GB/s", frame_gbps(map, create_dumb.pitch, NULL, 0, w, h), 1, 0);
+        snprintf(name, sizeof(name), "blit_dumb_%s", sizes[i].name);
+        add_result(b, name, "GB/s", frame_gbps(map, create_dumb.pitch, cached, pitch, w, h), 1, 0);
+
+        destroy_dumb_buffer(drm_fd, &create_dumb, map, fb_id);
+        free(cached);
+    }
+    return 0;
+}
+
+// each step of create_dumb_buffer timed on its own
+static int bench_dumb(struct bench *b, int drm_fd)
+{
+    static uint64_t create_ns[DUMB_RUNS], map_ns[DUMB_RUNS], addfb_ns[DUMB_RUNS];
+
+    for (int i = 0; i < DUMB_RUNS; i++)
+    {
+        struct drm_mode_create_dumb create_dumb = {.width = 1920, .height = 1080, .bpp = 32};
+        uint32_t fb_id;
+
+        uint64_t t0 = now_ns();
+        int ret = kms_create_dumb(drm_fd, &create_dumb);
+        uint64_t t1 = now_ns();
+        if (ret)
+            return ret;
+
+        void *map = kms_map_dumb(drm_fd, create_dumb.handle, create_dumb.size);
+        uint64_t t2 = now_ns();
+        if (map == MAP_FAILED)
+        {
+            ret = -errno;
+            kms_destroy_dumb(drm_fd, create_dumb.handle);
+            return ret;
+        }
+
+        uint32_t handles[4] = {create_dumb.handle}, pitches[4] = {create_dumb.pitch}, offsets[4] = {0};
+        ret = kms_add_fb2(drm_fd, 1920, 1080, DRM_FORMAT_XRGB8888, handles, pitches, offsets, NULL, 0, &fb_id);
+        uint64_t t3 = now_ns();
+        if (ret)
+        {
+            munmap(map, create_dumb.size);
+            kms_destroy_dumb(drm_fd, create_dumb.handle);
+            return ret;
+        }
+
+        create_ns[i] = t1 - t0;
+        map_ns[i] = t2 - t1;
+        addfb_ns[i] = t3 - t2;
+        destroy_dumb_buffer(drm_fd, &create_dumb, map, fb_id);
+    }
+
+    // syscall latencies are noisy, only a slowdown past 3x counts
+    add_result(b, "dumb_create_1080p", "us", median(create_ns, DUMB_RUNS) / 1000.0, 0, 2.0);
+    add_result(b, "dumb_map_1080p", "us", median(map_ns, DUMB_RUNS) / 1000.0, 0, 2.0);
+    add_result(b, "dumb_addfb_1080p", "us", median(addfb_ns, DUMB_RUNS) / 1000.0, 0, 2.0);
+    return 0;
+}
+
+// the primary plane of the first connected output, lit up with a blocking modeset
+static int bench_commit(struct bench *b, int drm_fd)
+{
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+        return -errno;
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        drmModeFreeResources(resources);
+        return -ENODEV;
+    }
+
+    const drmModeModeInfo *mode = mode_pick(connector);
+    uint32_t crtc_id = resources->crtcs[0];
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_table planes;
+    int ret = atomic_get_crtc_props(drm_fd, crtc_id, &crtc_props);
+    if (!ret)
+        ret = atomic_get_connector_props(drm_fd, connector->connector_id, &connector_props);
+    if (!ret)
+        ret = plane_table_load(drm_fd, &planes);
+    if (ret)
+    {
+        drmModeFreeConnector(connector);
+        drmModeFreeResources(resources);
+        return ret;
+    }
+
+    int crtc_index = plane_table_crtc_index(&planes, crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", crtc_id);
+        plane_table_free(&planes);
+        drmModeFreeConnector(connector);
+        drmModeFreeResources(resources);
+        return -ENODEV;
+    }
+
+    const struct plane_info *primary = NULL;
+    for (int i = 0; i < planes.count && !primary; i++)
+    {
+        if (planes.planes[i].type == DRM_PLANE_TYPE_PRIMARY && (planes.planes[i].possible_crtcs & (1u << crtc_index)))
+            primary = &planes.planes[i];
+    }
+
+    struct drm_mode_create_dumb create_dumb[2] = {
+        {.width = mode->hdisplay, .height = mode->vdisplay, .bpp = 32},
+        {.width = mode->hdisplay, .height = mode->vdisplay, .bpp = 32},
+    };
+    void *map[2] = {NULL, NULL};
+    uint32_t fb_id[2] = {0, 0};
+    uint32_t mode_blob_id = 0;
+    struct atomic_req req;
+    atomic_req_init(&req);
+
+    ret = primary ? 0 : -ENODEV;
+    for (int i = 0; i < 2 && !ret; i++)
+        ret = create_dumb_buffer(drm_fd, &create_dumb[i], &map[i], &fb_id[i]);
+    if (!ret)
+        ret = atomic_set_mode(drm_fd, &req, &crtc_props, &connector_props, mode, &mode_blob_id);
+    if (!ret)
+        ret = atomic_set_plane(&req, &primary->props, crtc_id, fb_id[0], 0, 0, mode->hdisplay, mode->vdisplay,
+                               0, 0, (uint32_t)mode->hdisplay << 16, (uint32_t)mode->vdisplay << 16);
+    if (!ret)
+        ret = atomic_commit(drm_fd, &req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+    if (ret)
+    {
+        fprintf(stderr, "Cannot light up CRTC %u: %s\n", crtc_id, strerror(-ret));
+        goto out;
+    }
+
+    // TEST_ONLY: what the driver's check costs, nothing reaches the screen
+    static uint64_t samples[COMMIT_RUNS];
+    for (int i = 0; i < COMMIT_RUNS && !ret; i++)
+    {
+        atomic_set_plane(&req, &primary->props, crtc_id, fb_id[i & 1], 0, 0, mode->hdisplay, mode->vdisplay,
+                         0, 0, (uint32_t)mode->hdisplay << 16, (uint32_t)mode->vdisplay << 16);
+        uint64_t t = now_ns();
+        ret = atomic_test(drm_fd, &req, ATOMIC_FLIP_FLAGS);
+        samples[i] = now_ns() - t;
+        atomic_req_reset(drm_fd, &req);
+    }
+    if (ret)
+        goto out;
+    add_result(b, "commit_test", "us", median(samples, COMMIT_RUNS) / 1000.0, 0, 2.0);
+
+    // back to back flips: the ioctl cost, and whether every vblank got a frame
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, NULL, NULL);
+    for (int i = 0; i < FLIP_RUNS && !ret; i++)
+    {
+        atomic_set_plane(&req, &primary->props, crtc_id, fb_id[(i + 1) & 1], 0, 0, mode->hdisplay, mode->vdisplay,
+                         0, 0, (uint32_t)mode->hdisplay << 16, (uint32_t)mode->vdisplay << 16);
+        uint64_t t = now_ns();
+        ret = atomic_commit(drm_fd, &req, ATOMIC_FLIP_FLAGS, &loop);
+        samples[i] = now_ns() - t;
+        if (!ret)
+        {
+            frame_loop_begin_flip(&loop);
+            ret = frame_loop_wait_idle(&loop);
+        }
+    }
+    if (ret)
+        goto out;
+
+    // the first flip has no previous one to count vblanks from
+    uint64_t vblanks = loop.hist.frames + loop.hist.dropped;
+    add_result(b, "commit_flip", "us", median(samples, FLIP_RUNS) / 1000.0, 0, 2.0);
+    add_result(b, "flip_vblank_hit", "ratio", vblanks ? (double)loop.hist.frames / vblanks : 0, 1, 0.05);
+
+out:
+    atomic_req_reset(drm_fd, &req);
+    for (int i = 0; i < 2; i++)
+    {
+        if (fb_id[i])
+            destroy_dumb_buffer(drm_fd, &create_dumb[i], map[i], fb_id[i]);
+    }
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
+    plane_table_free(&planes);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    return ret;
+}
+
+static int write_json(const struct bench *b, const char *device, const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "Cannot write %s: %m\n", path);
+        return -errno;
+    }
+
+    fprintf(file, "{\n  \"device\": \"%s\",\n  \"kernels\": \"%s\",\n  \"results\": {\n", device,
+            pixel_kernels_get()->name);
+    for (int i = 0; i < b->count; i++)
+    {
+        const struct result *r = &b->results[i];
+        fprintf(file, "    \"%s\": {\"value\": %.4f, \"unit\": \"%s\", \"higher_is_better\": %s", r->name, r->value,
+                r->unit, r->higher_is_better ? "true" : "false");
+        if (r->tolerance)
+            fprintf(file, ", \"tolerance\": %.2f", r->tolerance);
+        fprintf(file, "}%s\n", i + 1 < b->count ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+    fclose(file);
+    return 0;
+}
+
+static char *read_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return NULL;
+
+    char *text = NULL;
+    size_t size = 0, used = 0;
+    while (1)
+    {
+        if (used + 4096 + 1 > size)
+        {
+            size = size ? size * 2 : 8192;
+            char *grown = realloc(text, size);
+            if (!grown)
+            {
+                free(text);
+                fclose(file);
+                return NULL;
+            }
+            text = grown;
+        }
+        size_t n = fread(text + used, 1, 4096, file);
+        used += n;
+        if (n < 4096)
+            break;
+    }
+    text[used] = '\0';
+    fclose(file);
+    return text;
+}
+
+// a number field inside the {...} of one baseline entry, returns 0 if present
+static int entry_number(const char *entry, const char *end, const char *field, double *value)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "\"%s\":", field);
+    const char *p = strstr(entry, key);
+    if (!p || p > end)
+        return -ENOENT;
+
+    char *stop;
+    *value = strtod(p + strlen(key), &stop);
+    return stop == p + strlen(key) ? -EINVAL : 0;
+}
+
+// a top level string field of the baseline, returns 0 if present
+static int baseline_string(const char *text, const char *field, char *value, size_t size)
+{
+    char key[32];
+    snprintf(key, sizeof(key), "\"%s\": \"", field);
+    const char *p = strstr(text, key);
+    const char *end = p ? strchr(p + strlen(key), '"') : NULL;
+    if (!end)
+        return -ENOENT;
+
+    snprintf(value, size, "%.*s", (int)(end - p - strlen(key)), p + strlen(key));
+    return 0;
+}
+
+// compare against the baseline written by an earlier --json run. entries
+// only one side has are reported and skipped. a baseline taken on another
+// device or with other pixel kernels is not compared at all, "No baseline
+// for this machine" is printed instead. returns the number of regressions.
+static int compare_baseline(const struct bench *b, const char *device, const char *path, double tolerance)
+{
+    char *text = read_file(path);
+    if (!text)
+    {
+        fprintf(stderr, "Cannot read baseline %s: %m\n", path);
+        return -1;
+    }
+
+    char base_device[128], base_kernels[32];
+    const char *kernels = pixel_kernels_get()->name;
+    if (baseline_string(text, "device", base_device, sizeof(base_device)) ||
+        baseline_string(text, "kernels", base_kernels, sizeof(base_kernels)) || strcmp(base_device, device) ||
+        strcmp(base_kernels, kernels))
+    {
+        printf("No baseline for this machine: %s is not from %s with %s kernels\n", path, device, kernels);
+        free(text);
+        return 0;
+    }
+
+    int regressions = 0;
+    printf("Against %s:\n", path);
+    for (int i = 0; i < b->count; i++)
+    {
+        const struct result *r = &b->results[i];
+        char key[40];
+        snprintf(key, sizeof(key), "\"%s\":", r->name);
+
+        double base, tol = r->tolerance ? r->tolerance : tolerance, stored;
+        const char *entry = strstr(text, key);
+        const char *end = entry ? strchr(entry, '}') : NULL;
+        if (!entry || !end || entry_number(entry, end, "value", &base) || base <= 0)
+        {
+            printf("  %-22s no baseline\n", r->name);
+            continue;
+        }
+        if (entry_number(entry, end, "tolerance", &stored) == 0)
+            tol = stored;
+
+        double change = (r->value - base) / base;
+        int worse = r->higher_is_better ? change < -tol : change > tol;
+        regressions += worse;
+        printf("  %-22s %10.3f vs %10.3f %s %+6.1f%%%s\n", r->name, r->value, base, r->unit, change * 100,
+               worse ? "  REGRESSION" : "");
+    }
+
+    free(text);
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = DEFAULT_DEVICE;
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+    double tolerance = 0.25;
+    int retries = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline_path = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--retries") == 0 && i + 1 < argc)
+            retries = atoi(argv[++i]);
+        else if (argv[i][0] != '-')
+            device = argv[i];
+        else
+        {
+            fprintf(stderr, "usage: %s [device] [--json out.json] [--baseline file.json] [--tolerance 0.25] [--retries 0]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int drm_fd = kms_open(device);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+    if (atomic_init(drm_fd))
+    {
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    static struct bench b;
+    printf("%s, %s kernels\n", kms_backend_name(drm_fd), pixel_kernels_get()->name);
+
+    for (int attempt = 0;; attempt++)
+    {
+        b.count = 0;
+        int ret = bench_pixels(&b, drm_fd);
+        if (!ret)
+            ret = bench_dumb(&b, drm_fd);
+        if (!ret)
+            ret = bench_commit(&b, drm_fd);
+        if (ret)
+        {
+            fprintf(stderr, "Benchmark failed: %s\n", strerror(-ret));
+            kms_close(drm_fd);
+            return EXIT_FAILURE;
+        }
+
+        if (json_path && write_json(&b, device, json_path))
+        {
+            kms_close(drm_fd);
+            return EXIT_FAILURE;
+        }
+        if (!baseline_path)
+            break;
+
+        int regressions = compare_baseline(&b, device, baseline_path, tolerance);
+        if (!regressions)
+            break;
+        if (regressions > 0)
+            fprintf(stderr, "%d result%s regressed\n", regressions, regressions == 1 ? "" : "s");
+        if (regressions < 0 || attempt == retries)
+        {
+            kms_close(drm_fd);
+            return EXIT_FAILURE;
+        }
+        printf("Measuring again, %d retr%s left\n", retries - attempt, retries - attempt == 1 ? "y" : "ies");
+    }
+
+    kms_close(drm_fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE // memfd_create
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "src/pixel.h"
+#include "src/remote.h"
+
+// build: gcc planes_client.c src/remote.c src/pixel.c -o planes_client -lm
+// usage: ./planes_client [socket] [layers] [seconds] [z]
+//        layers 1-4 (default 1), z stacks this client's layers against other clients'
+
+#define LAYER_BUFFERS 3 // one on screen, one in the commit in flight, one to draw
+#define LAYER_SIZE 256
+
+static const uint32_t colors[REMOTE_MAX_LAYERS] = {0xC0C03030, 0xC030C030, 0xC03030C0, 0xC0C0C030};
+
+struct layer_buffer
+{
+    int fd;
+    void *map;
+};
+
+// a memfd the daemon can map for compositing, sealed so it cannot shrink under it
+static int create_buffer(struct layer_buffer *buf, uint32_t pitch, uint32_t height)
+{
+    size_t size = (size_t)pitch * height;
+    buf->fd = memfd_create("planes-client", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (buf->fd < 0)
+        return -errno;
+    if (ftruncate(buf->fd, size) || fcntl(buf->fd, F_ADD_SEALS, F_SEAL_SHRINK))
+        return -errno;
+    buf->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->fd, 0);
+    if (buf->map == MAP_FAILED)
+    {
+        buf->map = NULL;
+        return -errno;
+    }
+    return 0;
+}
+
+// premultiplied ARGB: a translucent square with an opaque band that moves with the frame
+static void draw(struct layer_buffer *buf, uint32_t pitch, uint32_t color, uint64_t frame)
+{
+    pixel_fill(buf->map, pitch, LAYER_SIZE, LAYER_SIZE, color);
+    uint32_t band = (uint32_t)(frame * 4 % (LAYER_SIZE - 16));
+    pixel_fill((uint8_t *)buf->map + band * pitch, pitch, LAYER_SIZE, 16, 0xFFFFFFFF);
+}
+
+int main(int argc, char **argv)
+{
+    char path[108];
+    int layer_count = argc > 2 ? atoi(argv[2]) : 1;
+    double seconds = argc > 3 ? atof(argv[3]) : 5.0;
+    int32_t base_z = argc > 4 ? atoi(argv[4]) : 0;
+    if (layer_count < 1 || layer_count > REMOTE_MAX_LAYERS || remote_socket_path(argc > 1 ? argv[1] : NULL, path, sizeof(path)))
+    {
+        fprintf(stderr, "usage: %s [socket] [layers 1-%d] [seconds] [z]\n", argv[0], REMOTE_MAX_LAYERS);
+        return EXIT_FAILURE;
+    }
+
+    struct remote_client client;
+    int ret = remote_client_connect(&client, path);
+    if (ret)
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    printf("Connected to %s, display %ux%u@%.2f\n", path, client.width, client.height, client.refresh_mhz / 1000.0);
+
+    uint32_t pitch = LAYER_SIZE * 4;
+    struct layer_buffer buffers[REMOTE_MAX_LAYERS * LAYER_BUFFERS] = {0};
+    for (int i = 0; i < layer_count * LAYER_BUFFERS; i++)
+    {
+        ret = create_buffer(&buffers[i], pitch, LAYER_SIZE);
+        if (!ret)
+            ret = remote_client_add_buffer(&client, i, buffers[i].fd, LAYER_SIZE, LAYER_SIZE, DRM_FORMAT_ARGB8888,
+                                           pitch, 0);
+        if (ret)
+        {
+            fprintf(stderr, "Cannot add buffer %d: %s\n", i, strerror(-ret));
+            remote_client_close(&client);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // each layer circles around its own point, phase shifted per process
+    uint32_t range_x = client.width > LAYER_SIZE ? client.width - LAYER_SIZE : 1;
+    uint32_t range_y = client.height > LAYER_SIZE ? client.height - LAYER_SIZE : 1;
+    double phase = (getpid() % 16) * 0.4;
+    uint64_t frames = 0, stalls = 0, first_us = 0, last_us = 0;
+    uint64_t frame_limit = (uint64_t)(seconds * (client.refresh_mhz ? client.refresh_mhz : 60000) / 1000.0);
+
+    for (uint64_t frame = 0; frame < frame_limit; frame++)
+    {
+        for (int l = 0; l < layer_count; l++)
+        {
+            int index = remote_client_free_buffer(&client, l * LAYER_BUFFERS, LAYER_BUFFERS);
+            if (index < 0)
+            {
+                // every buffer of the layer is still in use, keep showing the last one
+                stalls++;
+                continue;
+            }
+
+            draw(&buffers[index], pitch, colors[l], frame);
+            double t = frame / 60.0 + phase + l * 1.57;
+            struct remote_update update = {.layer = (uint32_t)l, .buffer = (uint32_t)index, .z = base_z + l};
+            update.x = (int32_t)(range_x / 2 + cos(t) * range_x / 2.5);
+            update.y = (int32_t)(range_y / 2 + sin(t * 1.3) * range_y / 2.5);
+            ret = remote_client_update(&client, &update);
+            if (ret == -EAGAIN)
+                stalls++;
+        }
+        remote_client_commit(&client);
+
+        struct remote_msg msg;
+        ret = remote_client_wait_frame(&client, 1000, &msg);
+        if (ret < 0)
+        {
+            fprintf(stderr, "Daemon went away: %s\n", strerror(-ret));
+            break;
+        }
+        if (ret == 0)
+        {
+            stalls++;
+            continue;
+        }
+        if (!first_us)
+            first_us = msg.time_us;
+        last_us = msg.time_us;
+        frames++;
+    }
+
+    printf("%llu frames presented", (unsigned long long)frames);
+    if (frames > 1)
+        printf(", %.2f ms apart", (last_us - first_us) / 1000.0 / (frames - 1));
+    printf(", %llu stalls\n", (unsigned long long)stalls);
+
+    remote_client_close(&client);
+    for (int i = 0; i < layer_count * LAYER_BUFFERS; i++)
+    {
+        if (buffers[i].map)
+            munmap(buffers[i].map, (size_t)pitch * LAYER_SIZE);
+        if (buffers[i].fd > 0)
+            close(buffers[i].fd);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,941 @@
+#define _GNU_SOURCE // memfd_create, accept4
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/atomic.h"
+#include "src/compositor.h"
+#include "src/dmabuf.h"
+#include "src/format.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/plane_alloc.h"
+#include "src/remote.h"
+#include "src/swapchain.h"
+#include "src/trace.h"
+
+// build: gcc planes_server.c src/remote.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/pixel.c src/tiling.c src/damage.c src/format.c src/mode.c src/plane_alloc.c src/compositor.c src/thread_pool.c src/dmabuf.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o planes_server -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./planes_server [device] [socket] [seconds]
+//        ./planes_server fake:1920x1080@60 & ./planes_client & ./planes_client
+
+#define MAX_CLIENTS 8
+#define MAX_LAYERS (PLANE_TABLE_MAX - 1) // the background takes one
+#define MAX_BUFFER_SIZE 8192
+#define BACKGROUND_BUFFERS 2
+#define COLOR_BACKGROUND 0xFF202020
+
+/*
+    A compositor daemon: it holds the display and other processes put
+    layers on it through the protocol in src/remote.h.
+
+    Every client layer is a candidate for a plane of its own. The layer set
+    goes through plane_alloc_assign (as in planesv3) whenever it changes
+    shape: a layer shown or hidden, resized, restacked, or given a buffer of
+    another size or format. Moves and buffer swaps only rewrite the planes'
+    FB_ID and position. Layers no plane took are flattened into the
+    background on the CPU, XRGB8888 and premultiplied ARGB8888 unscaled.
+
+    The daemon commits at most once per vblank. A doorbell that rings while
+    a flip is in flight is remembered, and as soon as the flip event comes
+    in every client's ring is drained into the next commit.
+*/
+
+enum event_source
+{
+    SOURCE_LISTEN,
+    SOURCE_DRM,
+    SOURCE_SIGNAL,
+    SOURCE_SOCKET,
+    SOURCE_DOORBELL,
+};
+
+struct client_buffer
+{
+    int fd; // the client's memfd or dma-buf, -1 for an empty slot
+    uint32_t fb_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t pitch;
+    uint32_t offset;
+    void *map; // for CPU compositing, NULL when it cannot be mapped safely
+    size_t map_size;
+    int removed; // the client let go, freed once nothing shows it
+};
+
+struct client_layer
+{
+    uint32_t buffer; // REMOTE_NO_BUFFER when hidden
+    int32_t x;
+    int32_t y;
+    uint32_t w;
+    uint32_t h;
+    int32_t z;
+};
+
+struct client
+{
+    int sock; // -1 for a free slot
+    int doorbell;
+    struct remote_shm *shm;
+    uint64_t serial; // connection order, breaks ties in z
+    int closing;     // hung up, freed once its buffers are off screen
+    int changed;     // has changes in the commit in flight
+    uint32_t shown;  // buffers on screen
+    struct client_buffer buffers[REMOTE_MAX_BUFFERS];
+    struct client_layer layers[REMOTE_MAX_LAYERS];
+};
+
+struct server
+{
+    int drm_fd;
+    int listen_fd;
+    int epoll_fd;
+    uint32_t crtc_id;
+    const drmModeModeInfo *mode;
+    struct plane_table planes;
+    const struct plane_info *primary;
+    struct atomic_req req;
+    uint32_t commit_flags;
+    struct frame_loop loop;
+
+    struct swapchain background;
+    uint32_t background_fb; // on screen or about to be
+    int background_composited;
+    struct compositor comp;
+
+    struct client clients[MAX_CLIENTS];
+    uint64_t next_serial;
+    int pending;  // a doorbell rang or a client came or went
+    int relayout; // the layer set changed shape, plane assignment is stale
+
+    // the last assignment, owner of each layer (client << 8 | layer) and its plane
+    int layer_count;
+    struct layer layers[PLANE_TABLE_MAX];
+    int owners[PLANE_TABLE_MAX];
+    int composited;
+
+    uint64_t commits;
+    uint64_t updates;
+    uint64_t assignments;
+    uint64_t composited_frames;
+    uint64_t connections;
+};
+
+static uint64_t source_key(enum event_source source, int index)
+{
+    return (uint64_t)source << 32 | (uint32_t)index;
+}
+
+static uint32_t buffer_mask(const struct client *c)
+{
+    uint32_t mask = 0;
+    for (int i = 0; i < REMOTE_MAX_LAYERS; i++)
+    {
+        if (c->layers[i].buffer != REMOTE_NO_BUFFER)
+            mask |= 1u << c->layers[i].buffer;
+    }
+    return mask;
+}
+
+static void free_buffer(struct server *srv, struct client_buffer *buf)
+{
+    if (buf->map)
+        munmap(buf->map, buf->map_size);
+    kms_rm_fb(srv->drm_fd, buf->fb_id);
+    close(buf->fd);
+    memset(buf, 0, sizeof(*buf));
+    buf->fd = -1;
+}
+
+// buffers the client removed, and the whole client once it hung up, go as
+// soon as neither the screen nor the next commit uses them
+static void release_client(struct server *srv, struct client *c)
+{
+    uint32_t used = c->shown | buffer_mask(c);
+    for (int i = 0; i < REMOTE_MAX_BUFFERS; i++)
+    {
+        struct client_buffer *buf = &c->buffers[i];
+        if (buf->fd >= 0 && (buf->removed || c->closing) && !(used & (1u << i)))
+            free_buffer(srv, buf);
+    }
+    if (c->shm)
+        __atomic_store_n(&c->shm->busy, used, __ATOMIC_RELEASE);
+
+    if (!c->closing || used)
+        return;
+    if (c->shm)
+        munmap(c->shm, sizeof(*c->shm));
+    close(c->doorbell);
+    c->shm = NULL;
+    c->doorbell = -1;
+    c->closing = 0;
+}
+
+static void drop_client(struct server *srv, struct client *c)
+{
+    epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+    if (c->doorbell >= 0)
+        epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->doorbell, NULL);
+    close(c->sock);
+    c->sock = -1;
+    c->closing = 1;
+
+    // its layers come down with the next commit
+    for (int i = 0; i < REMOTE_MAX_LAYERS; i++)
+    {
+        if (c->layers[i].buffer != REMOTE_NO_BUFFER)
+            srv->relayout = srv->pending = 1;
+        c->layers[i].buffer = REMOTE_NO_BUFFER;
+    }
+    release_client(srv, c);
+}
+
+static void accept_client(struct server *srv)
+{
+    int sock = accept4(srv->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (sock < 0)
+        return;
+
+    // a slot whose last owner is fully gone
+    struct client *c = NULL;
+    for (int i = 0; i < MAX_CLIENTS && !c; i++)
+    {
+        if (srv->clients[i].sock < 0 && !srv->clients[i].closing)
+            c = &srv->clients[i];
+    }
+    if (!c)
+    {
+        fprintf(stderr, "Too many clients, turning one away\n");
+        close(sock);
+        return;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->sock = sock;
+    c->doorbell = -1;
+    c->serial = srv->next_serial++;
+    for (int i = 0; i < REMOTE_MAX_BUFFERS; i++)
+        c->buffers[i].fd = -1;
+    for (int i = 0; i < REMOTE_MAX_LAYERS; i++)
+        c->layers[i].buffer = REMOTE_NO_BUFFER;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = source_key(SOURCE_SOCKET, (int)(c - srv->clients))};
+    if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, sock, &event))
+    {
+        close(sock);
+        c->sock = -1;
+        return;
+    }
+    srv->connections++;
+}
+
+// the shared ring and the doorbell, sent back with the welcome
+static int welcome(struct server *srv, struct client *c, const struct remote_msg *hello)
+{
+    struct remote_msg msg = {.type = REMOTE_WELCOME, .version = REMOTE_VERSION};
+    msg.width = srv->mode->hdisplay;
+    msg.height = srv->mode->vdisplay;
+    msg.refresh_mhz = mode_refresh_mhz(srv->mode);
+
+    if (hello->version != REMOTE_VERSION || c->shm)
+    {
+        msg.status = c->shm ? -EALREADY : -EPROTONOSUPPORT;
+        remote_send(c->sock, &msg, NULL, 0);
+        return msg.status;
+    }
+
+    // sealed at its size, a client cannot shrink it under the daemon's mapping
+    int shm_fd = memfd_create("planes-remote", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (shm_fd < 0)
+        return -errno;
+    int ret = 0;
+    if (ftruncate(shm_fd, sizeof(*c->shm)) || fcntl(shm_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+        ret = -errno;
+    if (!ret)
+    {
+        c->shm = mmap(NULL, sizeof(*c->shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+        if (c->shm == MAP_FAILED)
+        {
+            ret = -errno;
+            c->shm = NULL;
+        }
+    }
+    if (!ret)
+    {
+        c->doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (c->doorbell < 0)
+            ret = -errno;
+    }
+    if (!ret)
+    {
+        struct epoll_event event = {.events = EPOLLIN,
+                                    .data.u64 = source_key(SOURCE_DOORBELL, (int)(c - srv->clients))};
+        if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, c->doorbell, &event))
+            ret = -errno;
+    }
+    if (!ret)
+    {
+        int fds[2] = {shm_fd, c->doorbell};
+        ret = remote_send(c->sock, &msg, fds, 2);
+    }
+    close(shm_fd);
+    return ret;
+}
+
+// import the buffer for the planes and map it for the CPU fallback
+static int add_buffer(struct server *srv, struct client *c, const struct remote_msg *msg, int fd)
+{
+    const struct format_info *info = format_info_get(msg->format);
+    if (msg->buffer >= REMOTE_MAX_BUFFERS || !msg->width || !msg->height || msg->width > MAX_BUFFER_SIZE ||
+        msg->height > MAX_BUFFER_SIZE || !info || info->plane_count != 1 ||
+        msg->pitch < msg->width * info->cpp[0])
+        return -EINVAL;
+    struct client_buffer *buf = &c->buffers[msg->buffer];
+    if (buf->fd >= 0)
+        return -EBUSY;
+
+    // memfds and dma-bufs both tell their size this way
+    size_t size = (size_t)msg->offset + (size_t)msg->pitch * msg->height;
+    off_t fd_size = lseek(fd, 0, SEEK_END);
+    if (fd_size < 0 || (size_t)fd_size < size)
+        return -EINVAL;
+
+    struct dmabuf_image image = {.width = msg->width, .height = msg->height, .format = msg->format,
+                                 .modifier = DRM_FORMAT_MOD_LINEAR, .plane_count = 1, .fds = {fd},
+                                 .pitches = {msg->pitch}, .offsets = {msg->offset}};
+    uint32_t fb_id;
+    int ret = dmabuf_import(srv->drm_fd, &image, &fb_id);
+    if (ret && (fcntl(fd, F_GET_SEALS) >= 0))
+    {
+        // a memfd is no dma-buf for a real driver, udmabuf makes it one
+        int dmabuf = udmabuf_create(fd, (uint64_t)fd_size);
+        if (dmabuf >= 0)
+        {
+            image.fds[0] = dmabuf;
+            ret = dmabuf_import(srv->drm_fd, &image, &fb_id);
+            close(dmabuf);
+        }
+    }
+    if (ret)
+        return ret;
+
+    // a file the client could still shrink would fault the compositor. only
+    // dma-bufs and memfds sealed against shrinking are mapped, anything else
+    // (a plain file, POSIX shm) can go on planes but is never composited
+    memset(buf, 0, sizeof(*buf));
+    int seals = fcntl(fd, F_GET_SEALS);
+    if (dmabuf_is_dmabuf(fd) ||
+        (seals >= 0 && ((seals & F_SEAL_SHRINK) || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) == 0)))
+    {
+        buf->map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        buf->map_size = size;
+        if (buf->map == MAP_FAILED)
+            buf->map = NULL;
+    }
+    buf->fd = fd;
+    buf->fb_id = fb_id;
+    buf->width = msg->width;
+    buf->height = msg->height;
+    buf->format = msg->format;
+    buf->pitch = msg->pitch;
+    buf->offset = msg->offset;
+    return 0;
+}
+
+static void read_socket(struct server *srv, struct client *c)
+{
+    struct remote_msg msg;
+    int fds[4], fd_count;
+    int ret = remote_recv(c->sock, &msg, fds, 4, &fd_count);
+    if (ret == -EAGAIN)
+        return;
+    if (ret <= 0)
+    {
+        drop_client(srv, c);
+        return;
+    }
+
+    struct remote_msg reply = {.type = REMOTE_REPLY, .buffer = msg.buffer};
+    switch (msg.type)
+    {
+    case REMOTE_HELLO:
+        ret = welcome(srv, c, &msg);
+        if (ret)
+        {
+            fprintf(stderr, "Cannot set up client: %s\n", strerror(-ret));
+            drop_client(srv, c);
+        }
+        break;
+    case REMOTE_ADD_BUFFER:
+        reply.status = fd_count == 1 && c->shm ? add_buffer(srv, c, &msg, fds[0]) : -EINVAL;
+        if (reply.status == 0)
+            fd_count = 0; // the buffer keeps the fd
+        remote_send(c->sock, &reply, NULL, 0);
+        break;
+    case REMOTE_REMOVE_BUFFER:
+        if (msg.buffer < REMOTE_MAX_BUFFERS && c->buffers[msg.buffer].fd >= 0 && !c->buffers[msg.buffer].removed)
+        {
+            c->buffers[msg.buffer].removed = 1;
+            release_client(srv, c);
+        }
+        else
+        {
+            reply.status = -ENOENT;
+        }
+        remote_send(c->sock, &reply, NULL, 0);
+        break;
+    default:
+        drop_client(srv, c);
+        break;
+    }
+
+    for (int i = 0; i < fd_count; i++)
+        close(fds[i]);
+}
+
+// apply whatever the client published. returns 1 when something changed
+static int drain_client(struct server *srv, struct client *c)
+{
+    struct remote_update updates[REMOTE_RING_SIZE];
+    int count = remote_ring_drain(c->shm, updates, REMOTE_RING_SIZE);
+    if (count < 0)
+    {
+        fprintf(stderr, "Client %llu corrupted its ring, dropping it\n", (unsigned long long)c->serial);
+        drop_client(srv, c);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const struct remote_update *u = &updates[i];
+        if (u->layer >= REMOTE_MAX_LAYERS ||
+            (u->buffer != REMOTE_NO_BUFFER &&
+             (u->buffer >= REMOTE_MAX_BUFFERS || c->buffers[u->buffer].fd < 0 || c->buffers[u->buffer].removed)))
+            continue;
+
+        struct client_layer *layer = &c->layers[u->layer];
+        struct client_layer next = {u->buffer, u->x, u->y, u->w, u->h, u->z};
+        if (next.buffer != REMOTE_NO_BUFFER)
+        {
+            const struct client_buffer *buf = &c->buffers[next.buffer];
+            next.w = next.w ? next.w : buf->width;
+            next.h = next.h ? next.h : buf->height;
+        }
+
+        // anything but a move or a buffer of the same kind needs the planes handed out again
+        int was_shown = layer->buffer != REMOTE_NO_BUFFER, shown = next.buffer != REMOTE_NO_BUFFER;
+        if (was_shown != shown || (shown && (layer->w != next.w || layer->h != next.h || layer->z != next.z)))
+            srv->relayout = 1;
+        else if (shown)
+        {
+            const struct client_buffer *a = &c->buffers[layer->buffer], *b = &c->buffers[next.buffer];
+            if (a->width != b->width || a->height != b->height || a->format != b->format)
+                srv->relayout = 1;
+        }
+        *layer = next;
+        c->changed = 1;
+        srv->updates++;
+    }
+
+    // busy has to cover the new buffers before the client sees them applied
+    __atomic_store_n(&c->shm->busy, c->shown | buffer_mask(c), __ATOMIC_RELEASE);
+    remote_ring_release(c->shm, count);
+    return count > 0;
+}
+
+// visible layers bottom to top: z, then connection order, then layer index
+static int compare_owners(const void *a, const void *b, void *data)
+{
+    const struct server *srv = data;
+    int oa = *(const int *)a, ob = *(const int *)b;
+    const struct client *ca = &srv->clients[oa >> 8], *cb = &srv->clients[ob >> 8];
+    int32_t za = ca->layers[oa & 0xFF].z, zb = cb->layers[ob & 0xFF].z;
+    if (za != zb)
+        return za < zb ? -1 : 1;
+    if (ca->serial != cb->serial)
+        return ca->serial < cb->serial ? -1 : 1;
+    return (oa & 0xFF) - (ob & 0xFF);
+}
+
+static void fill_layer(const struct server *srv, int owner, struct layer *layer)
+{
+    const struct client *c = &srv->clients[owner >> 8];
+    const struct client_layer *cl = &c->layers[owner & 0xFF];
+    const struct client_buffer *buf = &c->buffers[cl->buffer];
+
+    layer->fb_id = buf->fb_id;
+    layer->format = buf->format;
+    layer->modifier = DRM_FORMAT_MOD_LINEAR;
+    layer->x = cl->x;
+    layer->y = cl->y;
+    layer->w = cl->w;
+    layer->h = cl->h;
+    layer->src_w = buf->width;
+    layer->src_h = buf->height;
+}
+
+// hand the planes out again for the current layer set
+static int assign_planes(struct server *srv)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        for (int l = 0; l < REMOTE_MAX_LAYERS; l++)
+        {
+            if (srv->clients[i].layers[l].buffer != REMOTE_NO_BUFFER && count < MAX_LAYERS)
+                srv->owners[1 + count++] = i << 8 | l;
+        }
+    }
+    qsort_r(srv->owners + 1, count, sizeof(int), compare_owners, srv);
+
+    struct layer *bg = &srv->layers[0];
+    memset(bg, 0, sizeof(*bg));
+    bg->fb_id = srv->background_fb;
+    bg->format = DRM_FORMAT_XRGB8888;
+    bg->modifier = DRM_FORMAT_MOD_LINEAR;
+    bg->w = bg->src_w = srv->mode->hdisplay;
+    bg->h = bg->src_h = srv->mode->vdisplay;
+    srv->owners[0] = -1;
+    for (int i = 1; i <= count; i++)
+        fill_layer(srv, srv->owners[i], &srv->layers[i]);
+    srv->layer_count = count + 1;
+
+    // planes the new set does not use are turned off in the same commit
+    int crtc_index = plane_table_crtc_index(&srv->planes, srv->crtc_id);
+    for (int p = 0; p < srv->planes.count && crtc_index >= 0; p++)
+    {
+        const struct plane_info *plane = &srv->planes.planes[p];
+        if (plane != srv->primary && (plane->possible_crtcs & (1u << crtc_index)))
+            atomic_disable_plane(&srv->req, &plane->props);
+    }
+
+    struct plane_alloc_result result;
+    int drm_fd_ctx = srv->drm_fd;
+    int ret = plane_alloc_assign(&srv->planes, srv->crtc_id, srv->layers, srv->layer_count, plane_atomic_test,
+                                 &drm_fd_ctx, &srv->req, &result);
+    if (ret)
+        return ret;
+
+    // with layers composited this runs every frame, only report what changed
+    if (srv->relayout || result.composited_layers != srv->composited)
+        printf("%d layers: %d on planes, %d composited\n", count, result.hw_layers - 1, result.composited_layers);
+    srv->composited = result.composited_layers;
+    srv->assignments++;
+    srv->relayout = 0;
+    return 0;
+}
+
+// same layer set, new positions and buffers on the planes they already have
+static int update_planes(struct server *srv)
+{
+    for (int i = 1; i < srv->layer_count; i++)
+    {
+        fill_layer(srv, srv->owners[i], &srv->layers[i]);
+        const struct layer *layer = &srv->layers[i];
+        if (!layer->plane_id)
+            continue;
+
+        for (int p = 0; p < srv->planes.count; p++)
+        {
+            const struct plane_info *plane = &srv->planes.planes[p];
+            if (plane->plane_id != layer->plane_id)
+                continue;
+            int ret = atomic_set_plane(&srv->req, &plane->props, srv->crtc_id, layer->fb_id, layer->x, layer->y,
+                                       layer->w, layer->h, 0, 0, layer->src_w << 16, layer->src_h << 16);
+            if (ret)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+// draw the layers no plane took into a fresh background buffer. only
+// unscaled XRGB8888 / ARGB8888 can be drawn, anything else is left out.
+static struct sc_buffer *composite(struct server *srv)
+{
+    struct sc_buffer *buf = swapchain_acquire(&srv->background);
+    if (!buf)
+        return NULL;
+
+    struct comp_layer layers[PLANE_TABLE_MAX] = {0};
+    int count = 0;
+    layers[count].type = COMP_LAYER_SOLID;
+    layers[count].w = srv->mode->hdisplay;
+    layers[count].h = srv->mode->vdisplay;
+    layers[count].color = COLOR_BACKGROUND;
+    count++;
+
+    for (int i = 1; i < srv->layer_count; i++)
+    {
+        const struct layer *layer = &srv->layers[i];
+        const struct client *c = &srv->clients[srv->owners[i] >> 8];
+        const struct client_buffer *cb = &c->buffers[c->layers[srv->owners[i] & 0xFF].buffer];
+        if (layer->plane_id || !cb->map ||
+            (cb->format != DRM_FORMAT_XRGB8888 && cb->format != DRM_FORMAT_ARGB8888))
+            continue;
+
+        struct comp_layer *cl = &layers[count++];
+        cl->type = cb->format == DRM_FORMAT_ARGB8888 ? COMP_LAYER_BLEND : COMP_LAYER_IMAGE;
+        cl->x = layer->x;
+        cl->y = layer->y;
+        cl->w = layer->w < cb->width ? layer->w : cb->width;
+        cl->h = layer->h < cb->height ? layer->h : cb->height;
+        cl->pixels = (const uint8_t *)cb->map + cb->offset;
+        cl->pitch = cb->pitch;
+    }
+
+    uint64_t start = trace_begin();
+    compositor_render(&srv->comp, layers, count, buf->map, buf->create_dumb.pitch, srv->mode->hdisplay,
+                      srv->mode->vdisplay, NULL);
+    trace_end("composite", start, (uint32_t)count);
+    swapchain_queue(&srv->background, buf, NULL);
+    srv->composited_frames++;
+    return swapchain_next_ready(&srv->background);
+}
+
+// everything that came in since the last frame, in one commit
+static void commit_frame(struct server *srv)
+{
+    srv->pending = 0;
+    int changed = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        if (srv->clients[i].sock >= 0 && srv->clients[i].shm)
+            changed |= drain_client(srv, &srv->clients[i]);
+    }
+    if (!changed && !srv->relayout && srv->commits)
+        return;
+
+    int ret = srv->relayout || srv->composited ? assign_planes(srv) : update_planes(srv);
+    if (ret)
+    {
+        fprintf(stderr, "Cannot place the layers: %s\n", strerror(-ret));
+        atomic_req_reset(srv->drm_fd, &srv->req);
+        return;
+    }
+
+    // the background changes when something is composited into it, or stops being
+    struct sc_buffer *next = NULL;
+    if (srv->composited || srv->background_composited)
+    {
+        next = composite(srv);
+        if (next)
+            atomic_req_add(&srv->req, srv->primary->plane_id, srv->primary->props.fb_id, next->fb_id);
+    }
+
+    ret = atomic_commit(srv->drm_fd, &srv->req, srv->commit_flags, &srv->loop);
+    if (ret)
+    {
+        fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+        if (next)
+            swapchain_cancel(&srv->background, next);
+        srv->relayout = 1; // start over from a fresh assignment next time
+        return;
+    }
+    if (next)
+    {
+        swapchain_submit(&srv->background, next);
+        srv->background_fb = next->fb_id;
+        srv->background_composited = srv->composited > 0;
+    }
+    frame_loop_begin_flip(&srv->loop);
+    srv->commit_flags = ATOMIC_FLIP_FLAGS;
+    srv->commits++;
+}
+
+// the commit is on screen: buffers it replaced go back to their clients
+static void on_flip(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us, void *data)
+{
+    struct server *srv = data;
+
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        struct client *c = &srv->clients[i];
+        if (!c->shm)
+            continue;
+
+        c->shown = buffer_mask(c);
+        release_client(srv, c);
+        if (!c->changed || c->sock < 0)
+            continue;
+
+        struct remote_msg frame = {.type = REMOTE_FRAME, .sequence = sequence, .time_us = flip_us};
+        __atomic_store_n(&c->shm->presented, (uint64_t)sequence, __ATOMIC_RELEASE);
+        remote_send(c->sock, &frame, NULL, 0);
+        c->changed = 0;
+    }
+}
+
+static int listen_on(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    // a socket left behind by a daemon that did not exit cleanly
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, MAX_CLIENTS))
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int main(int argc, char **argv)
+{
+    // PLANES_TRACE=1 prints commit/composite timings at exit
+    trace_init();
+
+    static struct server srv;
+    srv.drm_fd = kms_open(argc > 1 ? argv[1] : NULL);
+    if (srv.drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-srv.drm_fd));
+        return EXIT_FAILURE;
+    }
+    if (atomic_init(srv.drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(srv.drm_fd));
+        kms_close(srv.drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeRes *resources = kms_get_resources(srv.drm_fd);
+    if (!resources)
+    {
+        perror("drmModeGetResources failed");
+        kms_close(srv.drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(srv.drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        fprintf(stderr, "No active connector found.\n");
+        drmModeFreeResources(resources);
+        kms_close(srv.drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    srv.mode = mode_pick(connector);
+    srv.crtc_id = resources->crtcs[0];
+    drmModeCrtc *crtc = kms_get_crtc(srv.drm_fd, srv.crtc_id);
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    if (atomic_get_crtc_props(srv.drm_fd, srv.crtc_id, &crtc_props) ||
+        atomic_get_connector_props(srv.drm_fd, connector->connector_id, &connector_props) ||
+        plane_table_load(srv.drm_fd, &srv.planes))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector/plane properties\n");
+        return EXIT_FAILURE;
+    }
+
+    int crtc_index = plane_table_crtc_index(&srv.planes, srv.crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", srv.crtc_id);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < srv.planes.count && !srv.primary; i++)
+    {
+        if (srv.planes.planes[i].type == DRM_PLANE_TYPE_PRIMARY &&
+            (srv.planes.planes[i].possible_crtcs & (1u << crtc_index)))
+            srv.primary = &srv.planes.planes[i];
+    }
+    if (!srv.primary)
+    {
+        fprintf(stderr, "No primary plane for CRTC %u\n", srv.crtc_id);
+        return EXIT_FAILURE;
+    }
+
+    // the background: a plain colour until something has to be composited into it
+    if (swapchain_init(&srv.background, srv.drm_fd, BACKGROUND_BUFFERS, srv.mode->hdisplay, srv.mode->vdisplay,
+                       DRM_FORMAT_XRGB8888) ||
+        compositor_init(&srv.comp, 0, 0, 0))
+        return EXIT_FAILURE;
+    struct sc_buffer *bg = swapchain_acquire(&srv.background);
+    pixel_fill(bg->map, bg->create_dumb.pitch, bg->create_dumb.width, bg->create_dumb.height, COLOR_BACKGROUND);
+    swapchain_queue(&srv.background, bg, NULL);
+    swapchain_submit(&srv.background, swapchain_next_ready(&srv.background));
+    srv.background_fb = bg->fb_id;
+
+    frame_loop_init(&srv.loop, srv.drm_fd, on_flip, &srv);
+    frame_loop_add_swapchain(&srv.loop, &srv.background);
+
+    // the first commit lights the CRTC up, with the background alone
+    atomic_req_init(&srv.req);
+    srv.commit_flags = ATOMIC_FLIP_FLAGS;
+    uint32_t mode_blob_id = 0;
+    if (!crtc || !crtc->mode_valid || !mode_same(&crtc->mode, srv.mode))
+    {
+        if (atomic_set_mode(srv.drm_fd, &srv.req, &crtc_props, &connector_props, srv.mode, &mode_blob_id))
+            return EXIT_FAILURE;
+        srv.commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        srv.clients[i].sock = srv.clients[i].doorbell = -1;
+        for (int l = 0; l < REMOTE_MAX_LAYERS; l++)
+            srv.clients[i].layers[l].buffer = REMOTE_NO_BUFFER;
+    }
+    srv.relayout = 1;
+
+    char path[108];
+    int ret = remote_socket_path(argc > 2 ? argv[2] : NULL, path, sizeof(path));
+    srv.listen_fd = ret ? ret : listen_on(path);
+    if (srv.listen_fd < 0)
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(-srv.listen_fd));
+        return EXIT_FAILURE;
+    }
+
+    // SIGINT/SIGTERM end the loop like any other event
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = source_key(SOURCE_LISTEN, 0)};
+    int failed = srv.epoll_fd < 0 || signal_fd < 0 || epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &event);
+    event.data.u64 = source_key(SOURCE_DRM, 0);
+    failed = failed || epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.drm_fd, &event);
+    event.data.u64 = source_key(SOURCE_SIGNAL, 0);
+    failed = failed || epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+    if (failed)
+    {
+        perror("epoll setup failed");
+        return EXIT_FAILURE;
+    }
+
+    commit_frame(&srv);
+    printf("Listening on %s, %ux%u@%.2f\n", path, srv.mode->hdisplay, srv.mode->vdisplay,
+           mode_refresh_mhz(srv.mode) / 1000.0);
+
+    uint64_t end_ms = argc > 3 ? now_ms() + (uint64_t)(atof(argv[3]) * 1000) : 0;
+    int quit = 0;
+    while (!quit)
+    {
+        int timeout = -1;
+        if (end_ms)
+        {
+            uint64_t now = now_ms();
+            if (now >= end_ms)
+                break;
+            timeout = (int)(end_ms - now);
+        }
+
+        struct epoll_event events[2 * MAX_CLIENTS + 3];
+        int n = epoll_wait(srv.epoll_fd, events, 2 * MAX_CLIENTS + 3, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            enum event_source source = (enum event_source)(events[i].data.u64 >> 32);
+            struct client *c = &srv.clients[(uint32_t)events[i].data.u64];
+            uint64_t rung;
+
+            switch (source)
+            {
+            case SOURCE_LISTEN:
+                accept_client(&srv);
+                break;
+            case SOURCE_DRM:
+                frame_loop_dispatch(&srv.loop, 0);
+                break;
+            case SOURCE_SIGNAL:
+                quit = 1;
+                break;
+            case SOURCE_SOCKET:
+                if (c->sock >= 0)
+                    read_socket(&srv, c);
+                break;
+            case SOURCE_DOORBELL:
+                if (c->doorbell >= 0 && read(c->doorbell, &rung, sizeof(rung)) > 0)
+                    srv.pending = 1;
+                break;
+            }
+        }
+
+        // one commit per vblank, whatever arrived during the flip goes out now
+        if (srv.pending && !srv.loop.flip_pending)
+            commit_frame(&srv);
+    }
+
+    frame_loop_wait_idle(&srv.loop);
+    printf("%llu clients, %llu commits, %llu layer updates, %llu plane assignments, %llu composited frames\n",
+           (unsigned long long)srv.connections, (unsigned long long)srv.commits, (unsigned long long)srv.updates,
+           (unsigned long long)srv.assignments, (unsigned long long)srv.composited_frames);
+    frame_histogram_print(&srv.loop.hist, stdout);
+    trace_finish();
+
+    for (int i = 0; i < MAX_CLIENTS; i++)
+    {
+        struct client *c = &srv.clients[i];
+        if (c->sock >= 0)
+            drop_client(&srv, c);
+        c->shown = 0;
+        release_client(&srv, c);
+    }
+    unlink(path);
+    close(srv.listen_fd);
+    close(signal_fd);
+    close(srv.epoll_fd);
+    compositor_destroy(&srv.comp);
+    swapchain_destroy(&srv.background);
+    plane_table_free(&srv.planes);
+    if (mode_blob_id)
+        kms_destroy_property_blob(srv.drm_fd, mode_blob_id);
+    drmModeFreeCrtc(crtc);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    kms_close(srv.drm_fd);
+
+    return EXIT_SUCCESS;
+}
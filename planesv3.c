@@ -5,542 +5,842 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <drm_fourcc.h>
+
+#include "src/atomic.h"
+#include "src/buffer_pool.h"
+#include "src/compositor.h"
+#include "src/cursor.h"
+#include "src/dumb_buffer.h"
+#include "src/frame_loop.h"
+#include "src/input.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/plane_alloc.h"
+#include "src/scene.h"
+#include "src/snapshot.h"
+#include "src/swapchain.h"
+#include "src/tiling.h"
+#include "src/trace.h"
+
+// build: gcc planesv3.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/input.c src/pixel.c src/damage.c src/format.c src/mode.c src/plane_alloc.c src/scene.c src/snapshot.c src/tiling.c src/compositor.c src/cursor.c src/thread_pool.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o planesv3 -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./planesv3 [device] [/dev/input/eventN]
+//        keys: w/a/s/d move the overlay, c recolours it, +/- resize it, q quits
+//              i/j/k/l (or a mouse) move the cursor, p changes its shape
 
-#define DRM_DEVICE "/dev/dri/card1"
 #define COLOR_RED 0xFFFF0000  // ARGB for Red
 #define COLOR_BLUE 0xFF0000FF // ARGB for Blue
-
-// function to create a dumb buffer.
-void create_dumb_buffer(int drm_fd, struct drm_mode_create_dumb *create_dumb, void **buffer_map, uint32_t *fb_id)
+#define COLOR_GREEN 0xFF00FF00 // ARGB for Green
+#define OVERLAY_BUFFERS 2
+#define BACKGROUND_BUFFERS 2
+#define OVERLAY_POOL_BYTES (64u << 20)
+#define OVERLAY_RESIZE_STEP 64
+#define CURSOR_STEP 16
+
+// an arrow, a crosshair and a ring, uploaded once and switched with 'p'
+static int add_cursor_shapes(struct cursor *cur)
 {
-    if (ioctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, create_dumb))
-    {
-        perror("DRM_IOCTL_MODE_CREATE_DUMB failed");
-        exit(EXIT_FAILURE);
-    }
+    static uint32_t image[32 * 32];
+    int ret = 0;
 
-    struct drm_mode_map_dumb map_dumb = {0};
-    map_dumb.handle = create_dumb->handle;
-    if (ioctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb))
+    // arrow, black outline around white, pointing at its top left pixel
+    memset(image, 0, sizeof(image));
+    for (int y = 0; y < 18; y++)
     {
-        perror("DRM_IOCTL_MODE_MAP_DUMB failed");
-        exit(EXIT_FAILURE);
+        for (int x = 0; x <= y * 2 / 3; x++)
+            image[y * 32 + x] = x == 0 || x == y * 2 / 3 || y == 17 ? 0xFF000000 : 0xFFFFFFFF;
     }
+    ret |= cursor_add_shape(cur, image, 32, 32, 32 * 4, 0, 0) < 0;
 
-    *buffer_map = mmap(0, create_dumb->size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd, map_dumb.offset);
-    if (*buffer_map == MAP_FAILED)
+    // crosshair, white lines with black edges, centred on its hotspot
+    memset(image, 0, sizeof(image));
+    for (int y = 0; y < 31; y++)
     {
-        perror("mmap failed");
-        exit(EXIT_FAILURE);
+        for (int x = 0; x < 31; x++)
+        {
+            int dx = abs(x - 15), dy = abs(y - 15);
+            if ((dx == 0 || dy == 0) && dx + dy > 3)
+                image[y * 32 + x] = 0xFFFFFFFF;
+            else if ((dx == 1 || dy == 1) && dx + dy > 3)
+                image[y * 32 + x] = 0xFF000000;
+        }
     }
+    ret |= cursor_add_shape(cur, image, 31, 31, 32 * 4, 15, 15) < 0;
 
-    if (drmModeAddFB(drm_fd, create_dumb->width, create_dumb->height, 24, create_dumb->bpp, create_dumb->pitch, create_dumb->handle, fb_id))
+    // ring, half transparent inside
+    memset(image, 0, sizeof(image));
+    for (int y = 0; y < 24; y++)
     {
-        fprintf(stderr, "Cannot create framebuffer (%d): %m\n", errno);
-        exit(EXIT_FAILURE);
+        for (int x = 0; x < 24; x++)
+        {
+            int d = (x - 12) * (x - 12) + (y - 12) * (y - 12);
+            if (d >= 81 && d <= 121)
+                image[y * 32 + x] = COLOR_GREEN;
+            else if (d < 81)
+                image[y * 32 + x] = 0x40000000;
+        }
     }
-}
+    ret |= cursor_add_shape(cur, image, 24, 24, 32 * 4, 12, 12) < 0;
 
-// function to fill a buffer with a color
-void fill_buffer_with_color(uint32_t *pixels, size_t size, uint32_t color)
-{
-    for (size_t i = 0; i < size / sizeof(uint32_t); i++)
-    {
-        pixels[i] = color;
-    }
+    return ret ? -ENOMEM : 0;
 }
 
-// A function to get a available plane
-drmModePlane *get_plane(int drm_fd, drmModeRes *resources, drmModePlaneRes *plane_res, uint32_t *used_plane_ids, int used_count, int possible_crtc)
+// input that went out with the last commit, timed against its flip
+struct input_timing
 {
+    uint64_t committed_ns;
+    struct input_latency latency;
+};
 
-    for (uint32_t i = 0; i < plane_res->count_planes; i++)
-    {
-        drmModePlane *plane = drmModeGetPlane(drm_fd, plane_res->planes[i]);
-
-        if (plane && used_plane_ids[0] != plane->plane_id && resources->crtcs[plane->possible_crtcs >> 1] == possible_crtc)
-            return plane;
-
-        // if (plane && (plane->fb_id == 0))
-        // { // Check if the plane can be used
-        //     // Check if the plane is already used
-        //     int already_used = 0;
-        //     for (int j = 0; j < used_count; j++)
-        //     {
-        //         if (used_plane_ids[j] == plane->plane_id)
-        //         {
-        //             already_used = 1;
-        //             break;
-        //         }
-        //     }
-        //     if (!already_used)
-        //     {
-        //         return plane; // Found an unused plane
-        //     }
-        // }
-
-        drmModeFreePlane(plane);
-    }
-    return NULL;
-    // No available plane found
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
 }
 
-// NOT NEEDED FOR PROGRAM EXECUTION
-// utility functions to printout the various details in Resources
-
-// A function that will printout the frame properties
-void print_plane_properties(int drm_fd, drmModePlane *plane)
+// the first frame's request up to the planes: a modeset when the CRTC is idle
+// or in another mode, and variable refresh. 1 when VRR got enabled
+static int first_request(int drm_fd, const drmModeCrtc *crtc, drmModeConnector *connector, const drmModeModeInfo *mode,
+                         const struct crtc_props *crtc_props, const struct connector_props *connector_props,
+                         struct atomic_req *req, uint32_t *commit_flags, uint32_t *mode_blob_id)
 {
+    atomic_req_init(req);
 
-    // Print basic plane information
-    printf("------------------------\n");
-    printf("Plane ID: %u\n", plane->plane_id);
-    printf("Framebuffer ID: %u\n", plane->fb_id);
-    printf("CRTC ID: %u\n", plane->crtc_id);
-    printf("CRTC Position: (%d, %d)\n", plane->crtc_x, plane->crtc_y);
-
-    printf("Possible CRTC ID: %d\n", plane->possible_crtcs);
-
-    // // Print possible CRTC IDs
-    // printf("Possible CRTC IDs: ");
-    // for (int i = 0; i < 32; i++)
-    // {
-    //     if (plane->possible_crtcs & (1 << i))
-    //     {
-    //         printf("%u ", i);
-    //     }
-    // }
-    // printf("\n");
-
-    // Print formats
-    printf("Number of formats: %u\n", plane->count_formats);
-    if (plane->count_formats > 0)
+    // an idle CRTC (e.g. vkms with no fbcon) or one in another mode needs a
+    // modeset along with the first frame
+    *commit_flags = ATOMIC_FLIP_FLAGS;
+    if (!crtc->mode_valid || !mode_same(&crtc->mode, mode))
     {
-        printf("Formats: ");
-        for (uint32_t i = 0; i < plane->count_formats; i++)
-        {
-            printf("0x%08X ", plane->formats[i]);
-        }
-        printf("\n");
+        int ret = atomic_set_mode(drm_fd, req, crtc_props, connector_props, mode, mode_blob_id);
+        if (ret)
+            return ret;
+        *commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
     }
 
-    // drmModeObjectProperties *props = drmModeObjectGetProperties(drm_fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
-    // if (!props)
-    // {
-    //     fprintf(stderr, "Could not get properties for plane %u\n", plane->plane_id);
-    //     return;
-    // }
-
-    // printf("Properties for plane %u:\n", plane->plane_id);
-    // for (uint32_t i = 0; i < props->count_props; i++)
-    // {
-    //     drmModePropertyRes *prop = drmModeGetProperty(drm_fd, props->props[i]);
-    //     if (!prop)
-    //     {
-    //         fprintf(stderr, "Could not get property %u\n", props->props[i]);
-    //         continue;
-    //     }
-
-    //     printf("  Property ID %u: %s\n", prop->prop_id, prop->name);
-    //     drmModeFreeProperty(prop);
-    // }
-
-    // drmModeFreeObjectProperties(props);
+    // with variable refresh a frame carrying input goes out as soon as it is
+    // committed instead of waiting for the next fixed vblank
+    return atomic_vrr_capable(connector, connector_props) && atomic_set_vrr(req, crtc_props, 1) == 0;
 }
 
-// A function to print the CRTC info
-void print_crtc_info(int drm_fd, drmModeRes *resources)
+static void on_flip(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us, void *data)
 {
-    for (int i = 0; i < resources->count_crtcs; ++i)
-    {
-        drmModeCrtc *crtc = drmModeGetCrtc(drm_fd, resources->crtcs[i]);
-        if (!crtc)
-        {
-            fprintf(stderr, "Cannot get CRTC %u\n", resources->crtcs[i]);
-            continue;
-        }
-
-        printf("-----------------------------\n");
-        printf("CRTC ID: %u\n", crtc->crtc_id);
-        printf("Buffer ID: %u\n", crtc->buffer_id);
-        printf("Position: (%u, %u)\n", crtc->x, crtc->y);
-        printf("Size: (%u, %u)\n", crtc->width, crtc->height);
-        printf("Mode Valid: %d\n", crtc->mode_valid);
-        if (crtc->mode_valid)
-        {
-            printf("Mode:\n");
-            printf("  Name: %s\n", crtc->mode.name);
-            printf("  Clock: %u\n", crtc->mode.clock);
-            printf("  Resolution: %ux%u\n", crtc->mode.hdisplay, crtc->mode.vdisplay);
-            // Add more mode details if needed
-        }
+    struct input_timing *timing = data;
 
-        drmModeFreeCrtc(crtc);
-    }
+    // flip timestamps are CLOCK_MONOTONIC like the input times
+    if (timing->committed_ns && flip_us * 1000 >= timing->committed_ns)
+        input_latency_add(&timing->latency, flip_us - timing->committed_ns / 1000);
+    timing->committed_ns = 0;
 }
 
-// A function to print Connector info
-void print_connector_info(int drm_fd, drmModeRes *resources)
+int main(int argc, char **argv)
 {
-    for (int i = 0; i < resources->count_connectors; i++)
+    // PLANES_TRACE=1 prints render/commit timings at exit, a path also writes a Chrome trace
+    trace_init();
+    double start_ms = now_ms();
+
+    // SIGINT/SIGTERM end the loop like a 'q', so the terminal gets its echo
+    // and line editing back on the way out. blocked before any backend or
+    // compositor thread exists, one of those would take the signal and die
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &signals, NULL);
+
+    // get the drm file descriptor. the first argument picks the backend: a
+    // device node, "auto", "driver:vkms" or "fake", see src/kms.h
+    const char *device = argc > 1 ? argv[1] : NULL;
+    const int drm_fd = kms_open(device);
+    if (drm_fd < 0)
     {
-        drmModeConnector *connector = drmModeGetConnector(drm_fd, resources->connectors[i]);
-        if (connector)
-        {
-            printf("-----------------------------\n");
-
-            printf("Connector ID: %u\n", connector->connector_id);
-            printf("Connection Status: %s\n", connector->connection == DRM_MODE_CONNECTED ? "Connected" : "Disconnected");
-
-            if (connector->connection == DRM_MODE_CONNECTED)
-            {
-                // Check if this connector can be used with the current CRTC
-                if (connector->encoder_id)
-                {
-                    printf("  Encoder ID: %u\n", connector->encoder_id);
-                    for (int j = 0; j < resources->count_encoders; j++)
-                    {
-                        drmModeEncoder *encoder = drmModeGetEncoder(drm_fd, resources->encoders[j]);
-                        if (encoder && encoder->encoder_id == connector->encoder_id)
-                        {
-                            printf("  Associated CRTC: %u\n", encoder->crtc_id);
-                            // if (encoder->crtc_id == crtc2->crtc_id)
-                            // {
-                            //     printf("  CRTC %u is associated with this connector\n", crtc2->crtc_id);
-                            // }
-                            drmModeFreeEncoder(encoder);
-                        }
-                    }
-                }
-            }
-
-            drmModeFreeConnector(connector);
-        }
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
     }
-}
 
-// Function to print all DRM resources
-void print_drm_resources(int drm_fd)
-{
-    drmModeRes *resources = drmModeGetResources(drm_fd);
-    if (!resources)
+    if (atomic_init(drm_fd))
     {
-        perror("Failed to get DRM resources");
-        return;
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
     }
 
-    printf("============================================================\n");
-
-    printf("Number of CRTCs: %d\n", resources->count_crtcs);
-    printf("Number of Connectors: %d\n", resources->count_connectors);
-    printf("Number of Encoders: %d\n", resources->count_encoders);
-    printf("Number of Modes: %d\n", resources->count_fbs); // Framebuffers
-
-    // Print CRTC information
-    for (int i = 0; i < resources->count_crtcs; i++)
+    // everything the cleanup at the end releases, so any failure from here
+    // on can jump there
+    int status = EXIT_FAILURE;
+    drmModeRes *resources = NULL;
+    drmModeConnector *connector1 = NULL;
+    drmModeCrtc *crtc1 = NULL;
+    struct plane_table planes = {0};
+    struct buffer_pool pool = {0};
+    struct swapchain background = {0};
+    struct swapchain overlay = {0};
+    struct frame_loop loop = {0};
+    struct compositor comp = {0};
+    struct cursor cursor = {0};
+    struct input in = {0};
+    int epoll_fd = -1;
+    int signal_fd = -1;
+    uint32_t mode_blob_id = 0;
+
+    // what the last start found out, while the driver, the monitor and its
+    // connector are the same. the connector is read as last probed, its EDID
+    // is not fetched again (src/snapshot.h)
+    static struct snapshot snap;
+    char snapshot_file[512];
+    int have_snapshot_path = snapshot_path("planesv3", drm_fd, snapshot_file, sizeof(snapshot_file)) == 0;
+    int cached = have_snapshot_path && snapshot_load(drm_fd, snapshot_file, &snap) == 0;
+    uint32_t crtc_id = snap.crtc_id;
+    if (cached)
     {
-        drmModeCrtc *crtc = drmModeGetCrtc(drm_fd, resources->crtcs[i]);
-        if (crtc)
+        connector1 = kms_get_connector_current(drm_fd, snap.connector_id);
+        if (!connector1 || connector1->connection != DRM_MODE_CONNECTED || connector1->count_modes == 0)
         {
-            printf("\nCRTC %d:\n", crtc->crtc_id);
-            printf("  Buffer ID: %d\n", crtc->buffer_id);
-            printf("  Position: (%d, %d)\n", crtc->x, crtc->y);
-            printf("  Size: (%d, %d)\n", crtc->width, crtc->height);
-            printf("  Mode Valid: %d\n", crtc->mode_valid);
-            if (crtc->mode_valid)
-            {
-                printf("  Mode:\n");
-                printf("    Name: %s\n", crtc->mode.name);
-                printf("    Resolution: %dx%d\n", crtc->mode.hdisplay, crtc->mode.vdisplay);
-            }
-            drmModeFreeCrtc(crtc);
+            drmModeFreeConnector(connector1);
+            connector1 = NULL;
+            snapshot_free(&snap);
+            cached = 0;
         }
     }
 
-    // Print Connector information
-    for (int i = 0; i < resources->count_connectors; i++)
+    if (!cached)
     {
-        drmModeConnector *connector = drmModeGetConnector(drm_fd, resources->connectors[i]);
-        if (connector)
+        // get the resources
+        resources = kms_get_resources(drm_fd);
+        if (!resources)
         {
-            printf("\nConnector %d:\n", connector->connector_id);
-            printf("  Connection Status: %s\n", connector->connection == DRM_MODE_CONNECTED ? "Connected" : "Disconnected");
-            printf("  Number of Modes: %d\n", connector->count_modes);
-            printf("  Encoder ID: %d\n", connector->encoder_id);
-            drmModeFreeConnector(connector);
+            perror("drmModeGetResources failed");
+            goto out;
         }
-    }
 
-    // Print Encoder information
-    for (int i = 0; i < resources->count_encoders; i++)
-    {
-        drmModeEncoder *encoder = drmModeGetEncoder(drm_fd, resources->encoders[i]);
-        if (encoder)
+        // getting connector 1
+        for (int i = 0; i < resources->count_connectors; i++)
         {
-            printf("\nEncoder %d:\n", encoder->encoder_id);
-            printf("  CRTC ID: %d\n", encoder->crtc_id);
-            drmModeFreeEncoder(encoder);
+            connector1 = kms_get_connector(drm_fd, resources->connectors[i]);
+            if (connector1 && connector1->connection == DRM_MODE_CONNECTED && connector1->count_modes > 0)
+                break;
+            drmModeFreeConnector(connector1);
+            connector1 = NULL;
         }
-    }
 
-    drmModeFreeResources(resources);
-}
+        if (!connector1)
+        {
+            fprintf(stderr, "No active connector found.\n");
+            goto out;
+        }
+        crtc_id = resources->crtcs[0];
+    }
 
-// Print the plane - CRTC Compatibility
-void print_plane_crtc_compatibility(int drm_fd)
-{
-    drmModePlaneRes *plane_res = drmModeGetPlaneResources(drm_fd);
-    if (!plane_res)
+    // get CRTC 1
+    crtc1 = kms_get_crtc(drm_fd, crtc_id);
+    if (!crtc1)
     {
-        perror("drmModeGetPlaneResources failed");
-        return;
+        fprintf(stderr, "Cannot get CRTC\n");
+        goto out;
     }
 
-    for (uint32_t i = 0; i < plane_res->count_planes; i++)
+    // $PLANES_MODE picks the mode, the preferred one by default
+    const drmModeModeInfo *mode = mode_pick(connector1);
+    if (cached && !mode_same(mode, &snap.mode))
     {
-        drmModePlane *plane = drmModeGetPlane(drm_fd, plane_res->planes[i]);
-        if (!plane)
-        {
-            fprintf(stderr, "Failed to get plane %u\n", plane_res->planes[i]);
-            continue;
-        }
-
-        printf("--------------------------------\n");
-        printf("Plane ID: %u\n", plane->plane_id);
-        printf("Possible CRTCs: 0x%x\n", plane->possible_crtcs);
-
-        for (int j = 0; j < 8; j++)
-        {
-            if (plane->possible_crtcs & (1 << j))
-            {
-                printf("  Can be associated with CRTC: %d\n", j);
-            }
-        }
+        snapshot_free(&snap);
+        cached = 0;
+    }
 
-        drmModeFreePlane(plane);
+    // enumerate every plane once, with its formats, zpos and scaling support.
+    // a snapshot has the table already
+    if (cached)
+    {
+        planes = snap.planes;
+        snap.planes.count = 0;
+    }
+    else if (plane_table_load(drm_fd, &planes))
+    {
+        fprintf(stderr, "Cannot enumerate planes\n");
+        goto out;
     }
 
-    drmModeFreePlaneResources(plane_res);
-}
+    // The first plane is double buffered too, the CPU compositor draws into it
+    // when the overlay does not get a plane of its own. Only the CPU draws it,
+    // so it takes a tiled layout when the primary plane scans one out: the
+    // compositor's tiles land in whole 4 KiB blocks and scanout fetches less.
+    uint64_t background_modifier = DRM_FORMAT_MOD_LINEAR;
+    int crtc_index = plane_table_crtc_index(&planes, crtc1->crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", crtc1->crtc_id);
+        goto out;
+    }
+    for (int i = 0; i < planes.count; i++)
+    {
+        if (planes.planes[i].type == DRM_PLANE_TYPE_PRIMARY && (planes.planes[i].possible_crtcs & (1u << crtc_index)))
+            background_modifier = plane_pick_modifier(&planes.planes[i], DRM_FORMAT_XRGB8888);
+    }
 
-// connector crtc compatibility
-void print_connector_crtc_relationships(int drm_fd)
-{
-    drmModeRes *resources = drmModeGetResources(drm_fd);
-    if (!resources)
+    int ret = swapchain_init_modifier(&background, drm_fd, BACKGROUND_BUFFERS, mode->hdisplay, mode->vdisplay,
+                                      DRM_FORMAT_XRGB8888, background_modifier);
+    if (ret && background_modifier != DRM_FORMAT_MOD_LINEAR)
     {
-        perror("Failed to get resources");
-        return;
+        printf("Tiled background refused, falling back to linear\n");
+        ret = swapchain_init(&background, drm_fd, BACKGROUND_BUFFERS, mode->hdisplay, mode->vdisplay,
+                             DRM_FORMAT_XRGB8888);
     }
+    if (ret)
+        goto out;
 
-    // Loop through connectors
-    for (int i = 0; i < resources->count_connectors; i++)
+    struct sc_buffer *background_buf = swapchain_acquire(&background);
+    struct drm_mode_create_dumb create_dumb1 = background_buf->create_dumb;
+    if (background_buf->modifier != DRM_FORMAT_MOD_LINEAR)
     {
-        drmModeConnector *connector = drmModeGetConnector(drm_fd, resources->connectors[i]);
-        if (!connector)
-        {
-            continue;
-        }
+        // a solid colour is the same in any layout, fill every row of tiles
+        printf("Background is %s\n", tiling_info_get(background_buf->modifier)->name);
+        pixel_fill(background_buf->map, create_dumb1.pitch, create_dumb1.pitch / 4,
+                   (uint32_t)(create_dumb1.size / create_dumb1.pitch), COLOR_RED);
+    }
+    else
+    {
+        pixel_fill(background_buf->map, create_dumb1.pitch, create_dumb1.width, create_dumb1.height, COLOR_RED);
+    }
 
-        printf("--------------------------------\n");
-        printf("Connector ID: %u\n", connector->connector_id);
-        printf("  Connection Status: %s\n", connector->connection == DRM_MODE_CONNECTED ? "Connected" : "Disconnected");
+    // The second plane is double buffered so it can be redrawn without tearing.
+    // Its buffers come from a pool, resizing it reuses buffers of earlier sizes.
+    buffer_pool_init(&pool, drm_fd, OVERLAY_POOL_BYTES);
+    if (swapchain_init_pooled(&overlay, &pool, OVERLAY_BUFFERS, mode->hdisplay / 2, mode->vdisplay / 2, DRM_FORMAT_XRGB8888))
+        goto out;
+
+    struct sc_buffer *overlay_buf = swapchain_acquire(&overlay);
+    struct drm_mode_create_dumb create_dumb2 = overlay_buf->create_dumb;
+    pixel_fill(overlay_buf->map, create_dumb2.pitch, create_dumb2.width, create_dumb2.height, COLOR_BLUE);
+    swapchain_queue(&overlay, overlay_buf, NULL);
+    overlay_buf = swapchain_next_ready(&overlay);
+
+    static struct input_timing timing;
+    frame_loop_init(&loop, drm_fd, on_flip, &timing);
+    frame_loop_add_swapchain(&loop, &background);
+    frame_loop_add_swapchain(&loop, &overlay);
+
+    // cache the property IDs once, every commit after this is a single ioctl
+    struct crtc_props crtc_props = snap.crtc_props;
+    struct connector_props connector_props = snap.connector_props;
+    if (!cached && (atomic_get_crtc_props(drm_fd, crtc1->crtc_id, &crtc_props) ||
+                    atomic_get_connector_props(drm_fd, connector1->connector_id, &connector_props)))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector properties\n");
+        goto out;
+    }
 
-        // Loop through encoders to find which CRTC they are associated with
-        for (int j = 0; j < resources->count_encoders; j++)
+    struct atomic_req req;
+    uint32_t commit_flags;
+    int vrr = first_request(drm_fd, crtc1, connector1, mode, &crtc_props, &connector_props, &req, &commit_flags,
+                            &mode_blob_id);
+    if (vrr < 0)
+        goto out;
+
+    // layer 0 is the full screen background, layer 1 the movable overlay
+    // the scene keeps them from frame to frame, each commit only carries what changed
+    struct scene scene;
+    scene_init(&scene, crtc1->crtc_id);
+    int background_layer = scene_layer_create(&scene, background_buf->fb_id, DRM_FORMAT_XRGB8888,
+                                              background_buf->modifier, create_dumb1.width, create_dumb1.height, 0);
+    int overlay_layer = scene_layer_create(&scene, overlay_buf->fb_id, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR,
+                                           create_dumb2.width, create_dumb2.height, 1);
+    scene_layer_move(&scene, overlay_layer, 100, 100);
+
+    struct layer layers[SCENE_MAX_LAYERS];
+    int handles[SCENE_MAX_LAYERS];
+    int layer_count = scene_layers(&scene, layers, handles);
+
+    // the snapshot's planes get one TEST_ONLY commit of the whole first
+    // frame, only when that fails does plane_alloc search for planes again
+    struct plane_alloc_result alloc;
+    int drm_fd_ctx = drm_fd;
+    if (cached && snap.layer_count == layer_count &&
+        plane_alloc_reuse(&planes, crtc1->crtc_id, layers, layer_count, snap.layer_planes, &req, &alloc) == 0 &&
+        atomic_test(drm_fd, &req, commit_flags) == 0)
+    {
+        printf("Restored the plane setup from %s\n", snapshot_file);
+    }
+    else
+    {
+        // the property IDs may be stale as well (another kernel), look
+        // everything up again and start the request over
+        if (cached)
         {
-            drmModeEncoder *encoder = drmModeGetEncoder(drm_fd, resources->encoders[j]);
-            if (encoder && encoder->encoder_id == connector->encoder_id)
+            cached = 0;
+            atomic_req_reset(drm_fd, &req);
+            plane_table_free(&planes);
+            if (mode_blob_id)
+                kms_destroy_property_blob(drm_fd, mode_blob_id);
+            mode_blob_id = 0;
+            if (plane_table_load(drm_fd, &planes) || atomic_get_crtc_props(drm_fd, crtc1->crtc_id, &crtc_props) ||
+                atomic_get_connector_props(drm_fd, connector1->connector_id, &connector_props))
             {
-                printf("  Encoder ID: %u\n", encoder->encoder_id);
-                printf("    Associated CRTC: %u\n", encoder->crtc_id);
-                drmModeFreeEncoder(encoder);
-                break; // We found the associated encoder
-            }
-            if (encoder)
-            {
-                drmModeFreeEncoder(encoder);
+                fprintf(stderr, "Cannot look up planes and properties\n");
+                goto out;
             }
+            vrr = first_request(drm_fd, crtc1, connector1, mode, &crtc_props, &connector_props, &req, &commit_flags,
+                                &mode_blob_id);
+            if (vrr < 0)
+                goto out;
+        }
+        if (plane_alloc_assign(&planes, crtc1->crtc_id, layers, layer_count, plane_atomic_test, &drm_fd_ctx, &req,
+                               &alloc))
+        {
+            fprintf(stderr, "No suitable plane found for the first framebuffer.\n");
+            goto out;
         }
-
-        drmModeFreeConnector(connector);
     }
-
-    drmModeFreeResources(resources);
-}
-
-int main()
-{
-
-    // get the drm file descriptor
-    const int drm_fd = open(DRM_DEVICE, O_RDWR | O_CLOEXEC);
-    if (drm_fd < 0)
+    if (vrr)
+        printf("Variable refresh enabled\n");
+    scene_bind(&scene, &planes, layers, handles, layer_count);
+
+    // no plane left for the overlay: flatten it into the background on the CPU
+    struct comp_layer comp_layers[2] = {0};
+    comp_layers[0].type = COMP_LAYER_SOLID;
+    comp_layers[0].w = create_dumb1.width;
+    comp_layers[0].h = create_dumb1.height;
+    comp_layers[0].color = COLOR_RED;
+    comp_layers[1].type = COMP_LAYER_SOLID;
+    comp_layers[1].x = scene.x[overlay_layer];
+    comp_layers[1].y = scene.y[overlay_layer];
+    comp_layers[1].w = create_dumb2.width;
+    comp_layers[1].h = create_dumb2.height;
+    comp_layers[1].color = COLOR_BLUE;
+
+    if (alloc.composited_layers > 0)
     {
-        perror("Failed to open DRM device");
-        return EXIT_FAILURE;
+        printf("No plane for the overlay, compositing it on the CPU\n");
+        if (compositor_init(&comp, 0, 0, 0))
+            goto out;
+        compositor_render_tiled(&comp, comp_layers, 2, background_buf->map, create_dumb1.pitch,
+                                background_buf->modifier, create_dumb1.width, create_dumb1.height, NULL);
     }
+    swapchain_queue(&background, background_buf, NULL);
+    background_buf = swapchain_next_ready(&background);
 
-    drmSetClientCap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
-
-    // get the resources
-    drmModeRes *resources = drmModeGetResources(drm_fd);
-    if (!resources)
+    // probe the whole configuration before anything reaches the screen,
+    // a restored one has been probed already
+    ret = cached ? 0 : atomic_test(drm_fd, &req, commit_flags);
+    if (ret)
     {
-        perror("drmModeGetResources failed");
-        close(drm_fd);
-        return EXIT_FAILURE;
+        fprintf(stderr, "Plane configuration rejected by the driver: %s\n", strerror(-ret));
+        goto out;
     }
 
-    // getting connector 1
-    drmModeConnector *connector1 = NULL;
-    for (int i = 0; i < resources->count_connectors; i++)
+    // plane_alloc queued every plane already, this only adds what it does not know (alpha)
+    scene_commit(&scene, &req);
+    ret = atomic_commit(drm_fd, &req, commit_flags, &loop);
+    if (ret)
     {
-        connector1 = drmModeGetConnector(drm_fd, resources->connectors[i]);
-        if (connector1 && connector1->connection == DRM_MODE_CONNECTED && connector1->count_modes > 0)
-            break;
-        drmModeFreeConnector(connector1);
-        connector1 = NULL;
+        fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+        goto out;
     }
+    scene_committed(&scene);
+    printf("First frame committed %.1f ms after start%s%s\n", now_ms() - start_ms,
+           cached ? ", restored from a snapshot" : "",
+           commit_flags & DRM_MODE_ATOMIC_ALLOW_MODESET ? "" : ", no modeset");
 
-    if (!connector1)
+    // what this start found out, for the next one
+    if (!cached && have_snapshot_path)
     {
-        fprintf(stderr, "No active connector found.\n");
-        drmModeFreeResources(resources);
-        close(drm_fd);
-        return EXIT_FAILURE;
+        memset(&snap, 0, sizeof(snap));
+        snapshot_key(drm_fd, connector1->connector_id, snap.driver, sizeof(snap.driver), &snap.edid_hash);
+        snap.connector_id = connector1->connector_id;
+        snap.crtc_id = crtc1->crtc_id;
+        snap.mode = *mode;
+        snap.crtc_props = crtc_props;
+        snap.connector_props = connector_props;
+        snap.layer_count = layer_count;
+        for (int i = 0; i < layer_count; i++)
+            snap.layer_planes[i] = layers[i].plane_id;
+        snap.planes = planes;
+        ret = snapshot_save(snapshot_file, &snap);
+        if (ret)
+            fprintf(stderr, "Cannot save the snapshot %s: %s\n", snapshot_file, strerror(-ret));
+        memset(&snap, 0, sizeof(snap));
     }
-
-    // get CRTC 1
-    drmModeCrtc *crtc1 = drmModeGetCrtc(drm_fd, resources->crtcs[0]);
-    if (!crtc1)
+    swapchain_submit(&background, background_buf);
+    swapchain_submit(&overlay, overlay_buf);
+    frame_loop_begin_flip(&loop);
+
+    // the pointer gets a cursor plane the overlay did not take, or the legacy
+    // cursor ioctls. it goes up with the first cursor commit of the loop below.
+    cursor_init(&cursor, drm_fd, &planes, crtc1->crtc_id, layers, layer_count);
+    if (add_cursor_shapes(&cursor))
+        fprintf(stderr, "Cannot upload the cursor shapes\n");
+    if (cursor.shape_count)
     {
-        fprintf(stderr, "Cannot get CRTC\n");
-        drmModeFreeConnector(connector1);
-        drmModeFreeResources(resources);
-        close(drm_fd);
-        return EXIT_FAILURE;
+        cursor_move(&cursor, create_dumb1.width / 2, create_dumb1.height / 2);
+        cursor_set_shape(&cursor, 0);
     }
+    printf("Cursor on %s\n", cursor.legacy ? "the legacy cursor ioctls" : "a cursor plane");
 
-    // Create a dumb buffer for the first plane
-    struct drm_mode_create_dumb create_dumb1 = {0};
-    create_dumb1.width = connector1->modes[0].hdisplay;
-    create_dumb1.height = connector1->modes[0].vdisplay;
-    create_dumb1.bpp = 32;
-
-    void *buffer_map1;
-    uint32_t fb_id1;
-    create_dumb_buffer(drm_fd, &create_dumb1, &buffer_map1, &fb_id1);
-    fill_buffer_with_color((uint32_t *)buffer_map1, create_dumb1.size, COLOR_RED);
-
-    // Create a dumb buffer for the second plane
-    struct drm_mode_create_dumb create_dumb2 = {0};
-    create_dumb2.width = connector1->modes[0].hdisplay / 2;
-    create_dumb2.height = connector1->modes[0].vdisplay / 2;
-    create_dumb2.bpp = 32;
-
-    void *buffer_map2;
-    uint32_t fb_id2;
-    create_dumb_buffer(drm_fd, &create_dumb2, &buffer_map2, &fb_id2);
-    fill_buffer_with_color((uint32_t *)buffer_map2, create_dumb2.size, COLOR_BLUE);
-
-    // Get plane resources
-    drmModePlaneRes *plane_res = drmModeGetPlaneResources(drm_fd);
-    uint32_t used_plane_ids[2] = {0};
-    int used_count = 0;
-
-    // setting the plane 1
-    drmModePlane *plane1 = get_plane(drm_fd, resources, plane_res, used_plane_ids, used_count, crtc1->crtc_id);
-    if (plane1)
+    // ./kms_info prints every CRTC, encoder, connector and plane as JSON
+
+    int x = 100;
+    int y = 100;
+    struct swapchain retired = {0}; // the overlay's old swapchain until the resized one is on screen
+    uint32_t overlay_color = COLOR_BLUE;
+
+    // input folded since the last commit, it all goes out with the next one
+    int resize_steps = 0;
+    int recolor = 0;
+    uint32_t inputs = 0;
+    uint64_t input_ns = 0; // the oldest of them
+    uint64_t cursor_ns = 0; // the oldest pointer motion not on screen yet
+    int quit = 0;
+
+    // keys come from stdin (raw when it is a terminal) and, with a second
+    // argument or PLANES_INPUT, from an evdev node, see src/input.h
+    const char *evdev_path = argc > 2 ? argv[2] : getenv("PLANES_INPUT");
+    ret = input_open(&in, evdev_path);
+    if (ret)
     {
-        used_plane_ids[used_count++] = plane1->plane_id; // Mark as used
-        drmModeSetPlane(drm_fd, plane1->plane_id, crtc1->crtc_id, fb_id1, 1, 0, 0,
-                        create_dumb1.width, create_dumb1.height, 0, 0,
-                        create_dumb1.width << 16, create_dumb1.height << 16);
+        fprintf(stderr, "Cannot open input %s: %s\n", evdev_path ? evdev_path : "stdin", strerror(-ret));
+        goto out;
     }
-    else
+
+    // one epoll set for the flip events, the signals and every input source.
+    // a signal that came during the setup is pending and ends the loop at once
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = drm_fd};
+    int failed = epoll_fd < 0 || signal_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drm_fd, &event);
+    event.data.fd = signal_fd;
+    failed = failed || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+    if (failed)
     {
-        fprintf(stderr, "No suitable plane found for the first framebuffer.\n");
+        perror("epoll setup failed");
+        goto out;
     }
-
-    // setting the plane 2
-    drmModePlane *plane2 = get_plane(drm_fd, resources, plane_res, used_plane_ids, used_count, crtc1->crtc_id);
-    if (plane2)
+    int sources = 0;
+    for (int i = 0; i < in.fd_count; i++)
     {
-
-        used_plane_ids[used_count++] = plane2->plane_id; // Mark as used
-        drmModeSetPlane(drm_fd, plane2->plane_id, crtc1->crtc_id, fb_id2, 0, 100, 100,
-                        create_dumb2.width, create_dumb2.height, 0, 0,
-                        (create_dumb2.width << 16), (create_dumb2.height << 16));
+        event.data.fd = in.fds[i];
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, in.fds[i], &event) == 0)
+            sources++;
     }
-    else
+
+    // regular files and /dev/null cannot be polled, keys have to come from a terminal or a pipe
+    if (!sources)
     {
-        fprintf(stderr, "No suitable plane found for the second framebuffer.\n");
+        fprintf(stderr, "No input to wait on, stdin must be a terminal or a pipe\n");
+        quit = 1;
     }
 
-    // print_plane_crtc_compatibility(drm_fd);
-    // print_crtc_info(drm_fd, resources);
-    // print_drm_resources(drm_fd);
-    // print_connector_crtc_relationships(drm_fd);
-    // print_plane_properties(drm_fd, plane1);
-    // print_plane_properties(drm_fd, plane2);
+    while (!quit)
+    {
+        struct epoll_event events[INPUT_MAX_FDS + 2];
+        int n = epoll_wait(epoll_fd, events, INPUT_MAX_FDS + 2, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            break;
+        }
 
-    char key;
-    int x = 100;
-    int y = 100;
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == drm_fd)
+            {
+                frame_loop_dispatch(&loop, 0);
+                continue;
+            }
+            if (fd == signal_fd)
+            {
+                quit = 1;
+                continue;
+            }
 
-    while (1)
-    {
-        key = getchar();
-        printf("%c\n", key);
+            struct input_action actions[INPUT_MAX_ACTIONS];
+            int count = input_read(fd, actions, INPUT_MAX_ACTIONS);
+            if (count < 0)
+            {
+                // end of piped input, or the device went away
+                if (count != -EPIPE)
+                    fprintf(stderr, "Input read failed: %s\n", strerror(-count));
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                if (--sources == 0)
+                    quit = 1;
+                continue;
+            }
 
-        if (key == 'q')
+            // only the latest target counts, however many keys came in
+            for (int j = 0; j < count; j++)
+            {
+                switch (actions[j].key)
+                {
+                case 'w':
+                    y -= 100;
+                    break;
+                case 's':
+                    y += 100;
+                    break;
+                case 'a':
+                    x -= 100;
+                    break;
+                case 'd':
+                    x += 100;
+                    break;
+
+                // the pointer only moves the cursor, nothing gets redrawn for it
+                case 'i':
+                case 'j':
+                case 'k':
+                case 'l':
+                case 0:
+                {
+                    int32_t dx = actions[j].dx, dy = actions[j].dy;
+                    if (actions[j].key)
+                    {
+                        dx = actions[j].key == 'j' ? -CURSOR_STEP : actions[j].key == 'l' ? CURSOR_STEP : 0;
+                        dy = actions[j].key == 'i' ? -CURSOR_STEP : actions[j].key == 'k' ? CURSOR_STEP : 0;
+                    }
+                    cursor_move(&cursor, cursor.x + dx, cursor.y + dy);
+                    if (!cursor_ns && cursor.dirty)
+                        cursor_ns = actions[j].time_ns;
+                    continue;
+                }
+                case 'p':
+                    if (cursor.shape_count)
+                        cursor_set_shape(&cursor, (cursor.shape + 1) % cursor.shape_count);
+                    if (!cursor_ns && cursor.dirty)
+                        cursor_ns = actions[j].time_ns;
+                    continue;
+                case 'c':
+                    recolor ^= 1;
+                    break;
+                case '+':
+                    resize_steps++;
+                    break;
+                case '-':
+                    resize_steps--;
+                    break;
+                case 'q':
+                    quit = 1;
+                    break;
+                default:
+                    continue;
+                }
+                if (!input_ns)
+                    input_ns = actions[j].time_ns;
+                inputs++;
+            }
+        }
+        if (quit)
             break;
 
-        switch (key)
+        // the old overlay buffers are off screen once the resize has flipped
+        if (retired.count && !loop.flip_pending)
+            swapchain_destroy(&retired);
+
+        // one commit per vblank: input that arrives while a flip is in flight
+        // waits for its flip event and goes out with the next frame
+        if (loop.flip_pending)
+            continue;
+
+        // the cursor alone changed: a commit with just its plane
+        if (!input_ns)
         {
-        case 'w':
-            y -= 100;
-            break;
+            ret = cursor_commit(&cursor, &loop);
+            if (ret > 0)
+            {
+                frame_loop_begin_flip(&loop);
+                timing.committed_ns = cursor_ns;
+            }
+            else if (ret < 0)
+            {
+                fprintf(stderr, "Cursor commit failed: %s\n", strerror(-ret));
+            }
+            cursor_ns = 0;
+            continue;
+        }
 
-        case 's':
-            y += 100;
-            break;
+        uint32_t old_w = scene.w[overlay_layer];
+        uint32_t old_h = scene.h[overlay_layer];
 
-        case 'a':
-            x -= 100;
-            break;
+        // resize the overlay by the net steps that still fit the screen: a new
+        // swapchain from the pool, the old one is released once the new size is on screen
+        int64_t w = (int64_t)old_w + (int64_t)resize_steps * OVERLAY_RESIZE_STEP;
+        int64_t h = (int64_t)old_h + (int64_t)resize_steps * OVERLAY_RESIZE_STEP;
+        while (resize_steps && (w < OVERLAY_RESIZE_STEP || h < OVERLAY_RESIZE_STEP ||
+                                w > create_dumb1.width || h > create_dumb1.height))
+        {
+            int step = resize_steps > 0 ? OVERLAY_RESIZE_STEP : -OVERLAY_RESIZE_STEP;
+            resize_steps -= resize_steps > 0 ? 1 : -1;
+            w -= step;
+            h -= step;
+        }
+        // redraw the overlay in a back buffer, the visible one is never touched
+        int recolored = recolor;
+        if (recolor)
+        {
+            overlay_color = overlay_color == COLOR_BLUE ? COLOR_GREEN : COLOR_BLUE;
+            recolor = 0;
+            overlay_buf = comp.pool || resize_steps ? NULL : swapchain_acquire(&overlay);
+            if (overlay_buf)
+            {
+                pixel_fill(overlay_buf->map, overlay_buf->create_dumb.pitch, overlay_buf->create_dumb.width,
+                           overlay_buf->create_dumb.height, overlay_color);
+                swapchain_queue(&overlay, overlay_buf, NULL);
+            }
+        }
 
-        case 'd':
-            x += 100;
-            break;
+        if (resize_steps)
+        {
+            resize_steps = 0;
+            if (!comp.pool)
+            {
+                retired = overlay;
+                ret = swapchain_init_pooled(&overlay, &pool, OVERLAY_BUFFERS, (uint32_t)w, (uint32_t)h, DRM_FORMAT_XRGB8888);
+                if (ret)
+                {
+                    fprintf(stderr, "Cannot resize the overlay: %s\n", strerror(-ret));
+                    overlay = retired;
+                    retired.count = 0;
+                    w = old_w;
+                    h = old_h;
+                }
+                else
+                {
+                    overlay_buf = swapchain_acquire(&overlay);
+                    pixel_fill(overlay_buf->map, overlay_buf->create_dumb.pitch, (uint32_t)w, (uint32_t)h, overlay_color);
+                    swapchain_queue(&overlay, overlay_buf, NULL);
+                }
+            }
+            // the new size goes out together with the first resized buffer
+            scene_layer_resize(&scene, overlay_layer, (uint32_t)w, (uint32_t)h);
+            comp_layers[1].w = (uint32_t)w;
+            comp_layers[1].h = (uint32_t)h;
+        }
+        scene_layer_move(&scene, overlay_layer, x, y);
 
-        default:
-            break;
+        struct swapchain *sc = &overlay;
+        int sc_layer = overlay_layer;
+        uint64_t render_start = trace_begin();
+        if (comp.pool)
+        {
+            // recomposite the tiles under the overlay's old and new position
+            struct damage frame_damage;
+            damage_init(&frame_damage, create_dumb1.width, create_dumb1.height);
+            scene_damage(&scene, &frame_damage);
+            if (recolored)
+                damage_add(&frame_damage, x, y, scene.w[overlay_layer], scene.h[overlay_layer]);
+
+            background_buf = swapchain_acquire(&background);
+            struct damage redraw = background_buf->damage;
+            damage_union(&redraw, &frame_damage);
+
+            comp_layers[1].x = x;
+            comp_layers[1].y = y;
+            comp_layers[1].color = overlay_color;
+            compositor_render_tiled(&comp, comp_layers, 2, background_buf->map, create_dumb1.pitch,
+                                    background_buf->modifier, create_dumb1.width, create_dumb1.height, &redraw);
+            swapchain_queue(&background, background_buf, &frame_damage);
+
+            sc = &background;
+            sc_layer = background_layer;
+        }
+        trace_end("render", render_start, inputs);
+
+        // the buffer shown until now, for when the commit fails
+        uint32_t shown_fb = scene.fb_id[sc_layer];
+        uint32_t shown_src_w = scene.src_w[sc_layer];
+        uint32_t shown_src_h = scene.src_h[sc_layer];
+        struct sc_buffer *next = swapchain_next_ready(sc);
+        if (next)
+        {
+            // both layers are unscaled, pooled buffers may be larger than the layer
+            scene_layer_set_buffer(&scene, sc_layer, next->fb_id, scene.w[sc_layer], scene.h[sc_layer]);
+            atomic_set_damage(drm_fd, &req, &scene.plane[sc_layer]->props, &sc->submit_damage);
         }
+        scene_commit(&scene, &req);
 
-        drmModeSetPlane(drm_fd, plane2->plane_id, crtc1->crtc_id, fb_id2, 1, x, y,
-                        create_dumb2.width, create_dumb2.height, 0, 0,
-                        (create_dumb2.width << 16), (create_dumb2.height << 16));
+        // whatever the cursor did since its last commit goes out with the frame
+        cursor_add_to_req(&cursor, &req);
+        uint64_t frame_input_ns = cursor_ns && cursor_ns < input_ns ? cursor_ns : input_ns;
+        cursor_ns = 0;
+        input_ns = 0;
+        inputs = 0;
+
+        // the keys cancelled each other out, nothing to send
+        if (!req.count)
+        {
+            scene_committed(&scene);
+            continue;
+        }
+
+        ret = atomic_commit(drm_fd, &req, ATOMIC_FLIP_FLAGS, &loop);
+        if (ret)
+        {
+            fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+            if (next)
+            {
+                swapchain_cancel(sc, next);
+                scene_layer_set_buffer(&scene, sc_layer, shown_fb, shown_src_w, shown_src_h);
+            }
+            if (!cursor.legacy)
+                cursor.dirty = 1;
+            if (retired.count)
+            {
+                // the old size is still on screen, go back to it
+                swapchain_destroy(&overlay);
+                overlay = retired;
+                retired.count = 0;
+                scene_layer_resize(&scene, overlay_layer, old_w, old_h);
+                comp_layers[1].w = old_w;
+                comp_layers[1].h = old_h;
+            }
+            continue;
+        }
+        if (next)
+            swapchain_submit(sc, next);
+        scene_committed(&scene);
+        frame_loop_begin_flip(&loop);
+        timing.committed_ns = frame_input_ns;
     }
 
+    frame_loop_wait_idle(&loop);
+    input_latency_print(&timing.latency, stdout);
+    status = EXIT_SUCCESS;
+
+out:
+    // a start that failed after its first commit still has that flip in flight
+    frame_loop_wait_idle(&loop);
+    input_close(&in);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (signal_fd >= 0)
+        close(signal_fd);
+    trace_finish();
+
     // Cleanup
-    if (plane1)
-        drmModeFreePlane(plane1);
-    if (plane2)
-        drmModeFreePlane(plane2);
-
-    munmap(buffer_map1, create_dumb1.size);
-    munmap(buffer_map2, create_dumb2.size);
-    drmModeRmFB(drm_fd, fb_id1);
-    drmModeRmFB(drm_fd, fb_id2);
-    drmModeFreePlaneResources(plane_res);
+    cursor_destroy(&cursor);
+    plane_table_free(&planes);
+
+    if (comp.pool)
+        compositor_destroy(&comp);
+    swapchain_destroy(&background);
+    swapchain_destroy(&overlay);
+    buffer_pool_print_stats(&pool, stdout);
+    buffer_pool_destroy(&pool);
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
     drmModeFreeConnector(connector1);
     drmModeFreeCrtc(crtc1);
     drmModeFreeResources(resources);
-    close(drm_fd);
+    snapshot_free(&snap);
+    kms_close(drm_fd);
 
-    return EXIT_SUCCESS;
+    return status;
 }
\ No newline at end of file
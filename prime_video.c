@@ -0,0 +1,332 @@
+#define _GNU_SOURCE // memfd_create
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/atomic.h"
+#include "src/dmabuf.h"
+#include "src/dumb_buffer.h"
+#include "src/format.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pixel.h"
+#include "src/plane_alloc.h"
+
+// build: gcc prime_video.c src/dmabuf.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/frame_loop.c src/swapchain.c src/pixel.c src/tiling.c src/damage.c src/format.c src/mode.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o prime_video -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./prime_video [device]
+
+#define VIDEO_FRAMES 4
+#define RUN_SECONDS 5
+#define COLOR_BACKGROUND 0xFF202020
+
+/*
+    Plays a looping "video" on an overlay plane without copying a pixel.
+
+    Every video frame lives in its own memfd, the way a decoder or camera
+    would hand out dma-bufs. The memfds are turned into dma-bufs with
+    /dev/udmabuf (vkms accepts those, no GPU needed), imported with PRIME and
+    put on the overlay plane as they are. The fake backend imports the
+    memfds directly when there is no /dev/udmabuf.
+
+    The frames repeat, so after the first loop every framebuffer comes out of
+    the FB cache and no further AddFB2 calls are made.
+
+    The frames are NV12, like a decoder's output, when an overlay plane can
+    scan that out. Otherwise they are XRGB8888.
+*/
+
+struct video_frame
+{
+    int memfd;
+    int dmabuf_fd;
+    void *map;
+    uint64_t size;
+    struct dmabuf_image image;
+};
+
+// a flat colour with a white stripe through the middle, in NV12 the luma and
+// the interleaved chroma plane are filled separately
+static void fill_frame(const struct video_frame *frame, uint32_t color)
+{
+    const struct dmabuf_image *image = &frame->image;
+    int32_t stripe_y = (int32_t)(image->height / 2 - 8);
+
+    if (image->format != DRM_FORMAT_NV12)
+    {
+        pixel_fill(frame->map, image->pitches[0], image->width, image->height, color);
+        pixel_fill_rect(frame->map, image->pitches[0], 0, stripe_y, image->width, 16, 0xFFFFFFFF);
+        return;
+    }
+
+    uint8_t y, u, v, white_y, white_u, white_v;
+    format_rgb_to_yuv(color, &y, &u, &v);
+    format_rgb_to_yuv(0xFFFFFFFF, &white_y, &white_u, &white_v);
+    uint8_t *luma = frame->map;
+    uint8_t *chroma = (uint8_t *)frame->map + image->offsets[1];
+    for (uint32_t row = 0; row < image->height; row++)
+    {
+        int stripe = (int32_t)row >= stripe_y && (int32_t)row < stripe_y + 16;
+        memset(luma + (size_t)row * image->pitches[0], stripe ? white_y : y, image->width);
+        if (row % 2)
+            continue;
+        uint8_t *c = chroma + (size_t)(row / 2) * image->pitches[1];
+        for (uint32_t x = 0; x < image->width; x += 2)
+        {
+            c[x] = stripe ? white_u : u;
+            c[x + 1] = stripe ? white_v : v;
+        }
+    }
+}
+
+static int create_frame(struct video_frame *frame, uint32_t width, uint32_t height, uint32_t format, uint32_t color)
+{
+    const struct format_info *info = format_info_get(format);
+    uint32_t pitch = (width * info->cpp[0] + 63) & ~63u;
+    uint64_t size = (pitch * format_buffer_rows(info, height) + 4095) & ~4095ull;
+
+    frame->memfd = memfd_create("video-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (frame->memfd < 0 || ftruncate(frame->memfd, (off_t)size))
+    {
+        perror("Cannot allocate video frame");
+        return -1;
+    }
+
+    frame->map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, frame->memfd, 0);
+    if (frame->map == MAP_FAILED)
+    {
+        perror("Cannot map video frame");
+        return -1;
+    }
+    frame->size = size;
+
+    frame->dmabuf_fd = udmabuf_create(frame->memfd, size);
+    if (frame->dmabuf_fd < 0)
+        frame->dmabuf_fd = frame->memfd;
+
+    memset(&frame->image, 0, sizeof(frame->image));
+    frame->image.width = width;
+    frame->image.height = height;
+    frame->image.format = format;
+    frame->image.modifier = DRM_FORMAT_MOD_LINEAR;
+    frame->image.plane_count = info->plane_count;
+    for (int i = 0; i < info->plane_count; i++)
+    {
+        frame->image.fds[i] = frame->dmabuf_fd;
+        frame->image.pitches[i] = pitch;
+        frame->image.offsets[i] = format_plane_offset(info, pitch, height, i);
+    }
+    fill_frame(frame, color);
+    return 0;
+}
+
+static void destroy_frame(struct video_frame *frame)
+{
+    if (frame->map && frame->map != MAP_FAILED)
+        munmap(frame->map, frame->size);
+    if (frame->dmabuf_fd >= 0 && frame->dmabuf_fd != frame->memfd)
+        close(frame->dmabuf_fd);
+    if (frame->memfd >= 0)
+        close(frame->memfd);
+}
+
+int main(int argc, char **argv)
+{
+    int drm_fd = kms_open(argc > 1 ? argv[1] : NULL);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    if (atomic_init(drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+    {
+        perror("drmModeGetResources failed");
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        fprintf(stderr, "No active connector found.\n");
+        drmModeFreeResources(resources);
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    const drmModeModeInfo *mode = mode_pick(connector);
+    uint32_t crtc_id = resources->crtcs[0];
+    drmModeCrtc *crtc = kms_get_crtc(drm_fd, crtc_id);
+
+    // the primary plane only shows a flat background
+    struct drm_mode_create_dumb background = {.width = mode->hdisplay, .height = mode->vdisplay, .bpp = 32};
+    void *background_map;
+    uint32_t background_fb;
+    if (create_dumb_buffer(drm_fd, &background, &background_map, &background_fb))
+        return EXIT_FAILURE;
+    pixel_fill(background_map, background.pitch, background.width, background.height, COLOR_BACKGROUND);
+
+    struct fb_cache cache;
+    fb_cache_init(&cache, drm_fd);
+
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, NULL, NULL);
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_table planes;
+    if (atomic_get_crtc_props(drm_fd, crtc_id, &crtc_props) ||
+        atomic_get_connector_props(drm_fd, connector->connector_id, &connector_props) ||
+        plane_table_load(drm_fd, &planes))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector/plane properties\n");
+        return EXIT_FAILURE;
+    }
+
+    // NV12 is half the size of XRGB8888, use it when an overlay takes it
+    uint32_t video_format = DRM_FORMAT_XRGB8888;
+    for (int i = 0; i < planes.count; i++)
+    {
+        if (planes.planes[i].type == DRM_PLANE_TYPE_OVERLAY &&
+            plane_supports_format(&planes.planes[i], DRM_FORMAT_NV12, DRM_FORMAT_MOD_LINEAR))
+            video_format = DRM_FORMAT_NV12;
+    }
+
+    static const uint32_t colors[VIDEO_FRAMES] = {0xFFC00000, 0xFF00C000, 0xFF0000C0, 0xFFC0C000};
+    struct video_frame frames[VIDEO_FRAMES];
+    uint32_t video_w = (mode->hdisplay / 2) & ~1u, video_h = (mode->vdisplay / 2) & ~1u;
+    for (int i = 0; i < VIDEO_FRAMES; i++)
+        frames[i] = (struct video_frame){.memfd = -1, .dmabuf_fd = -1};
+    for (int i = 0; i < VIDEO_FRAMES; i++)
+    {
+        if (create_frame(&frames[i], video_w, video_h, video_format, colors[i]))
+            return EXIT_FAILURE;
+    }
+    printf("Video frames are %s %s\n", format_info_get(video_format)->name,
+           frames[0].dmabuf_fd != frames[0].memfd ? "udmabufs" : "plain memfds");
+
+    struct atomic_req req;
+    atomic_req_init(&req);
+    uint32_t commit_flags = ATOMIC_FLIP_FLAGS;
+    uint32_t mode_blob_id = 0;
+    if (!crtc || !crtc->mode_valid || !mode_same(&crtc->mode, mode))
+    {
+        if (atomic_set_mode(drm_fd, &req, &crtc_props, &connector_props, mode, &mode_blob_id))
+            return EXIT_FAILURE;
+        commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    // layer 0 is the background, layer 1 the video centred on top of it
+    uint32_t video_fb;
+    if (fb_cache_get(&cache, &frames[0].image, &video_fb))
+        return EXIT_FAILURE;
+
+    struct layer layers[2] = {0};
+    layers[0].fb_id = background_fb;
+    layers[0].format = DRM_FORMAT_XRGB8888;
+    layers[0].modifier = DRM_FORMAT_MOD_LINEAR;
+    layers[0].w = layers[0].src_w = background.width;
+    layers[0].h = layers[0].src_h = background.height;
+    layers[1] = layers[0];
+    layers[1].fb_id = video_fb;
+    layers[1].format = video_format;
+    layers[1].x = (int32_t)(background.width - video_w) / 2;
+    layers[1].y = (int32_t)(background.height - video_h) / 2;
+    layers[1].w = layers[1].src_w = video_w;
+    layers[1].h = layers[1].src_h = video_h;
+
+    struct plane_alloc_result alloc;
+    int test_fd = drm_fd;
+    if (plane_alloc_assign(&planes, crtc_id, layers, 2, plane_atomic_test, &test_fd, &req, &alloc) ||
+        alloc.composited_layers)
+    {
+        // copying the frames is exactly what this program avoids
+        fprintf(stderr, "No overlay plane can scan out the video directly\n");
+        return EXIT_FAILURE;
+    }
+
+    const struct plane_props *video_props = NULL;
+    for (int i = 0; i < planes.count; i++)
+    {
+        if (planes.planes[i].plane_id == layers[1].plane_id)
+            video_props = &planes.planes[i].props;
+    }
+
+    int ret = atomic_commit(drm_fd, &req, commit_flags, &loop);
+    if (ret)
+    {
+        fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    frame_loop_begin_flip(&loop);
+
+    // one video frame per vblank, only the plane's FB_ID changes
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t frame = 1;; frame++)
+    {
+        if (frame_loop_wait_idle(&loop))
+            break;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - start.tv_sec >= RUN_SECONDS)
+            break;
+
+        if (fb_cache_get(&cache, &frames[frame % VIDEO_FRAMES].image, &video_fb))
+            break;
+
+        atomic_req_add(&req, video_props->plane_id, video_props->fb_id, video_fb);
+        ret = atomic_commit(drm_fd, &req, ATOMIC_FLIP_FLAGS, &loop);
+        if (ret)
+        {
+            fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+            break;
+        }
+        frame_loop_begin_flip(&loop);
+    }
+
+    frame_histogram_print(&loop.hist, stdout);
+    printf("FB cache: %llu hits, %llu imports\n", (unsigned long long)cache.hits, (unsigned long long)cache.misses);
+
+    // turn the overlay off before its framebuffers go away
+    atomic_disable_plane(&req, video_props);
+    atomic_commit(drm_fd, &req, 0, NULL);
+
+    fb_cache_destroy(&cache);
+    for (int i = 0; i < VIDEO_FRAMES; i++)
+        destroy_frame(&frames[i]);
+    plane_table_free(&planes);
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
+    destroy_dumb_buffer(drm_fd, &background, background_map, background_fb);
+    drmModeFreeCrtc(crtc);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    kms_close(drm_fd);
+
+    return EXIT_SUCCESS;
+}
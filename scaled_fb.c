@@ -0,0 +1,242 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/atomic.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/plane_alloc.h"
+#include "src/render_scale.h"
+#include "src/swapchain.h"
+#include "src/trace.h"
+
+// build: gcc scaled_fb.c src/render_scale.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/damage.c src/format.c src/pixel.c src/tiling.c src/mode.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o scaled_fb -lpthread $(pkg-config --cflags --libs libdrm)
+// usage: ./scaled_fb [device] [budget_ms]
+//        ./scaled_fb fake:1920x1080@60,scale 2
+
+#define SWAPCHAIN_BUFFERS 3
+#define RUN_SECONDS 5
+
+/*
+    Renders a full screen animation on the CPU, every pixel every frame,
+    at whatever resolution keeps the render time within budget, and has
+    the primary plane's scaler stretch it to the mode's size (src/render_scale.c).
+
+    The budget defaults to a quarter of the refresh interval. Planes that
+    cannot scale (vkms, the fake backend without "scale") always render at
+    full size.
+*/
+
+// rings and diagonal bands, drawn in full size coordinates so the picture is
+// the same at every render size
+static void render_scene(uint32_t *map, uint32_t pitch, uint32_t w, uint32_t h, uint32_t full_w, uint32_t full_h,
+                         uint32_t frame)
+{
+    uint32_t step_x = (full_w << 16) / w, step_y = (full_h << 16) / h;
+    int32_t cx = (int32_t)full_w / 2, cy = (int32_t)full_h / 2;
+
+    for (uint32_t y = 0; y < h; y++)
+    {
+        uint32_t *row = (uint32_t *)((uint8_t *)map + (size_t)y * pitch);
+        int32_t fy = (int32_t)((y * step_y) >> 16);
+        for (uint32_t x = 0; x < w; x++)
+        {
+            int32_t fx = (int32_t)((x * step_x) >> 16);
+            uint32_t d = (uint32_t)((fx - cx) * (fx - cx) + (fy - cy) * (fy - cy)) >> 9;
+            uint32_t r = (uint32_t)(fx + fy + (int32_t)frame * 4) & 0xFF;
+            uint32_t g = (d + frame * 3) & 0xFF;
+            uint32_t b = (uint32_t)(fx ^ fy) & 0xFF;
+            row[x] = 0xFF000000 | r << 16 | g << 8 | b;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    // PLANES_TRACE=1 prints render/commit timings at exit
+    trace_init();
+
+    int drm_fd = kms_open(argc > 1 ? argv[1] : NULL);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    if (atomic_init(drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+    {
+        perror("drmModeGetResources failed");
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        fprintf(stderr, "No active connector found.\n");
+        drmModeFreeResources(resources);
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    const drmModeModeInfo *mode = mode_pick(connector);
+    uint32_t crtc_id = resources->crtcs[0];
+    drmModeCrtc *crtc = kms_get_crtc(drm_fd, crtc_id);
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_table planes;
+    if (atomic_get_crtc_props(drm_fd, crtc_id, &crtc_props) ||
+        atomic_get_connector_props(drm_fd, connector->connector_id, &connector_props) ||
+        plane_table_load(drm_fd, &planes))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector/plane properties\n");
+        return EXIT_FAILURE;
+    }
+
+    int crtc_index = plane_table_crtc_index(&planes, crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+    struct plane_info *primary = NULL;
+    for (int i = 0; i < planes.count && !primary; i++)
+    {
+        if (planes.planes[i].type == DRM_PLANE_TYPE_PRIMARY && (planes.planes[i].possible_crtcs & (1u << crtc_index)))
+            primary = &planes.planes[i];
+    }
+    if (!primary)
+    {
+        fprintf(stderr, "No primary plane for CRTC %u\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+
+    // full size buffers, a smaller scale only draws into their top left part
+    struct swapchain sc;
+    if (swapchain_init(&sc, drm_fd, SWAPCHAIN_BUFFERS, mode->hdisplay, mode->vdisplay, DRM_FORMAT_XRGB8888))
+        return EXIT_FAILURE;
+
+    uint32_t refresh = mode->vrefresh ? mode->vrefresh : 60;
+    uint64_t budget_us = argc > 2 ? (uint64_t)(atof(argv[2]) * 1000) : 1000000 / refresh / 4;
+    struct render_scale rs;
+    render_scale_init(&rs, mode->hdisplay, mode->vdisplay, budget_us);
+
+    struct atomic_req req;
+    atomic_req_init(&req);
+    uint32_t commit_flags = ATOMIC_FLIP_FLAGS;
+    uint32_t mode_blob_id = 0;
+    if (!crtc || !crtc->mode_valid || !mode_same(&crtc->mode, mode))
+    {
+        if (atomic_set_mode(drm_fd, &req, &crtc_props, &connector_props, mode, &mode_blob_id))
+            return EXIT_FAILURE;
+        commit_flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    // ask the driver which render sizes its scaler takes before the first frame
+    int scales = render_scale_probe(&rs, drm_fd, &req, primary, crtc_id, sc.buffers[0].fb_id, commit_flags);
+    printf("Primary plane %u: %s, render budget %.2f ms\n", primary->plane_id,
+           scales > 1 ? "scales" : "does not scale", budget_us / 1000.0);
+
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, NULL, NULL);
+    frame_loop_add_swapchain(&loop, &sc);
+
+    // the render size of each buffer, the scale may have moved on by the time it is shown
+    uint32_t rendered_w[SWAPCHAIN_BUFFERS], rendered_h[SWAPCHAIN_BUFFERS];
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t frame = 0;
+    int ret;
+
+    while (1)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec - start.tv_sec >= RUN_SECONDS)
+            break;
+
+        // render ahead into any buffer that is neither on screen nor queued
+        struct sc_buffer *buf = swapchain_acquire(&sc);
+        if (buf)
+        {
+            uint64_t trace_start = trace_begin();
+            uint64_t render_start = trace_now();
+            render_scene(buf->map, buf->create_dumb.pitch, rs.render_w, rs.render_h, rs.full_w, rs.full_h, frame);
+            uint64_t render_us = (trace_now() - render_start) / 1000;
+            trace_end("render", trace_start, rs.render_w);
+
+            rendered_w[buf - sc.buffers] = rs.render_w;
+            rendered_h[buf - sc.buffers] = rs.render_h;
+            swapchain_queue(&sc, buf, NULL);
+            frame++;
+
+            if (render_scale_update(&rs, render_us))
+                printf("Frame %u: rendering at %ux%u\n", frame, rs.render_w, rs.render_h);
+        }
+
+        // the plane always covers the whole CRTC, only its SRC rect follows the render size
+        if (!loop.flip_pending)
+        {
+            struct sc_buffer *next = swapchain_next_ready(&sc);
+            if (next)
+            {
+                ptrdiff_t i = next - sc.buffers;
+                atomic_set_plane(&req, &primary->props, crtc_id, next->fb_id, 0, 0, rs.full_w, rs.full_h,
+                                 0, 0, rendered_w[i] << 16, rendered_h[i] << 16);
+                ret = atomic_commit(drm_fd, &req, commit_flags, &loop);
+                if (ret)
+                {
+                    fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+                    swapchain_cancel(&sc, next);
+                    break;
+                }
+                swapchain_submit(&sc, next);
+                frame_loop_begin_flip(&loop);
+                commit_flags = ATOMIC_FLIP_FLAGS;
+            }
+        }
+
+        // keep rendering while a buffer is free, otherwise sleep until the next flip
+        int timeout = swapchain_can_acquire(&sc) ? 0 : -1;
+        if (frame_loop_dispatch(&loop, timeout) < 0)
+            break;
+    }
+
+    frame_loop_wait_idle(&loop);
+    frame_histogram_print(&loop.hist, stdout);
+    render_scale_print(&rs, stdout);
+    trace_finish();
+
+    swapchain_destroy(&sc);
+    plane_table_free(&planes);
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
+    drmModeFreeCrtc(crtc);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    kms_close(drm_fd);
+
+    return EXIT_SUCCESS;
+}
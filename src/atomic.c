@@ -0,0 +1,316 @@
+#include "atomic.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+// enable the client caps the atomic path depends on
+int atomic_init(int drm_fd)
+{
+    if (kms_set_client_cap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1))
+    {
+        perror("DRM_CLIENT_CAP_UNIVERSAL_PLANES not supported");
+        return -errno;
+    }
+
+    if (kms_set_client_cap(drm_fd, DRM_CLIENT_CAP_ATOMIC, 1))
+    {
+        perror("DRM_CLIENT_CAP_ATOMIC not supported");
+        return -errno;
+    }
+
+    return 0;
+}
+
+// look up a property ID by name, returns 0 when the object does not have it
+uint32_t get_property_id(int drm_fd, uint32_t object_id, uint32_t object_type, const char *name)
+{
+    drmModeObjectProperties *props = kms_get_object_properties(drm_fd, object_id, object_type);
+    if (!props)
+        return 0;
+
+    uint32_t id = 0;
+    for (uint32_t i = 0; i < props->count_props && !id; i++)
+    {
+        drmModePropertyRes *prop = kms_get_property(drm_fd, props->props[i]);
+        if (!prop)
+            continue;
+
+        if (strcmp(prop->name, name) == 0)
+            id = prop->prop_id;
+
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+// walk the object's properties once and fill in every ID we know about,
+// names past the first `required` ones may be missing
+static int cache_props(int drm_fd, uint32_t object_id, uint32_t object_type,
+                       const char *const *names, uint32_t *const *ids, int count, int required)
+{
+    drmModeObjectProperties *props = kms_get_object_properties(drm_fd, object_id, object_type);
+    if (!props)
+        return -errno;
+
+    for (uint32_t i = 0; i < props->count_props; i++)
+    {
+        drmModePropertyRes *prop = kms_get_property(drm_fd, props->props[i]);
+        if (!prop)
+            continue;
+
+        for (int j = 0; j < count; j++)
+        {
+            if (strcmp(prop->name, names[j]) == 0)
+                *ids[j] = prop->prop_id;
+        }
+
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+
+    for (int j = 0; j < required; j++)
+    {
+        if (!*ids[j])
+        {
+            fprintf(stderr, "Object %u is missing property %s\n", object_id, names[j]);
+            return -ENOENT;
+        }
+    }
+
+    return 0;
+}
+
+int atomic_get_plane_props(int drm_fd, uint32_t plane_id, struct plane_props *props)
+{
+    static const char *const names[] = {
+        "FB_ID", "CRTC_ID",
+        "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+        "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+        "FB_DAMAGE_CLIPS", "alpha",
+    };
+    uint32_t *const ids[] = {
+        &props->fb_id, &props->crtc_id,
+        &props->crtc_x, &props->crtc_y, &props->crtc_w, &props->crtc_h,
+        &props->src_x, &props->src_y, &props->src_w, &props->src_h,
+        &props->fb_damage_clips, &props->alpha,
+    };
+
+    memset(props, 0, sizeof(*props));
+    props->plane_id = plane_id;
+    return cache_props(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE, names, ids, 12, 10);
+}
+
+int atomic_get_crtc_props(int drm_fd, uint32_t crtc_id, struct crtc_props *props)
+{
+    static const char *const names[] = {"MODE_ID", "ACTIVE", "VRR_ENABLED"};
+    uint32_t *const ids[] = {&props->mode_id, &props->active, &props->vrr_enabled};
+
+    memset(props, 0, sizeof(*props));
+    props->crtc_id = crtc_id;
+    return cache_props(drm_fd, crtc_id, DRM_MODE_OBJECT_CRTC, names, ids, 3, 2);
+}
+
+int atomic_get_connector_props(int drm_fd, uint32_t connector_id, struct connector_props *props)
+{
+    static const char *const names[] = {"CRTC_ID", "vrr_capable"};
+    uint32_t *const ids[] = {&props->crtc_id, &props->vrr_capable};
+
+    memset(props, 0, sizeof(*props));
+    props->connector_id = connector_id;
+    return cache_props(drm_fd, connector_id, DRM_MODE_OBJECT_CONNECTOR, names, ids, 2, 1);
+}
+
+int atomic_get_writeback_props(int drm_fd, uint32_t connector_id, struct writeback_props *props)
+{
+    static const char *const names[] = {"CRTC_ID", "WRITEBACK_FB_ID", "WRITEBACK_OUT_FENCE_PTR", "WRITEBACK_PIXEL_FORMATS"};
+    uint32_t *const ids[] = {&props->crtc_id, &props->fb_id, &props->out_fence_ptr, &props->pixel_formats};
+
+    memset(props, 0, sizeof(*props));
+    props->connector_id = connector_id;
+    return cache_props(drm_fd, connector_id, DRM_MODE_OBJECT_CONNECTOR, names, ids, 4, 4);
+}
+
+void atomic_req_init(struct atomic_req *req)
+{
+    req->count = 0;
+    req->blob_count = 0;
+}
+
+// drop everything queued so far, including blobs created for this request
+void atomic_req_reset(int drm_fd, struct atomic_req *req)
+{
+    for (int i = 0; i < req->blob_count; i++)
+        kms_destroy_property_blob(drm_fd, req->blobs[i]);
+    atomic_req_init(req);
+}
+
+// queue a property write, replacing any earlier write of the same property
+int atomic_req_add(struct atomic_req *req, uint32_t object_id, uint32_t property_id, uint64_t value)
+{
+    for (int i = 0; i < req->count; i++)
+    {
+        if (req->props[i].object_id == object_id && req->props[i].property_id == property_id)
+        {
+            req->props[i].value = value;
+            return 0;
+        }
+    }
+
+    if (req->count == ATOMIC_MAX_PROPS)
+        return -ENOSPC;
+
+    req->props[req->count].object_id = object_id;
+    req->props[req->count].property_id = property_id;
+    req->props[req->count].value = value;
+    req->count++;
+    return 0;
+}
+
+// atomic equivalent of drmModeSetPlane, src_* are 16.16 fixed point
+int atomic_set_plane(struct atomic_req *req, const struct plane_props *props, uint32_t crtc_id, uint32_t fb_id,
+                     int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                     uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h)
+{
+    uint32_t id = props->plane_id;
+    int ret = 0;
+
+    ret |= atomic_req_add(req, id, props->crtc_id, crtc_id);
+    ret |= atomic_req_add(req, id, props->fb_id, fb_id);
+    ret |= atomic_req_add(req, id, props->crtc_x, (uint64_t)(int64_t)crtc_x);
+    ret |= atomic_req_add(req, id, props->crtc_y, (uint64_t)(int64_t)crtc_y);
+    ret |= atomic_req_add(req, id, props->crtc_w, crtc_w);
+    ret |= atomic_req_add(req, id, props->crtc_h, crtc_h);
+    ret |= atomic_req_add(req, id, props->src_x, src_x);
+    ret |= atomic_req_add(req, id, props->src_y, src_y);
+    ret |= atomic_req_add(req, id, props->src_w, src_w);
+    ret |= atomic_req_add(req, id, props->src_h, src_h);
+
+    return ret ? -ENOSPC : 0;
+}
+
+// only touch the position, everything else keeps its committed value
+int atomic_move_plane(struct atomic_req *req, const struct plane_props *props, int32_t crtc_x, int32_t crtc_y)
+{
+    int ret = 0;
+
+    ret |= atomic_req_add(req, props->plane_id, props->crtc_x, (uint64_t)(int64_t)crtc_x);
+    ret |= atomic_req_add(req, props->plane_id, props->crtc_y, (uint64_t)(int64_t)crtc_y);
+
+    return ret ? -ENOSPC : 0;
+}
+
+int atomic_disable_plane(struct atomic_req *req, const struct plane_props *props)
+{
+    int ret = 0;
+
+    ret |= atomic_req_add(req, props->plane_id, props->crtc_id, 0);
+    ret |= atomic_req_add(req, props->plane_id, props->fb_id, 0);
+
+    return ret ? -ENOSPC : 0;
+}
+
+// attach the plane's damage rects (FB coordinates) to the request.
+// a plane without FB_DAMAGE_CLIPS just gets a full update, which is always correct.
+int atomic_set_damage(int drm_fd, struct atomic_req *req, const struct plane_props *props, const struct damage *damage)
+{
+    if (!props->fb_damage_clips || damage->count == 0)
+        return 0;
+
+    if (req->blob_count == ATOMIC_MAX_BLOBS)
+        return -ENOSPC;
+
+    uint32_t blob_id;
+    int ret = kms_create_property_blob(drm_fd, damage->rects, sizeof(damage->rects[0]) * damage->count, &blob_id);
+    if (ret)
+        return ret;
+
+    req->blobs[req->blob_count++] = blob_id;
+    return atomic_req_add(req, props->plane_id, props->fb_damage_clips, blob_id);
+}
+
+// queue a full modeset, the commit needs DRM_MODE_ATOMIC_ALLOW_MODESET
+int atomic_set_mode(int drm_fd, struct atomic_req *req, const struct crtc_props *crtc, const struct connector_props *connector,
+                    const drmModeModeInfo *mode, uint32_t *mode_blob_id)
+{
+    int ret = kms_create_property_blob(drm_fd, mode, sizeof(*mode), mode_blob_id);
+    if (ret)
+    {
+        fprintf(stderr, "Cannot create mode blob: %s\n", strerror(-ret));
+        return ret;
+    }
+
+    ret |= atomic_req_add(req, crtc->crtc_id, crtc->mode_id, *mode_blob_id);
+    ret |= atomic_req_add(req, crtc->crtc_id, crtc->active, 1);
+    ret |= atomic_req_add(req, connector->connector_id, connector->crtc_id, crtc->crtc_id);
+
+    return ret ? -ENOSPC : 0;
+}
+
+// whether the sink on connector can do variable refresh right now, props as
+// cached by atomic_get_connector_props
+int atomic_vrr_capable(const drmModeConnector *connector, const struct connector_props *props)
+{
+    if (!props->vrr_capable)
+        return 0;
+
+    for (int i = 0; i < connector->count_props; i++)
+    {
+        if (connector->props[i] == props->vrr_capable)
+            return connector->prop_values[i] != 0;
+    }
+    return 0;
+}
+
+// turn variable refresh on or off, -ENOTSUP if the CRTC cannot do it at all
+int atomic_set_vrr(struct atomic_req *req, const struct crtc_props *crtc, int enable)
+{
+    if (!crtc->vrr_enabled)
+        return enable ? -ENOTSUP : 0;
+    return atomic_req_add(req, crtc->crtc_id, crtc->vrr_enabled, enable ? 1 : 0);
+}
+
+// capture the next frame of crtc_id into fb_id. the kernel stores a fence fd
+// in *out_fence during the commit, readable once the capture is complete.
+// moving the connector to another CRTC is a modeset
+int atomic_set_writeback(struct atomic_req *req, const struct writeback_props *props, uint32_t crtc_id, uint32_t fb_id,
+                         int32_t *out_fence)
+{
+    uint32_t id = props->connector_id;
+    int ret = 0;
+
+    ret |= atomic_req_add(req, id, props->crtc_id, crtc_id);
+    ret |= atomic_req_add(req, id, props->fb_id, fb_id);
+    ret |= atomic_req_add(req, id, props->out_fence_ptr, (uint64_t)(uintptr_t)out_fence);
+
+    return ret ? -ENOSPC : 0;
+}
+
+static int submit(int drm_fd, struct atomic_req *req, uint32_t flags, void *user_data)
+{
+    return kms_atomic_commit(drm_fd, req->props, req->count, flags, user_data);
+}
+
+// ask the driver whether the request would be accepted without applying it
+int atomic_test(int drm_fd, struct atomic_req *req, uint32_t flags)
+{
+    flags &= ~(DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
+    return submit(drm_fd, req, flags | DRM_MODE_ATOMIC_TEST_ONLY, NULL);
+}
+
+// push the whole batch in one ioctl. the request is consumed either way, so
+// the caller starts the next frame from an empty request.
+// returns -EBUSY while a previous nonblocking commit is still in flight.
+int atomic_commit(int drm_fd, struct atomic_req *req, uint32_t flags, void *user_data)
+{
+    uint64_t start = trace_begin();
+    int ret = submit(drm_fd, req, flags, user_data);
+    trace_end("commit", start, (uint32_t)req->count);
+    atomic_req_reset(drm_fd, req);
+
+    return ret;
+}
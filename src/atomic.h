@@ -0,0 +1,100 @@
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "damage.h"
+#include "kms.h"
+
+// Property IDs are looked up once per object and cached here, so building a
+// frame never has to walk drmModeObjectGetProperties again.
+struct plane_props
+{
+    uint32_t plane_id;
+    uint32_t fb_id;
+    uint32_t crtc_id;
+    uint32_t crtc_x;
+    uint32_t crtc_y;
+    uint32_t crtc_w;
+    uint32_t crtc_h;
+    uint32_t src_x;
+    uint32_t src_y;
+    uint32_t src_w;
+    uint32_t src_h;
+    uint32_t fb_damage_clips; // optional, 0 when the driver has no damage support
+    uint32_t alpha;           // optional, 0 when the plane is always opaque
+};
+
+struct crtc_props
+{
+    uint32_t crtc_id;
+    uint32_t mode_id;
+    uint32_t active;
+    uint32_t vrr_enabled; // optional, 0 when the CRTC cannot do variable refresh
+};
+
+struct connector_props
+{
+    uint32_t connector_id;
+    uint32_t crtc_id;
+    uint32_t vrr_capable; // optional
+};
+
+// a writeback connector, see writeback.h
+struct writeback_props
+{
+    uint32_t connector_id;
+    uint32_t crtc_id;
+    uint32_t fb_id;
+    uint32_t out_fence_ptr;
+    uint32_t pixel_formats;
+};
+
+#define ATOMIC_MAX_PROPS 128
+#define ATOMIC_MAX_BLOBS 8
+
+// A batch of property writes that goes to the kernel as a single atomic
+// commit, however many planes it touches. Writes to the same (object,
+// property) pair are collapsed so only the latest value reaches the kernel.
+// Blobs created only for this request are destroyed once it has been committed.
+struct atomic_req
+{
+    int count;
+    struct kms_prop props[ATOMIC_MAX_PROPS];
+    int blob_count;
+    uint32_t blobs[ATOMIC_MAX_BLOBS];
+};
+
+#define ATOMIC_FLIP_FLAGS (DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT)
+
+int atomic_init(int drm_fd);
+
+uint32_t get_property_id(int drm_fd, uint32_t object_id, uint32_t object_type, const char *name);
+int atomic_get_plane_props(int drm_fd, uint32_t plane_id, struct plane_props *props);
+int atomic_get_crtc_props(int drm_fd, uint32_t crtc_id, struct crtc_props *props);
+int atomic_get_connector_props(int drm_fd, uint32_t connector_id, struct connector_props *props);
+int atomic_get_writeback_props(int drm_fd, uint32_t connector_id, struct writeback_props *props);
+
+void atomic_req_init(struct atomic_req *req);
+void atomic_req_reset(int drm_fd, struct atomic_req *req);
+int atomic_req_add(struct atomic_req *req, uint32_t object_id, uint32_t property_id, uint64_t value);
+
+int atomic_set_plane(struct atomic_req *req, const struct plane_props *props, uint32_t crtc_id, uint32_t fb_id,
+                     int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                     uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h);
+int atomic_move_plane(struct atomic_req *req, const struct plane_props *props, int32_t crtc_x, int32_t crtc_y);
+int atomic_disable_plane(struct atomic_req *req, const struct plane_props *props);
+int atomic_set_damage(int drm_fd, struct atomic_req *req, const struct plane_props *props, const struct damage *damage);
+int atomic_set_mode(int drm_fd, struct atomic_req *req, const struct crtc_props *crtc, const struct connector_props *connector,
+                    const drmModeModeInfo *mode, uint32_t *mode_blob_id);
+int atomic_vrr_capable(const drmModeConnector *connector, const struct connector_props *props);
+int atomic_set_vrr(struct atomic_req *req, const struct crtc_props *crtc, int enable);
+int atomic_set_writeback(struct atomic_req *req, const struct writeback_props *props, uint32_t crtc_id, uint32_t fb_id,
+                         int32_t *out_fence);
+
+int atomic_test(int drm_fd, struct atomic_req *req, uint32_t flags);
+int atomic_commit(int drm_fd, struct atomic_req *req, uint32_t flags, void *user_data);
+
+#endif
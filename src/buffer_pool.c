@@ -0,0 +1,153 @@
+#include "buffer_pool.h"
+#include "dumb_buffer.h"
+#include "format.h"
+
+#include <errno.h>
+#include <string.h>
+
+void buffer_pool_init(struct buffer_pool *pool, int drm_fd, uint64_t max_bytes)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->drm_fd = drm_fd;
+    pool->max_bytes = max_bytes;
+}
+
+// slots are never moved, callers hold pointers to the ones in use
+static void release(struct buffer_pool *pool, struct pool_buffer *buf)
+{
+    destroy_dumb_buffer(pool->drm_fd, &buf->create_dumb, buf->map, buf->fb_id);
+    pool->resident_bytes -= buf->create_dumb.size;
+    pool->count--;
+    memset(buf, 0, sizeof(*buf));
+}
+
+// everything goes, including buffers still handed out
+void buffer_pool_destroy(struct buffer_pool *pool)
+{
+    for (int i = 0; i < BUFFER_POOL_MAX; i++)
+    {
+        if (pool->buffers[i].map)
+            release(pool, &pool->buffers[i]);
+    }
+}
+
+static struct pool_buffer *least_recently_used(struct buffer_pool *pool)
+{
+    struct pool_buffer *oldest = NULL;
+    for (int i = 0; i < BUFFER_POOL_MAX; i++)
+    {
+        struct pool_buffer *buf = &pool->buffers[i];
+        if (buf->map && !buf->in_use && (!oldest || buf->last_use < oldest->last_use))
+            oldest = buf;
+    }
+    return oldest;
+}
+
+// destroy free buffers, oldest first, until at most target_bytes are resident
+void buffer_pool_trim(struct buffer_pool *pool, uint64_t target_bytes)
+{
+    while (pool->resident_bytes > target_bytes)
+    {
+        struct pool_buffer *oldest = least_recently_used(pool);
+        if (!oldest)
+            break;
+        release(pool, oldest);
+        pool->evictions++;
+    }
+}
+
+// hand out a buffer of at least width x height, reused when one of the same
+// size class and format is free. returns 0 or -errno.
+int buffer_pool_get(struct buffer_pool *pool, uint32_t width, uint32_t height, uint32_t format, struct pool_buffer **out)
+{
+    uint32_t class_w = (width + POOL_SIZE_ALIGN - 1) / POOL_SIZE_ALIGN * POOL_SIZE_ALIGN;
+    uint32_t class_h = (height + POOL_SIZE_ALIGN - 1) / POOL_SIZE_ALIGN * POOL_SIZE_ALIGN;
+    const struct format_info *info = format_info_get(format);
+    struct pool_buffer *slot = NULL;
+
+    if (!width || !height || !info)
+        return -EINVAL;
+
+    pool->clock++;
+    for (int i = 0; i < BUFFER_POOL_MAX; i++)
+    {
+        struct pool_buffer *buf = &pool->buffers[i];
+        if (!buf->map)
+        {
+            if (!slot)
+                slot = buf;
+            continue;
+        }
+
+        if (!buf->in_use && buf->create_dumb.width == class_w && buf->create_dumb.height == class_h &&
+            buf->format == format)
+        {
+            buf->in_use = 1;
+            buf->last_use = pool->clock;
+            pool->hits++;
+            *out = buf;
+            return 0;
+        }
+    }
+
+    pool->misses++;
+
+    // make room under the cap before allocating, the driver's pitch is not
+    // known yet so this estimates it from the size class
+    uint64_t estimate = (uint64_t)class_w * format_buffer_rows(info, class_h) * info->cpp[0];
+    if (pool->max_bytes)
+    {
+        if (estimate > pool->max_bytes)
+            return -ENOMEM;
+        buffer_pool_trim(pool, pool->max_bytes - estimate);
+        if (pool->resident_bytes + estimate > pool->max_bytes)
+            return -ENOMEM;
+    }
+
+    if (!slot)
+    {
+        // every slot taken: reuse the least recently used free one
+        slot = least_recently_used(pool);
+        if (!slot)
+            return -ENOSPC;
+        release(pool, slot);
+        pool->evictions++;
+    }
+
+    slot->create_dumb.width = class_w;
+    slot->create_dumb.height = class_h;
+    int ret = create_dumb_buffer_format(pool->drm_fd, format, &slot->create_dumb, &slot->map, &slot->fb_id);
+    if (ret)
+    {
+        memset(slot, 0, sizeof(*slot));
+        return ret;
+    }
+
+    slot->format = format;
+    slot->in_use = 1;
+    slot->last_use = pool->clock;
+    pool->resident_bytes += slot->create_dumb.size;
+    pool->count++;
+    *out = slot;
+    return 0;
+}
+
+// the buffer stays mapped with its framebuffer for the next request of its
+// class. it must not be on screen any more.
+void buffer_pool_put(struct buffer_pool *pool, struct pool_buffer *buf)
+{
+    buf->in_use = 0;
+    buf->last_use = ++pool->clock;
+
+    if (pool->max_bytes && pool->resident_bytes > pool->max_bytes)
+        buffer_pool_trim(pool, pool->max_bytes);
+}
+
+void buffer_pool_print_stats(const struct buffer_pool *pool, FILE *out)
+{
+    fprintf(out, "Buffer pool: %d buffers, %.1f MiB resident", pool->count, pool->resident_bytes / 1048576.0);
+    if (pool->max_bytes)
+        fprintf(out, " of %.1f MiB", pool->max_bytes / 1048576.0);
+    fprintf(out, ", %llu hits, %llu misses, %llu evictions\n", (unsigned long long)pool->hits,
+            (unsigned long long)pool->misses, (unsigned long long)pool->evictions);
+}
@@ -0,0 +1,56 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// Recycles dumb buffers together with their mapping and framebuffer, so a
+// layer that changes size or comes and goes does not pay CREATE_DUMB +
+// MAP_DUMB + mmap + ADDFB on the frame path.
+//
+// Requests are rounded up to a size class of POOL_SIZE_ALIGN pixels in each
+// direction and only a free buffer of the same class and format is reused. The
+// framebuffer covers the whole class, scan out the requested size with the
+// plane's SRC rectangle.
+//
+// Buffers returned with buffer_pool_put stay allocated until the pool is
+// over its memory cap, then the least recently used free ones are destroyed
+// first. Buffers in use are never evicted, a request that cannot fit under
+// the cap fails with -ENOMEM.
+#define BUFFER_POOL_MAX 64
+#define POOL_SIZE_ALIGN 64
+
+struct pool_buffer
+{
+    struct drm_mode_create_dumb create_dumb; // width/height are the size class
+    uint32_t format;
+    void *map;
+    uint32_t fb_id;
+    int in_use;
+    uint64_t last_use;
+};
+
+struct buffer_pool
+{
+    int drm_fd;
+    uint64_t max_bytes; // 0 means no cap
+    uint64_t resident_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t clock;
+    int count;
+    struct pool_buffer buffers[BUFFER_POOL_MAX];
+};
+
+void buffer_pool_init(struct buffer_pool *pool, int drm_fd, uint64_t max_bytes);
+void buffer_pool_destroy(struct buffer_pool *pool);
+
+int buffer_pool_get(struct buffer_pool *pool, uint32_t width, uint32_t height, uint32_t format, struct pool_buffer **out);
+void buffer_pool_put(struct buffer_pool *pool, struct pool_buffer *buf);
+void buffer_pool_trim(struct buffer_pool *pool, uint64_t target_bytes);
+void buffer_pool_print_stats(const struct buffer_pool *pool, FILE *out);
+
+#endif
@@ -0,0 +1,270 @@
+#include "compositor.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+#include "pixel.h"
+#include "tiling.h"
+#include "trace.h"
+
+struct render_job
+{
+    struct compositor *comp;
+    const struct pixel_kernels *kernels;
+    const struct format_kernels *format_kernels;
+    const struct comp_layer *layers;
+    int layer_count;
+    uint8_t *dst;
+    uint32_t dst_pitch;
+    const struct tiling_info *tiling;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t *tiles; // indices of the tiles to render
+};
+
+struct rect
+{
+    int32_t x1, y1, x2, y2;
+};
+
+static int clip(const struct comp_layer *layer, const struct rect *tile, struct rect *out)
+{
+    out->x1 = layer->x > tile->x1 ? layer->x : tile->x1;
+    out->y1 = layer->y > tile->y1 ? layer->y : tile->y1;
+    out->x2 = layer->x + (int32_t)layer->w < tile->x2 ? layer->x + (int32_t)layer->w : tile->x2;
+    out->y2 = layer->y + (int32_t)layer->h < tile->y2 ? layer->y + (int32_t)layer->h : tile->y2;
+    return out->x1 < out->x2 && out->y1 < out->y2;
+}
+
+static int is_opaque(const struct comp_layer *layer)
+{
+    if (layer->type == COMP_LAYER_IMAGE || layer->type == COMP_LAYER_NV12)
+        return 1;
+    return layer->type == COMP_LAYER_SOLID && (layer->color >> 24) == 0xFF;
+}
+
+static int covers(const struct comp_layer *layer, const struct rect *tile)
+{
+    return layer->x <= tile->x1 && layer->y <= tile->y1 &&
+           layer->x + (int32_t)layer->w >= tile->x2 && layer->y + (int32_t)layer->h >= tile->y2;
+}
+
+// composite every visible layer into the worker's scratch tile, then stream
+// the finished tile out to the destination
+static void render_tile(void *ctx, int worker, uint32_t index)
+{
+    struct render_job *job = ctx;
+    struct compositor *comp = job->comp;
+    uint32_t tile_index = job->tiles[index];
+
+    struct rect tile;
+    tile.x1 = (int32_t)((tile_index % job->tiles_x) * comp->tile_w);
+    tile.y1 = (int32_t)((tile_index / job->tiles_x) * comp->tile_h);
+    tile.x2 = tile.x1 + (int32_t)comp->tile_w;
+    tile.y2 = tile.y1 + (int32_t)comp->tile_h;
+    if (tile.x2 > (int32_t)job->width)
+        tile.x2 = (int32_t)job->width;
+    if (tile.y2 > (int32_t)job->height)
+        tile.y2 = (int32_t)job->height;
+
+    uint32_t *scratch = comp->scratch + (size_t)worker * comp->tile_w * comp->tile_h;
+    uint32_t *solid_row = comp->solid_row + (size_t)worker * comp->tile_w;
+    uint32_t scratch_pitch = comp->tile_w * 4;
+    uint32_t tw = (uint32_t)(tile.x2 - tile.x1);
+    uint32_t th = (uint32_t)(tile.y2 - tile.y1);
+
+    // everything below the topmost opaque layer covering the whole tile is hidden
+    int first = 0;
+    for (int i = job->layer_count - 1; i >= 0; i--)
+    {
+        if (is_opaque(&job->layers[i]) && covers(&job->layers[i], &tile))
+        {
+            first = i;
+            break;
+        }
+    }
+    if (!(is_opaque(&job->layers[first]) && covers(&job->layers[first], &tile)))
+    {
+        for (uint32_t row = 0; row < th; row++)
+            memset(scratch + (size_t)row * comp->tile_w, 0, tw * 4);
+    }
+
+    for (int i = first; i < job->layer_count; i++)
+    {
+        const struct comp_layer *layer = &job->layers[i];
+        struct rect r;
+        if (!clip(layer, &tile, &r))
+            continue;
+
+        uint32_t w = (uint32_t)(r.x2 - r.x1);
+        uint32_t h = (uint32_t)(r.y2 - r.y1);
+        uint32_t *out = scratch + (size_t)(r.y1 - tile.y1) * comp->tile_w + (r.x1 - tile.x1);
+
+        switch (layer->type)
+        {
+        case COMP_LAYER_SOLID:
+            if ((layer->color >> 24) == 0xFF)
+            {
+                for (uint32_t row = 0; row < h; row++)
+                {
+                    uint32_t *p = out + (size_t)row * comp->tile_w;
+                    for (uint32_t col = 0; col < w; col++)
+                        p[col] = layer->color;
+                }
+            }
+            else if (layer->color >> 24)
+            {
+                for (uint32_t col = 0; col < w; col++)
+                    solid_row[col] = layer->color;
+                // a zero source pitch reuses the one row for every line
+                job->kernels->blend(out, scratch_pitch, solid_row, 0, w, h);
+            }
+            break;
+        case COMP_LAYER_IMAGE:
+        case COMP_LAYER_BLEND:
+        {
+            const uint8_t *src = (const uint8_t *)layer->pixels +
+                                 (size_t)(r.y1 - layer->y) * layer->pitch + (size_t)(r.x1 - layer->x) * 4;
+            if (layer->type == COMP_LAYER_BLEND)
+            {
+                job->kernels->blend(out, scratch_pitch, src, layer->pitch, w, h);
+                break;
+            }
+            for (uint32_t row = 0; row < h; row++)
+                memcpy(out + (size_t)row * comp->tile_w, src + (size_t)row * layer->pitch, (size_t)w * 4);
+            break;
+        }
+        case COMP_LAYER_NV12:
+            // only the part inside this tile is converted, straight into the scratch tile
+            job->format_kernels->nv12_to_argb(out, scratch_pitch, layer->pixels, layer->pitch, layer->chroma,
+                                              layer->chroma_pitch, (uint32_t)(r.x1 - layer->x),
+                                              (uint32_t)(r.y1 - layer->y), w, h);
+            break;
+        }
+    }
+
+    // a tiled destination takes the tile in whole 4 KiB blocks when the tile
+    // sizes line up, the default 128x64 tile is 8 X-tiles or 4 Y-tiles
+    if (job->tiling->tile_width)
+    {
+        tiling_swizzle(job->tiling, job->dst, job->dst_pitch, (uint32_t)tile.x1, (uint32_t)tile.y1, scratch,
+                       scratch_pitch, tw, th);
+        return;
+    }
+    uint8_t *dst = job->dst + (size_t)tile.y1 * job->dst_pitch + (size_t)tile.x1 * 4;
+    job->kernels->blit(dst, job->dst_pitch, scratch, scratch_pitch, tw, th);
+}
+
+// threads <= 0 uses one worker per CPU, tile sizes of 0 pick the defaults
+int compositor_init(struct compositor *comp, int threads, uint32_t tile_w, uint32_t tile_h)
+{
+    memset(comp, 0, sizeof(*comp));
+    comp->tile_w = tile_w ? tile_w : COMP_TILE_W;
+    comp->tile_h = tile_h ? tile_h : COMP_TILE_H;
+
+    comp->pool = thread_pool_create(threads);
+    if (!comp->pool)
+    {
+        fprintf(stderr, "Failed to create compositor thread pool\n");
+        return -1;
+    }
+
+    size_t workers = (size_t)thread_pool_size(comp->pool);
+    size_t tile_bytes = (size_t)comp->tile_w * comp->tile_h * 4;
+    size_t row_bytes = ((size_t)comp->tile_w * 4 + 63) & ~(size_t)63;
+    comp->scratch = aligned_alloc(64, workers * ((tile_bytes + 63) & ~(size_t)63));
+    comp->solid_row = aligned_alloc(64, workers * row_bytes);
+    if (!comp->scratch || !comp->solid_row)
+    {
+        perror("Failed to allocate compositor tiles");
+        compositor_destroy(comp);
+        return -1;
+    }
+
+    return 0;
+}
+
+void compositor_destroy(struct compositor *comp)
+{
+    thread_pool_destroy(comp->pool);
+    free(comp->scratch);
+    free(comp->solid_row);
+    memset(comp, 0, sizeof(*comp));
+}
+
+// render the layers into dst (32bpp, usually a dumb buffer map); only tiles
+// touching the damage are redrawn, NULL damage redraws the whole output
+void compositor_render(struct compositor *comp, const struct comp_layer *layers, int layer_count,
+                       void *dst, uint32_t dst_pitch, uint32_t width, uint32_t height, const struct damage *damage)
+{
+    compositor_render_tiled(comp, layers, layer_count, dst, dst_pitch, DRM_FORMAT_MOD_LINEAR, width, height, damage);
+}
+
+// same into a dst laid out as dst_modifier (tiling.h), -EINVAL for a layout
+// the CPU cannot write
+int compositor_render_tiled(struct compositor *comp, const struct comp_layer *layers, int layer_count, void *dst,
+                            uint32_t dst_pitch, uint64_t dst_modifier, uint32_t width, uint32_t height,
+                            const struct damage *damage)
+{
+    const struct tiling_info *tiling = tiling_info_get(dst_modifier);
+    if (!tiling || (tiling->tile_width && dst_pitch % tiling->tile_width))
+        return -EINVAL;
+    if (layer_count <= 0 || !width || !height)
+        return 0;
+
+    uint64_t start = trace_begin();
+    uint32_t tiles_x = (width + comp->tile_w - 1) / comp->tile_w;
+    uint32_t tiles_y = (height + comp->tile_h - 1) / comp->tile_h;
+    uint32_t *tiles = malloc((size_t)tiles_x * tiles_y * sizeof(*tiles));
+    if (!tiles)
+    {
+        perror("Failed to allocate tile list");
+        return -ENOMEM;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t ty = 0; ty < tiles_y; ty++)
+    {
+        for (uint32_t tx = 0; tx < tiles_x; tx++)
+        {
+            int32_t x1 = (int32_t)(tx * comp->tile_w);
+            int32_t y1 = (int32_t)(ty * comp->tile_h);
+            int32_t x2 = x1 + (int32_t)comp->tile_w;
+            int32_t y2 = y1 + (int32_t)comp->tile_h;
+            int hit = !damage;
+
+            for (int i = 0; damage && i < damage->count && !hit; i++)
+            {
+                const struct drm_mode_rect *r = &damage->rects[i];
+                hit = r->x1 < x2 && r->x2 > x1 && r->y1 < y2 && r->y2 > y1;
+            }
+            if (hit)
+                tiles[count++] = ty * tiles_x + tx;
+        }
+    }
+
+    struct render_job job = {
+        .comp = comp,
+        .kernels = pixel_kernels_get(),
+        .format_kernels = format_kernels_get(),
+        .layers = layers,
+        .layer_count = layer_count,
+        .dst = dst,
+        .dst_pitch = dst_pitch,
+        .tiling = tiling,
+        .width = width,
+        .height = height,
+        .tiles_x = tiles_x,
+        .tiles = tiles,
+    };
+    thread_pool_run(comp->pool, count, render_tile, &job);
+
+    free(tiles);
+    trace_end("composite", start, count);
+    return 0;
+}
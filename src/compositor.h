@@ -0,0 +1,54 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdint.h>
+
+#include "damage.h"
+#include "thread_pool.h"
+
+// Default tile: 128x64 ARGB8888 is 32 KiB, it stays in L2 while every layer
+// is composited into it.
+#define COMP_TILE_W 128
+#define COMP_TILE_H 64
+
+enum comp_layer_type
+{
+    COMP_LAYER_SOLID, // color, blended when its alpha is below 255
+    COMP_LAYER_IMAGE, // opaque pixels, copied
+    COMP_LAYER_BLEND, // premultiplied ARGB8888 pixels, src-over
+    COMP_LAYER_NV12,  // opaque NV12 video, converted per tile (format.h)
+};
+
+// Layers are ordered bottom (index 0) to top. Rects may hang off the output.
+struct comp_layer
+{
+    enum comp_layer_type type;
+    int32_t x;
+    int32_t y;
+    uint32_t w;
+    uint32_t h;
+    uint32_t color;     // SOLID, premultiplied
+    const void *pixels; // IMAGE / BLEND, top-left of the w x h source; NV12 luma plane
+    uint32_t pitch;
+    const void *chroma; // NV12 interleaved CbCr plane, half height
+    uint32_t chroma_pitch;
+};
+
+struct compositor
+{
+    struct thread_pool *pool;
+    uint32_t tile_w;
+    uint32_t tile_h;
+    uint32_t *scratch; // one tile per worker, cached memory
+    uint32_t *solid_row; // per worker row of a translucent solid color
+};
+
+int compositor_init(struct compositor *comp, int threads, uint32_t tile_w, uint32_t tile_h);
+void compositor_destroy(struct compositor *comp);
+void compositor_render(struct compositor *comp, const struct comp_layer *layers, int layer_count,
+                       void *dst, uint32_t dst_pitch, uint32_t width, uint32_t height, const struct damage *damage);
+int compositor_render_tiled(struct compositor *comp, const struct comp_layer *layers, int layer_count, void *dst,
+                            uint32_t dst_pitch, uint64_t dst_modifier, uint32_t width, uint32_t height,
+                            const struct damage *damage);
+
+#endif
@@ -0,0 +1,202 @@
+#include "cursor.h"
+#include "dumb_buffer.h"
+#include "kms.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CURSOR_DEFAULT_SIZE 64
+
+// first cursor plane of crtc_id that none of the layers already got
+static const struct plane_info *find_cursor_plane(const struct plane_table *planes, uint32_t crtc_id,
+                                                  const struct layer *layers, int layer_count)
+{
+    int crtc_index = plane_table_crtc_index(planes, crtc_id);
+    if (crtc_index < 0)
+        return NULL;
+
+    for (int p = 0; p < planes->count; p++)
+    {
+        const struct plane_info *plane = &planes->planes[p];
+        if (plane->type != DRM_PLANE_TYPE_CURSOR || !(plane->possible_crtcs & (1u << crtc_index)) ||
+            !plane_supports_format(plane, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR))
+            continue;
+
+        int taken = 0;
+        for (int i = 0; i < layer_count; i++)
+            taken |= layers[i].plane_id == plane->plane_id;
+        if (!taken)
+            return plane;
+    }
+    return NULL;
+}
+
+// pick the cursor plane (or the legacy ioctls) for crtc_id. planes is the
+// table plane_alloc_assign worked on, layers what it assigned, so a cursor
+// plane that went to one of them is not taken twice. the cursor starts hidden.
+int cursor_init(struct cursor *cur, int drm_fd, const struct plane_table *planes, uint32_t crtc_id,
+                const struct layer *layers, int layer_count)
+{
+    memset(cur, 0, sizeof(*cur));
+    cur->drm_fd = drm_fd;
+    cur->crtc_id = crtc_id;
+    cur->shape = -1;
+
+    uint64_t width = 0, height = 0;
+    if (kms_get_cap(drm_fd, DRM_CAP_CURSOR_WIDTH, &width) || !width)
+        width = CURSOR_DEFAULT_SIZE;
+    if (kms_get_cap(drm_fd, DRM_CAP_CURSOR_HEIGHT, &height) || !height)
+        height = CURSOR_DEFAULT_SIZE;
+    cur->width = (uint32_t)width;
+    cur->height = (uint32_t)height;
+
+    const struct plane_info *plane = planes ? find_cursor_plane(planes, crtc_id, layers, layer_count) : NULL;
+    if (plane)
+        cur->props = plane->props;
+    else
+        cur->legacy = 1;
+    return 0;
+}
+
+void cursor_destroy(struct cursor *cur)
+{
+    // a legacy cursor stays up after its buffer is gone, take it down first
+    if (cur->legacy && cur->shape >= 0)
+        kms_set_cursor2(cur->drm_fd, cur->crtc_id, 0, 0, 0, 0, 0);
+
+    for (int i = 0; i < cur->shape_count; i++)
+    {
+        struct cursor_shape *shape = &cur->shapes[i];
+        destroy_dumb_buffer(cur->drm_fd, &shape->create_dumb, shape->map, shape->fb_id);
+    }
+    cur->shape_count = 0;
+    cur->shape = -1;
+}
+
+// upload a width x height ARGB image, stride in bytes. hot_x/hot_y is the
+// pixel that points. returns the shape index or -errno.
+int cursor_add_shape(struct cursor *cur, const uint32_t *argb, uint32_t width, uint32_t height, uint32_t stride,
+                     int32_t hot_x, int32_t hot_y)
+{
+    if (cur->shape_count == CURSOR_MAX_SHAPES)
+        return -ENOSPC;
+    if (width > cur->width || height > cur->height)
+        return -E2BIG;
+
+    struct cursor_shape *shape = &cur->shapes[cur->shape_count];
+    memset(shape, 0, sizeof(*shape));
+    shape->create_dumb.width = cur->width;
+    shape->create_dumb.height = cur->height;
+
+    void *map;
+    int ret = create_dumb_buffer_format(cur->drm_fd, DRM_FORMAT_ARGB8888, &shape->create_dumb, &map, &shape->fb_id);
+    if (ret)
+        return ret;
+    shape->map = map;
+    shape->hot_x = hot_x;
+    shape->hot_y = hot_y;
+
+    // transparent all around, the image in the top left corner
+    memset(shape->map, 0, shape->create_dumb.size);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        memcpy((uint8_t *)shape->map + (size_t)y * shape->create_dumb.pitch,
+               (const uint8_t *)argb + (size_t)y * stride, (size_t)width * 4);
+    }
+
+    return cur->shape_count++;
+}
+
+// show shape, -1 hides the cursor
+int cursor_set_shape(struct cursor *cur, int shape)
+{
+    if (shape < -1 || shape >= cur->shape_count)
+        return -EINVAL;
+    if (shape == cur->shape)
+        return 0;
+
+    cur->shape = shape;
+    if (!cur->legacy)
+    {
+        cur->dirty = 1;
+        return 0;
+    }
+
+    if (shape < 0)
+        return kms_set_cursor2(cur->drm_fd, cur->crtc_id, 0, 0, 0, 0, 0);
+
+    const struct cursor_shape *s = &cur->shapes[shape];
+    int ret = kms_set_cursor2(cur->drm_fd, cur->crtc_id, s->create_dumb.handle, cur->width, cur->height,
+                              s->hot_x, s->hot_y);
+    if (ret)
+        return ret;
+    return kms_move_cursor(cur->drm_fd, cur->crtc_id, cur->x - s->hot_x, cur->y - s->hot_y);
+}
+
+// put the hotspot at x, y
+int cursor_move(struct cursor *cur, int32_t x, int32_t y)
+{
+    if (x == cur->x && y == cur->y)
+        return 0;
+
+    cur->x = x;
+    cur->y = y;
+    if (!cur->legacy)
+    {
+        cur->dirty = 1;
+        return 0;
+    }
+    if (cur->shape < 0)
+        return 0;
+
+    const struct cursor_shape *s = &cur->shapes[cur->shape];
+    return kms_move_cursor(cur->drm_fd, cur->crtc_id, x - s->hot_x, y - s->hot_y);
+}
+
+// add the cursor plane's pending state to a frame the caller is about to
+// commit. returns 1 if anything was added, 0 if nothing changed.
+int cursor_add_to_req(struct cursor *cur, struct atomic_req *req)
+{
+    if (cur->legacy || !cur->dirty)
+        return 0;
+
+    int ret;
+    if (cur->shape < 0)
+    {
+        ret = atomic_disable_plane(req, &cur->props);
+    }
+    else
+    {
+        const struct cursor_shape *s = &cur->shapes[cur->shape];
+        ret = atomic_set_plane(req, &cur->props, cur->crtc_id, s->fb_id, cur->x - s->hot_x, cur->y - s->hot_y,
+                               cur->width, cur->height, 0, 0, cur->width << 16, cur->height << 16);
+    }
+    if (ret)
+        return ret;
+
+    cur->dirty = 0;
+    return 1;
+}
+
+// commit just the cursor plane, nonblocking with a flip event for
+// user_data. returns 1 if a flip event will follow, 0 if there was nothing
+// to send, -EBUSY while an earlier commit on the CRTC is still in flight.
+int cursor_commit(struct cursor *cur, void *user_data)
+{
+    struct atomic_req req;
+    atomic_req_init(&req);
+
+    int ret = cursor_add_to_req(cur, &req);
+    if (ret <= 0)
+        return ret;
+
+    ret = atomic_commit(cur->drm_fd, &req, ATOMIC_FLIP_FLAGS, user_data);
+    if (ret)
+    {
+        cur->dirty = 1;
+        return ret;
+    }
+    return 1;
+}
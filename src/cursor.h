@@ -0,0 +1,66 @@
+#ifndef CURSOR_H
+#define CURSOR_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "atomic.h"
+#include "plane_alloc.h"
+
+// A pointer on one CRTC, shown on a cursor plane when there is a free one
+// and through the legacy SetCursor2/MoveCursor ioctls otherwise.
+//
+// Every shape is uploaded once into its own ARGB8888 dumb buffer of exactly
+// DRM_CAP_CURSOR_WIDTH x HEIGHT (64x64 almost everywhere), the one size every
+// driver takes without scaling. Smaller images sit in the top left corner on
+// a transparent background. Switching shapes is an FB_ID (or handle) swap,
+// nothing is copied.
+//
+// On the plane path cursor_move only records the position. The caller sends
+// it either on its own (cursor_commit, a commit with just the cursor plane in
+// it) or along with the next frame (cursor_add_to_req), so the pointer never
+// waits for the rest of the screen to be redrawn. Legacy ioctls take effect
+// immediately and need neither.
+#define CURSOR_MAX_SHAPES 16
+
+struct cursor_shape
+{
+    struct drm_mode_create_dumb create_dumb;
+    uint32_t *map;
+    uint32_t fb_id;
+    int32_t hot_x;
+    int32_t hot_y;
+};
+
+struct cursor
+{
+    int drm_fd;
+    uint32_t crtc_id;
+    uint32_t width;  // DRM_CAP_CURSOR_WIDTH, the size of every shape buffer
+    uint32_t height;
+
+    int legacy;      // no cursor plane, SetCursor2/MoveCursor instead
+    struct plane_props props;
+
+    struct cursor_shape shapes[CURSOR_MAX_SHAPES];
+    int shape_count;
+    int shape;       // -1 while hidden
+    int32_t x;       // hotspot position in CRTC coordinates
+    int32_t y;
+    int dirty;       // position or shape not sent to the plane yet
+};
+
+int cursor_init(struct cursor *cur, int drm_fd, const struct plane_table *planes, uint32_t crtc_id,
+                const struct layer *layers, int layer_count);
+void cursor_destroy(struct cursor *cur);
+
+int cursor_add_shape(struct cursor *cur, const uint32_t *argb, uint32_t width, uint32_t height, uint32_t stride,
+                     int32_t hot_x, int32_t hot_y);
+int cursor_set_shape(struct cursor *cur, int shape);
+int cursor_move(struct cursor *cur, int32_t x, int32_t y);
+
+int cursor_add_to_req(struct cursor *cur, struct atomic_req *req);
+int cursor_commit(struct cursor *cur, void *user_data);
+
+#endif
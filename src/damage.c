@@ -0,0 +1,194 @@
+#include "damage.h"
+#include "kms.h"
+#include "pixel.h"
+
+#include <errno.h>
+#include <string.h>
+
+// two rects are merged when their bounding box wastes at most a quarter more
+// pixels than the two rects cover on their own
+#define MERGE_SLACK_NUM 5
+#define MERGE_SLACK_DEN 4
+
+// past this fraction of the surface one full-surface rect is cheaper to handle
+#define FULL_NUM 3
+#define FULL_DEN 4
+
+static uint64_t rect_area(const struct drm_mode_rect *r)
+{
+    return (uint64_t)(r->x2 - r->x1) * (uint64_t)(r->y2 - r->y1);
+}
+
+static struct drm_mode_rect rect_union(const struct drm_mode_rect *a, const struct drm_mode_rect *b)
+{
+    struct drm_mode_rect u;
+    u.x1 = a->x1 < b->x1 ? a->x1 : b->x1;
+    u.y1 = a->y1 < b->y1 ? a->y1 : b->y1;
+    u.x2 = a->x2 > b->x2 ? a->x2 : b->x2;
+    u.y2 = a->y2 > b->y2 ? a->y2 : b->y2;
+    return u;
+}
+
+static int rect_contains(const struct drm_mode_rect *outer, const struct drm_mode_rect *inner)
+{
+    return outer->x1 <= inner->x1 && outer->y1 <= inner->y1 && outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+static void remove_rect(struct damage *d, int i)
+{
+    d->rects[i] = d->rects[--d->count];
+}
+
+void damage_init(struct damage *d, int32_t width, int32_t height)
+{
+    d->width = width;
+    d->height = height;
+    d->count = 0;
+}
+
+void damage_clear(struct damage *d)
+{
+    d->count = 0;
+}
+
+int damage_is_empty(const struct damage *d)
+{
+    return d->count == 0;
+}
+
+uint64_t damage_area(const struct damage *d)
+{
+    uint64_t area = 0;
+    for (int i = 0; i < d->count; i++)
+        area += rect_area(&d->rects[i]);
+    return area;
+}
+
+void damage_add_all(struct damage *d)
+{
+    d->count = 1;
+    d->rects[0].x1 = 0;
+    d->rects[0].y1 = 0;
+    d->rects[0].x2 = d->width;
+    d->rects[0].y2 = d->height;
+}
+
+// with the list full, fold together the pair whose union grows the least
+static void merge_cheapest_pair(struct damage *d)
+{
+    int best_i = 0, best_j = 1;
+    uint64_t best_cost = UINT64_MAX;
+
+    for (int i = 0; i < d->count; i++)
+    {
+        for (int j = i + 1; j < d->count; j++)
+        {
+            struct drm_mode_rect u = rect_union(&d->rects[i], &d->rects[j]);
+            uint64_t covered = rect_area(&d->rects[i]) + rect_area(&d->rects[j]);
+            uint64_t cost = rect_area(&u) > covered ? rect_area(&u) - covered : 0;
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_i = i;
+                best_j = j;
+            }
+        }
+    }
+
+    d->rects[best_i] = rect_union(&d->rects[best_i], &d->rects[best_j]);
+    remove_rect(d, best_j);
+}
+
+void damage_add_rect(struct damage *d, const struct drm_mode_rect *rect)
+{
+    struct drm_mode_rect r = *rect;
+
+    // clip to the surface
+    if (r.x1 < 0)
+        r.x1 = 0;
+    if (r.y1 < 0)
+        r.y1 = 0;
+    if (r.x2 > d->width)
+        r.x2 = d->width;
+    if (r.y2 > d->height)
+        r.y2 = d->height;
+    if (r.x1 >= r.x2 || r.y1 >= r.y2)
+        return;
+
+    // absorb or merge with existing rects until nothing changes
+    int merged = 1;
+    while (merged)
+    {
+        merged = 0;
+        for (int i = 0; i < d->count; i++)
+        {
+            struct drm_mode_rect *e = &d->rects[i];
+            if (rect_contains(e, &r))
+                return;
+
+            struct drm_mode_rect u = rect_union(e, &r);
+            if (rect_contains(&r, e) ||
+                rect_area(&u) * MERGE_SLACK_DEN <= (rect_area(e) + rect_area(&r)) * MERGE_SLACK_NUM)
+            {
+                r = u;
+                remove_rect(d, i);
+                merged = 1;
+                break;
+            }
+        }
+    }
+
+    if (d->count == DAMAGE_MAX_RECTS)
+        merge_cheapest_pair(d);
+    d->rects[d->count++] = r;
+
+    if (damage_area(d) * FULL_DEN >= (uint64_t)d->width * d->height * FULL_NUM)
+        damage_add_all(d);
+}
+
+void damage_add(struct damage *d, int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    struct drm_mode_rect r = {x, y, x + w, y + h};
+    damage_add_rect(d, &r);
+}
+
+void damage_union(struct damage *d, const struct damage *other)
+{
+    for (int i = 0; i < other->count; i++)
+        damage_add_rect(d, &other->rects[i]);
+}
+
+// copy only the damaged rects of a 32bpp surface
+void damage_blit(const struct damage *d, void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch)
+{
+    for (int i = 0; i < d->count; i++)
+    {
+        const struct drm_mode_rect *r = &d->rects[i];
+        pixel_blit((uint8_t *)dst + (size_t)r->y1 * dst_pitch + (size_t)r->x1 * 4, dst_pitch,
+                   (const uint8_t *)src + (size_t)r->y1 * src_pitch + (size_t)r->x1 * 4, src_pitch,
+                   r->x2 - r->x1, r->y2 - r->y1);
+    }
+}
+
+// legacy path: tell the driver which part of a front-buffer-rendered fb changed.
+// drivers that scan out directly from memory do not implement it, that is not an error.
+int damage_dirty_fb(int drm_fd, uint32_t fb_id, const struct damage *d)
+{
+    drmModeClip clips[DAMAGE_MAX_RECTS];
+
+    if (d->count == 0)
+        return 0;
+
+    for (int i = 0; i < d->count; i++)
+    {
+        clips[i].x1 = d->rects[i].x1;
+        clips[i].y1 = d->rects[i].y1;
+        clips[i].x2 = d->rects[i].x2;
+        clips[i].y2 = d->rects[i].y2;
+    }
+
+    int ret = kms_dirty_fb(drm_fd, fb_id, clips, d->count);
+    if (ret == -ENOSYS || ret == -EOPNOTSUPP)
+        return 0;
+    return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// Rects are kept as struct drm_mode_rect (x2/y2 exclusive) so the list can be
+// handed to FB_DAMAGE_CLIPS as-is.
+#define DAMAGE_MAX_RECTS 16
+
+struct damage
+{
+    int32_t width;
+    int32_t height;
+    int count;
+    struct drm_mode_rect rects[DAMAGE_MAX_RECTS];
+};
+
+void damage_init(struct damage *d, int32_t width, int32_t height);
+void damage_clear(struct damage *d);
+void damage_add(struct damage *d, int32_t x, int32_t y, int32_t w, int32_t h);
+void damage_add_rect(struct damage *d, const struct drm_mode_rect *r);
+void damage_add_all(struct damage *d);
+void damage_union(struct damage *d, const struct damage *other);
+int damage_is_empty(const struct damage *d);
+uint64_t damage_area(const struct damage *d);
+
+void damage_blit(const struct damage *d, void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch);
+int damage_dirty_fb(int drm_fd, uint32_t fb_id, const struct damage *d);
+
+#endif
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE // F_ADD_SEALS
+#include "dmabuf.h"
+#include "kms.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <linux/udmabuf.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#ifndef DMA_BUF_MAGIC
+#define DMA_BUF_MAGIC 0x444d4142 // "DMAB", linux/magic.h since 5.3
+#endif
+
+// PRIME import every plane and wrap them in one framebuffer. The GEM handles
+// are closed again right away, the framebuffer holds its own reference.
+int dmabuf_import(int drm_fd, const struct dmabuf_image *image, uint32_t *fb_id)
+{
+    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+    uint64_t modifiers[4] = {0};
+    int ret = 0;
+
+    if (image->plane_count < 1 || image->plane_count > DMABUF_MAX_PLANES)
+        return -EINVAL;
+
+    for (int i = 0; i < image->plane_count && !ret; i++)
+    {
+        ret = kms_prime_fd_to_handle(drm_fd, image->fds[i], &handles[i]);
+        pitches[i] = image->pitches[i];
+        offsets[i] = image->offsets[i];
+        modifiers[i] = image->modifier;
+    }
+
+    if (!ret)
+    {
+        uint32_t flags = image->modifier != DRM_FORMAT_MOD_INVALID ? DRM_MODE_FB_MODIFIERS : 0;
+        ret = kms_add_fb2(drm_fd, image->width, image->height, image->format, handles, pitches, offsets,
+                          flags ? modifiers : NULL, flags, fb_id);
+    }
+
+    // planes of one buffer share a handle, close each one once
+    for (int i = 0; i < image->plane_count; i++)
+    {
+        int seen = 0;
+        for (int j = 0; j < i; j++)
+            seen |= handles[j] == handles[i];
+        if (handles[i] && !seen)
+            kms_close_handle(drm_fd, handles[i]);
+    }
+
+    return ret;
+}
+
+// 1 when fd is a dma-buf. its size is fixed at export, a mapping of it
+// cannot fault the way one of a file truncated behind the reader's back can
+int dmabuf_is_dmabuf(int fd)
+{
+    struct statfs fs;
+    return fstatfs(fd, &fs) == 0 && fs.f_type == DMA_BUF_MAGIC;
+}
+
+// wrap a page aligned memfd in a dma-buf through /dev/udmabuf. the memfd must
+// have been created with MFD_ALLOW_SEALING, it gets sealed against shrinking.
+// returns the dma-buf fd or -errno.
+int udmabuf_create(int memfd, uint64_t size)
+{
+    int dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (dev < 0)
+        return -errno;
+
+    if (fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+    {
+        int err = errno;
+        close(dev);
+        return -err;
+    }
+
+    struct udmabuf_create create = {0};
+    create.memfd = memfd;
+    create.flags = UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = size;
+
+    int fd = ioctl(dev, UDMABUF_CREATE, &create);
+    int err = errno;
+    close(dev);
+    return fd < 0 ? -err : fd;
+}
+
+void fb_cache_init(struct fb_cache *cache, int drm_fd)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->drm_fd = drm_fd;
+}
+
+static void drop_entry(struct fb_cache *cache, int index)
+{
+    struct fb_cache_entry *entry = &cache->entries[index];
+    kms_rm_fb(cache->drm_fd, entry->fb_id);
+    for (int i = 0; i < entry->plane_count; i++)
+    {
+        if (entry->fds[i] >= 0)
+            close(entry->fds[i]);
+    }
+
+    cache->entries[index] = cache->entries[--cache->count];
+}
+
+void fb_cache_destroy(struct fb_cache *cache)
+{
+    while (cache->count)
+        drop_entry(cache, cache->count - 1);
+}
+
+// the same buffers in the same layout, plane by plane
+static int same_image(const struct fb_cache_entry *entry, const struct dmabuf_image *image, const struct stat *st)
+{
+    if (entry->width != image->width || entry->height != image->height || entry->format != image->format ||
+        entry->modifier != image->modifier || entry->plane_count != image->plane_count)
+        return 0;
+
+    for (int i = 0; i < image->plane_count; i++)
+    {
+        if (entry->dev[i] != st[i].st_dev || entry->ino[i] != st[i].st_ino ||
+            entry->pitches[i] != image->pitches[i] || entry->offsets[i] != image->offsets[i])
+            return 0;
+    }
+    return 1;
+}
+
+// framebuffer for image, imported on the first sight of its buffer
+int fb_cache_get(struct fb_cache *cache, const struct dmabuf_image *image, uint32_t *fb_id)
+{
+    if (image->plane_count < 1 || image->plane_count > DMABUF_MAX_PLANES)
+        return -EINVAL;
+
+    struct stat st[DMABUF_MAX_PLANES];
+    for (int i = 0; i < image->plane_count; i++)
+    {
+        if (fstat(image->fds[i], &st[i]))
+            return -errno;
+    }
+
+    cache->clock++;
+    for (int i = 0; i < cache->count; i++)
+    {
+        struct fb_cache_entry *entry = &cache->entries[i];
+        if (entry->ino[0] != st[0].st_ino || entry->dev[0] != st[0].st_dev)
+            continue;
+
+        // the same buffer reused with a different layout, or with other
+        // buffers for its other planes, needs a new framebuffer
+        if (!same_image(entry, image, st))
+        {
+            drop_entry(cache, i);
+            break;
+        }
+
+        entry->last_use = cache->clock;
+        cache->hits++;
+        *fb_id = entry->fb_id;
+        return 0;
+    }
+
+    cache->misses++;
+    if (cache->count == FB_CACHE_SIZE)
+    {
+        int oldest = 0;
+        for (int i = 1; i < cache->count; i++)
+        {
+            if (cache->entries[i].last_use < cache->entries[oldest].last_use)
+                oldest = i;
+        }
+        drop_entry(cache, oldest);
+    }
+
+    struct fb_cache_entry *entry = &cache->entries[cache->count];
+    entry->plane_count = image->plane_count;
+    int ret = 0;
+    for (int i = 0; i < image->plane_count; i++)
+    {
+        int shared = 0;
+        for (int j = 0; j < i; j++)
+            shared |= st[j].st_dev == st[i].st_dev && st[j].st_ino == st[i].st_ino;
+
+        entry->fds[i] = shared ? -1 : fcntl(image->fds[i], F_DUPFD_CLOEXEC, 0);
+        if (!shared && entry->fds[i] < 0 && !ret)
+            ret = -errno;
+        entry->dev[i] = st[i].st_dev;
+        entry->ino[i] = st[i].st_ino;
+        entry->pitches[i] = image->pitches[i];
+        entry->offsets[i] = image->offsets[i];
+    }
+
+    if (!ret)
+    {
+        ret = dmabuf_import(cache->drm_fd, image, fb_id);
+        if (ret)
+            fprintf(stderr, "Cannot import dma-buf: %s\n", strerror(-ret));
+    }
+    if (ret)
+    {
+        for (int i = 0; i < image->plane_count; i++)
+        {
+            if (entry->fds[i] >= 0)
+                close(entry->fds[i]);
+        }
+        return ret;
+    }
+
+    cache->count++;
+    entry->width = image->width;
+    entry->height = image->height;
+    entry->format = image->format;
+    entry->modifier = image->modifier;
+    entry->fb_id = *fb_id;
+    entry->last_use = cache->clock;
+    return 0;
+}
+
+// the producer is done with a buffer, drop its framebuffer once it is off screen
+void fb_cache_forget(struct fb_cache *cache, int dmabuf_fd)
+{
+    struct stat st;
+    if (fstat(dmabuf_fd, &st))
+        return;
+
+    for (int i = 0; i < cache->count; i++)
+    {
+        if (cache->entries[i].ino[0] == st.st_ino && cache->entries[i].dev[0] == st.st_dev)
+        {
+            drop_entry(cache, i);
+            return;
+        }
+    }
+}
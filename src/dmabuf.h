@@ -0,0 +1,70 @@
+#ifndef DMABUF_H
+#define DMABUF_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Zero-copy import of client buffers. A producer (video decoder, camera,
+// another process) hands over dma-buf fds plus the layout of the image in
+// them, the buffer is imported with PRIME and wrapped in a framebuffer that
+// goes straight onto a plane, no pixel is copied.
+//
+// Producers usually cycle through a handful of buffers, so the FB cache keeps
+// the framebuffer of every buffer it has seen, keyed by the dma-buf's inode.
+// A buffer shown again costs a lookup instead of PRIME import + AddFB2. The
+// buffer and layout of every plane are part of the key, not just plane 0's.
+#define DMABUF_MAX_PLANES 4
+#define FB_CACHE_SIZE 16
+
+struct dmabuf_image
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;   // DRM_FORMAT_*
+    uint64_t modifier; // DRM_FORMAT_MOD_INVALID when the producer gave none
+    int plane_count;
+    int fds[DMABUF_MAX_PLANES];
+    uint32_t pitches[DMABUF_MAX_PLANES];
+    uint32_t offsets[DMABUF_MAX_PLANES];
+};
+
+struct fb_cache_entry
+{
+    // dups of the image's fds, keep the inodes from being reused while
+    // cached. -1 for a plane in the same buffer as an earlier one
+    int fds[DMABUF_MAX_PLANES];
+    dev_t dev[DMABUF_MAX_PLANES];
+    ino_t ino[DMABUF_MAX_PLANES];
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t modifier;
+    int plane_count;
+    uint32_t pitches[DMABUF_MAX_PLANES];
+    uint32_t offsets[DMABUF_MAX_PLANES];
+    uint32_t fb_id;
+    uint64_t last_use;
+};
+
+// The least recently used framebuffer is removed when the cache is full, keep
+// FB_CACHE_SIZE above the number of buffers that can be on screen or queued.
+struct fb_cache
+{
+    int drm_fd;
+    int count;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+    struct fb_cache_entry entries[FB_CACHE_SIZE];
+};
+
+int dmabuf_import(int drm_fd, const struct dmabuf_image *image, uint32_t *fb_id);
+int dmabuf_is_dmabuf(int fd);
+int udmabuf_create(int memfd, uint64_t size);
+
+void fb_cache_init(struct fb_cache *cache, int drm_fd);
+void fb_cache_destroy(struct fb_cache *cache);
+int fb_cache_get(struct fb_cache *cache, const struct dmabuf_image *image, uint32_t *fb_id);
+void fb_cache_forget(struct fb_cache *cache, int dmabuf_fd);
+
+#endif
@@ -0,0 +1,112 @@
+#include "dumb_buffer.h"
+#include "format.h"
+#include "kms.h"
+#include "tiling.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// function to create a dumb buffer, mapped and wrapped in a framebuffer.
+// create_dumb holds the size in pixels, 32 bpp is XRGB8888 and 16 bpp RGB565.
+// returns 0 or -errno, nothing is left allocated on failure.
+int create_dumb_buffer(int drm_fd, struct drm_mode_create_dumb *create_dumb, void **buffer_map, uint32_t *fb_id)
+{
+    uint32_t format = create_dumb->bpp == 16 ? DRM_FORMAT_RGB565 : DRM_FORMAT_XRGB8888;
+    return create_dumb_buffer_format(drm_fd, format, create_dumb, buffer_map, fb_id);
+}
+
+// same for any format in format.h. the bpp of create_dumb is filled in, the
+// planes of a multi-planar format are stacked in the one buffer with the same
+// pitch (see format_plane_offset).
+int create_dumb_buffer_format(int drm_fd, uint32_t format, struct drm_mode_create_dumb *create_dumb, void **buffer_map, uint32_t *fb_id)
+{
+    return create_dumb_buffer_modifier(drm_fd, format, DRM_FORMAT_MOD_LINEAR, create_dumb, buffer_map, fb_id);
+}
+
+// same with a tiled layout from tiling.h. dumb buffers are only memory to the
+// driver, the modifier given to AddFB2 decides how scanout reads them, so the
+// CPU has to write them through tiling_swizzle. the allocation is rounded up
+// to whole tiles. -EINVAL when the driver takes no such framebuffer, the
+// caller can fall back to linear.
+int create_dumb_buffer_modifier(int drm_fd, uint32_t format, uint64_t modifier, struct drm_mode_create_dumb *create_dumb,
+                                void **buffer_map, uint32_t *fb_id)
+{
+    const struct format_info *info = format_info_get(format);
+    if (!info)
+    {
+        fprintf(stderr, "Unsupported framebuffer format %.4s\n", (const char *)&format);
+        return -EINVAL;
+    }
+    const struct tiling_info *tiling = tiling_info_get(modifier);
+    if (!tiling || (tiling->tile_width && (info->plane_count != 1 || info->cpp[0] != 4)))
+    {
+        fprintf(stderr, "No %s layout for %s buffers\n", tiling ? tiling->name : "such", info->name);
+        return -EINVAL;
+    }
+
+    // the dumb buffer is allocated as rows of plane 0's pixel size, chroma
+    // rows of NV12 are as wide in bytes as luma rows
+    uint32_t width = create_dumb->width, height = create_dumb->height;
+    uint32_t alloc_height = height;
+    tiling_align(tiling, info->cpp[0], &create_dumb->width, &alloc_height);
+    create_dumb->bpp = info->cpp[0] * 8;
+    create_dumb->height = (uint32_t)format_buffer_rows(info, alloc_height);
+    int ret = kms_create_dumb(drm_fd, create_dumb);
+    create_dumb->width = width;
+    create_dumb->height = height;
+    if (ret)
+    {
+        fprintf(stderr, "DRM_IOCTL_MODE_CREATE_DUMB failed: %s\n", strerror(-ret));
+        return ret;
+    }
+    if (tiling->tile_width && create_dumb->pitch % tiling->tile_width)
+    {
+        // the driver padded the pitch past whole tiles
+        kms_destroy_dumb(drm_fd, create_dumb->handle);
+        return -EINVAL;
+    }
+
+    *buffer_map = kms_map_dumb(drm_fd, create_dumb->handle, create_dumb->size);
+    if (*buffer_map == MAP_FAILED)
+    {
+        ret = -errno;
+        perror("mmap failed");
+        kms_destroy_dumb(drm_fd, create_dumb->handle);
+        return ret;
+    }
+
+    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+    for (int i = 0; i < info->plane_count; i++)
+    {
+        handles[i] = create_dumb->handle;
+        pitches[i] = create_dumb->pitch;
+        offsets[i] = format_plane_offset(info, create_dumb->pitch, height, i);
+    }
+
+    // linear is what a dumb buffer is without modifiers, drivers that do not
+    // know DRM_MODE_FB_MODIFIERS keep working
+    uint64_t modifiers[4] = {modifier};
+    uint32_t flags = tiling->tile_width ? DRM_MODE_FB_MODIFIERS : 0;
+    if (kms_add_fb2(drm_fd, create_dumb->width, height, format, handles, pitches, offsets, flags ? modifiers : NULL,
+                    flags, fb_id))
+    {
+        ret = -errno;
+        fprintf(stderr, "Cannot create %s %s framebuffer (%d): %m\n", tiling->name, info->name, errno);
+        munmap(*buffer_map, create_dumb->size);
+        kms_destroy_dumb(drm_fd, create_dumb->handle);
+        return ret;
+    }
+
+    return 0;
+}
+
+// undo create_dumb_buffer, the buffer memory goes back to the driver
+void destroy_dumb_buffer(int drm_fd, struct drm_mode_create_dumb *create_dumb, void *buffer_map, uint32_t fb_id)
+{
+    kms_rm_fb(drm_fd, fb_id);
+    munmap(buffer_map, create_dumb->size);
+    kms_destroy_dumb(drm_fd, create_dumb->handle);
+}
@@ -0,0 +1,14 @@
+#ifndef DUMB_BUFFER_H
+#define DUMB_BUFFER_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+int create_dumb_buffer(int drm_fd, struct drm_mode_create_dumb *create_dumb, void **buffer_map, uint32_t *fb_id);
+int create_dumb_buffer_format(int drm_fd, uint32_t format, struct drm_mode_create_dumb *create_dumb, void **buffer_map, uint32_t *fb_id);
+int create_dumb_buffer_modifier(int drm_fd, uint32_t format, uint64_t modifier, struct drm_mode_create_dumb *create_dumb,
+                                void **buffer_map, uint32_t *fb_id);
+void destroy_dumb_buffer(int drm_fd, struct drm_mode_create_dumb *create_dumb, void *buffer_map, uint32_t fb_id);
+
+#endif
@@ -0,0 +1,380 @@
+#include "format.h"
+#include "pixel.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FORMAT_X86 1
+#include <immintrin.h>
+#endif
+
+static const struct format_info formats[] = {
+    {DRM_FORMAT_XRGB8888, "XRGB8888", 1, {4, 0}, 1, 1},
+    {DRM_FORMAT_ARGB8888, "ARGB8888", 1, {4, 0}, 1, 1},
+    {DRM_FORMAT_XBGR8888, "XBGR8888", 1, {4, 0}, 1, 1},
+    {DRM_FORMAT_ABGR8888, "ABGR8888", 1, {4, 0}, 1, 1},
+    {DRM_FORMAT_RGB565, "RGB565", 1, {2, 0}, 1, 1},
+    {DRM_FORMAT_XRGB2101010, "XRGB2101010", 1, {4, 0}, 1, 1},
+    {DRM_FORMAT_ARGB2101010, "ARGB2101010", 1, {4, 0}, 1, 1},
+    {DRM_FORMAT_NV12, "NV12", 2, {1, 2}, 2, 2},
+};
+
+#define FORMAT_COUNT (int)(sizeof(formats) / sizeof(formats[0]))
+
+const struct format_info *format_info_get(uint32_t format)
+{
+    for (int i = 0; i < FORMAT_COUNT; i++)
+    {
+        if (formats[i].format == format)
+            return &formats[i];
+    }
+    return NULL;
+}
+
+const struct format_info *format_info_by_name(const char *name)
+{
+    for (int i = 0; i < FORMAT_COUNT; i++)
+    {
+        if (strcmp(formats[i].name, name) == 0)
+            return &formats[i];
+    }
+    return NULL;
+}
+
+// rows of pitch bytes a buffer of this height needs, all planes together
+uint64_t format_buffer_rows(const struct format_info *info, uint32_t height)
+{
+    uint64_t rows = height;
+    if (info->plane_count > 1)
+        rows += (height + info->vsub - 1) / info->vsub;
+    return rows;
+}
+
+uint32_t format_plane_offset(const struct format_info *info, uint32_t pitch, uint32_t height, int plane)
+{
+    return plane ? pitch * height : 0;
+}
+
+#define ROW(base, pitch, y) ((uint8_t *)(base) + (size_t)(y) * (pitch))
+#define CROW(base, pitch, y) ((const uint8_t *)(base) + (size_t)(y) * (pitch))
+
+// 4x4 Bayer matrix, 0..15
+static const uint8_t bayer[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5},
+};
+
+// the threshold is added with saturation before the low bits are dropped:
+// up to 7 for the 5-bit channels, up to 3 for the 6-bit one
+static inline uint16_t rgb565_pixel(uint32_t p, uint32_t d)
+{
+    uint32_t r = (p >> 16) & 0xFF, g = (p >> 8) & 0xFF, b = p & 0xFF;
+    uint32_t d5 = d >> 1, d6 = d >> 2;
+
+    r = r + d5 > 255 ? 255 : r + d5;
+    g = g + d6 > 255 ? 255 : g + d6;
+    b = b + d5 > 255 ? 255 : b + d5;
+    return (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+}
+
+static inline uint32_t widen10(uint32_t c)
+{
+    return (c << 2) | (c >> 6);
+}
+
+static inline uint32_t argb2101010_pixel(uint32_t p)
+{
+    return ((p >> 30) << 30) | (widen10((p >> 16) & 0xFF) << 20) | (widen10((p >> 8) & 0xFF) << 10) | widen10(p & 0xFF);
+}
+
+static inline uint32_t clamp255(int32_t v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : (uint32_t)v;
+}
+
+static inline uint32_t yuv_pixel(int32_t y, int32_t u, int32_t v)
+{
+    int32_t c = 298 * (y - 16), d = u - 128, e = v - 128;
+    uint32_t r = clamp255((c + 409 * e + 128) >> 8);
+    uint32_t g = clamp255((c - 100 * d - 208 * e + 128) >> 8);
+    uint32_t b = clamp255((c + 516 * d + 128) >> 8);
+    return 0xFF000000u | (r << 16) | (g << 8) | b;
+}
+
+// scalar reference kernels
+
+static void argb_to_rgb565_scalar(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                                  uint32_t width, uint32_t height, uint32_t x0, uint32_t y0)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint16_t *d = (uint16_t *)ROW(dst, dst_pitch, y);
+        const uint32_t *s = (const uint32_t *)CROW(src, src_pitch, y);
+        const uint8_t *threshold = bayer[(y0 + y) & 3];
+        for (uint32_t x = 0; x < width; x++)
+            d[x] = rgb565_pixel(s[x], threshold[(x0 + x) & 3]);
+    }
+}
+
+static void argb_to_argb2101010_scalar(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                                       uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = (uint32_t *)ROW(dst, dst_pitch, y);
+        const uint32_t *s = (const uint32_t *)CROW(src, src_pitch, y);
+        for (uint32_t x = 0; x < width; x++)
+            d[x] = argb2101010_pixel(s[x]);
+    }
+}
+
+static void nv12_to_argb_scalar(void *dst, uint32_t dst_pitch, const uint8_t *luma, uint32_t luma_pitch,
+                                const uint8_t *chroma, uint32_t chroma_pitch, uint32_t src_x, uint32_t src_y,
+                                uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = (uint32_t *)ROW(dst, dst_pitch, y);
+        const uint8_t *l = CROW(luma, luma_pitch, src_y + y) + src_x;
+        const uint8_t *c = CROW(chroma, chroma_pitch, (src_y + y) / 2);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            uint32_t cx = (src_x + x) & ~1u;
+            d[x] = yuv_pixel(l[x], c[cx], c[cx + 1]);
+        }
+    }
+}
+
+static const struct format_kernels kernels_scalar = {
+    .name = "scalar",
+    .argb_to_rgb565 = argb_to_rgb565_scalar,
+    .argb_to_argb2101010 = argb_to_argb2101010_scalar,
+    .nv12_to_argb = nv12_to_argb_scalar,
+};
+
+#ifdef FORMAT_X86
+
+// AVX2, 8 pixels per step in 32-bit lanes, the scalar kernels finish each row
+
+__attribute__((target("avx2"))) static void argb_to_rgb565_avx2(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                                                                uint32_t width, uint32_t height, uint32_t x0, uint32_t y0)
+{
+    __m256i mask5 = _mm256_set1_epi32(0x1F), mask6 = _mm256_set1_epi32(0x3F);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint16_t *d = (uint16_t *)ROW(dst, dst_pitch, y);
+        const uint32_t *s = (const uint32_t *)CROW(src, src_pitch, y);
+        const uint8_t *threshold = bayer[(y0 + y) & 3];
+
+        // the pattern repeats every 4 pixels, so one vector serves the whole row
+        uint32_t lanes[8];
+        for (int i = 0; i < 8; i++)
+        {
+            uint32_t t = threshold[(x0 + i) & 3];
+            lanes[i] = ((t >> 1) << 16) | ((t >> 2) << 8) | (t >> 1);
+        }
+        __m256i dither = _mm256_loadu_si256((const __m256i *)lanes);
+
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i p = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i *)(s + x)), dither);
+            __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 19), mask5);
+            __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 10), mask6);
+            __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), mask5);
+            __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 11), _mm256_slli_epi32(g, 5)), b);
+
+            // packus works per 128-bit half, the useful words end up in qwords 0 and 2
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(d + x), _mm256_castsi256_si128(packed));
+        }
+        for (; x < width; x++)
+            d[x] = rgb565_pixel(s[x], threshold[(x0 + x) & 3]);
+    }
+}
+
+__attribute__((target("avx2"))) static inline __m256i widen10_avx2(__m256i c)
+{
+    return _mm256_or_si256(_mm256_slli_epi32(c, 2), _mm256_srli_epi32(c, 6));
+}
+
+__attribute__((target("avx2"))) static void argb_to_argb2101010_avx2(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                                                                     uint32_t width, uint32_t height)
+{
+    __m256i mask8 = _mm256_set1_epi32(0xFF);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = (uint32_t *)ROW(dst, dst_pitch, y);
+        const uint32_t *s = (const uint32_t *)CROW(src, src_pitch, y);
+        uint32_t x = 0;
+
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i p = _mm256_loadu_si256((const __m256i *)(s + x));
+            __m256i a = _mm256_slli_epi32(_mm256_srli_epi32(p, 30), 30);
+            __m256i r = widen10_avx2(_mm256_and_si256(_mm256_srli_epi32(p, 16), mask8));
+            __m256i g = widen10_avx2(_mm256_and_si256(_mm256_srli_epi32(p, 8), mask8));
+            __m256i b = widen10_avx2(_mm256_and_si256(p, mask8));
+            __m256i v = _mm256_or_si256(_mm256_or_si256(a, _mm256_slli_epi32(r, 20)),
+                                        _mm256_or_si256(_mm256_slli_epi32(g, 10), b));
+            _mm256_storeu_si256((__m256i *)(d + x), v);
+        }
+        for (; x < width; x++)
+            d[x] = argb2101010_pixel(s[x]);
+    }
+}
+
+__attribute__((target("avx2"))) static inline __m256i clamp255_avx2(__m256i v)
+{
+    return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+}
+
+__attribute__((target("avx2"))) static void nv12_to_argb_avx2(void *dst, uint32_t dst_pitch, const uint8_t *luma, uint32_t luma_pitch,
+                                                              const uint8_t *chroma, uint32_t chroma_pitch, uint32_t src_x, uint32_t src_y,
+                                                              uint32_t width, uint32_t height)
+{
+    __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    __m256i mask8 = _mm256_set1_epi32(0xFF);
+    __m256i c16 = _mm256_set1_epi32(16), c128 = _mm256_set1_epi32(128), round = _mm256_set1_epi32(128);
+    __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = (uint32_t *)ROW(dst, dst_pitch, y);
+        const uint8_t *l = CROW(luma, luma_pitch, src_y + y) + src_x;
+        const uint8_t *c = CROW(chroma, chroma_pitch, (src_y + y) / 2);
+        uint32_t x = 0;
+
+        // the vector body needs chroma pairs aligned to the 8 pixel step
+        if ((src_x & 1) && width)
+        {
+            d[0] = yuv_pixel(l[0], c[src_x - 1], c[src_x]);
+            x = 1;
+        }
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i yv = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(l + x)));
+            __m128i uv4 = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(c + src_x + x)));
+            __m256i uv = _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(uv4), dup);
+            __m256i dv = _mm256_sub_epi32(_mm256_and_si256(uv, mask8), c128);
+            __m256i ev = _mm256_sub_epi32(_mm256_srli_epi32(uv, 8), c128);
+            __m256i cv = _mm256_mullo_epi32(_mm256_sub_epi32(yv, c16), _mm256_set1_epi32(298));
+            cv = _mm256_add_epi32(cv, round);
+
+            __m256i r = _mm256_add_epi32(cv, _mm256_mullo_epi32(ev, _mm256_set1_epi32(409)));
+            __m256i g = _mm256_sub_epi32(cv, _mm256_add_epi32(_mm256_mullo_epi32(dv, _mm256_set1_epi32(100)),
+                                                              _mm256_mullo_epi32(ev, _mm256_set1_epi32(208))));
+            __m256i b = _mm256_add_epi32(cv, _mm256_mullo_epi32(dv, _mm256_set1_epi32(516)));
+            r = clamp255_avx2(_mm256_srai_epi32(r, 8));
+            g = clamp255_avx2(_mm256_srai_epi32(g, 8));
+            b = clamp255_avx2(_mm256_srai_epi32(b, 8));
+
+            __m256i v = _mm256_or_si256(_mm256_or_si256(alpha, _mm256_slli_epi32(r, 16)),
+                                        _mm256_or_si256(_mm256_slli_epi32(g, 8), b));
+            _mm256_storeu_si256((__m256i *)(d + x), v);
+        }
+        for (; x < width; x++)
+        {
+            uint32_t cx = (src_x + x) & ~1u;
+            d[x] = yuv_pixel(l[x], c[cx], c[cx + 1]);
+        }
+    }
+}
+
+static const struct format_kernels kernels_avx2 = {
+    .name = "avx2",
+    .argb_to_rgb565 = argb_to_rgb565_avx2,
+    .argb_to_argb2101010 = argb_to_argb2101010_avx2,
+    .nv12_to_argb = nv12_to_argb_avx2,
+};
+
+#endif
+
+// every kernel set this CPU can run, fastest first
+int format_kernels_supported(const struct format_kernels **list, int max)
+{
+    int count = 0;
+
+#ifdef FORMAT_X86
+    __builtin_cpu_init();
+    if (count < max && __builtin_cpu_supports("avx2"))
+        list[count++] = &kernels_avx2;
+#endif
+    if (count < max)
+        list[count++] = &kernels_scalar;
+
+    return count;
+}
+
+const struct format_kernels *format_kernels_scalar(void)
+{
+    return &kernels_scalar;
+}
+
+// best kernel set for this CPU. PLANES_PIXEL_KERNELS applies here too, a
+// name without a converter set of its own (sse2, avx512) gets the best one
+// that is not faster than it
+const struct format_kernels *format_kernels_get(void)
+{
+    static const struct format_kernels *selected;
+
+    const struct format_kernels *k = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (k)
+        return k;
+
+    const char *forced = getenv("PLANES_PIXEL_KERNELS");
+    if (forced && (strcmp(forced, "scalar") == 0 || strcmp(forced, "sse2") == 0))
+        k = &kernels_scalar;
+    else
+        format_kernels_supported(&k, 1);
+
+    __atomic_store_n(&selected, k, __ATOMIC_RELEASE);
+    return k;
+}
+
+// convert the (x, y, width, height) rect of an ARGB8888 frame into the same
+// rect of a buffer in format. both pointers are the top-left of their buffer.
+int format_convert_rect(uint32_t format, void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                        uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    const struct format_info *info = format_info_get(format);
+    if (!info || info->plane_count != 1)
+        return -EINVAL;
+
+    uint8_t *d = ROW(dst, dst_pitch, y) + (size_t)x * info->cpp[0];
+    const uint8_t *s = CROW(src, src_pitch, y) + (size_t)x * 4;
+
+    switch (format)
+    {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+        pixel_blit(d, dst_pitch, s, src_pitch, width, height);
+        return 0;
+    case DRM_FORMAT_RGB565:
+        format_kernels_get()->argb_to_rgb565(d, dst_pitch, s, src_pitch, width, height, x, y);
+        return 0;
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_ARGB2101010:
+        format_kernels_get()->argb_to_argb2101010(d, dst_pitch, s, src_pitch, width, height);
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+// BT.601 limited range, the inverse of what nv12_to_argb does
+void format_rgb_to_yuv(uint32_t color, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+    int32_t r = (color >> 16) & 0xFF, g = (color >> 8) & 0xFF, b = color & 0xFF;
+
+    *y = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    *u = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    *v = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
@@ -0,0 +1,59 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+
+// Pixel formats buffers can be allocated in, and converters between them.
+//
+// Rendering always happens in ARGB8888 (pixel.h, compositor.h). Formats with
+// fewer bytes per pixel halve what the display engine has to fetch, so on
+// bandwidth limited panels the finished frame is converted on the way into
+// the scanout buffer: RGB565 with ordered dithering to hide the banding,
+// ARGB2101010 by widening each channel. NV12 goes the other way, video
+// planes scan it out as is and the CPU fallback converts it to ARGB8888.
+//
+// Multi-planar buffers are one allocation with the planes stacked: every
+// plane uses the same pitch and starts right after the rows of the one
+// before it.
+#define FORMAT_MAX_PLANES 2
+
+struct format_info
+{
+    uint32_t format; // DRM_FORMAT_*
+    const char *name;
+    int plane_count;
+    uint8_t cpp[FORMAT_MAX_PLANES]; // bytes per pixel, per plane
+    uint8_t hsub;                   // chroma subsampling of plane 1
+    uint8_t vsub;
+};
+
+// YUV is BT.601 limited range. The dither matrix is anchored at the
+// destination's (x0, y0), converting a frame rect by rect gives the same
+// pixels as converting it in one go. Every kernel set gives bit-identical
+// results.
+struct format_kernels
+{
+    const char *name;
+    void (*argb_to_rgb565)(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                           uint32_t width, uint32_t height, uint32_t x0, uint32_t y0);
+    void (*argb_to_argb2101010)(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                                uint32_t width, uint32_t height);
+    void (*nv12_to_argb)(void *dst, uint32_t dst_pitch, const uint8_t *luma, uint32_t luma_pitch,
+                         const uint8_t *chroma, uint32_t chroma_pitch, uint32_t src_x, uint32_t src_y,
+                         uint32_t width, uint32_t height);
+};
+
+const struct format_info *format_info_get(uint32_t format);
+const struct format_info *format_info_by_name(const char *name);
+uint64_t format_buffer_rows(const struct format_info *info, uint32_t height);
+uint32_t format_plane_offset(const struct format_info *info, uint32_t pitch, uint32_t height, int plane);
+
+const struct format_kernels *format_kernels_get(void);
+const struct format_kernels *format_kernels_scalar(void);
+int format_kernels_supported(const struct format_kernels **list, int max);
+
+int format_convert_rect(uint32_t format, void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch,
+                        uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+void format_rgb_to_yuv(uint32_t color, uint8_t *y, uint8_t *u, uint8_t *v);
+
+#endif
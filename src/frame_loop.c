@@ -0,0 +1,148 @@
+#include "frame_loop.h"
+#include "kms.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+static void record_frame(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us)
+{
+    struct frame_histogram *hist = &loop->hist;
+
+    // the first flip only gives us a reference point
+    if (loop->last_flip_us)
+    {
+        uint64_t delta = flip_us - loop->last_flip_us;
+        uint64_t bin = delta / FRAME_HIST_BIN_US;
+        if (bin >= FRAME_HIST_BINS)
+            bin = FRAME_HIST_BINS - 1;
+
+        hist->bins[bin]++;
+        hist->frames++;
+        hist->total_us += delta;
+        if (!hist->min_us || delta < hist->min_us)
+            hist->min_us = delta;
+        if (delta > hist->max_us)
+            hist->max_us = delta;
+
+        // every vblank between two flips is a frame we failed to deliver
+        if (sequence - loop->last_sequence > 1)
+            hist->dropped += sequence - loop->last_sequence - 1;
+    }
+
+    loop->last_sequence = sequence;
+    loop->last_flip_us = flip_us;
+}
+
+// page_flip_handler2 callback, user_data is the frame_loop that issued the commit
+static void page_flip_handler(int drm_fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                              unsigned int crtc_id, void *user_data)
+{
+    frame_loop_flip_event(user_data, sequence, tv_sec, tv_usec, crtc_id);
+}
+
+// what the flip handler does, for callers that read the drm fd themselves
+// and route the events to their loops (src/output.c)
+void frame_loop_flip_event(struct frame_loop *loop, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                           unsigned int crtc_id)
+{
+    uint64_t flip_us = (uint64_t)tv_sec * 1000000 + tv_usec;
+    trace_vblank(crtc_id, sequence, flip_us * 1000);
+
+    for (int i = 0; i < loop->swapchain_count; i++)
+        swapchain_flip_done(loop->swapchains[i]);
+
+    loop->flip_pending = 0;
+    record_frame(loop, sequence, flip_us);
+
+    if (loop->on_flip)
+        loop->on_flip(loop, sequence, flip_us, loop->data);
+}
+
+void frame_loop_init(struct frame_loop *loop, int drm_fd, frame_flip_cb on_flip, void *data)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->drm_fd = drm_fd;
+    loop->ev.version = 3;
+    loop->ev.page_flip_handler2 = page_flip_handler;
+    loop->on_flip = on_flip;
+    loop->data = data;
+    frame_histogram_reset(&loop->hist);
+}
+
+int frame_loop_add_swapchain(struct frame_loop *loop, struct swapchain *sc)
+{
+    if (loop->swapchain_count == FRAME_LOOP_MAX_SWAPCHAINS)
+        return -ENOSPC;
+
+    loop->swapchains[loop->swapchain_count++] = sc;
+    return 0;
+}
+
+// call right after a commit/page flip that passed the loop as user_data succeeded
+void frame_loop_begin_flip(struct frame_loop *loop)
+{
+    loop->flip_pending = 1;
+}
+
+// wait up to timeout_ms for DRM events and run their handlers.
+// returns 1 if events were handled, 0 on timeout.
+int frame_loop_dispatch(struct frame_loop *loop, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = loop->drm_fd, .events = POLLIN};
+
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return errno == EINTR ? 0 : -errno;
+    if (ret == 0)
+        return 0;
+
+    if (kms_handle_event(loop->drm_fd, &loop->ev))
+        return -EIO;
+
+    return 1;
+}
+
+// block until the outstanding flip, if any, has completed
+int frame_loop_wait_idle(struct frame_loop *loop)
+{
+    while (loop->flip_pending)
+    {
+        int ret = frame_loop_dispatch(loop, -1);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
+void frame_histogram_reset(struct frame_histogram *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void frame_histogram_print(const struct frame_histogram *hist, FILE *out)
+{
+    if (!hist->frames)
+    {
+        fprintf(out, "No frames recorded\n");
+        return;
+    }
+
+    fprintf(out, "Frames: %llu, dropped vblanks: %llu\n",
+            (unsigned long long)hist->frames, (unsigned long long)hist->dropped);
+    fprintf(out, "Frame time: min %.2f ms, avg %.2f ms, max %.2f ms\n",
+            hist->min_us / 1000.0, (double)hist->total_us / hist->frames / 1000.0, hist->max_us / 1000.0);
+
+    for (int i = 0; i < FRAME_HIST_BINS; i++)
+    {
+        if (!hist->bins[i])
+            continue;
+
+        double lo = i * FRAME_HIST_BIN_US / 1000.0;
+        int width = (int)(hist->bins[i] * 50 / hist->frames);
+        fprintf(out, "  %6.2f%s ms | %8llu %.*s\n", lo, i == FRAME_HIST_BINS - 1 ? "+" : " ",
+                (unsigned long long)hist->bins[i], width,
+                "##################################################");
+    }
+}
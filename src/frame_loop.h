@@ -0,0 +1,60 @@
+#ifndef FRAME_LOOP_H
+#define FRAME_LOOP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <xf86drm.h>
+
+#include "swapchain.h"
+
+#define FRAME_LOOP_MAX_SWAPCHAINS 8
+
+// Frame times in 250us bins, anything at or past the last bin is lumped into it.
+#define FRAME_HIST_BIN_US 250
+#define FRAME_HIST_BINS 200
+
+struct frame_histogram
+{
+    uint64_t bins[FRAME_HIST_BINS];
+    uint64_t frames;
+    uint64_t dropped;  // vblanks that passed without a new frame
+    uint64_t min_us;
+    uint64_t max_us;
+    uint64_t total_us;
+};
+
+struct frame_loop;
+
+typedef void (*frame_flip_cb)(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us, void *data);
+
+// Owns the flip event plumbing for one CRTC. Commits pass the loop as their
+// user_data and the flip handler retires every attached swapchain.
+struct frame_loop
+{
+    int drm_fd;
+    drmEventContext ev;
+    int flip_pending;
+
+    struct swapchain *swapchains[FRAME_LOOP_MAX_SWAPCHAINS];
+    int swapchain_count;
+
+    unsigned int last_sequence;
+    uint64_t last_flip_us;
+    struct frame_histogram hist;
+
+    frame_flip_cb on_flip;
+    void *data;
+};
+
+void frame_loop_init(struct frame_loop *loop, int drm_fd, frame_flip_cb on_flip, void *data);
+int frame_loop_add_swapchain(struct frame_loop *loop, struct swapchain *sc);
+void frame_loop_begin_flip(struct frame_loop *loop);
+void frame_loop_flip_event(struct frame_loop *loop, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                           unsigned int crtc_id);
+int frame_loop_dispatch(struct frame_loop *loop, int timeout_ms);
+int frame_loop_wait_idle(struct frame_loop *loop);
+
+void frame_histogram_reset(struct frame_histogram *hist);
+void frame_histogram_print(const struct frame_histogram *hist, FILE *out);
+
+#endif
@@ -0,0 +1,162 @@
+#include "frame_queue.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// publish one entry. 1 when the consumer had taken everything before it (and
+// may be asleep), 0 when not, -EAGAIN when the ring is full. head and tail are
+// sequentially consistent so that either this sees the consumer's last tail
+// or the consumer's check before sleeping sees this head, never neither.
+int frame_ring_push(struct frame_ring *ring, const struct frame_entry *entry)
+{
+    uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= FRAME_QUEUE_SIZE)
+        return -EAGAIN;
+
+    ring->entries[head % FRAME_QUEUE_SIZE] = *entry;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head;
+}
+
+// take the oldest entry, -EAGAIN when there is none
+int frame_ring_pop(struct frame_ring *ring, struct frame_entry *entry)
+{
+    uint32_t tail = ring->tail;
+    if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail)
+        return -EAGAIN;
+
+    *entry = ring->entries[tail % FRAME_QUEUE_SIZE];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static int ring_doorbell(int fd)
+{
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return -errno;
+    return 0;
+}
+
+static void drain_doorbell(int fd)
+{
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) > 0)
+        ;
+}
+
+// an empty queue whose renderer owns buffers 0 .. buffer_count - 1, all free
+int frame_queue_init(struct frame_queue *q, int buffer_count)
+{
+    memset(q, 0, sizeof(*q));
+    if (buffer_count < 1 || buffer_count > FRAME_QUEUE_SIZE)
+        return -EINVAL;
+
+    q->ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    q->released_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (q->ready_fd < 0 || q->released_fd < 0)
+    {
+        int ret = -errno;
+        frame_queue_destroy(q);
+        return ret;
+    }
+
+    for (int i = 0; i < buffer_count; i++)
+    {
+        struct frame_entry entry = {.buffer = (uint32_t)i};
+        frame_ring_push(&q->released, &entry);
+    }
+    return 0;
+}
+
+void frame_queue_destroy(struct frame_queue *q)
+{
+    if (q->ready_fd > 0)
+        close(q->ready_fd);
+    if (q->released_fd > 0)
+        close(q->released_fd);
+    q->ready_fd = q->released_fd = -1;
+}
+
+// a buffer to render into, waiting up to timeout_ms (-1 forever) for the
+// presenter to give one back. its index, -ETIMEDOUT or -errno
+int frame_queue_acquire(struct frame_queue *q, int timeout_ms)
+{
+    for (;;)
+    {
+        struct frame_entry entry;
+        if (frame_ring_pop(&q->released, &entry) == 0)
+            return (int)entry.buffer;
+
+        struct pollfd pfd = {.fd = q->released_fd, .events = POLLIN};
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0)
+            return -errno;
+        if (ret == 0)
+            return -ETIMEDOUT;
+        drain_doorbell(q->released_fd);
+    }
+}
+
+// hand a finished frame to the presenter
+int frame_queue_submit(struct frame_queue *q, uint32_t buffer, uint64_t frame, uint64_t ready_ns)
+{
+    struct frame_entry entry = {.buffer = buffer, .frame = frame, .ready_ns = ready_ns};
+    int ret = frame_ring_push(&q->ready, &entry);
+    if (ret > 0)
+        ret = ring_doorbell(q->ready_fd);
+    return ret;
+}
+
+// give a buffer the presenter no longer needs back to its renderer
+int frame_queue_release(struct frame_queue *q, uint32_t buffer)
+{
+    struct frame_entry entry = {.buffer = buffer};
+    int ret = frame_ring_push(&q->released, &entry);
+    if (ret > 0)
+        ret = ring_doorbell(q->released_fd);
+    return ret;
+}
+
+// mailbox: the newest ready frame of all queues that is newer than after,
+// every other ready frame goes back to its renderer unshown. the queue the
+// frame came from, -EAGAIN when nothing new is ready
+int frame_queue_pick(struct frame_queue **queues, int count, uint64_t after, struct frame_entry *entry)
+{
+    int picked = -EAGAIN;
+    for (int i = 0; i < count; i++)
+    {
+        struct frame_queue *q = queues[i];
+        drain_doorbell(q->ready_fd);
+
+        struct frame_entry next;
+        while (frame_ring_pop(&q->ready, &next) == 0)
+        {
+            if (next.frame <= after || (picked >= 0 && next.frame <= entry->frame))
+            {
+                frame_queue_release(q, next.buffer);
+                q->replaced++;
+                continue;
+            }
+            if (picked >= 0)
+            {
+                frame_queue_release(queues[picked], entry->buffer);
+                queues[picked]->replaced++;
+            }
+            *entry = next;
+            picked = i;
+        }
+    }
+    return picked;
+}
+
+// the presenter saw ready_fd ring but cannot pick yet. the doorbell is
+// cleared so it stops waking the presenter, and it is not rung again until
+// a pick has emptied the ring
+void frame_queue_ack(struct frame_queue *q)
+{
+    drain_doorbell(q->ready_fd);
+}
@@ -0,0 +1,67 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include <stdint.h>
+
+// Hands finished frames from a render thread to the thread that owns the DRM
+// fd, and their buffers back once they are off screen. Each renderer has its
+// own queue, so every ring has a single producer and a single consumer:
+// ready goes renderer to presenter, released presenter to renderer. head and
+// tail are the only shared variables and each has one writer, nothing takes
+// a lock.
+//
+// The presenter works in mailbox mode. When the CRTC is free it takes the
+// newest ready frame of all queues and sends every older one straight back
+// unshown, so the screen never shows a stale frame. Frames are only taken
+// once per vblank though: a renderer with one buffer on screen and one in
+// the flip in flight can get the rest of its buffers ahead, then it waits
+// in frame_queue_acquire for the next pick to give the superseded ones back.
+//
+// The eventfds are only there to sleep on. A push rings one when the other
+// side had emptied the ring, the only case in which it may be waiting. The
+// presenter clears a ready_fd that rang while a flip was in flight with
+// frame_queue_ack, the frames stay queued until the next pick.
+#define FRAME_QUEUE_SIZE 16 // power of two, more than the buffers of one renderer
+
+struct frame_entry
+{
+    uint32_t buffer;   // index into the renderer's buffers
+    uint32_t pad;
+    uint64_t frame;    // newer frames have higher numbers, across all renderers
+    uint64_t ready_ns; // when rendering finished, trace_now() clock
+};
+
+struct frame_ring
+{
+    uint32_t head;     // written by the producer, entries up to here are published
+    uint32_t pad0[15]; // head and tail on their own cache lines
+    uint32_t tail;     // written by the consumer, entries up to here are taken
+    uint32_t pad1[15];
+    struct frame_entry entries[FRAME_QUEUE_SIZE];
+};
+
+struct frame_queue
+{
+    struct frame_ring ready;    // finished frames, renderer -> presenter
+    struct frame_ring released; // buffers off screen, presenter -> renderer
+    int ready_fd;               // eventfd the presenter waits on
+    int released_fd;            // eventfd the renderer waits on
+    uint64_t replaced;          // ready frames a newer one overtook, presenter only
+};
+
+int frame_ring_push(struct frame_ring *ring, const struct frame_entry *entry);
+int frame_ring_pop(struct frame_ring *ring, struct frame_entry *entry);
+
+int frame_queue_init(struct frame_queue *q, int buffer_count);
+void frame_queue_destroy(struct frame_queue *q);
+
+// render thread
+int frame_queue_acquire(struct frame_queue *q, int timeout_ms);
+int frame_queue_submit(struct frame_queue *q, uint32_t buffer, uint64_t frame, uint64_t ready_ns);
+
+// present thread
+int frame_queue_pick(struct frame_queue **queues, int count, uint64_t after, struct frame_entry *entry);
+void frame_queue_ack(struct frame_queue *q);
+int frame_queue_release(struct frame_queue *q, uint32_t buffer);
+
+#endif
@@ -0,0 +1,194 @@
+#include "input.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+// evdev key codes and the character they stand for on stdin
+static const struct
+{
+    uint16_t code;
+    char key;
+} evdev_keys[] = {
+    {KEY_W, 'w'},      {KEY_A, 'a'},    {KEY_S, 's'},       {KEY_D, 'd'},
+    {KEY_UP, 'w'},     {KEY_LEFT, 'a'}, {KEY_DOWN, 's'},    {KEY_RIGHT, 'd'},
+    {KEY_C, 'c'},      {KEY_Q, 'q'},    {KEY_ESC, 'q'},     {KEY_EQUAL, '+'},
+    {KEY_KPPLUS, '+'}, {KEY_MINUS, '-'}, {KEY_KPMINUS, '-'}, {KEY_I, 'i'},
+    {KEY_J, 'j'},      {KEY_K, 'k'},    {KEY_L, 'l'},       {KEY_P, 'p'},
+    {BTN_LEFT, 'p'},
+};
+
+static char evdev_key(uint16_t code)
+{
+    for (size_t i = 0; i < sizeof(evdev_keys) / sizeof(evdev_keys[0]); i++)
+    {
+        if (evdev_keys[i].code == code)
+            return evdev_keys[i].key;
+    }
+    return 0;
+}
+
+// open stdin, raw if it is a terminal, and evdev_path if given
+int input_open(struct input *in, const char *evdev_path)
+{
+    memset(in, 0, sizeof(*in));
+
+    in->stdin_flags = fcntl(STDIN_FILENO, F_GETFL);
+    if (in->stdin_flags < 0 || fcntl(STDIN_FILENO, F_SETFL, in->stdin_flags | O_NONBLOCK))
+        return -errno;
+    in->fds[in->fd_count++] = STDIN_FILENO;
+
+    // no line buffering and no echo, ^C still works
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &in->saved) == 0)
+    {
+        struct termios raw = in->saved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0)
+            in->stdin_raw = 1;
+    }
+
+    if (evdev_path)
+    {
+        int fd = open(evdev_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+        {
+            int ret = -errno;
+            input_close(in);
+            return ret;
+        }
+
+        // event timestamps default to CLOCK_REALTIME, flips use CLOCK_MONOTONIC
+        int clock = CLOCK_MONOTONIC;
+        if (ioctl(fd, EVIOCSCLOCKID, &clock))
+            perror("EVIOCSCLOCKID failed, evdev latencies are off");
+        in->fds[in->fd_count++] = fd;
+    }
+    return 0;
+}
+
+// everything fd has right now, at most max actions.
+// returns the number of actions, -EPIPE at end of file or -errno.
+int input_read(int fd, struct input_action *actions, int max)
+{
+    int count = 0;
+
+    if (fd == STDIN_FILENO)
+    {
+        char keys[INPUT_MAX_ACTIONS];
+        if (max > INPUT_MAX_ACTIONS)
+            max = INPUT_MAX_ACTIONS;
+
+        ssize_t len = read(fd, keys, (size_t)max);
+        if (len == 0)
+            return -EPIPE;
+        if (len < 0)
+            return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+
+        uint64_t now = trace_now();
+        for (ssize_t i = 0; i < len; i++)
+        {
+            actions[count] = (struct input_action){.key = keys[i], .time_ns = now};
+            count++;
+        }
+        return count;
+    }
+
+    // evdev: a batch of events closed by SYN_REPORT, motion is summed per batch
+    struct input_event events[INPUT_MAX_ACTIONS];
+    ssize_t len = read(fd, events, sizeof(events));
+    if (len == 0)
+        return -EPIPE;
+    if (len < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -errno;
+
+    struct input_action motion = {0};
+    for (size_t i = 0; i < (size_t)len / sizeof(events[0]) && count < max; i++)
+    {
+        const struct input_event *ev = &events[i];
+        uint64_t time_ns = (uint64_t)ev->input_event_sec * 1000000000ull + (uint64_t)ev->input_event_usec * 1000;
+
+        // value 1 is a press, 2 an autorepeat, releases do nothing
+        if (ev->type == EV_KEY && ev->value)
+        {
+            char key = evdev_key(ev->code);
+            if (key)
+                actions[count++] = (struct input_action){.key = key, .time_ns = time_ns};
+        }
+        else if (ev->type == EV_REL && (ev->code == REL_X || ev->code == REL_Y))
+        {
+            if (ev->code == REL_X)
+                motion.dx += ev->value;
+            else
+                motion.dy += ev->value;
+            if (!motion.time_ns)
+                motion.time_ns = time_ns;
+        }
+        else if (ev->type == EV_SYN && ev->code == SYN_REPORT && motion.time_ns)
+        {
+            actions[count++] = motion;
+            memset(&motion, 0, sizeof(motion));
+        }
+    }
+    return count;
+}
+
+// put stdin back the way it was and close the evdev node
+void input_close(struct input *in)
+{
+    for (int i = 0; i < in->fd_count; i++)
+    {
+        if (in->fds[i] != STDIN_FILENO)
+            close(in->fds[i]);
+    }
+    if (in->stdin_raw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &in->saved);
+    if (in->fd_count)
+        fcntl(STDIN_FILENO, F_SETFL, in->stdin_flags);
+    in->fd_count = 0;
+    in->stdin_raw = 0;
+}
+
+void input_latency_add(struct input_latency *lat, uint64_t us)
+{
+    lat->samples_us[lat->count % INPUT_LATENCY_SAMPLES] = us;
+    lat->count++;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+void input_latency_print(const struct input_latency *lat, FILE *out)
+{
+    if (!lat->count)
+    {
+        fprintf(out, "No input reached the screen\n");
+        return;
+    }
+
+    size_t n = lat->count < INPUT_LATENCY_SAMPLES ? (size_t)lat->count : INPUT_LATENCY_SAMPLES;
+    uint64_t *sorted = malloc(n * sizeof(*sorted));
+    if (!sorted)
+        return;
+    memcpy(sorted, lat->samples_us, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), compare_u64);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += sorted[i];
+
+    fprintf(out, "Input to photon: %llu frames, min %.2f ms, p50 %.2f ms, avg %.2f ms, p99 %.2f ms, max %.2f ms\n",
+            (unsigned long long)lat->count, sorted[0] / 1000.0, sorted[n / 2] / 1000.0, (double)total / n / 1000.0,
+            sorted[n * 99 / 100] / 1000.0, sorted[n - 1] / 1000.0);
+    free(sorted);
+}
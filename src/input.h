@@ -0,0 +1,56 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <termios.h>
+
+// Non-blocking keyboard/pointer input for the interactive programs.
+//
+// stdin is switched to raw mode when it is a terminal, so every key arrives
+// as soon as it is pressed instead of after Enter; the old mode is put back
+// by input_close. An evdev node (/dev/input/eventN) can be read as well,
+// its keys are mapped to the same characters and relative pointer motion
+// comes through as dx/dy. All fds are non-blocking and meant to sit in the
+// caller's epoll set next to the drm fd.
+//
+// Every action carries the CLOCK_MONOTONIC time it was generated (evdev's
+// own timestamp, or the read time for stdin) so it can be compared against
+// flip timestamps, which use the same clock.
+#define INPUT_MAX_FDS 2
+#define INPUT_MAX_ACTIONS 64
+#define INPUT_LATENCY_SAMPLES 4096
+
+struct input_action
+{
+    char key;   // 'w', 'a', '+', ... or 0 for pointer motion
+    int32_t dx;
+    int32_t dy;
+    uint64_t time_ns;
+};
+
+struct input
+{
+    int fds[INPUT_MAX_FDS];
+    int fd_count;
+    int stdin_flags; // fcntl flags to restore
+    int stdin_raw;   // a termios mode to restore
+    struct termios saved;
+};
+
+// Input-to-photon latencies, one sample per frame that carried input, taken
+// from the oldest input folded into it to its flip timestamp.
+struct input_latency
+{
+    uint64_t samples_us[INPUT_LATENCY_SAMPLES];
+    uint64_t count; // may exceed the samples kept, the oldest get overwritten
+};
+
+int input_open(struct input *in, const char *evdev_path);
+int input_read(int fd, struct input_action *actions, int max);
+void input_close(struct input *in);
+
+void input_latency_add(struct input_latency *lat, uint64_t us);
+void input_latency_print(const struct input_latency *lat, FILE *out);
+
+#endif
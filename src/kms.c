@@ -0,0 +1,318 @@
+#include "kms.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct kms_device devices[KMS_MAX_DEVICES];
+static int device_count;
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// copy out the device registered for fd, fds nobody registered are plain
+// libdrm devices
+static struct kms_device *lookup(int fd, struct kms_device *dev)
+{
+    dev->fd = fd;
+    dev->ops = &kms_drm_ops;
+    dev->priv = NULL;
+
+    pthread_mutex_lock(&devices_lock);
+    for (int i = 0; i < device_count; i++)
+    {
+        if (devices[i].fd == fd)
+        {
+            *dev = devices[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&devices_lock);
+
+    return dev;
+}
+
+int kms_register(int fd, const struct kms_ops *ops, void *priv)
+{
+    pthread_mutex_lock(&devices_lock);
+    if (device_count == KMS_MAX_DEVICES)
+    {
+        pthread_mutex_unlock(&devices_lock);
+        return -ENOSPC;
+    }
+
+    devices[device_count].fd = fd;
+    devices[device_count].ops = ops;
+    devices[device_count].priv = priv;
+    device_count++;
+    pthread_mutex_unlock(&devices_lock);
+    return 0;
+}
+
+// open a device by spec, see kms.h. returns the fd or -errno
+int kms_open(const char *spec)
+{
+    if (!spec || !*spec)
+        spec = getenv("PLANES_KMS");
+    if (!spec || !*spec)
+        spec = "auto";
+
+    int fd;
+    if (strcmp(spec, "fake") == 0 || strncmp(spec, "fake:", 5) == 0)
+        fd = kms_fake_open(spec[4] ? spec + 5 : NULL);
+    else if (strcmp(spec, "fbdev") == 0 || strncmp(spec, "fbdev:", 6) == 0)
+        fd = kms_fbdev_open(spec[5] ? spec + 6 : NULL);
+    else if (strcmp(spec, "auto") == 0)
+        fd = kms_drm_open_auto(NULL);
+    else if (strncmp(spec, "driver:", 7) == 0)
+        fd = kms_drm_open_auto(spec + 7);
+    else if ((fd = open(spec, O_RDWR | O_CLOEXEC)) < 0)
+        fd = -errno;
+
+    if (fd < 0)
+        return fd;
+
+    // libdrm fds are registered too, so kms_backend_name can tell them apart
+    struct kms_device tmp;
+    if (lookup(fd, &tmp)->ops == &kms_drm_ops)
+    {
+        int ret = kms_register(fd, &kms_drm_ops, NULL);
+        if (ret)
+        {
+            close(fd);
+            return ret;
+        }
+    }
+
+    return fd;
+}
+
+void kms_close(int fd)
+{
+    pthread_mutex_lock(&devices_lock);
+    for (int i = 0; i < device_count; i++)
+    {
+        if (devices[i].fd != fd)
+            continue;
+
+        struct kms_device dev = devices[i];
+        devices[i] = devices[--device_count];
+        pthread_mutex_unlock(&devices_lock);
+
+        if (dev.ops->close)
+            dev.ops->close(&dev);
+        close(fd);
+        return;
+    }
+    pthread_mutex_unlock(&devices_lock);
+
+    close(fd);
+}
+
+const char *kms_backend_name(int fd)
+{
+    struct kms_device tmp;
+    return lookup(fd, &tmp)->ops->name;
+}
+
+int kms_set_client_cap(int fd, uint64_t cap, uint64_t value)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->set_client_cap(dev, cap, value);
+}
+
+int kms_get_cap(int fd, uint64_t cap, uint64_t *value)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_cap(dev, cap, value);
+}
+
+drmModeRes *kms_get_resources(int fd)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_resources(dev);
+}
+
+drmModeConnector *kms_get_connector(int fd, uint32_t connector_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_connector(dev, connector_id);
+}
+
+// the connector as last probed, without making the driver read the EDID again
+drmModeConnector *kms_get_connector_current(int fd, uint32_t connector_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_connector_current(dev, connector_id);
+}
+
+drmModeEncoder *kms_get_encoder(int fd, uint32_t encoder_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_encoder(dev, encoder_id);
+}
+
+drmModeCrtc *kms_get_crtc(int fd, uint32_t crtc_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_crtc(dev, crtc_id);
+}
+
+drmModePlaneRes *kms_get_plane_resources(int fd)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_plane_resources(dev);
+}
+
+drmModePlane *kms_get_plane(int fd, uint32_t plane_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_plane(dev, plane_id);
+}
+
+drmModeObjectProperties *kms_get_object_properties(int fd, uint32_t object_id, uint32_t object_type)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_object_properties(dev, object_id, object_type);
+}
+
+drmModePropertyRes *kms_get_property(int fd, uint32_t property_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_property(dev, property_id);
+}
+
+drmModePropertyBlobRes *kms_get_property_blob(int fd, uint32_t blob_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->get_property_blob(dev, blob_id);
+}
+
+int kms_create_property_blob(int fd, const void *data, size_t size, uint32_t *blob_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->create_property_blob(dev, data, size, blob_id);
+}
+
+int kms_destroy_property_blob(int fd, uint32_t blob_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->destroy_property_blob(dev, blob_id);
+}
+
+int kms_create_dumb(int fd, struct drm_mode_create_dumb *create)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->create_dumb(dev, create);
+}
+
+// map a whole dumb buffer, MAP_FAILED on error like mmap itself
+void *kms_map_dumb(int fd, uint32_t handle, uint64_t size)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->map_dumb(dev, handle, size);
+}
+
+int kms_destroy_dumb(int fd, uint32_t handle)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->destroy_dumb(dev, handle);
+}
+
+// import a dma-buf, importing the same buffer twice gives the same handle
+int kms_prime_fd_to_handle(int fd, int prime_fd, uint32_t *handle)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->prime_fd_to_handle(dev, prime_fd, handle);
+}
+
+// export a buffer as a dma-buf fd, for handing it to another device or process
+int kms_prime_handle_to_fd(int fd, uint32_t handle, int *prime_fd)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->prime_handle_to_fd(dev, handle, prime_fd);
+}
+
+// drop a GEM handle, framebuffers made from it keep the buffer alive
+int kms_close_handle(int fd, uint32_t handle)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->close_handle(dev, handle);
+}
+
+int kms_add_fb(int fd, uint32_t width, uint32_t height, uint8_t depth, uint8_t bpp,
+               uint32_t pitch, uint32_t handle, uint32_t *fb_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->add_fb(dev, width, height, depth, bpp, pitch, handle, fb_id);
+}
+
+// flags takes DRM_MODE_FB_MODIFIERS when modifiers[] is meaningful
+int kms_add_fb2(int fd, uint32_t width, uint32_t height, uint32_t format,
+                const uint32_t handles[4], const uint32_t pitches[4], const uint32_t offsets[4],
+                const uint64_t modifiers[4], uint32_t flags, uint32_t *fb_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->add_fb2(dev, width, height, format, handles, pitches, offsets, modifiers, flags, fb_id);
+}
+
+int kms_rm_fb(int fd, uint32_t fb_id)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->rm_fb(dev, fb_id);
+}
+
+int kms_dirty_fb(int fd, uint32_t fb_id, drmModeClip *clips, uint32_t count)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->dirty_fb(dev, fb_id, clips, count);
+}
+
+int kms_set_crtc(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y,
+                 uint32_t *connectors, int count, drmModeModeInfo *mode)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->set_crtc(dev, crtc_id, fb_id, x, y, connectors, count, mode);
+}
+
+int kms_set_plane(int fd, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                  int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                  uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->set_plane(dev, plane_id, crtc_id, fb_id, crtc_x, crtc_y, crtc_w, crtc_h,
+                               src_x, src_y, src_w, src_h);
+}
+
+int kms_page_flip(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *user_data)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->page_flip(dev, crtc_id, fb_id, flags, user_data);
+}
+
+int kms_set_cursor2(int fd, uint32_t crtc_id, uint32_t handle, uint32_t width, uint32_t height,
+                    int32_t hot_x, int32_t hot_y)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->set_cursor2(dev, crtc_id, handle, width, height, hot_x, hot_y);
+}
+
+int kms_move_cursor(int fd, uint32_t crtc_id, int32_t x, int32_t y)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->move_cursor(dev, crtc_id, x, y);
+}
+
+int kms_atomic_commit(int fd, const struct kms_prop *props, int count, uint32_t flags, void *user_data)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->atomic_commit(dev, props, count, flags, user_data);
+}
+
+int kms_handle_event(int fd, drmEventContext *ev)
+{
+    struct kms_device tmp, *dev = lookup(fd, &tmp);
+    return dev->ops->handle_event(dev, ev);
+}
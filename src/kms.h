@@ -0,0 +1,149 @@
+#ifndef KMS_H
+#define KMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// Every KMS call in this repo goes through the kms_* wrappers below instead of
+// libdrm directly, so the same code runs on four backends:
+//
+//   "/dev/dri/cardN"  a device node, driven through libdrm
+//   "auto"            the first card with a connected output, "driver:NAME"
+//                     picks a card or render node by its driver name (vkms, ...)
+//   "fake[:WxH@R,..]" an in-process KMS device: planes, CRTCs and connectors
+//                     in memory, memfd backed dumb buffers and vblank events
+//                     timed off CLOCK_MONOTONIC. One output per mode given,
+//                     "scale" in the list gives the planes a scaler,
+//                     "vrr" makes the connectors VRR capable,
+//                     "writeback" adds a writeback connector.
+//   "fbdev[:PATH]"    a legacy fbdev node, /dev/fb0 by default, as a single
+//                     output. Buffers are screens of the panned virtual
+//                     framebuffer, "fbdev:fake[:WxH@R,..]" runs it on a memfd.
+//
+// kms_open(NULL) reads the spec from $PLANES_KMS and defaults to "auto".
+// The fd it returns can be polled for events like a real DRM fd. Objects
+// returned by the kms_get_* calls are laid out and allocated the way libdrm
+// does it, so they are released with the usual drmModeFree* functions.
+// An fd that was not opened through kms_open is treated as a libdrm device.
+#define KMS_MAX_DEVICES 16
+
+// One property write of an atomic commit.
+struct kms_prop
+{
+    uint32_t object_id;
+    uint32_t property_id;
+    uint64_t value;
+};
+
+struct kms_device;
+
+struct kms_ops
+{
+    const char *name;
+    void (*close)(struct kms_device *dev);
+
+    int (*set_client_cap)(struct kms_device *dev, uint64_t cap, uint64_t value);
+    int (*get_cap)(struct kms_device *dev, uint64_t cap, uint64_t *value);
+
+    drmModeRes *(*get_resources)(struct kms_device *dev);
+    drmModeConnector *(*get_connector)(struct kms_device *dev, uint32_t connector_id);
+    drmModeConnector *(*get_connector_current)(struct kms_device *dev, uint32_t connector_id);
+    drmModeEncoder *(*get_encoder)(struct kms_device *dev, uint32_t encoder_id);
+    drmModeCrtc *(*get_crtc)(struct kms_device *dev, uint32_t crtc_id);
+    drmModePlaneRes *(*get_plane_resources)(struct kms_device *dev);
+    drmModePlane *(*get_plane)(struct kms_device *dev, uint32_t plane_id);
+    drmModeObjectProperties *(*get_object_properties)(struct kms_device *dev, uint32_t object_id, uint32_t object_type);
+    drmModePropertyRes *(*get_property)(struct kms_device *dev, uint32_t property_id);
+    drmModePropertyBlobRes *(*get_property_blob)(struct kms_device *dev, uint32_t blob_id);
+    int (*create_property_blob)(struct kms_device *dev, const void *data, size_t size, uint32_t *blob_id);
+    int (*destroy_property_blob)(struct kms_device *dev, uint32_t blob_id);
+
+    int (*create_dumb)(struct kms_device *dev, struct drm_mode_create_dumb *create);
+    void *(*map_dumb)(struct kms_device *dev, uint32_t handle, uint64_t size);
+    int (*destroy_dumb)(struct kms_device *dev, uint32_t handle);
+    int (*prime_fd_to_handle)(struct kms_device *dev, int prime_fd, uint32_t *handle);
+    int (*prime_handle_to_fd)(struct kms_device *dev, uint32_t handle, int *prime_fd);
+    int (*close_handle)(struct kms_device *dev, uint32_t handle);
+    int (*add_fb)(struct kms_device *dev, uint32_t width, uint32_t height, uint8_t depth, uint8_t bpp,
+                  uint32_t pitch, uint32_t handle, uint32_t *fb_id);
+    int (*add_fb2)(struct kms_device *dev, uint32_t width, uint32_t height, uint32_t format,
+                   const uint32_t handles[4], const uint32_t pitches[4], const uint32_t offsets[4],
+                   const uint64_t modifiers[4], uint32_t flags, uint32_t *fb_id);
+    int (*rm_fb)(struct kms_device *dev, uint32_t fb_id);
+    int (*dirty_fb)(struct kms_device *dev, uint32_t fb_id, drmModeClip *clips, uint32_t count);
+
+    int (*set_crtc)(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y,
+                    uint32_t *connectors, int count, drmModeModeInfo *mode);
+    int (*set_plane)(struct kms_device *dev, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                     int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                     uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h);
+    int (*page_flip)(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *user_data);
+    int (*set_cursor2)(struct kms_device *dev, uint32_t crtc_id, uint32_t handle, uint32_t width, uint32_t height,
+                       int32_t hot_x, int32_t hot_y);
+    int (*move_cursor)(struct kms_device *dev, uint32_t crtc_id, int32_t x, int32_t y);
+    int (*atomic_commit)(struct kms_device *dev, const struct kms_prop *props, int count, uint32_t flags, void *user_data);
+    int (*handle_event)(struct kms_device *dev, drmEventContext *ev);
+};
+
+struct kms_device
+{
+    int fd;
+    const struct kms_ops *ops;
+    void *priv;
+};
+
+extern const struct kms_ops kms_drm_ops;
+
+int kms_open(const char *spec);
+void kms_close(int fd);
+const char *kms_backend_name(int fd);
+int kms_register(int fd, const struct kms_ops *ops, void *priv);
+int kms_drm_open_auto(const char *driver);
+int kms_fake_open(const char *modes);
+int kms_fbdev_open(const char *path);
+
+int kms_set_client_cap(int fd, uint64_t cap, uint64_t value);
+int kms_get_cap(int fd, uint64_t cap, uint64_t *value);
+
+drmModeRes *kms_get_resources(int fd);
+drmModeConnector *kms_get_connector(int fd, uint32_t connector_id);
+drmModeConnector *kms_get_connector_current(int fd, uint32_t connector_id);
+drmModeEncoder *kms_get_encoder(int fd, uint32_t encoder_id);
+drmModeCrtc *kms_get_crtc(int fd, uint32_t crtc_id);
+drmModePlaneRes *kms_get_plane_resources(int fd);
+drmModePlane *kms_get_plane(int fd, uint32_t plane_id);
+drmModeObjectProperties *kms_get_object_properties(int fd, uint32_t object_id, uint32_t object_type);
+drmModePropertyRes *kms_get_property(int fd, uint32_t property_id);
+drmModePropertyBlobRes *kms_get_property_blob(int fd, uint32_t blob_id);
+int kms_create_property_blob(int fd, const void *data, size_t size, uint32_t *blob_id);
+int kms_destroy_property_blob(int fd, uint32_t blob_id);
+
+int kms_create_dumb(int fd, struct drm_mode_create_dumb *create);
+void *kms_map_dumb(int fd, uint32_t handle, uint64_t size);
+int kms_destroy_dumb(int fd, uint32_t handle);
+int kms_prime_fd_to_handle(int fd, int prime_fd, uint32_t *handle);
+int kms_prime_handle_to_fd(int fd, uint32_t handle, int *prime_fd);
+int kms_close_handle(int fd, uint32_t handle);
+int kms_add_fb(int fd, uint32_t width, uint32_t height, uint8_t depth, uint8_t bpp,
+               uint32_t pitch, uint32_t handle, uint32_t *fb_id);
+int kms_add_fb2(int fd, uint32_t width, uint32_t height, uint32_t format,
+                const uint32_t handles[4], const uint32_t pitches[4], const uint32_t offsets[4],
+                const uint64_t modifiers[4], uint32_t flags, uint32_t *fb_id);
+int kms_rm_fb(int fd, uint32_t fb_id);
+int kms_dirty_fb(int fd, uint32_t fb_id, drmModeClip *clips, uint32_t count);
+
+int kms_set_crtc(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y,
+                 uint32_t *connectors, int count, drmModeModeInfo *mode);
+int kms_set_plane(int fd, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                  int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                  uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h);
+int kms_page_flip(int fd, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *user_data);
+int kms_set_cursor2(int fd, uint32_t crtc_id, uint32_t handle, uint32_t width, uint32_t height,
+                    int32_t hot_x, int32_t hot_y);
+int kms_move_cursor(int fd, uint32_t crtc_id, int32_t x, int32_t y);
+int kms_atomic_commit(int fd, const struct kms_prop *props, int count, uint32_t flags, void *user_data);
+int kms_handle_event(int fd, drmEventContext *ev);
+
+#endif
@@ -0,0 +1,345 @@
+#include "kms.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// the libdrm backend: every op is the libdrm call of the same name
+
+static int drm_set_client_cap(struct kms_device *dev, uint64_t cap, uint64_t value)
+{
+    return drmSetClientCap(dev->fd, cap, value) ? -errno : 0;
+}
+
+static int drm_get_cap(struct kms_device *dev, uint64_t cap, uint64_t *value)
+{
+    return drmGetCap(dev->fd, cap, value) ? -errno : 0;
+}
+
+static drmModeRes *drm_get_resources(struct kms_device *dev)
+{
+    return drmModeGetResources(dev->fd);
+}
+
+static drmModeConnector *drm_get_connector(struct kms_device *dev, uint32_t connector_id)
+{
+    return drmModeGetConnector(dev->fd, connector_id);
+}
+
+static drmModeConnector *drm_get_connector_current(struct kms_device *dev, uint32_t connector_id)
+{
+    return drmModeGetConnectorCurrent(dev->fd, connector_id);
+}
+
+static drmModeEncoder *drm_get_encoder(struct kms_device *dev, uint32_t encoder_id)
+{
+    return drmModeGetEncoder(dev->fd, encoder_id);
+}
+
+static drmModeCrtc *drm_get_crtc(struct kms_device *dev, uint32_t crtc_id)
+{
+    return drmModeGetCrtc(dev->fd, crtc_id);
+}
+
+static drmModePlaneRes *drm_get_plane_resources(struct kms_device *dev)
+{
+    return drmModeGetPlaneResources(dev->fd);
+}
+
+static drmModePlane *drm_get_plane(struct kms_device *dev, uint32_t plane_id)
+{
+    return drmModeGetPlane(dev->fd, plane_id);
+}
+
+static drmModeObjectProperties *drm_get_object_properties(struct kms_device *dev, uint32_t object_id, uint32_t object_type)
+{
+    return drmModeObjectGetProperties(dev->fd, object_id, object_type);
+}
+
+static drmModePropertyRes *drm_get_property(struct kms_device *dev, uint32_t property_id)
+{
+    return drmModeGetProperty(dev->fd, property_id);
+}
+
+static drmModePropertyBlobRes *drm_get_property_blob(struct kms_device *dev, uint32_t blob_id)
+{
+    return drmModeGetPropertyBlob(dev->fd, blob_id);
+}
+
+static int drm_create_property_blob(struct kms_device *dev, const void *data, size_t size, uint32_t *blob_id)
+{
+    return drmModeCreatePropertyBlob(dev->fd, data, size, blob_id);
+}
+
+static int drm_destroy_property_blob(struct kms_device *dev, uint32_t blob_id)
+{
+    return drmModeDestroyPropertyBlob(dev->fd, blob_id);
+}
+
+static int drm_create_dumb(struct kms_device *dev, struct drm_mode_create_dumb *create)
+{
+    return ioctl(dev->fd, DRM_IOCTL_MODE_CREATE_DUMB, create) ? -errno : 0;
+}
+
+static void *drm_map_dumb(struct kms_device *dev, uint32_t handle, uint64_t size)
+{
+    struct drm_mode_map_dumb map_dumb = {0};
+    map_dumb.handle = handle;
+    if (ioctl(dev->fd, DRM_IOCTL_MODE_MAP_DUMB, &map_dumb))
+        return MAP_FAILED;
+
+    return mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, dev->fd, map_dumb.offset);
+}
+
+static int drm_destroy_dumb(struct kms_device *dev, uint32_t handle)
+{
+    struct drm_mode_destroy_dumb destroy_dumb = {0};
+    destroy_dumb.handle = handle;
+    return ioctl(dev->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_dumb) ? -errno : 0;
+}
+
+static int drm_prime_fd_to_handle(struct kms_device *dev, int prime_fd, uint32_t *handle)
+{
+    return drmPrimeFDToHandle(dev->fd, prime_fd, handle) ? -errno : 0;
+}
+
+static int drm_prime_handle_to_fd(struct kms_device *dev, uint32_t handle, int *prime_fd)
+{
+    return drmPrimeHandleToFD(dev->fd, handle, DRM_CLOEXEC | DRM_RDWR, prime_fd) ? -errno : 0;
+}
+
+static int drm_close_handle(struct kms_device *dev, uint32_t handle)
+{
+    struct drm_gem_close gem_close = {0};
+    gem_close.handle = handle;
+    return ioctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &gem_close) ? -errno : 0;
+}
+
+static int drm_add_fb(struct kms_device *dev, uint32_t width, uint32_t height, uint8_t depth, uint8_t bpp,
+                      uint32_t pitch, uint32_t handle, uint32_t *fb_id)
+{
+    return drmModeAddFB(dev->fd, width, height, depth, bpp, pitch, handle, fb_id);
+}
+
+static int drm_add_fb2(struct kms_device *dev, uint32_t width, uint32_t height, uint32_t format,
+                       const uint32_t handles[4], const uint32_t pitches[4], const uint32_t offsets[4],
+                       const uint64_t modifiers[4], uint32_t flags, uint32_t *fb_id)
+{
+    return drmModeAddFB2WithModifiers(dev->fd, width, height, format, handles, pitches, offsets, modifiers, fb_id, flags);
+}
+
+static int drm_rm_fb(struct kms_device *dev, uint32_t fb_id)
+{
+    return drmModeRmFB(dev->fd, fb_id);
+}
+
+static int drm_dirty_fb(struct kms_device *dev, uint32_t fb_id, drmModeClip *clips, uint32_t count)
+{
+    return drmModeDirtyFB(dev->fd, fb_id, clips, count);
+}
+
+static int drm_set_crtc(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y,
+                        uint32_t *connectors, int count, drmModeModeInfo *mode)
+{
+    return drmModeSetCrtc(dev->fd, crtc_id, fb_id, x, y, connectors, count, mode);
+}
+
+static int drm_set_plane(struct kms_device *dev, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                         int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                         uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h)
+{
+    return drmModeSetPlane(dev->fd, plane_id, crtc_id, fb_id, 0, crtc_x, crtc_y, crtc_w, crtc_h,
+                           src_x, src_y, src_w, src_h);
+}
+
+static int drm_page_flip(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *user_data)
+{
+    return drmModePageFlip(dev->fd, crtc_id, fb_id, flags, user_data);
+}
+
+static int drm_set_cursor2(struct kms_device *dev, uint32_t crtc_id, uint32_t handle, uint32_t width, uint32_t height,
+                           int32_t hot_x, int32_t hot_y)
+{
+    return drmModeSetCursor2(dev->fd, crtc_id, handle, width, height, hot_x, hot_y) ? -errno : 0;
+}
+
+static int drm_move_cursor(struct kms_device *dev, uint32_t crtc_id, int32_t x, int32_t y)
+{
+    return drmModeMoveCursor(dev->fd, crtc_id, x, y) ? -errno : 0;
+}
+
+static int drm_atomic_commit(struct kms_device *dev, const struct kms_prop *props, int count, uint32_t flags, void *user_data)
+{
+    drmModeAtomicReq *kreq = drmModeAtomicAlloc();
+    if (!kreq)
+        return -ENOMEM;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (drmModeAtomicAddProperty(kreq, props[i].object_id, props[i].property_id, props[i].value) < 0)
+        {
+            drmModeAtomicFree(kreq);
+            return -ENOMEM;
+        }
+    }
+
+    // libdrm reports failures as -errno
+    int ret = drmModeAtomicCommit(dev->fd, kreq, flags, user_data);
+
+    drmModeAtomicFree(kreq);
+    return ret;
+}
+
+static int drm_handle_event(struct kms_device *dev, drmEventContext *ev)
+{
+    return drmHandleEvent(dev->fd, ev);
+}
+
+const struct kms_ops kms_drm_ops = {
+    .name = "drm",
+    .set_client_cap = drm_set_client_cap,
+    .get_cap = drm_get_cap,
+    .get_resources = drm_get_resources,
+    .get_connector = drm_get_connector,
+    .get_connector_current = drm_get_connector_current,
+    .get_encoder = drm_get_encoder,
+    .get_crtc = drm_get_crtc,
+    .get_plane_resources = drm_get_plane_resources,
+    .get_plane = drm_get_plane,
+    .get_object_properties = drm_get_object_properties,
+    .get_property = drm_get_property,
+    .get_property_blob = drm_get_property_blob,
+    .create_property_blob = drm_create_property_blob,
+    .destroy_property_blob = drm_destroy_property_blob,
+    .create_dumb = drm_create_dumb,
+    .map_dumb = drm_map_dumb,
+    .destroy_dumb = drm_destroy_dumb,
+    .prime_fd_to_handle = drm_prime_fd_to_handle,
+    .prime_handle_to_fd = drm_prime_handle_to_fd,
+    .close_handle = drm_close_handle,
+    .add_fb = drm_add_fb,
+    .add_fb2 = drm_add_fb2,
+    .rm_fb = drm_rm_fb,
+    .dirty_fb = drm_dirty_fb,
+    .set_crtc = drm_set_crtc,
+    .set_plane = drm_set_plane,
+    .page_flip = drm_page_flip,
+    .set_cursor2 = drm_set_cursor2,
+    .move_cursor = drm_move_cursor,
+    .atomic_commit = drm_atomic_commit,
+    .handle_event = drm_handle_event,
+};
+
+// a card is usable for output when it has at least one connected connector
+static int has_connected_output(int fd)
+{
+    drmModeRes *resources = drmModeGetResources(fd);
+    if (!resources)
+        return 0;
+
+    int connected = 0;
+    for (int i = 0; i < resources->count_connectors && !connected; i++)
+    {
+        drmModeConnector *connector = drmModeGetConnector(fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            connected = 1;
+        drmModeFreeConnector(connector);
+    }
+
+    drmModeFreeResources(resources);
+    return connected;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// try the nodes named prefix* in /dev/dri in order, returns the first match
+static int scan_nodes(const char *prefix, const char *driver)
+{
+    DIR *dir = opendir("/dev/dri");
+    if (!dir)
+        return -errno;
+
+    char *names[64];
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) && count < 64)
+    {
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0)
+            names[count++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof(names[0]), compare_names);
+
+    int found = -ENODEV;
+    for (int i = 0; i < count && found < 0; i++)
+    {
+        char path[300];
+        snprintf(path, sizeof(path), "/dev/dri/%s", names[i]);
+
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        int match;
+        if (driver)
+        {
+            drmVersion *version = drmGetVersion(fd);
+            match = version && strcmp(version->name, driver) == 0;
+            drmFreeVersion(version);
+        }
+        else
+        {
+            match = has_connected_output(fd);
+        }
+
+        if (match)
+        {
+            printf("Using %s\n", path);
+            found = fd;
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+        free(names[i]);
+    return found;
+}
+
+// pick a device instead of hardcoding a card index. with a driver name the
+// first card, then render node, of that driver wins. without one it is the
+// first card with something connected, then vkms, then the fake device so
+// the programs still run on a headless machine.
+int kms_drm_open_auto(const char *driver)
+{
+    if (driver)
+    {
+        int fd = scan_nodes("card", driver);
+        if (fd < 0)
+            fd = scan_nodes("renderD", driver);
+        if (fd < 0)
+            fprintf(stderr, "No DRM device with driver %s\n", driver);
+        return fd;
+    }
+
+    int fd = scan_nodes("card", NULL);
+    if (fd < 0)
+        fd = scan_nodes("card", "vkms");
+    if (fd < 0)
+    {
+        fprintf(stderr, "No KMS device found, using the fake backend\n");
+        fd = kms_fake_open(NULL);
+    }
+    return fd;
+}
@@ -0,0 +1,2048 @@
+#define _GNU_SOURCE // memfd_create
+#include "kms.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+// In-process KMS device. It keeps the state a driver would (property values
+// per object, dumb buffers, framebuffers, blobs) and checks commits the way
+// the atomic helpers do, so code that passes here passes on vkms. The fd
+// handed out is a timerfd armed for the next pending flip, which makes it
+// pollable just like a DRM fd.
+//
+// Each output is one connector, encoder and CRTC with its own primary and
+// cursor plane. Two overlay planes are shared by every CRTC. Planes only
+// take linear buffers and do not scale, like vkms, unless "scale" is in the
+// mode list ("fake:1920x1080@60,scale"): then primary and overlay planes
+// upscale up to FAKE_MAX_UPSCALE times. With "vrr" in the list every
+// connector reports vrr_capable and a CRTC with VRR_ENABLED set refreshes
+// when a frame arrives instead of on a fixed beat, down to FAKE_VRR_MIN_HZ.
+// "tiled" adds the Intel X- and Y-tiled modifiers to IN_FORMATS for the
+// 32bpp formats of primary and overlay planes, framebuffers in them need a
+// pitch of whole tiles and memory for the last tile row.
+//
+// "writeback" adds a writeback connector, listed once the client sets
+// DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, that any CRTC can drive. A commit
+// with WRITEBACK_FB_ID set composites the CRTC's planes into that fb right
+// away, the way vkms blends them, and hands back an out fence that signals
+// at the vblank the commit latches on: a timerfd, pollable like a sync_file.
+//
+// PRIME import takes any mappable fd (a memfd, a udmabuf, a real dma-buf)
+// and treats it like a dumb buffer of the fd's size.
+
+#define FAKE_MAX_OUTPUTS 4
+#define FAKE_OVERLAYS 2
+#define FAKE_MAX_PLANES (FAKE_MAX_OUTPUTS * 2 + FAKE_OVERLAYS)
+#define FAKE_MAX_MODES 4
+#define FAKE_MAX_DUMBS 64
+#define FAKE_MAX_FBS 64
+#define FAKE_MAX_BLOBS 64
+#define FAKE_MAX_SIZE 8192
+#define FAKE_CURSOR_SIZE 64
+#define FAKE_MAX_UPSCALE 4
+#define FAKE_VRR_MIN_HZ 48
+#define FAKE_DEFAULT_MODE "1920x1080@60"
+
+#define FAKE_CONNECTOR_BASE 30
+#define FAKE_ENCODER_BASE 40
+#define FAKE_CRTC_BASE 50
+#define FAKE_PLANE_BASE 60
+#define FAKE_PROP_BASE 100
+#define FAKE_OBJECT_BASE 1000 // blobs and framebuffers
+#define FAKE_WRITEBACK_ID (FAKE_CONNECTOR_BASE + FAKE_MAX_OUTPUTS) // its encoder is FAKE_ENCODER_BASE + FAKE_MAX_OUTPUTS
+
+enum fake_prop
+{
+    PROP_TYPE,
+    PROP_FB_ID,
+    PROP_CRTC_ID,
+    PROP_CRTC_X,
+    PROP_CRTC_Y,
+    PROP_CRTC_W,
+    PROP_CRTC_H,
+    PROP_SRC_X,
+    PROP_SRC_Y,
+    PROP_SRC_W,
+    PROP_SRC_H,
+    PROP_ZPOS,
+    PROP_IN_FORMATS,
+    PROP_FB_DAMAGE_CLIPS,
+    PROP_ALPHA,
+    PROP_MODE_ID,
+    PROP_ACTIVE,
+    PROP_VRR_ENABLED,
+    PROP_CONNECTOR_CRTC_ID,
+    PROP_VRR_CAPABLE,
+    PROP_WRITEBACK_FB_ID,
+    PROP_WRITEBACK_OUT_FENCE_PTR,
+    PROP_WRITEBACK_PIXEL_FORMATS,
+    PROP_COUNT,
+};
+
+struct prop_def
+{
+    const char *name;
+    uint32_t flags;
+    int64_t min; // RANGE / SIGNED_RANGE
+    int64_t max;
+    uint32_t object_type; // OBJECT
+};
+
+static const struct prop_def prop_defs[PROP_COUNT] = {
+    [PROP_TYPE] = {"type", DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE, 0, 0, 0},
+    [PROP_FB_ID] = {"FB_ID", DRM_MODE_PROP_OBJECT, 0, 0, DRM_MODE_OBJECT_FB},
+    [PROP_CRTC_ID] = {"CRTC_ID", DRM_MODE_PROP_OBJECT, 0, 0, DRM_MODE_OBJECT_CRTC},
+    [PROP_CRTC_X] = {"CRTC_X", DRM_MODE_PROP_SIGNED_RANGE, INT32_MIN, INT32_MAX, 0},
+    [PROP_CRTC_Y] = {"CRTC_Y", DRM_MODE_PROP_SIGNED_RANGE, INT32_MIN, INT32_MAX, 0},
+    [PROP_CRTC_W] = {"CRTC_W", DRM_MODE_PROP_RANGE, 0, INT32_MAX, 0},
+    [PROP_CRTC_H] = {"CRTC_H", DRM_MODE_PROP_RANGE, 0, INT32_MAX, 0},
+    [PROP_SRC_X] = {"SRC_X", DRM_MODE_PROP_RANGE, 0, UINT32_MAX, 0},
+    [PROP_SRC_Y] = {"SRC_Y", DRM_MODE_PROP_RANGE, 0, UINT32_MAX, 0},
+    [PROP_SRC_W] = {"SRC_W", DRM_MODE_PROP_RANGE, 0, UINT32_MAX, 0},
+    [PROP_SRC_H] = {"SRC_H", DRM_MODE_PROP_RANGE, 0, UINT32_MAX, 0},
+    [PROP_ZPOS] = {"zpos", DRM_MODE_PROP_RANGE, 0, FAKE_MAX_PLANES - 1, 0},
+    [PROP_IN_FORMATS] = {"IN_FORMATS", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE, 0, 0, 0},
+    [PROP_FB_DAMAGE_CLIPS] = {"FB_DAMAGE_CLIPS", DRM_MODE_PROP_BLOB, 0, 0, 0},
+    [PROP_ALPHA] = {"alpha", DRM_MODE_PROP_RANGE, 0, 0xFFFF, 0},
+    [PROP_MODE_ID] = {"MODE_ID", DRM_MODE_PROP_BLOB, 0, 0, 0},
+    [PROP_ACTIVE] = {"ACTIVE", DRM_MODE_PROP_RANGE, 0, 1, 0},
+    [PROP_VRR_ENABLED] = {"VRR_ENABLED", DRM_MODE_PROP_RANGE, 0, 1, 0},
+    [PROP_CONNECTOR_CRTC_ID] = {"CRTC_ID", DRM_MODE_PROP_OBJECT, 0, 0, DRM_MODE_OBJECT_CRTC},
+    [PROP_VRR_CAPABLE] = {"vrr_capable", DRM_MODE_PROP_RANGE | DRM_MODE_PROP_IMMUTABLE, 0, 1, 0},
+    [PROP_WRITEBACK_FB_ID] = {"WRITEBACK_FB_ID", DRM_MODE_PROP_OBJECT, 0, 0, DRM_MODE_OBJECT_FB},
+    [PROP_WRITEBACK_OUT_FENCE_PTR] = {"WRITEBACK_OUT_FENCE_PTR", DRM_MODE_PROP_RANGE, 0, (int64_t)UINT64_MAX, 0},
+    [PROP_WRITEBACK_PIXEL_FORMATS] = {"WRITEBACK_PIXEL_FORMATS", DRM_MODE_PROP_BLOB | DRM_MODE_PROP_IMMUTABLE, 0, 0, 0},
+};
+
+static const int plane_prop_list[] = {
+    PROP_TYPE, PROP_FB_ID, PROP_CRTC_ID, PROP_CRTC_X, PROP_CRTC_Y, PROP_CRTC_W, PROP_CRTC_H,
+    PROP_SRC_X, PROP_SRC_Y, PROP_SRC_W, PROP_SRC_H, PROP_ZPOS, PROP_IN_FORMATS, PROP_FB_DAMAGE_CLIPS,
+    PROP_ALPHA,
+};
+static const int crtc_prop_list[] = {PROP_MODE_ID, PROP_ACTIVE, PROP_VRR_ENABLED};
+static const int connector_prop_list[] = {PROP_CONNECTOR_CRTC_ID, PROP_VRR_CAPABLE};
+static const int writeback_prop_list[] = {
+    PROP_CONNECTOR_CRTC_ID, PROP_WRITEBACK_FB_ID, PROP_WRITEBACK_OUT_FENCE_PTR, PROP_WRITEBACK_PIXEL_FORMATS,
+};
+
+static const uint32_t plane_formats[] = {
+    DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,    DRM_FORMAT_XBGR8888,    DRM_FORMAT_ABGR8888,
+    DRM_FORMAT_RGB565,   DRM_FORMAT_XRGB2101010, DRM_FORMAT_ARGB2101010,
+};
+// overlays are the video planes, they also scan out NV12
+static const uint32_t overlay_formats[] = {
+    DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888,    DRM_FORMAT_XBGR8888,    DRM_FORMAT_ABGR8888,
+    DRM_FORMAT_RGB565,   DRM_FORMAT_XRGB2101010, DRM_FORMAT_ARGB2101010, DRM_FORMAT_NV12,
+};
+static const uint32_t cursor_formats[] = {DRM_FORMAT_ARGB8888};
+static const uint32_t writeback_formats[] = {DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888};
+
+struct fake_plane
+{
+    uint32_t id;
+    uint32_t type;
+    uint32_t possible_crtcs;
+    const uint32_t *formats;
+    uint32_t format_count;
+    uint64_t values[PROP_COUNT];
+};
+
+struct fake_crtc
+{
+    uint32_t id;
+    uint64_t values[PROP_COUNT];
+    drmModeModeInfo mode;
+    uint64_t period_ns;
+    uint64_t vblank_base_ns; // vblank 0, set on every modeset
+    uint64_t last_vblank_ns; // when the last commit latched, 0 after a modeset
+    uint32_t last_sequence;
+
+    int event_pending; // flip done but not yet read by handle_event
+    uint64_t event_ns;
+    uint32_t event_sequence;
+    void *event_data;
+
+    // legacy SetCursor2/MoveCursor state, kept apart from the cursor plane.
+    // the position is the image's top left corner, not the hotspot
+    uint32_t cursor_handle;
+    int32_t cursor_x;
+    int32_t cursor_y;
+};
+
+struct fake_connector
+{
+    uint32_t id;
+    uint32_t possible_crtcs;
+    int mode_count;
+    drmModeModeInfo modes[FAKE_MAX_MODES];
+    uint64_t values[PROP_COUNT];
+};
+
+struct fake_state
+{
+    struct fake_crtc crtcs[FAKE_MAX_OUTPUTS];
+    struct fake_connector connectors[FAKE_MAX_OUTPUTS];
+    struct fake_connector writeback; // FAKE_WRITEBACK_ID, only used with kms->writeback
+    struct fake_plane planes[FAKE_MAX_PLANES];
+};
+
+struct fake_dumb
+{
+    uint32_t handle; // 0 means the slot is free
+    int memfd;
+    uint64_t size;
+    dev_t dev; // the file a PRIME import came from, so a second import finds it
+    ino_t ino;
+};
+
+struct fake_fb
+{
+    uint32_t id;
+    uint32_t handle;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t format;
+    uint64_t modifier;
+};
+
+struct fake_blob
+{
+    uint32_t id;
+    uint32_t size;
+    void *data;
+};
+
+struct fake_kms
+{
+    pthread_mutex_t lock;
+    int timer_fd;
+    int atomic;
+    int scaler;
+    int vrr;
+    int tiled;
+    int writeback;     // the device has a writeback connector
+    int writeback_cap; // and the client can see it
+    int outputs;
+    int plane_count;
+    struct fake_state state;
+
+    struct fake_dumb dumbs[FAKE_MAX_DUMBS];
+    uint32_t next_handle;
+    struct fake_fb fbs[FAKE_MAX_FBS];
+    struct fake_blob blobs[FAKE_MAX_BLOBS];
+    uint32_t next_object;
+};
+
+static int fail(int err)
+{
+    errno = err;
+    return -err;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = {.tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// reduced-blanking style timings, the clock is rounded to kHz like real modes
+static void make_mode(drmModeModeInfo *mode, uint32_t width, uint32_t height, uint32_t refresh)
+{
+    memset(mode, 0, sizeof(*mode));
+    mode->hdisplay = width;
+    mode->hsync_start = width + 48;
+    mode->hsync_end = width + 80;
+    mode->htotal = width + 160;
+    mode->vdisplay = height;
+    mode->vsync_start = height + 3;
+    mode->vsync_end = height + 8;
+    mode->vtotal = height + 40;
+    mode->vrefresh = refresh;
+    mode->clock = (uint32_t)((uint64_t)mode->htotal * mode->vtotal * refresh / 1000);
+    mode->type = DRM_MODE_TYPE_DRIVER;
+    snprintf(mode->name, sizeof(mode->name), "%ux%u", width, height);
+}
+
+static uint64_t mode_period_ns(const drmModeModeInfo *mode)
+{
+    if (!mode->clock)
+        return 1000000000ull / 60;
+    return (uint64_t)mode->htotal * mode->vtotal * 1000000ull / mode->clock;
+}
+
+static struct fake_blob *find_blob(struct fake_kms *kms, uint32_t id)
+{
+    for (int i = 0; id && i < FAKE_MAX_BLOBS; i++)
+    {
+        if (kms->blobs[i].id == id)
+            return &kms->blobs[i];
+    }
+    return NULL;
+}
+
+static struct fake_fb *find_fb(struct fake_kms *kms, uint32_t id)
+{
+    for (int i = 0; id && i < FAKE_MAX_FBS; i++)
+    {
+        if (kms->fbs[i].id == id)
+            return &kms->fbs[i];
+    }
+    return NULL;
+}
+
+static struct fake_dumb *find_dumb(struct fake_kms *kms, uint32_t handle)
+{
+    for (int i = 0; handle && i < FAKE_MAX_DUMBS; i++)
+    {
+        if (kms->dumbs[i].handle == handle)
+            return &kms->dumbs[i];
+    }
+    return NULL;
+}
+
+// bytes per pixel of plane 0 of the formats the planes take, 0 if unknown.
+// NV12's second plane is half height with the same bytes per row.
+static uint32_t format_cpp(uint32_t format)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_ARGB2101010:
+        return 4;
+    case DRM_FORMAT_RGB565:
+        return 2;
+    case DRM_FORMAT_NV12:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// tile size of the tiled modifiers the device takes, width in bytes.
+// 0 for linear, -1 for anything else
+static int tile_size(uint64_t modifier, uint32_t *width, uint32_t *height)
+{
+    switch (modifier)
+    {
+    case DRM_FORMAT_MOD_LINEAR:
+        return 0;
+    case I915_FORMAT_MOD_X_TILED:
+        *width = 512;
+        *height = 8;
+        return 1;
+    case I915_FORMAT_MOD_Y_TILED:
+        *width = 128;
+        *height = 32;
+        return 1;
+    default:
+        return -1;
+    }
+}
+
+static int crtc_index(const struct fake_kms *kms, uint32_t crtc_id)
+{
+    int index = (int)crtc_id - FAKE_CRTC_BASE;
+    return index >= 0 && index < kms->outputs ? index : -1;
+}
+
+static int blob_create(struct fake_kms *kms, const void *data, size_t size, uint32_t *blob_id)
+{
+    for (int i = 0; i < FAKE_MAX_BLOBS; i++)
+    {
+        if (kms->blobs[i].id)
+            continue;
+
+        kms->blobs[i].data = malloc(size ? size : 1);
+        if (!kms->blobs[i].data)
+            return fail(ENOMEM);
+        memcpy(kms->blobs[i].data, data, size);
+        kms->blobs[i].size = size;
+        kms->blobs[i].id = kms->next_object++;
+        *blob_id = kms->blobs[i].id;
+        return 0;
+    }
+    return fail(ENOSPC);
+}
+
+// find an object's property values and the properties it has
+static uint64_t *object_values(struct fake_state *state, const struct fake_kms *kms, uint32_t id, uint32_t type,
+                               const int **list, int *count)
+{
+    int index;
+
+    index = (int)id - FAKE_PLANE_BASE;
+    if (index >= 0 && index < kms->plane_count && (!type || type == DRM_MODE_OBJECT_PLANE))
+    {
+        *list = plane_prop_list;
+        *count = sizeof(plane_prop_list) / sizeof(plane_prop_list[0]);
+        return state->planes[index].values;
+    }
+
+    index = (int)id - FAKE_CRTC_BASE;
+    if (index >= 0 && index < kms->outputs && (!type || type == DRM_MODE_OBJECT_CRTC))
+    {
+        *list = crtc_prop_list;
+        *count = sizeof(crtc_prop_list) / sizeof(crtc_prop_list[0]);
+        return state->crtcs[index].values;
+    }
+
+    index = (int)id - FAKE_CONNECTOR_BASE;
+    if (index >= 0 && index < kms->outputs && (!type || type == DRM_MODE_OBJECT_CONNECTOR))
+    {
+        *list = connector_prop_list;
+        *count = sizeof(connector_prop_list) / sizeof(connector_prop_list[0]);
+        return state->connectors[index].values;
+    }
+
+    if (id == FAKE_WRITEBACK_ID && kms->writeback_cap && (!type || type == DRM_MODE_OBJECT_CONNECTOR))
+    {
+        *list = writeback_prop_list;
+        *count = sizeof(writeback_prop_list) / sizeof(writeback_prop_list[0]);
+        return state->writeback.values;
+    }
+
+    return NULL;
+}
+
+static void arm_timer(struct fake_kms *kms)
+{
+    uint64_t next = 0;
+    for (int i = 0; i < kms->outputs; i++)
+    {
+        const struct fake_crtc *crtc = &kms->state.crtcs[i];
+        if (crtc->event_pending && (!next || crtc->event_ns < next))
+            next = crtc->event_ns;
+    }
+
+    // an all-zero it_value disarms the timer, so never ask for time 0
+    struct itimerspec its = {0};
+    if (next)
+    {
+        its.it_value.tv_sec = next / 1000000000ull;
+        its.it_value.tv_nsec = next % 1000000000ull;
+        if (!its.it_value.tv_sec && !its.it_value.tv_nsec)
+            its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(kms->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// when a commit made at now latches, and the vblank count at that point.
+// with VRR the panel waits for the frame: it goes out as soon as it arrives
+// but no sooner than one mode period after the last one. a panel left idle
+// longer than the VRR range allows refreshes on its own in the meantime.
+static uint64_t next_vblank(const struct fake_kms *kms, const struct fake_crtc *crtc, uint64_t now, uint32_t *sequence)
+{
+    if (!kms->vrr || !crtc->values[PROP_VRR_ENABLED] || !crtc->last_vblank_ns)
+    {
+        uint64_t count = (now - crtc->vblank_base_ns) / crtc->period_ns + 1;
+        *sequence = (uint32_t)count;
+        return crtc->vblank_base_ns + count * crtc->period_ns;
+    }
+
+    uint64_t max_period = 1000000000ull / FAKE_VRR_MIN_HZ;
+    uint64_t idle = now > crtc->last_vblank_ns ? (now - crtc->last_vblank_ns) / max_period : 0;
+    uint64_t earliest = crtc->last_vblank_ns + idle * max_period + crtc->period_ns;
+    *sequence = crtc->last_sequence + (uint32_t)idle + 1;
+    return now > earliest ? now : earliest;
+}
+
+// check the new state like drm_atomic_helper_check would
+static int check_state(struct fake_kms *kms, struct fake_state *state, const struct fake_state *old,
+                       uint32_t flags, uint32_t *modeset_crtcs)
+{
+    *modeset_crtcs = 0;
+
+    for (int i = 0; i < kms->outputs; i++)
+    {
+        struct fake_crtc *crtc = &state->crtcs[i];
+        const struct fake_crtc *old_crtc = &old->crtcs[i];
+        // a new MODE_ID is read from its blob, an unchanged one keeps the
+        // mode the CRTC already has even if userspace dropped the blob since
+        if (crtc->values[PROP_MODE_ID] != old_crtc->values[PROP_MODE_ID])
+        {
+            struct fake_blob *blob = find_blob(kms, (uint32_t)crtc->values[PROP_MODE_ID]);
+            if (crtc->values[PROP_MODE_ID] && (!blob || blob->size != sizeof(drmModeModeInfo)))
+                return fail(EINVAL);
+
+            memset(&crtc->mode, 0, sizeof(crtc->mode));
+            if (blob)
+                memcpy(&crtc->mode, blob->data, sizeof(crtc->mode));
+        }
+        if (crtc->values[PROP_ACTIVE] && !crtc->values[PROP_MODE_ID])
+            return fail(EINVAL);
+
+        if (crtc->values[PROP_ACTIVE] != old_crtc->values[PROP_ACTIVE] ||
+            (crtc->values[PROP_ACTIVE] && memcmp(&crtc->mode, &old_crtc->mode, sizeof(crtc->mode))))
+            *modeset_crtcs |= 1u << i;
+
+        int routed = 0;
+        for (int c = 0; c < kms->outputs; c++)
+        {
+            const struct fake_connector *connector = &state->connectors[c];
+            if (connector->values[PROP_CONNECTOR_CRTC_ID] != crtc->id)
+                continue;
+            if (!(connector->possible_crtcs & (1u << i)))
+                return fail(EINVAL);
+            routed = 1;
+            if (connector->values[PROP_CONNECTOR_CRTC_ID] != old->connectors[c].values[PROP_CONNECTOR_CRTC_ID])
+                *modeset_crtcs |= 1u << i;
+        }
+
+        // attaching or detaching the writeback connector is a modeset like any other connector
+        uint64_t writeback_crtc = state->writeback.values[PROP_CONNECTOR_CRTC_ID];
+        uint64_t old_writeback_crtc = old->writeback.values[PROP_CONNECTOR_CRTC_ID];
+        if (writeback_crtc == crtc->id)
+            routed = 1;
+        if (writeback_crtc != old_writeback_crtc && (writeback_crtc == crtc->id || old_writeback_crtc == crtc->id))
+            *modeset_crtcs |= 1u << i;
+        if (crtc->values[PROP_ACTIVE] && !routed)
+            return fail(EINVAL);
+    }
+
+    if (*modeset_crtcs && !(flags & DRM_MODE_ATOMIC_ALLOW_MODESET))
+        return fail(EINVAL);
+
+    for (int i = 0; i < kms->plane_count; i++)
+    {
+        const struct fake_plane *plane = &state->planes[i];
+        const uint64_t *v = plane->values;
+
+        if (!v[PROP_FB_ID] != !v[PROP_CRTC_ID])
+            return fail(EINVAL);
+        if (!v[PROP_FB_ID])
+            continue;
+
+        int index = crtc_index(kms, (uint32_t)v[PROP_CRTC_ID]);
+        if (index < 0 || !(plane->possible_crtcs & (1u << index)) || !state->crtcs[index].values[PROP_ACTIVE])
+            return fail(EINVAL);
+
+        const struct fake_fb *fb = find_fb(kms, (uint32_t)v[PROP_FB_ID]);
+        int format_ok = 0;
+        for (uint32_t f = 0; f < plane->format_count; f++)
+            format_ok |= plane->formats[f] == fb->format;
+        if (!format_ok || (fb->modifier != DRM_FORMAT_MOD_LINEAR && plane->type == DRM_PLANE_TYPE_CURSOR))
+            return fail(EINVAL);
+
+        if (!v[PROP_CRTC_W] || !v[PROP_CRTC_H] || !v[PROP_SRC_W] || !v[PROP_SRC_H])
+            return fail(EINVAL);
+        if (v[PROP_SRC_X] + v[PROP_SRC_W] > (uint64_t)fb->width << 16 ||
+            v[PROP_SRC_Y] + v[PROP_SRC_H] > (uint64_t)fb->height << 16)
+            return fail(ENOSPC);
+
+        // no scalers on this device, or upscaling only
+        if (v[PROP_SRC_W] != v[PROP_CRTC_W] << 16 || v[PROP_SRC_H] != v[PROP_CRTC_H] << 16)
+        {
+            if (!kms->scaler || plane->type == DRM_PLANE_TYPE_CURSOR ||
+                v[PROP_SRC_W] > v[PROP_CRTC_W] << 16 || v[PROP_SRC_H] > v[PROP_CRTC_H] << 16 ||
+                v[PROP_CRTC_W] << 16 > v[PROP_SRC_W] * FAKE_MAX_UPSCALE ||
+                v[PROP_CRTC_H] << 16 > v[PROP_SRC_H] * FAKE_MAX_UPSCALE)
+                return fail(ERANGE);
+        }
+    }
+
+    // a capture needs a running CRTC and a linear fb of its mode's size,
+    // an out fence is only handed out for a capture
+    const uint64_t *wb = state->writeback.values;
+    if (wb[PROP_WRITEBACK_OUT_FENCE_PTR] && !wb[PROP_WRITEBACK_FB_ID])
+        return fail(EINVAL);
+    if (wb[PROP_WRITEBACK_FB_ID])
+    {
+        int index = crtc_index(kms, (uint32_t)wb[PROP_CONNECTOR_CRTC_ID]);
+        if (index < 0 || !state->crtcs[index].values[PROP_ACTIVE])
+            return fail(EINVAL);
+
+        const struct fake_fb *fb = find_fb(kms, (uint32_t)wb[PROP_WRITEBACK_FB_ID]);
+        const drmModeModeInfo *mode = &state->crtcs[index].mode;
+        int format_ok = 0;
+        for (size_t f = 0; f < sizeof(writeback_formats) / sizeof(writeback_formats[0]); f++)
+            format_ok |= writeback_formats[f] == fb->format;
+        if (!format_ok || fb->modifier != DRM_FORMAT_MOD_LINEAR || fb->width != mode->hdisplay ||
+            fb->height != mode->vdisplay)
+            return fail(EINVAL);
+    }
+
+    return 0;
+}
+
+// premultiplied ARGB8888 of pixel (x, y) of a framebuffer as the display
+// engine reads it, NV12 only as its luma in grey
+static uint32_t read_pixel(const struct fake_fb *fb, const uint8_t *map, uint32_t x, uint32_t y)
+{
+    uint32_t cpp = format_cpp(fb->format);
+    uint32_t x_bytes = x * cpp;
+    uint64_t offset = (uint64_t)y * fb->pitch + x_bytes;
+
+    // the layout tiling.h describes: 4 KiB tiles in rows, columns of span bytes inside
+    uint32_t tile_w, tile_h;
+    if (tile_size(fb->modifier, &tile_w, &tile_h) > 0)
+    {
+        uint32_t span = fb->modifier == I915_FORMAT_MOD_Y_TILED ? 16 : tile_w;
+        uint32_t within = x_bytes % tile_w;
+        offset = ((uint64_t)(y / tile_h) * (fb->pitch / tile_w) + x_bytes / tile_w) * tile_w * tile_h +
+                 (uint64_t)(within / span) * span * tile_h + (uint64_t)(y % tile_h) * span + within % span;
+    }
+
+    uint32_t v = 0;
+    memcpy(&v, map + offset, cpp);
+    switch (fb->format)
+    {
+    case DRM_FORMAT_XRGB8888:
+        return v | 0xFF000000;
+    case DRM_FORMAT_ARGB8888:
+        return v;
+    case DRM_FORMAT_XBGR8888:
+        v |= 0xFF000000;
+        return (v & 0xFF00FF00) | (v & 0xFF) << 16 | (v >> 16 & 0xFF);
+    case DRM_FORMAT_ABGR8888:
+        return (v & 0xFF00FF00) | (v & 0xFF) << 16 | (v >> 16 & 0xFF);
+    case DRM_FORMAT_RGB565:
+    {
+        uint32_t r = v >> 11 & 0x1F, g = v >> 5 & 0x3F, b = v & 0x1F;
+        return 0xFF000000 | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+    }
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_ARGB2101010:
+    {
+        uint32_t a = fb->format == DRM_FORMAT_ARGB2101010 ? (v >> 30) * 85 : 0xFF;
+        return a << 24 | (v >> 22 & 0xFF) << 16 | (v >> 12 & 0xFF) << 8 | (v >> 2 & 0xFF);
+    }
+    default:
+        return 0xFF000000 | (v & 0xFF) * 0x010101;
+    }
+}
+
+// round(x / 255) for x up to 255 * 255, the same as src/pixel.c
+static uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// src over dst, both premultiplied, src weighted by a plane alpha of 0..0xFFFF
+static uint32_t blend_pixel(uint32_t src, uint32_t dst, uint32_t alpha)
+{
+    if (alpha != 0xFFFF)
+    {
+        uint32_t scaled = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+            scaled |= (((src >> shift & 0xFF) * alpha + 0x7FFF) / 0xFFFF) << shift;
+        src = scaled;
+    }
+
+    uint32_t inv = 255 - (src >> 24), out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t c = (src >> shift & 0xFF) + div255((dst >> shift & 0xFF) * inv);
+        out |= (c > 255 ? 255 : c) << shift;
+    }
+    return out;
+}
+
+// the writeback job of a commit: the planes on the CRTC bottom to top by
+// zpos over opaque black, clipped to the mode, nearest sampling where a
+// plane scales. the legacy cursor is not part of it. called with the lock held
+static int compose(struct fake_kms *kms, const struct fake_state *state, int index, const struct fake_fb *out)
+{
+    const struct fake_crtc *crtc = &state->crtcs[index];
+    int order[FAKE_MAX_PLANES], count = 0;
+    for (int i = 0; i < kms->plane_count; i++)
+    {
+        if (state->planes[i].values[PROP_CRTC_ID] != crtc->id)
+            continue;
+        int n = count++;
+        while (n > 0 && state->planes[order[n - 1]].values[PROP_ZPOS] > state->planes[i].values[PROP_ZPOS])
+        {
+            order[n] = order[n - 1];
+            n--;
+        }
+        order[n] = i;
+    }
+
+    const struct fake_dumb *out_dumb = find_dumb(kms, out->handle);
+    uint8_t *dst = mmap(NULL, out_dumb->size, PROT_READ | PROT_WRITE, MAP_SHARED, out_dumb->memfd, 0);
+    if (dst == MAP_FAILED)
+        return -errno;
+
+    int64_t width = crtc->mode.hdisplay, height = crtc->mode.vdisplay;
+    for (int64_t y = 0; y < height; y++)
+    {
+        uint32_t *row = (uint32_t *)(dst + (size_t)y * out->pitch);
+        for (int64_t x = 0; x < width; x++)
+            row[x] = 0xFF000000;
+    }
+
+    for (int n = 0; n < count; n++)
+    {
+        const uint64_t *v = state->planes[order[n]].values;
+        const struct fake_fb *fb = find_fb(kms, (uint32_t)v[PROP_FB_ID]);
+        const struct fake_dumb *dumb = find_dumb(kms, fb->handle);
+        uint8_t *src = dumb ? mmap(NULL, dumb->size, PROT_READ, MAP_SHARED, dumb->memfd, 0) : MAP_FAILED;
+        if (src == MAP_FAILED)
+            continue;
+
+        int64_t crtc_x = (int32_t)v[PROP_CRTC_X], crtc_y = (int32_t)v[PROP_CRTC_Y];
+        int64_t x0 = crtc_x > 0 ? crtc_x : 0, y0 = crtc_y > 0 ? crtc_y : 0;
+        int64_t x1 = crtc_x + (int64_t)v[PROP_CRTC_W], y1 = crtc_y + (int64_t)v[PROP_CRTC_H];
+        if (x1 > width)
+            x1 = width;
+        if (y1 > height)
+            y1 = height;
+
+        for (int64_t y = y0; y < y1; y++)
+        {
+            uint32_t sy = (uint32_t)((v[PROP_SRC_Y] + (uint64_t)(y - crtc_y) * v[PROP_SRC_H] / v[PROP_CRTC_H]) >> 16);
+            uint32_t *row = (uint32_t *)(dst + (size_t)y * out->pitch);
+            for (int64_t x = x0; x < x1; x++)
+            {
+                uint32_t sx = (uint32_t)((v[PROP_SRC_X] + (uint64_t)(x - crtc_x) * v[PROP_SRC_W] / v[PROP_CRTC_W]) >> 16);
+                row[x] = blend_pixel(read_pixel(fb, src, sx, sy), row[x], (uint32_t)v[PROP_ALPHA]);
+            }
+        }
+        munmap(src, dumb->size);
+    }
+
+    munmap(dst, out_dumb->size);
+    return 0;
+}
+
+// a fence that signals at ns: a timerfd, readable from then on like a signalled sync_file
+static int out_fence(uint64_t ns)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = ns / 1000000000ull;
+    its.it_value.tv_nsec = ns % 1000000000ull;
+    if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL))
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
+// apply props to a copy of the state, check it and, unless it is a test,
+// make it current. called with the lock held.
+static int commit_locked(struct fake_kms *kms, const struct kms_prop *props, int count, uint32_t flags,
+                         void *user_data, uint64_t *wait_until)
+{
+    struct fake_state state = kms->state;
+    uint32_t touched_crtcs = 0;
+
+    *wait_until = 0;
+    if ((flags & DRM_MODE_ATOMIC_TEST_ONLY) && (flags & DRM_MODE_PAGE_FLIP_EVENT))
+        return fail(EINVAL);
+
+    for (int i = 0; i < count; i++)
+    {
+        const int *list;
+        int list_count;
+        uint64_t *values = object_values(&state, kms, props[i].object_id, 0, &list, &list_count);
+        if (!values)
+            return fail(ENOENT);
+
+        int prop = -1;
+        for (int p = 0; p < list_count; p++)
+        {
+            if (FAKE_PROP_BASE + (uint32_t)list[p] == props[i].property_id)
+                prop = list[p];
+        }
+        if (prop < 0)
+            return fail(ENOENT);
+
+        const struct prop_def *def = &prop_defs[prop];
+        uint64_t value = props[i].value;
+        if (def->flags & DRM_MODE_PROP_IMMUTABLE)
+            return fail(EINVAL);
+        if ((def->flags & DRM_MODE_PROP_SIGNED_RANGE) == DRM_MODE_PROP_SIGNED_RANGE)
+        {
+            if ((int64_t)value < def->min || (int64_t)value > def->max)
+                return fail(EINVAL);
+        }
+        else if ((def->flags & DRM_MODE_PROP_RANGE) && (value < (uint64_t)def->min || value > (uint64_t)def->max))
+        {
+            return fail(EINVAL);
+        }
+        if ((def->flags & DRM_MODE_PROP_BLOB) && value && !find_blob(kms, (uint32_t)value))
+            return fail(ENOENT);
+        if (def->object_type == DRM_MODE_OBJECT_FB && value && !find_fb(kms, (uint32_t)value))
+            return fail(ENOENT);
+        if (def->object_type == DRM_MODE_OBJECT_CRTC && value && crtc_index(kms, (uint32_t)value) < 0)
+            return fail(ENOENT);
+
+        // every CRTC the write affects, before and after
+        int index = crtc_index(kms, props[i].object_id);
+        if (index >= 0)
+            touched_crtcs |= 1u << index;
+        if (def->object_type == DRM_MODE_OBJECT_CRTC)
+        {
+            index = crtc_index(kms, (uint32_t)values[prop]);
+            if (index >= 0)
+                touched_crtcs |= 1u << index;
+            index = crtc_index(kms, (uint32_t)value);
+            if (index >= 0)
+                touched_crtcs |= 1u << index;
+        }
+        else if (list == plane_prop_list)
+        {
+            index = crtc_index(kms, (uint32_t)values[PROP_CRTC_ID]);
+            if (index >= 0)
+                touched_crtcs |= 1u << index;
+        }
+
+        values[prop] = value;
+    }
+
+    // a plane write also touches the CRTC it ends up on
+    for (int i = 0; i < kms->plane_count; i++)
+    {
+        int index = crtc_index(kms, (uint32_t)state.planes[i].values[PROP_CRTC_ID]);
+        if (index >= 0 && memcmp(state.planes[i].values, kms->state.planes[i].values, sizeof(state.planes[i].values)))
+            touched_crtcs |= 1u << index;
+    }
+
+    // so does a capture, on the CRTC the writeback connector ends up on
+    int writeback_index = -1;
+    if (state.writeback.values[PROP_WRITEBACK_FB_ID])
+    {
+        writeback_index = crtc_index(kms, (uint32_t)state.writeback.values[PROP_CONNECTOR_CRTC_ID]);
+        if (writeback_index >= 0)
+            touched_crtcs |= 1u << writeback_index;
+    }
+
+    uint32_t modeset_crtcs;
+    int ret = check_state(kms, &state, &kms->state, flags, &modeset_crtcs);
+    if (ret)
+        return ret;
+
+    // the previous flip has to be retired first. real drivers let blocking
+    // commits queue up behind it, here they fail just like nonblocking ones.
+    for (int i = 0; i < kms->outputs; i++)
+    {
+        if ((touched_crtcs & (1u << i)) && kms->state.crtcs[i].event_pending)
+            return fail(EBUSY);
+    }
+
+    if (flags & DRM_MODE_PAGE_FLIP_EVENT)
+    {
+        int active = 0;
+        for (int i = 0; i < kms->outputs; i++)
+            active |= (touched_crtcs & (1u << i)) && state.crtcs[i].values[PROP_ACTIVE];
+        if (!active)
+            return fail(EINVAL);
+    }
+
+    if (flags & DRM_MODE_ATOMIC_TEST_ONLY)
+        return 0;
+
+    uint64_t now = now_ns();
+    for (int i = 0; i < kms->outputs; i++)
+    {
+        struct fake_crtc *crtc = &state.crtcs[i];
+        if (modeset_crtcs & (1u << i))
+        {
+            crtc->period_ns = mode_period_ns(&crtc->mode);
+            crtc->vblank_base_ns = now;
+            crtc->last_vblank_ns = 0;
+            crtc->last_sequence = 0;
+        }
+        else if (crtc->values[PROP_VRR_ENABLED] < kms->state.crtcs[i].values[PROP_VRR_ENABLED] &&
+                 crtc->last_vblank_ns >= (uint64_t)crtc->last_sequence * crtc->period_ns)
+        {
+            // back to a fixed beat, counting on from the last variable one
+            crtc->vblank_base_ns = crtc->last_vblank_ns - (uint64_t)crtc->last_sequence * crtc->period_ns;
+        }
+        if (!(touched_crtcs & (1u << i)) || !crtc->values[PROP_ACTIVE])
+            continue;
+
+        // the new state latches at the next vblank
+        uint32_t sequence;
+        uint64_t vblank = next_vblank(kms, crtc, now, &sequence);
+        crtc->last_vblank_ns = vblank;
+        crtc->last_sequence = sequence;
+        if (vblank > *wait_until)
+            *wait_until = vblank;
+        if (flags & DRM_MODE_PAGE_FLIP_EVENT)
+        {
+            crtc->event_pending = 1;
+            crtc->event_ns = vblank;
+            crtc->event_sequence = sequence;
+            crtc->event_data = user_data;
+        }
+    }
+
+    // damage clips only apply to the commit that carried them
+    for (int i = 0; i < kms->plane_count; i++)
+        state.planes[i].values[PROP_FB_DAMAGE_CLIPS] = 0;
+
+    // and so does a writeback job, its fence signals when the frame latches
+    uint64_t *wb = state.writeback.values;
+    const struct fake_fb *capture = writeback_index >= 0 ? find_fb(kms, (uint32_t)wb[PROP_WRITEBACK_FB_ID]) : NULL;
+    int fence = -1;
+    if (capture && wb[PROP_WRITEBACK_OUT_FENCE_PTR])
+    {
+        fence = out_fence(state.crtcs[writeback_index].last_vblank_ns);
+        if (fence < 0)
+            return fail(-fence);
+        *(int32_t *)(uintptr_t)wb[PROP_WRITEBACK_OUT_FENCE_PTR] = fence;
+    }
+    wb[PROP_WRITEBACK_FB_ID] = wb[PROP_WRITEBACK_OUT_FENCE_PTR] = 0;
+
+    kms->state = state;
+    arm_timer(kms);
+    if (capture)
+        compose(kms, &kms->state, writeback_index, capture);
+
+    if (flags & DRM_MODE_ATOMIC_NONBLOCK)
+        *wait_until = 0;
+    return 0;
+}
+
+static int commit(struct fake_kms *kms, const struct kms_prop *props, int count, uint32_t flags, void *user_data)
+{
+    uint64_t wait_until;
+
+    pthread_mutex_lock(&kms->lock);
+    int ret = commit_locked(kms, props, count, flags, user_data, &wait_until);
+    pthread_mutex_unlock(&kms->lock);
+
+    // a blocking commit returns once the new state is on screen
+    if (!ret && wait_until)
+        sleep_until(wait_until);
+    return ret;
+}
+
+static int primary_plane(const struct fake_kms *kms, int crtc)
+{
+    for (int i = 0; i < kms->plane_count; i++)
+    {
+        const struct fake_plane *plane = &kms->state.planes[i];
+        if (plane->type == DRM_PLANE_TYPE_PRIMARY && (plane->possible_crtcs & (1u << crtc)))
+            return i;
+    }
+    return -1;
+}
+
+static void add_prop(struct kms_prop *props, int *count, uint32_t object_id, int prop, uint64_t value)
+{
+    props[*count].object_id = object_id;
+    props[*count].property_id = FAKE_PROP_BASE + prop;
+    props[*count].value = value;
+    (*count)++;
+}
+
+static void add_plane_props(struct kms_prop *props, int *count, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                            int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                            uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h)
+{
+    add_prop(props, count, plane_id, PROP_CRTC_ID, crtc_id);
+    add_prop(props, count, plane_id, PROP_FB_ID, fb_id);
+    add_prop(props, count, plane_id, PROP_CRTC_X, (uint64_t)(int64_t)crtc_x);
+    add_prop(props, count, plane_id, PROP_CRTC_Y, (uint64_t)(int64_t)crtc_y);
+    add_prop(props, count, plane_id, PROP_CRTC_W, crtc_w);
+    add_prop(props, count, plane_id, PROP_CRTC_H, crtc_h);
+    add_prop(props, count, plane_id, PROP_SRC_X, src_x);
+    add_prop(props, count, plane_id, PROP_SRC_Y, src_y);
+    add_prop(props, count, plane_id, PROP_SRC_W, src_w);
+    add_prop(props, count, plane_id, PROP_SRC_H, src_h);
+}
+
+static int fake_set_client_cap(struct kms_device *dev, uint64_t cap, uint64_t value)
+{
+    struct fake_kms *kms = dev->priv;
+
+    switch (cap)
+    {
+    case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+    case DRM_CLIENT_CAP_ASPECT_RATIO:
+        return value <= 1 ? 0 : fail(EINVAL);
+    case DRM_CLIENT_CAP_ATOMIC:
+        if (value > 1)
+            return fail(EINVAL);
+        kms->atomic = (int)value;
+        return 0;
+    case DRM_CLIENT_CAP_WRITEBACK_CONNECTORS:
+        // only atomic clients can use writeback connectors
+        if (value > 1 || !kms->atomic)
+            return fail(EINVAL);
+        kms->writeback_cap = (int)value;
+        return 0;
+    default:
+        return fail(EINVAL);
+    }
+}
+
+static int fake_get_cap(struct kms_device *dev, uint64_t cap, uint64_t *value)
+{
+    switch (cap)
+    {
+    case DRM_CAP_DUMB_BUFFER:
+    case DRM_CAP_TIMESTAMP_MONOTONIC:
+    case DRM_CAP_ADDFB2_MODIFIERS:
+    case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+        *value = 1;
+        return 0;
+    case DRM_CAP_DUMB_PREFERRED_DEPTH:
+        *value = 24;
+        return 0;
+    case DRM_CAP_CURSOR_WIDTH:
+    case DRM_CAP_CURSOR_HEIGHT:
+        *value = FAKE_CURSOR_SIZE;
+        return 0;
+    case DRM_CAP_PRIME:
+    case DRM_CAP_ASYNC_PAGE_FLIP:
+        *value = 0;
+        return 0;
+    default:
+        return fail(EINVAL);
+    }
+}
+
+static uint32_t *copy_ids(uint32_t base, int count)
+{
+    uint32_t *ids = malloc(sizeof(*ids) * (count ? count : 1));
+    for (int i = 0; ids && i < count; i++)
+        ids[i] = base + i;
+    return ids;
+}
+
+static drmModeRes *fake_get_resources(struct kms_device *dev)
+{
+    struct fake_kms *kms = dev->priv;
+    drmModeRes *res = calloc(1, sizeof(*res));
+    if (!res)
+        return NULL;
+
+    pthread_mutex_lock(&kms->lock);
+    res->fbs = malloc(sizeof(uint32_t) * FAKE_MAX_FBS);
+    for (int i = 0; res->fbs && i < FAKE_MAX_FBS; i++)
+    {
+        if (kms->fbs[i].id)
+            res->fbs[res->count_fbs++] = kms->fbs[i].id;
+    }
+    int writeback = kms->writeback && kms->writeback_cap;
+    res->count_crtcs = kms->outputs;
+    res->count_connectors = res->count_encoders = kms->outputs + writeback;
+    res->crtcs = copy_ids(FAKE_CRTC_BASE, kms->outputs);
+    res->connectors = copy_ids(FAKE_CONNECTOR_BASE, kms->outputs + writeback);
+    res->encoders = copy_ids(FAKE_ENCODER_BASE, kms->outputs + writeback);
+    if (writeback && res->connectors && res->encoders)
+    {
+        res->connectors[kms->outputs] = FAKE_WRITEBACK_ID;
+        res->encoders[kms->outputs] = FAKE_ENCODER_BASE + FAKE_MAX_OUTPUTS;
+    }
+    res->max_width = FAKE_MAX_SIZE;
+    res->max_height = FAKE_MAX_SIZE;
+    pthread_mutex_unlock(&kms->lock);
+
+    if (!res->fbs || !res->crtcs || !res->connectors || !res->encoders)
+    {
+        drmModeFreeResources(res);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return res;
+}
+
+static void fill_props(const int *list, int count, const uint64_t *values, uint32_t **props, uint64_t **prop_values)
+{
+    *props = malloc(sizeof(**props) * count);
+    *prop_values = malloc(sizeof(**prop_values) * count);
+    for (int i = 0; *props && *prop_values && i < count; i++)
+    {
+        (*props)[i] = FAKE_PROP_BASE + list[i];
+        (*prop_values)[i] = values[list[i]];
+    }
+}
+
+static drmModeConnector *fake_get_connector(struct kms_device *dev, uint32_t connector_id)
+{
+    struct fake_kms *kms = dev->priv;
+    int index = (int)connector_id - FAKE_CONNECTOR_BASE;
+    int writeback = connector_id == FAKE_WRITEBACK_ID && kms->writeback && kms->writeback_cap;
+    if (index < 0 || (index >= kms->outputs && !writeback))
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeConnector *connector = calloc(1, sizeof(*connector));
+    if (!connector)
+        return NULL;
+
+    // the writeback connector has no modes, the CRTC it is on decides the size
+    pthread_mutex_lock(&kms->lock);
+    const struct fake_connector *fc = writeback ? &kms->state.writeback : &kms->state.connectors[index];
+    const int *list = writeback ? writeback_prop_list : connector_prop_list;
+    connector->connector_id = connector_id;
+    connector->encoder_id = fc->values[PROP_CONNECTOR_CRTC_ID] ? FAKE_ENCODER_BASE + index : 0;
+    connector->connector_type = writeback ? DRM_MODE_CONNECTOR_WRITEBACK : DRM_MODE_CONNECTOR_VIRTUAL;
+    connector->connector_type_id = writeback ? 1 : index + 1;
+    connector->connection = DRM_MODE_CONNECTED;
+    connector->mmWidth = fc->modes[0].hdisplay * 254 / 960; // 96 dpi
+    connector->mmHeight = fc->modes[0].vdisplay * 254 / 960;
+    connector->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+    connector->count_modes = fc->mode_count;
+    connector->modes = malloc(sizeof(drmModeModeInfo) * (fc->mode_count ? fc->mode_count : 1));
+    if (connector->modes)
+        memcpy(connector->modes, fc->modes, sizeof(drmModeModeInfo) * fc->mode_count);
+    connector->count_props = writeback ? sizeof(writeback_prop_list) / sizeof(writeback_prop_list[0])
+                                       : sizeof(connector_prop_list) / sizeof(connector_prop_list[0]);
+    fill_props(list, connector->count_props, fc->values, &connector->props, &connector->prop_values);
+    connector->count_encoders = 1;
+    connector->encoders = copy_ids(FAKE_ENCODER_BASE + index, 1);
+    pthread_mutex_unlock(&kms->lock);
+
+    if (!connector->modes || !connector->props || !connector->prop_values || !connector->encoders)
+    {
+        drmModeFreeConnector(connector);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return connector;
+}
+
+static drmModeEncoder *fake_get_encoder(struct kms_device *dev, uint32_t encoder_id)
+{
+    struct fake_kms *kms = dev->priv;
+    int index = (int)encoder_id - FAKE_ENCODER_BASE;
+    int writeback = index == FAKE_MAX_OUTPUTS && kms->writeback && kms->writeback_cap;
+    if (index < 0 || (index >= kms->outputs && !writeback))
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeEncoder *encoder = calloc(1, sizeof(*encoder));
+    if (!encoder)
+        return NULL;
+
+    pthread_mutex_lock(&kms->lock);
+    const struct fake_connector *fc = writeback ? &kms->state.writeback : &kms->state.connectors[index];
+    encoder->encoder_id = encoder_id;
+    encoder->encoder_type = DRM_MODE_ENCODER_VIRTUAL;
+    encoder->crtc_id = (uint32_t)fc->values[PROP_CONNECTOR_CRTC_ID];
+    encoder->possible_crtcs = fc->possible_crtcs;
+    pthread_mutex_unlock(&kms->lock);
+    return encoder;
+}
+
+static drmModeCrtc *fake_get_crtc(struct kms_device *dev, uint32_t crtc_id)
+{
+    struct fake_kms *kms = dev->priv;
+    int index = crtc_index(kms, crtc_id);
+    if (index < 0)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeCrtc *crtc = calloc(1, sizeof(*crtc));
+    if (!crtc)
+        return NULL;
+
+    pthread_mutex_lock(&kms->lock);
+    const struct fake_crtc *fc = &kms->state.crtcs[index];
+    int primary = primary_plane(kms, index);
+    crtc->crtc_id = crtc_id;
+    crtc->buffer_id = primary >= 0 ? (uint32_t)kms->state.planes[primary].values[PROP_FB_ID] : 0;
+    crtc->mode_valid = fc->values[PROP_ACTIVE] ? 1 : 0;
+    if (crtc->mode_valid)
+    {
+        crtc->mode = fc->mode;
+        crtc->width = fc->mode.hdisplay;
+        crtc->height = fc->mode.vdisplay;
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return crtc;
+}
+
+static drmModePlaneRes *fake_get_plane_resources(struct kms_device *dev)
+{
+    struct fake_kms *kms = dev->priv;
+    drmModePlaneRes *res = calloc(1, sizeof(*res));
+    if (!res)
+        return NULL;
+
+    res->count_planes = kms->plane_count;
+    res->planes = copy_ids(FAKE_PLANE_BASE, kms->plane_count);
+    if (!res->planes)
+    {
+        drmModeFreePlaneResources(res);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return res;
+}
+
+static drmModePlane *fake_get_plane(struct kms_device *dev, uint32_t plane_id)
+{
+    struct fake_kms *kms = dev->priv;
+    int index = (int)plane_id - FAKE_PLANE_BASE;
+    if (index < 0 || index >= kms->plane_count)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModePlane *plane = calloc(1, sizeof(*plane));
+    if (!plane)
+        return NULL;
+
+    pthread_mutex_lock(&kms->lock);
+    const struct fake_plane *fp = &kms->state.planes[index];
+    plane->count_formats = fp->format_count;
+    plane->formats = malloc(sizeof(uint32_t) * fp->format_count);
+    if (plane->formats)
+        memcpy(plane->formats, fp->formats, sizeof(uint32_t) * fp->format_count);
+    plane->plane_id = plane_id;
+    plane->crtc_id = (uint32_t)fp->values[PROP_CRTC_ID];
+    plane->fb_id = (uint32_t)fp->values[PROP_FB_ID];
+    plane->crtc_x = (uint32_t)fp->values[PROP_CRTC_X];
+    plane->crtc_y = (uint32_t)fp->values[PROP_CRTC_Y];
+    plane->x = (uint32_t)(fp->values[PROP_SRC_X] >> 16);
+    plane->y = (uint32_t)(fp->values[PROP_SRC_Y] >> 16);
+    plane->possible_crtcs = fp->possible_crtcs;
+    pthread_mutex_unlock(&kms->lock);
+
+    if (!plane->formats)
+    {
+        drmModeFreePlane(plane);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return plane;
+}
+
+static drmModeObjectProperties *fake_get_object_properties(struct kms_device *dev, uint32_t object_id, uint32_t object_type)
+{
+    struct fake_kms *kms = dev->priv;
+    drmModeObjectProperties *props = calloc(1, sizeof(*props));
+    if (!props)
+        return NULL;
+
+    pthread_mutex_lock(&kms->lock);
+    const int *list;
+    int count;
+    uint64_t *values = object_values(&kms->state, kms, object_id, object_type, &list, &count);
+    if (values)
+    {
+        props->count_props = count;
+        fill_props(list, count, values, &props->props, &props->prop_values);
+    }
+    pthread_mutex_unlock(&kms->lock);
+
+    if (!values || !props->props || !props->prop_values)
+    {
+        drmModeFreeObjectProperties(props);
+        errno = values ? ENOMEM : ENOENT;
+        return NULL;
+    }
+    return props;
+}
+
+static drmModePropertyRes *fake_get_property(struct kms_device *dev, uint32_t property_id)
+{
+    int index = (int)property_id - FAKE_PROP_BASE;
+    if (index < 0 || index >= PROP_COUNT)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    const struct prop_def *def = &prop_defs[index];
+    drmModePropertyRes *prop = calloc(1, sizeof(*prop));
+    if (!prop)
+        return NULL;
+
+    prop->prop_id = property_id;
+    prop->flags = def->flags;
+    snprintf(prop->name, sizeof(prop->name), "%s", def->name);
+
+    if (def->flags & (DRM_MODE_PROP_RANGE | DRM_MODE_PROP_SIGNED_RANGE))
+    {
+        prop->count_values = 2;
+        prop->values = malloc(sizeof(uint64_t) * 2);
+        if (prop->values)
+        {
+            prop->values[0] = (uint64_t)def->min;
+            prop->values[1] = (uint64_t)def->max;
+        }
+    }
+    else if (def->flags & DRM_MODE_PROP_OBJECT)
+    {
+        prop->count_values = 1;
+        prop->values = malloc(sizeof(uint64_t));
+        if (prop->values)
+            prop->values[0] = def->object_type;
+    }
+    else if (index == PROP_TYPE)
+    {
+        static const char *const names[] = {"Overlay", "Primary", "Cursor"};
+        prop->count_values = prop->count_enums = 3;
+        prop->values = malloc(sizeof(uint64_t) * 3);
+        prop->enums = calloc(3, sizeof(*prop->enums));
+        for (int i = 0; prop->values && prop->enums && i < 3; i++)
+        {
+            prop->values[i] = i;
+            prop->enums[i].value = i;
+            snprintf(prop->enums[i].name, sizeof(prop->enums[i].name), "%s", names[i]);
+        }
+        if (!prop->enums)
+        {
+            drmModeFreeProperty(prop);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    if (prop->count_values && !prop->values)
+    {
+        drmModeFreeProperty(prop);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return prop;
+}
+
+static drmModePropertyBlobRes *fake_get_property_blob(struct kms_device *dev, uint32_t blob_id)
+{
+    struct fake_kms *kms = dev->priv;
+    drmModePropertyBlobRes *res = calloc(1, sizeof(*res));
+    if (!res)
+        return NULL;
+
+    pthread_mutex_lock(&kms->lock);
+    struct fake_blob *blob = find_blob(kms, blob_id);
+    if (blob)
+    {
+        res->id = blob_id;
+        res->length = blob->size;
+        res->data = malloc(blob->size ? blob->size : 1);
+        if (res->data)
+            memcpy(res->data, blob->data, blob->size);
+    }
+    pthread_mutex_unlock(&kms->lock);
+
+    if (!blob || !res->data)
+    {
+        drmModeFreePropertyBlob(res);
+        errno = blob ? ENOMEM : ENOENT;
+        return NULL;
+    }
+    return res;
+}
+
+static int fake_create_property_blob(struct kms_device *dev, const void *data, size_t size, uint32_t *blob_id)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    int ret = blob_create(kms, data, size, blob_id);
+    pthread_mutex_unlock(&kms->lock);
+    return ret;
+}
+
+static int fake_destroy_property_blob(struct kms_device *dev, uint32_t blob_id)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    struct fake_blob *blob = find_blob(kms, blob_id);
+    if (blob)
+    {
+        // committed state keeps its own reference in the kernel, here the
+        // mode has already been copied into the CRTC so dropping it is fine
+        free(blob->data);
+        memset(blob, 0, sizeof(*blob));
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return blob ? 0 : fail(ENOENT);
+}
+
+static int fake_create_dumb(struct kms_device *dev, struct drm_mode_create_dumb *create)
+{
+    struct fake_kms *kms = dev->priv;
+
+    if (!create->width || !create->height || create->width > FAKE_MAX_SIZE || create->height > FAKE_MAX_SIZE ||
+        !create->bpp || create->bpp % 8)
+        return fail(EINVAL);
+
+    uint32_t pitch = (create->width * (create->bpp / 8) + 63) & ~63u;
+    uint64_t size = ((uint64_t)pitch * create->height + 4095) & ~4095ull;
+
+    int memfd = memfd_create("fake-kms-dumb", MFD_CLOEXEC);
+    if (memfd < 0)
+        return -errno;
+    if (ftruncate(memfd, (off_t)size))
+    {
+        int err = errno;
+        close(memfd);
+        return fail(err);
+    }
+
+    pthread_mutex_lock(&kms->lock);
+    for (int i = 0; i < FAKE_MAX_DUMBS; i++)
+    {
+        if (kms->dumbs[i].handle)
+            continue;
+
+        kms->dumbs[i].handle = kms->next_handle++;
+        kms->dumbs[i].memfd = memfd;
+        kms->dumbs[i].size = size;
+        create->handle = kms->dumbs[i].handle;
+        create->pitch = pitch;
+        create->size = size;
+        pthread_mutex_unlock(&kms->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&kms->lock);
+
+    close(memfd);
+    return fail(ENOSPC);
+}
+
+static void *fake_map_dumb(struct kms_device *dev, uint32_t handle, uint64_t size)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    struct fake_dumb *dumb = find_dumb(kms, handle);
+    int memfd = dumb && size <= dumb->size ? dumb->memfd : -1;
+    pthread_mutex_unlock(&kms->lock);
+
+    if (memfd < 0)
+    {
+        errno = dumb ? EINVAL : ENOENT;
+        return MAP_FAILED;
+    }
+    return mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+}
+
+static int fake_destroy_dumb(struct kms_device *dev, uint32_t handle)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    struct fake_dumb *dumb = find_dumb(kms, handle);
+    if (dumb)
+    {
+        // existing maps keep the pages alive, like a GEM object with a mapping
+        close(dumb->memfd);
+        memset(dumb, 0, sizeof(*dumb));
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return dumb ? 0 : fail(ENOENT);
+}
+
+// the buffer behind prime_fd becomes a handle like a dumb buffer's
+static int fake_prime_fd_to_handle(struct kms_device *dev, int prime_fd, uint32_t *handle)
+{
+    struct fake_kms *kms = dev->priv;
+    struct stat st;
+
+    if (fstat(prime_fd, &st))
+        return -errno;
+    off_t size = lseek(prime_fd, 0, SEEK_END);
+    if (size <= 0)
+        return fail(EINVAL);
+
+    pthread_mutex_lock(&kms->lock);
+    for (int i = 0; i < FAKE_MAX_DUMBS; i++)
+    {
+        if (kms->dumbs[i].handle && kms->dumbs[i].ino == st.st_ino && kms->dumbs[i].dev == st.st_dev)
+        {
+            *handle = kms->dumbs[i].handle;
+            pthread_mutex_unlock(&kms->lock);
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < FAKE_MAX_DUMBS; i++)
+    {
+        if (kms->dumbs[i].handle)
+            continue;
+
+        int fd = fcntl(prime_fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0)
+            break;
+        kms->dumbs[i].handle = kms->next_handle++;
+        kms->dumbs[i].memfd = fd;
+        kms->dumbs[i].size = (uint64_t)size;
+        kms->dumbs[i].dev = st.st_dev;
+        kms->dumbs[i].ino = st.st_ino;
+        *handle = kms->dumbs[i].handle;
+        pthread_mutex_unlock(&kms->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return fail(ENOSPC);
+}
+
+// a dumb buffer's memfd stands in for its dma-buf, importing it again finds the same handle
+static int fake_prime_handle_to_fd(struct kms_device *dev, uint32_t handle, int *prime_fd)
+{
+    struct fake_kms *kms = dev->priv;
+    struct stat st;
+
+    pthread_mutex_lock(&kms->lock);
+    struct fake_dumb *dumb = find_dumb(kms, handle);
+    int fd = dumb ? fcntl(dumb->memfd, F_DUPFD_CLOEXEC, 0) : -1;
+    int err = dumb ? errno : ENOENT;
+    if (fd >= 0 && !fstat(fd, &st))
+    {
+        dumb->dev = st.st_dev;
+        dumb->ino = st.st_ino;
+    }
+    pthread_mutex_unlock(&kms->lock);
+
+    if (fd < 0)
+        return fail(err);
+    *prime_fd = fd;
+    return 0;
+}
+
+static int fake_add_fb2(struct kms_device *dev, uint32_t width, uint32_t height, uint32_t format,
+                        const uint32_t handles[4], const uint32_t pitches[4], const uint32_t offsets[4],
+                        const uint64_t modifiers[4], uint32_t flags, uint32_t *fb_id)
+{
+    struct fake_kms *kms = dev->priv;
+    uint32_t cpp = format_cpp(format);
+    int plane_count = format == DRM_FORMAT_NV12 ? 2 : 1;
+
+    if (!cpp || !width || !height || (plane_count == 2 && (width % 2 || height % 2)))
+        return fail(EINVAL);
+    for (int i = plane_count; i < 4; i++)
+    {
+        if (handles[i])
+            return fail(EINVAL);
+    }
+
+    uint64_t modifier = flags & DRM_MODE_FB_MODIFIERS ? modifiers[0] : DRM_FORMAT_MOD_LINEAR;
+    uint32_t tile_w = 0, tile_h = 1;
+    int tiled = tile_size(modifier, &tile_w, &tile_h);
+    if (tiled < 0 || (tiled && (!kms->tiled || cpp != 4)))
+        return fail(EINVAL);
+
+    pthread_mutex_lock(&kms->lock);
+    for (int i = 0; i < plane_count; i++)
+    {
+        // both NV12 planes are width bytes wide, the chroma plane half as tall
+        uint32_t rows = i ? height / 2 : height;
+        rows = (rows + tile_h - 1) / tile_h * tile_h;
+        struct fake_dumb *dumb = find_dumb(kms, handles[i]);
+        if (!dumb || pitches[i] < width * cpp || offsets[i] + (uint64_t)pitches[i] * rows > dumb->size ||
+            ((flags & DRM_MODE_FB_MODIFIERS) && modifiers[i] != modifier) || (tiled && pitches[i] % tile_w))
+        {
+            pthread_mutex_unlock(&kms->lock);
+            return fail(dumb ? EINVAL : ENOENT);
+        }
+    }
+
+    for (int i = 0; i < FAKE_MAX_FBS; i++)
+    {
+        if (kms->fbs[i].id)
+            continue;
+
+        struct fake_fb *fb = &kms->fbs[i];
+        fb->id = kms->next_object++;
+        fb->handle = handles[0];
+        fb->width = width;
+        fb->height = height;
+        fb->pitch = pitches[0];
+        fb->format = format;
+        fb->modifier = modifier;
+        *fb_id = fb->id;
+        pthread_mutex_unlock(&kms->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return fail(ENOSPC);
+}
+
+static int fake_add_fb(struct kms_device *dev, uint32_t width, uint32_t height, uint8_t depth, uint8_t bpp,
+                       uint32_t pitch, uint32_t handle, uint32_t *fb_id)
+{
+    uint32_t handles[4] = {handle}, pitches[4] = {pitch}, offsets[4] = {0};
+    uint32_t format;
+
+    if (depth == 24 && bpp == 32)
+        format = DRM_FORMAT_XRGB8888;
+    else if (depth == 32 && bpp == 32)
+        format = DRM_FORMAT_ARGB8888;
+    else if (depth == 30 && bpp == 32)
+        format = DRM_FORMAT_XRGB2101010;
+    else if (depth == 16 && bpp == 16)
+        format = DRM_FORMAT_RGB565;
+    else
+        return fail(EINVAL);
+
+    return fake_add_fb2(dev, width, height, format, handles, pitches, offsets, NULL, 0, fb_id);
+}
+
+static int fake_rm_fb(struct kms_device *dev, uint32_t fb_id)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    struct fake_fb *fb = find_fb(kms, fb_id);
+    if (fb)
+    {
+        // like the kernel, removing a framebuffer that is still shown turns its plane off
+        for (int i = 0; i < kms->plane_count; i++)
+        {
+            uint64_t *v = kms->state.planes[i].values;
+            if (v[PROP_FB_ID] == fb_id)
+                v[PROP_FB_ID] = v[PROP_CRTC_ID] = 0;
+        }
+        memset(fb, 0, sizeof(*fb));
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return fb ? 0 : fail(ENOENT);
+}
+
+static int fake_dirty_fb(struct kms_device *dev, uint32_t fb_id, drmModeClip *clips, uint32_t count)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    int found = find_fb(kms, fb_id) != NULL;
+    pthread_mutex_unlock(&kms->lock);
+    return found ? 0 : fail(ENOENT);
+}
+
+static int fake_set_crtc(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y,
+                         uint32_t *connectors, int count, drmModeModeInfo *mode)
+{
+    struct fake_kms *kms = dev->priv;
+    struct kms_prop props[16 + FAKE_MAX_OUTPUTS];
+    int n = 0;
+
+    int index = crtc_index(kms, crtc_id);
+    if (index < 0 || count > FAKE_MAX_OUTPUTS)
+        return fail(index < 0 ? ENOENT : EINVAL);
+
+    pthread_mutex_lock(&kms->lock);
+    int primary = primary_plane(kms, index);
+    uint32_t mode_blob = 0;
+    if (mode && fb_id)
+    {
+        int ret = blob_create(kms, mode, sizeof(*mode), &mode_blob);
+        if (ret)
+        {
+            pthread_mutex_unlock(&kms->lock);
+            return ret;
+        }
+    }
+
+    add_prop(props, &n, crtc_id, PROP_MODE_ID, mode_blob);
+    add_prop(props, &n, crtc_id, PROP_ACTIVE, mode_blob ? 1 : 0);
+    for (int i = 0; i < kms->outputs; i++)
+    {
+        // connectors left off the list are detached from this CRTC
+        uint32_t connector_id = FAKE_CONNECTOR_BASE + i;
+        int listed = 0;
+        for (int c = 0; c < count; c++)
+            listed |= connectors[c] == connector_id;
+        if (listed && mode_blob)
+            add_prop(props, &n, connector_id, PROP_CONNECTOR_CRTC_ID, crtc_id);
+        else if (kms->state.connectors[i].values[PROP_CONNECTOR_CRTC_ID] == crtc_id)
+            add_prop(props, &n, connector_id, PROP_CONNECTOR_CRTC_ID, 0);
+    }
+    if (mode_blob)
+        add_plane_props(props, &n, FAKE_PLANE_BASE + primary, crtc_id, fb_id, 0, 0, mode->hdisplay, mode->vdisplay,
+                        x << 16, y << 16, (uint32_t)mode->hdisplay << 16, (uint32_t)mode->vdisplay << 16);
+    else
+        add_plane_props(props, &n, FAKE_PLANE_BASE + primary, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    uint64_t wait_until;
+    int ret = commit_locked(kms, props, n, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL, &wait_until);
+
+    // the committed CRTC has its own copy of the mode, the legacy blob is internal
+    struct fake_blob *blob = find_blob(kms, mode_blob);
+    if (blob)
+    {
+        free(blob->data);
+        memset(blob, 0, sizeof(*blob));
+    }
+    pthread_mutex_unlock(&kms->lock);
+
+    if (!ret && wait_until)
+        sleep_until(wait_until);
+    return ret;
+}
+
+static int fake_set_plane(struct kms_device *dev, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                          int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                          uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h)
+{
+    struct fake_kms *kms = dev->priv;
+    struct kms_prop props[10];
+    int n = 0;
+
+    if (!fb_id)
+        crtc_id = 0;
+    add_plane_props(props, &n, plane_id, crtc_id, fb_id, crtc_x, crtc_y, crtc_w, crtc_h, src_x, src_y, src_w, src_h);
+    return commit(kms, props, n, 0, NULL);
+}
+
+static int fake_page_flip(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *user_data)
+{
+    struct fake_kms *kms = dev->priv;
+    struct kms_prop props[1];
+    int n = 0;
+
+    int index = crtc_index(kms, crtc_id);
+    if (index < 0)
+        return fail(ENOENT);
+    if (flags & DRM_MODE_PAGE_FLIP_ASYNC)
+        return fail(EINVAL);
+
+    add_prop(props, &n, FAKE_PLANE_BASE + primary_plane(kms, index), PROP_FB_ID, fb_id);
+    return commit(kms, props, n, DRM_MODE_ATOMIC_NONBLOCK | (flags & DRM_MODE_PAGE_FLIP_EVENT), user_data);
+}
+
+// legacy cursor ioctls take effect right away, they never wait for a flip
+static int fake_set_cursor2(struct kms_device *dev, uint32_t crtc_id, uint32_t handle, uint32_t width, uint32_t height,
+                            int32_t hot_x, int32_t hot_y)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    int index = crtc_index(kms, crtc_id);
+    int ret = 0;
+    if (index < 0)
+        ret = fail(ENOENT);
+    else if (handle && (width > FAKE_CURSOR_SIZE || height > FAKE_CURSOR_SIZE))
+        ret = fail(EINVAL);
+    else if (handle && (!find_dumb(kms, handle) || find_dumb(kms, handle)->size < (uint64_t)width * height * 4))
+        ret = fail(ENOENT);
+    else
+        kms->state.crtcs[index].cursor_handle = handle; // the hotspot only matters to virtual drivers
+    pthread_mutex_unlock(&kms->lock);
+    return ret;
+}
+
+static int fake_move_cursor(struct kms_device *dev, uint32_t crtc_id, int32_t x, int32_t y)
+{
+    struct fake_kms *kms = dev->priv;
+
+    pthread_mutex_lock(&kms->lock);
+    int index = crtc_index(kms, crtc_id);
+    if (index >= 0)
+    {
+        kms->state.crtcs[index].cursor_x = x;
+        kms->state.crtcs[index].cursor_y = y;
+    }
+    pthread_mutex_unlock(&kms->lock);
+    return index < 0 ? fail(ENOENT) : 0;
+}
+
+static int fake_atomic_commit(struct kms_device *dev, const struct kms_prop *props, int count, uint32_t flags, void *user_data)
+{
+    struct fake_kms *kms = dev->priv;
+
+    if (!kms->atomic)
+        return fail(EOPNOTSUPP);
+    return commit(kms, props, count, flags, user_data);
+}
+
+// deliver every flip whose vblank has passed, handlers run without the lock
+// so they are free to queue the next commit
+static int fake_handle_event(struct kms_device *dev, drmEventContext *ev)
+{
+    struct fake_kms *kms = dev->priv;
+    struct
+    {
+        uint32_t crtc_id;
+        uint32_t sequence;
+        uint64_t ns;
+        void *data;
+    } events[FAKE_MAX_OUTPUTS];
+    int count = 0;
+    uint64_t expirations;
+
+    if (read(kms->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        return -1;
+
+    pthread_mutex_lock(&kms->lock);
+    uint64_t now = now_ns();
+    for (int i = 0; i < kms->outputs; i++)
+    {
+        struct fake_crtc *crtc = &kms->state.crtcs[i];
+        if (!crtc->event_pending || crtc->event_ns > now)
+            continue;
+
+        events[count].crtc_id = crtc->id;
+        events[count].sequence = crtc->event_sequence;
+        events[count].ns = crtc->event_ns;
+        events[count].data = crtc->event_data;
+        count++;
+        crtc->event_pending = 0;
+    }
+    arm_timer(kms);
+    pthread_mutex_unlock(&kms->lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int sec = (unsigned int)(events[i].ns / 1000000000ull);
+        unsigned int usec = (unsigned int)(events[i].ns % 1000000000ull / 1000);
+        if (ev->version >= 3 && ev->page_flip_handler2)
+            ev->page_flip_handler2(kms->timer_fd, events[i].sequence, sec, usec, events[i].crtc_id, events[i].data);
+        else if (ev->page_flip_handler)
+            ev->page_flip_handler(kms->timer_fd, events[i].sequence, sec, usec, events[i].data);
+    }
+    return 0;
+}
+
+static void fake_close(struct kms_device *dev)
+{
+    struct fake_kms *kms = dev->priv;
+
+    for (int i = 0; i < FAKE_MAX_DUMBS; i++)
+    {
+        if (kms->dumbs[i].handle)
+            close(kms->dumbs[i].memfd);
+    }
+    for (int i = 0; i < FAKE_MAX_BLOBS; i++)
+        free(kms->blobs[i].data);
+    pthread_mutex_destroy(&kms->lock);
+    free(kms);
+}
+
+static const struct kms_ops fake_ops = {
+    .name = "fake",
+    .close = fake_close,
+    .set_client_cap = fake_set_client_cap,
+    .get_cap = fake_get_cap,
+    .get_resources = fake_get_resources,
+    .get_connector = fake_get_connector,
+    .get_connector_current = fake_get_connector, // nothing to probe
+    .get_encoder = fake_get_encoder,
+    .get_crtc = fake_get_crtc,
+    .get_plane_resources = fake_get_plane_resources,
+    .get_plane = fake_get_plane,
+    .get_object_properties = fake_get_object_properties,
+    .get_property = fake_get_property,
+    .get_property_blob = fake_get_property_blob,
+    .create_property_blob = fake_create_property_blob,
+    .destroy_property_blob = fake_destroy_property_blob,
+    .create_dumb = fake_create_dumb,
+    .map_dumb = fake_map_dumb,
+    .destroy_dumb = fake_destroy_dumb,
+    .prime_fd_to_handle = fake_prime_fd_to_handle,
+    .prime_handle_to_fd = fake_prime_handle_to_fd,
+    .close_handle = fake_destroy_dumb,
+    .add_fb = fake_add_fb,
+    .add_fb2 = fake_add_fb2,
+    .rm_fb = fake_rm_fb,
+    .dirty_fb = fake_dirty_fb,
+    .set_crtc = fake_set_crtc,
+    .set_plane = fake_set_plane,
+    .page_flip = fake_page_flip,
+    .set_cursor2 = fake_set_cursor2,
+    .move_cursor = fake_move_cursor,
+    .atomic_commit = fake_atomic_commit,
+    .handle_event = fake_handle_event,
+};
+
+// IN_FORMATS blob: every format is offered linear, with "tiled" the 32bpp
+// ones of primary and overlay planes X- and Y-tiled too
+static int add_in_formats(struct fake_kms *kms, struct fake_plane *plane)
+{
+    struct
+    {
+        struct drm_format_modifier_blob hdr;
+        uint32_t formats[sizeof(overlay_formats) / sizeof(overlay_formats[0])];
+        struct drm_format_modifier modifiers[3];
+    } blob = {0};
+
+    blob.hdr.version = FORMAT_BLOB_CURRENT;
+    blob.hdr.count_formats = plane->format_count;
+    blob.hdr.formats_offset = offsetof(__typeof__(blob), formats);
+    blob.hdr.count_modifiers = 1;
+    blob.hdr.modifiers_offset = offsetof(__typeof__(blob), modifiers);
+    memcpy(blob.formats, plane->formats, sizeof(uint32_t) * plane->format_count);
+    blob.modifiers[0].formats = (1ull << plane->format_count) - 1;
+    blob.modifiers[0].modifier = DRM_FORMAT_MOD_LINEAR;
+
+    uint64_t tileable = 0;
+    for (uint32_t i = 0; i < plane->format_count; i++)
+    {
+        if (format_cpp(plane->formats[i]) == 4)
+            tileable |= 1ull << i;
+    }
+    if (kms->tiled && plane->type != DRM_PLANE_TYPE_CURSOR && tileable)
+    {
+        blob.modifiers[1].formats = blob.modifiers[2].formats = tileable;
+        blob.modifiers[1].modifier = I915_FORMAT_MOD_X_TILED;
+        blob.modifiers[2].modifier = I915_FORMAT_MOD_Y_TILED;
+        blob.hdr.count_modifiers = 3;
+    }
+
+    uint32_t id = 0;
+    int ret = blob_create(kms, &blob, sizeof(blob), &id);
+    plane->values[PROP_IN_FORMATS] = id;
+    return ret;
+}
+
+static void add_plane(struct fake_kms *kms, uint32_t type, uint32_t possible_crtcs)
+{
+    struct fake_plane *plane = &kms->state.planes[kms->plane_count];
+    plane->id = FAKE_PLANE_BASE + kms->plane_count;
+    plane->type = type;
+    plane->possible_crtcs = possible_crtcs;
+    if (type == DRM_PLANE_TYPE_CURSOR)
+    {
+        plane->formats = cursor_formats;
+        plane->format_count = 1;
+    }
+    else if (type == DRM_PLANE_TYPE_OVERLAY)
+    {
+        plane->formats = overlay_formats;
+        plane->format_count = sizeof(overlay_formats) / sizeof(overlay_formats[0]);
+    }
+    else
+    {
+        plane->formats = plane_formats;
+        plane->format_count = sizeof(plane_formats) / sizeof(plane_formats[0]);
+    }
+    plane->values[PROP_TYPE] = type;
+    plane->values[PROP_ZPOS] = kms->plane_count;
+    plane->values[PROP_ALPHA] = 0xFFFF;
+    kms->plane_count++;
+}
+
+// length of keyword if the mode list entry at p is it, 0 otherwise
+static int list_keyword(const char *p, const char *keyword)
+{
+    size_t len = strlen(keyword);
+    return strncmp(p, keyword, len) == 0 && (p[len] == ',' || !p[len]) ? (int)len : 0;
+}
+
+// modes is "WxH[@R][,WxH[@R]...]", one output per entry
+int kms_fake_open(const char *modes)
+{
+    if (!modes || !*modes)
+        modes = FAKE_DEFAULT_MODE;
+
+    struct fake_kms *kms = calloc(1, sizeof(*kms));
+    if (!kms)
+        return -ENOMEM;
+    pthread_mutex_init(&kms->lock, NULL);
+    kms->next_handle = 1;
+    kms->next_object = FAKE_OBJECT_BASE;
+
+    const char *p = modes;
+    while (*p && kms->outputs < FAKE_MAX_OUTPUTS)
+    {
+        int scale = list_keyword(p, "scale"), vrr = list_keyword(p, "vrr"), tiled = list_keyword(p, "tiled");
+        int writeback = list_keyword(p, "writeback");
+        if (scale || vrr || tiled || writeback)
+        {
+            kms->scaler |= scale > 0;
+            kms->vrr |= vrr > 0;
+            kms->tiled |= tiled > 0;
+            kms->writeback |= writeback > 0;
+            p += scale + vrr + tiled + writeback;
+            if (*p == ',')
+                p++;
+            if (!*p && !kms->outputs)
+                p = FAKE_DEFAULT_MODE;
+            continue;
+        }
+
+        unsigned int width, height, refresh = 60;
+        int used = 0;
+        if (sscanf(p, "%ux%u%n@%u%n", &width, &height, &used, &refresh, &used) < 2 ||
+            !width || !height || width > FAKE_MAX_SIZE || height > FAKE_MAX_SIZE || !refresh)
+        {
+            fprintf(stderr, "Bad fake KMS mode list: %s\n", modes);
+            fake_close(&(struct kms_device){.priv = kms});
+            return -EINVAL;
+        }
+        p += used;
+        if (*p == ',')
+            p++;
+
+        int i = kms->outputs++;
+        struct fake_crtc *crtc = &kms->state.crtcs[i];
+        crtc->id = FAKE_CRTC_BASE + i;
+        crtc->period_ns = 1000000000ull / refresh;
+
+        // the requested mode is preferred, a couple of common ones follow
+        struct fake_connector *connector = &kms->state.connectors[i];
+        connector->id = FAKE_CONNECTOR_BASE + i;
+        connector->possible_crtcs = 1u << i;
+        make_mode(&connector->modes[connector->mode_count++], width, height, refresh);
+        connector->modes[0].type |= DRM_MODE_TYPE_PREFERRED;
+        if (width != 1280 || height != 720)
+            make_mode(&connector->modes[connector->mode_count++], 1280, 720, 60);
+        if (width != 640 || height != 480)
+            make_mode(&connector->modes[connector->mode_count++], 640, 480, 60);
+    }
+
+    for (int i = 0; i < kms->outputs; i++)
+        kms->state.connectors[i].values[PROP_VRR_CAPABLE] = kms->vrr;
+    for (int i = 0; i < kms->outputs; i++)
+        add_plane(kms, DRM_PLANE_TYPE_PRIMARY, 1u << i);
+    for (int i = 0; i < FAKE_OVERLAYS; i++)
+        add_plane(kms, DRM_PLANE_TYPE_OVERLAY, (1u << kms->outputs) - 1);
+    for (int i = 0; i < kms->outputs; i++)
+        add_plane(kms, DRM_PLANE_TYPE_CURSOR, 1u << i);
+    for (int i = 0; i < kms->plane_count; i++)
+        add_in_formats(kms, &kms->state.planes[i]);
+    if (kms->writeback)
+    {
+        uint32_t id = 0;
+        kms->state.writeback.id = FAKE_WRITEBACK_ID;
+        kms->state.writeback.possible_crtcs = (1u << kms->outputs) - 1;
+        blob_create(kms, writeback_formats, sizeof(writeback_formats), &id);
+        kms->state.writeback.values[PROP_WRITEBACK_PIXEL_FORMATS] = id;
+    }
+
+    kms->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (kms->timer_fd < 0)
+    {
+        int err = errno;
+        fake_close(&(struct kms_device){.priv = kms});
+        return -err;
+    }
+
+    int ret = kms_register(kms->timer_fd, &fake_ops, kms);
+    if (ret)
+    {
+        close(kms->timer_fd);
+        fake_close(&(struct kms_device){.priv = kms});
+        return ret;
+    }
+
+    fprintf(stderr, "Fake KMS device with %d output%s\n", kms->outputs, kms->outputs == 1 ? "" : "s");
+    return kms->timer_fd;
+}
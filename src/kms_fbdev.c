@@ -0,0 +1,1069 @@
+#define _GNU_SOURCE // memfd_create
+#include "kms.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// KMS on top of a legacy fbdev node, for boards whose display only has an
+// fbdev driver. The device looks like the smallest KMS device there is: one
+// connector, encoder and CRTC, a primary plane in the framebuffer's own
+// format and a single mode taken from the current screeninfo.
+//
+// Double buffering is done the fbdev way. yres_virtual is raised to hold
+// FBDEV_MAX_SLOTS (or at least two) screens stacked on top of each other,
+// each dumb buffer is one of those slots, mapped straight from the node, and
+// a flip is a FBIOPAN_DISPLAY to the slot's first row. The slots are padded
+// to whole pages so each can be mapped on its own, and their pitch is the
+// driver's line_length, which is not always width * bpp.
+//
+// Flip events come from a thread sitting in FBIO_WAITFORVSYNC. Drivers that
+// do not have it get the vblank timed off CLOCK_MONOTONIC instead. The fd
+// handed out is an eventfd the thread signals, so it polls like a DRM fd.
+//
+// "fbdev:fake[:WxH[@R]][,rgb565][,double]" is the same backend on a memfd
+// with made up screeninfo instead of a node, "double" leaves room for two
+// slots only.
+
+#define FBDEV_MAX_SLOTS 3
+#define FBDEV_DEFAULT_NODE "/dev/fb0"
+#define FBDEV_FAKE_MODE "1920x1080@60"
+#define FBDEV_MAX_SIZE 8192
+
+#define FBDEV_CONNECTOR_ID 30
+#define FBDEV_ENCODER_ID 40
+#define FBDEV_CRTC_ID 50
+#define FBDEV_PLANE_ID 60
+#define FBDEV_FB_BASE 1000
+
+// the layouts fbdev drivers use that have a DRM format, offsets and
+// lengths as in fb_bitfield
+static const struct
+{
+    uint32_t format;
+    uint32_t bpp;
+    uint32_t depth;
+    uint8_t red[2];
+    uint8_t green[2];
+    uint8_t blue[2];
+} fbdev_formats[] = {
+    {DRM_FORMAT_XRGB8888, 32, 24, {16, 8}, {8, 8}, {0, 8}},
+    {DRM_FORMAT_XBGR8888, 32, 24, {0, 8}, {8, 8}, {16, 8}},
+    {DRM_FORMAT_XRGB2101010, 32, 30, {20, 10}, {10, 10}, {0, 10}},
+    {DRM_FORMAT_RGB565, 16, 16, {11, 5}, {5, 6}, {0, 5}},
+};
+#define FBDEV_FORMAT_COUNT (int)(sizeof(fbdev_formats) / sizeof(fbdev_formats[0]))
+
+struct fbdev_kms
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int thread_started;
+    int node_fd;  // the fbdev node, -1 for the fake one
+    int mem_fd;   // what slots are mapped from, the node or the fake's memfd
+    int event_fd;
+    int fake;
+    int can_wait; // FBIO_WAITFORVSYNC works
+    const char *name;
+
+    struct fb_var_screeninfo var;   // as programmed now
+    struct fb_var_screeninfo saved; // put back on close
+    uint32_t line_length;
+    uint64_t smem_len;
+    int format;
+    drmModeModeInfo mode;
+    uint64_t period_ns;
+    uint64_t base_ns; // vblank sequence 0
+
+    int slot_count;
+    uint32_t slot_rows;
+    uint64_t slot_size;
+    int slot_used[FBDEV_MAX_SLOTS]; // a dumb buffer handle is out
+    int slot_fb[FBDEV_MAX_SLOTS];   // a framebuffer wraps it
+
+    int active; // a slot is on screen
+    int front;
+    int flip_pending;
+    int want_event;
+    int vblank_wanted; // the thread has a flip to wait for
+    int event_ready;   // it finished, handle_event delivers it
+    uint64_t event_ns;
+    uint32_t event_sequence;
+    void *event_data;
+    int stop;
+};
+
+static int fail(int err)
+{
+    errno = err;
+    return -err;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+    struct timespec ts = {.tv_sec = ns / 1000000000ull, .tv_nsec = ns % 1000000000ull};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while (b)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int field_is(const struct fb_bitfield *field, const uint8_t want[2])
+{
+    return field->offset == want[0] && field->length == want[1];
+}
+
+// index into fbdev_formats, -1 when the layout has no DRM format
+static int var_format(const struct fb_var_screeninfo *var)
+{
+    if (var->grayscale || var->nonstd)
+        return -1;
+    for (int i = 0; i < FBDEV_FORMAT_COUNT; i++)
+    {
+        if (var->bits_per_pixel == fbdev_formats[i].bpp && field_is(&var->red, fbdev_formats[i].red) &&
+            field_is(&var->green, fbdev_formats[i].green) && field_is(&var->blue, fbdev_formats[i].blue))
+            return i;
+    }
+    return -1;
+}
+
+// the mode the screeninfo describes. pixclock is in picoseconds, drivers
+// that leave it and the margins at 0 get 60 Hz reduced blanking timings.
+static void var_mode(drmModeModeInfo *mode, const struct fb_var_screeninfo *var)
+{
+    memset(mode, 0, sizeof(*mode));
+    mode->hdisplay = var->xres;
+    mode->vdisplay = var->yres;
+
+    if (var->pixclock && var->left_margin + var->right_margin + var->hsync_len &&
+        var->upper_margin + var->lower_margin + var->vsync_len)
+    {
+        mode->hsync_start = var->xres + var->right_margin;
+        mode->hsync_end = mode->hsync_start + var->hsync_len;
+        mode->htotal = mode->hsync_end + var->left_margin;
+        mode->vsync_start = var->yres + var->lower_margin;
+        mode->vsync_end = mode->vsync_start + var->vsync_len;
+        mode->vtotal = mode->vsync_end + var->upper_margin;
+        mode->clock = 1000000000u / var->pixclock;
+    }
+    else
+    {
+        mode->hsync_start = var->xres + 48;
+        mode->hsync_end = var->xres + 80;
+        mode->htotal = var->xres + 160;
+        mode->vsync_start = var->yres + 3;
+        mode->vsync_end = var->yres + 8;
+        mode->vtotal = var->yres + 40;
+        mode->clock = (uint32_t)((uint64_t)mode->htotal * mode->vtotal * 60 / 1000);
+    }
+
+    uint64_t pixels = (uint64_t)mode->htotal * mode->vtotal;
+    mode->vrefresh = (uint32_t)((mode->clock * 1000ull + pixels / 2) / pixels);
+    mode->type = DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED;
+    snprintf(mode->name, sizeof(mode->name), "%ux%u", var->xres, var->yres);
+}
+
+static int put_var(struct fbdev_kms *fb, struct fb_var_screeninfo *var)
+{
+    if (!fb->fake)
+        return ioctl(fb->node_fd, FBIOPUT_VSCREENINFO, var) ? -errno : 0;
+
+    if ((uint64_t)var->yres_virtual * fb->line_length > fb->smem_len || var->yoffset + var->yres > var->yres_virtual)
+        return fail(EINVAL);
+    return 0;
+}
+
+// grow the virtual screen to hold as many slots as the driver and its
+// memory allow, FBDEV_MAX_SLOTS down to two
+static int setup_slots(struct fbdev_kms *fb)
+{
+    // slots start on a page and on a row the display can pan to
+    uint32_t rows = 4096 / gcd(fb->line_length, 4096);
+    uint32_t step = fb->fake ? 1 : 0;
+    if (!fb->fake)
+    {
+        struct fb_fix_screeninfo fix;
+        if (ioctl(fb->node_fd, FBIOGET_FSCREENINFO, &fix))
+            return -errno;
+        step = fix.ypanstep;
+    }
+    if (!step)
+        return fail(ENOTSUP);
+    rows = rows / gcd(rows, step) * step;
+    fb->slot_rows = (fb->var.yres + rows - 1) / rows * rows;
+    fb->slot_size = (uint64_t)fb->slot_rows * fb->line_length;
+
+    for (int n = FBDEV_MAX_SLOTS; n >= 2; n--)
+    {
+        struct fb_var_screeninfo var = fb->var;
+        var.xres_virtual = var.xres;
+        var.yres_virtual = n * fb->slot_rows;
+        var.xoffset = 0;
+        var.yoffset = 0;
+        var.activate = FB_ACTIVATE_NOW;
+        if (put_var(fb, &var))
+            continue;
+
+        // the driver may have settled for less than asked
+        if (!fb->fake)
+        {
+            struct fb_fix_screeninfo fix;
+            if (ioctl(fb->node_fd, FBIOGET_FSCREENINFO, &fix))
+                return -errno;
+            fb->smem_len = fix.smem_len;
+            if (fix.line_length != fb->line_length)
+                continue;
+        }
+        if (var.yres_virtual < n * fb->slot_rows || fb->smem_len < n * fb->slot_size)
+            continue;
+
+        fb->var = var;
+        fb->slot_count = n;
+        return 0;
+    }
+
+    put_var(fb, &fb->saved);
+    return fail(ENOSPC);
+}
+
+static int pan(struct fbdev_kms *fb, int slot)
+{
+    struct fb_var_screeninfo var = fb->var;
+    var.xoffset = 0;
+    var.yoffset = slot * fb->slot_rows;
+    if (!fb->fake && ioctl(fb->node_fd, FBIOPAN_DISPLAY, &var))
+        return -errno;
+    fb->var.yoffset = var.yoffset;
+    return 0;
+}
+
+// block until the next vblank, returns its time
+static uint64_t wait_vblank(struct fbdev_kms *fb)
+{
+    while (fb->can_wait)
+    {
+        uint32_t screen = 0;
+        if (ioctl(fb->node_fd, FBIO_WAITFORVSYNC, &screen) == 0)
+            return now_ns();
+        if (errno != EINTR)
+            fb->can_wait = 0; // the driver does not know it, time it instead
+    }
+
+    uint64_t now = now_ns();
+    uint64_t next = fb->base_ns + ((now - fb->base_ns) / fb->period_ns + 1) * fb->period_ns;
+    sleep_until(next);
+    return next;
+}
+
+// completes one flip per vblank it is asked to wait for
+static void *vblank_thread(void *arg)
+{
+    struct fbdev_kms *fb = arg;
+
+    pthread_mutex_lock(&fb->lock);
+    while (!fb->stop)
+    {
+        if (!fb->vblank_wanted)
+        {
+            pthread_cond_wait(&fb->cond, &fb->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&fb->lock);
+        uint64_t ns = wait_vblank(fb);
+        pthread_mutex_lock(&fb->lock);
+
+        fb->vblank_wanted = 0;
+        if (!fb->want_event)
+        {
+            fb->flip_pending = 0;
+            continue;
+        }
+        fb->event_ns = ns;
+        fb->event_sequence = (uint32_t)((ns - fb->base_ns + fb->period_ns / 2) / fb->period_ns);
+        fb->event_ready = 1;
+
+        uint64_t one = 1;
+        if (write(fb->event_fd, &one, sizeof(one)) < 0)
+            perror("fbdev flip event");
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return NULL;
+}
+
+// slot behind a dumb buffer handle or framebuffer id, -1 if there is none
+static int handle_slot(const struct fbdev_kms *fb, uint32_t handle)
+{
+    int slot = (int)handle - 1;
+    return slot >= 0 && slot < fb->slot_count && fb->slot_used[slot] ? slot : -1;
+}
+
+static int fb_slot(const struct fbdev_kms *fb, uint32_t fb_id)
+{
+    int slot = (int)fb_id - FBDEV_FB_BASE;
+    return slot >= 0 && slot < fb->slot_count && fb->slot_fb[slot] ? slot : -1;
+}
+
+static int fbdev_set_client_cap(struct kms_device *dev, uint64_t cap, uint64_t value)
+{
+    switch (cap)
+    {
+    case DRM_CLIENT_CAP_UNIVERSAL_PLANES:
+    case DRM_CLIENT_CAP_ASPECT_RATIO:
+        return value <= 1 ? 0 : fail(EINVAL);
+    case DRM_CLIENT_CAP_ATOMIC:
+        return fail(EOPNOTSUPP);
+    default:
+        return fail(EINVAL);
+    }
+}
+
+static int fbdev_get_cap(struct kms_device *dev, uint64_t cap, uint64_t *value)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    switch (cap)
+    {
+    case DRM_CAP_DUMB_BUFFER:
+    case DRM_CAP_TIMESTAMP_MONOTONIC:
+    case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+        *value = 1;
+        return 0;
+    case DRM_CAP_DUMB_PREFERRED_DEPTH:
+        *value = fbdev_formats[fb->format].depth;
+        return 0;
+    case DRM_CAP_ADDFB2_MODIFIERS:
+    case DRM_CAP_PRIME:
+    case DRM_CAP_ASYNC_PAGE_FLIP:
+        *value = 0;
+        return 0;
+    default:
+        return fail(EINVAL);
+    }
+}
+
+static uint32_t *one_id(uint32_t id)
+{
+    uint32_t *ids = malloc(sizeof(*ids));
+    if (ids)
+        *ids = id;
+    return ids;
+}
+
+static drmModeRes *fbdev_get_resources(struct kms_device *dev)
+{
+    struct fbdev_kms *fb = dev->priv;
+    drmModeRes *res = calloc(1, sizeof(*res));
+    if (!res)
+        return NULL;
+
+    pthread_mutex_lock(&fb->lock);
+    res->fbs = malloc(sizeof(uint32_t) * FBDEV_MAX_SLOTS);
+    for (int i = 0; res->fbs && i < fb->slot_count; i++)
+    {
+        if (fb->slot_fb[i])
+            res->fbs[res->count_fbs++] = FBDEV_FB_BASE + i;
+    }
+    pthread_mutex_unlock(&fb->lock);
+    res->count_crtcs = res->count_connectors = res->count_encoders = 1;
+    res->crtcs = one_id(FBDEV_CRTC_ID);
+    res->connectors = one_id(FBDEV_CONNECTOR_ID);
+    res->encoders = one_id(FBDEV_ENCODER_ID);
+    res->min_width = res->max_width = fb->var.xres;
+    res->min_height = res->max_height = fb->var.yres;
+
+    if (!res->fbs || !res->crtcs || !res->connectors || !res->encoders)
+    {
+        drmModeFreeResources(res);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return res;
+}
+
+static drmModeConnector *fbdev_get_connector(struct kms_device *dev, uint32_t connector_id)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (connector_id != FBDEV_CONNECTOR_ID)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeConnector *connector = calloc(1, sizeof(*connector));
+    if (!connector)
+        return NULL;
+
+    // fbdev leaves the physical size at 0 or ~0 when it does not know it
+    pthread_mutex_lock(&fb->lock);
+    connector->connector_id = connector_id;
+    connector->encoder_id = fb->active ? FBDEV_ENCODER_ID : 0;
+    connector->connector_type = fb->fake ? DRM_MODE_CONNECTOR_VIRTUAL : DRM_MODE_CONNECTOR_Unknown;
+    connector->connector_type_id = 1;
+    connector->connection = DRM_MODE_CONNECTED;
+    connector->mmWidth = (int32_t)fb->var.width > 0 ? fb->var.width : 0;
+    connector->mmHeight = (int32_t)fb->var.height > 0 ? fb->var.height : 0;
+    connector->subpixel = DRM_MODE_SUBPIXEL_UNKNOWN;
+    connector->count_modes = 1;
+    connector->modes = malloc(sizeof(drmModeModeInfo));
+    if (connector->modes)
+        connector->modes[0] = fb->mode;
+    connector->count_encoders = 1;
+    connector->encoders = one_id(FBDEV_ENCODER_ID);
+    pthread_mutex_unlock(&fb->lock);
+
+    if (!connector->modes || !connector->encoders)
+    {
+        drmModeFreeConnector(connector);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return connector;
+}
+
+static drmModeEncoder *fbdev_get_encoder(struct kms_device *dev, uint32_t encoder_id)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (encoder_id != FBDEV_ENCODER_ID)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeEncoder *encoder = calloc(1, sizeof(*encoder));
+    if (!encoder)
+        return NULL;
+
+    pthread_mutex_lock(&fb->lock);
+    encoder->encoder_id = encoder_id;
+    encoder->encoder_type = DRM_MODE_ENCODER_NONE;
+    encoder->crtc_id = fb->active ? FBDEV_CRTC_ID : 0;
+    encoder->possible_crtcs = 1;
+    pthread_mutex_unlock(&fb->lock);
+    return encoder;
+}
+
+static drmModeCrtc *fbdev_get_crtc(struct kms_device *dev, uint32_t crtc_id)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (crtc_id != FBDEV_CRTC_ID)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModeCrtc *crtc = calloc(1, sizeof(*crtc));
+    if (!crtc)
+        return NULL;
+
+    pthread_mutex_lock(&fb->lock);
+    crtc->crtc_id = crtc_id;
+    crtc->mode_valid = fb->active;
+    if (fb->active)
+    {
+        crtc->buffer_id = FBDEV_FB_BASE + fb->front;
+        crtc->mode = fb->mode;
+        crtc->width = fb->mode.hdisplay;
+        crtc->height = fb->mode.vdisplay;
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return crtc;
+}
+
+static drmModePlaneRes *fbdev_get_plane_resources(struct kms_device *dev)
+{
+    drmModePlaneRes *res = calloc(1, sizeof(*res));
+    if (!res)
+        return NULL;
+
+    res->count_planes = 1;
+    res->planes = one_id(FBDEV_PLANE_ID);
+    if (!res->planes)
+    {
+        drmModeFreePlaneResources(res);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return res;
+}
+
+static drmModePlane *fbdev_get_plane(struct kms_device *dev, uint32_t plane_id)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (plane_id != FBDEV_PLANE_ID)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    drmModePlane *plane = calloc(1, sizeof(*plane));
+    if (!plane)
+        return NULL;
+
+    pthread_mutex_lock(&fb->lock);
+    plane->count_formats = 1;
+    plane->formats = one_id(fbdev_formats[fb->format].format);
+    plane->plane_id = plane_id;
+    plane->crtc_id = fb->active ? FBDEV_CRTC_ID : 0;
+    plane->fb_id = fb->active ? FBDEV_FB_BASE + fb->front : 0;
+    plane->possible_crtcs = 1;
+    pthread_mutex_unlock(&fb->lock);
+
+    if (!plane->formats)
+    {
+        drmModeFreePlane(plane);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return plane;
+}
+
+// the objects exist but have no properties, atomic users find nothing to set
+static drmModeObjectProperties *fbdev_get_object_properties(struct kms_device *dev, uint32_t object_id, uint32_t object_type)
+{
+    if (object_id != FBDEV_CONNECTOR_ID && object_id != FBDEV_CRTC_ID && object_id != FBDEV_PLANE_ID)
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+    return calloc(1, sizeof(drmModeObjectProperties));
+}
+
+static drmModePropertyRes *fbdev_get_property(struct kms_device *dev, uint32_t property_id)
+{
+    errno = ENOENT;
+    return NULL;
+}
+
+static drmModePropertyBlobRes *fbdev_get_property_blob(struct kms_device *dev, uint32_t blob_id)
+{
+    errno = ENOENT;
+    return NULL;
+}
+
+static int fbdev_create_property_blob(struct kms_device *dev, const void *data, size_t size, uint32_t *blob_id)
+{
+    return fail(EOPNOTSUPP);
+}
+
+static int fbdev_destroy_property_blob(struct kms_device *dev, uint32_t blob_id)
+{
+    return fail(ENOENT);
+}
+
+// a dumb buffer is a free slot of the virtual screen, in the screen's pitch
+static int fbdev_create_dumb(struct kms_device *dev, struct drm_mode_create_dumb *create)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    if (!create->width || !create->height || create->width > fb->var.xres || create->height > fb->slot_rows ||
+        create->bpp != fb->var.bits_per_pixel)
+        return fail(EINVAL);
+
+    pthread_mutex_lock(&fb->lock);
+    for (int i = 0; i < fb->slot_count; i++)
+    {
+        // a framebuffer keeps its slot after the handle is gone, like GEM
+        if (fb->slot_used[i] || fb->slot_fb[i])
+            continue;
+
+        fb->slot_used[i] = 1;
+        create->handle = i + 1;
+        create->pitch = fb->line_length;
+        create->size = fb->slot_size;
+        pthread_mutex_unlock(&fb->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return fail(ENOSPC);
+}
+
+static void *fbdev_map_dumb(struct kms_device *dev, uint32_t handle, uint64_t size)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    pthread_mutex_lock(&fb->lock);
+    int slot = handle_slot(fb, handle);
+    pthread_mutex_unlock(&fb->lock);
+
+    if (slot < 0 || size > fb->slot_size)
+    {
+        errno = slot < 0 ? ENOENT : EINVAL;
+        return MAP_FAILED;
+    }
+    return mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fb->mem_fd, (off_t)(slot * fb->slot_size));
+}
+
+static int fbdev_destroy_dumb(struct kms_device *dev, uint32_t handle)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    pthread_mutex_lock(&fb->lock);
+    int slot = handle_slot(fb, handle);
+    if (slot >= 0)
+        fb->slot_used[slot] = 0;
+    pthread_mutex_unlock(&fb->lock);
+    return slot >= 0 ? 0 : fail(ENOENT);
+}
+
+static int fbdev_prime_fd_to_handle(struct kms_device *dev, int prime_fd, uint32_t *handle)
+{
+    return fail(EOPNOTSUPP);
+}
+
+static int fbdev_prime_handle_to_fd(struct kms_device *dev, uint32_t handle, int *prime_fd)
+{
+    return fail(EOPNOTSUPP);
+}
+
+// only a whole slot in the screen's format can be scanned out
+static int fbdev_add_fb2(struct kms_device *dev, uint32_t width, uint32_t height, uint32_t format,
+                         const uint32_t handles[4], const uint32_t pitches[4], const uint32_t offsets[4],
+                         const uint64_t modifiers[4], uint32_t flags, uint32_t *fb_id)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    if (format != fbdev_formats[fb->format].format || width != fb->var.xres || height != fb->var.yres ||
+        pitches[0] != fb->line_length || offsets[0] || handles[1] ||
+        ((flags & DRM_MODE_FB_MODIFIERS) && modifiers[0] != DRM_FORMAT_MOD_LINEAR))
+        return fail(EINVAL);
+
+    pthread_mutex_lock(&fb->lock);
+    int slot = handle_slot(fb, handles[0]);
+    if (slot >= 0 && fb->slot_fb[slot])
+    {
+        pthread_mutex_unlock(&fb->lock);
+        return fail(EBUSY);
+    }
+    if (slot >= 0)
+        fb->slot_fb[slot] = 1;
+    pthread_mutex_unlock(&fb->lock);
+
+    if (slot < 0)
+        return fail(ENOENT);
+    *fb_id = FBDEV_FB_BASE + slot;
+    return 0;
+}
+
+static int fbdev_add_fb(struct kms_device *dev, uint32_t width, uint32_t height, uint8_t depth, uint8_t bpp,
+                        uint32_t pitch, uint32_t handle, uint32_t *fb_id)
+{
+    uint32_t format;
+    if (bpp == 32 && depth == 24)
+        format = DRM_FORMAT_XRGB8888;
+    else if (bpp == 32 && depth == 30)
+        format = DRM_FORMAT_XRGB2101010;
+    else if (bpp == 16 && depth == 16)
+        format = DRM_FORMAT_RGB565;
+    else
+        return fail(EINVAL);
+
+    uint32_t handles[4] = {handle}, pitches[4] = {pitch}, offsets[4] = {0};
+    return fbdev_add_fb2(dev, width, height, format, handles, pitches, offsets, NULL, 0, fb_id);
+}
+
+// removing the framebuffer on screen turns the CRTC off, as on DRM
+static int fbdev_rm_fb(struct kms_device *dev, uint32_t fb_id)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    pthread_mutex_lock(&fb->lock);
+    int slot = fb_slot(fb, fb_id);
+    if (slot >= 0)
+    {
+        fb->slot_fb[slot] = 0;
+        if (fb->active && fb->front == slot)
+            fb->active = 0;
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return slot >= 0 ? 0 : fail(ENOENT);
+}
+
+// the slots are the scanout memory itself, there is nothing to flush
+static int fbdev_dirty_fb(struct kms_device *dev, uint32_t fb_id, drmModeClip *clips, uint32_t count)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    pthread_mutex_lock(&fb->lock);
+    int slot = fb_slot(fb, fb_id);
+    pthread_mutex_unlock(&fb->lock);
+    return slot >= 0 ? 0 : fail(ENOENT);
+}
+
+// put fb_id on screen right away, called with the lock held
+static int show_locked(struct fbdev_kms *fb, uint32_t fb_id)
+{
+    int slot = fb_slot(fb, fb_id);
+    if (slot < 0)
+        return fail(ENOENT);
+    if (fb->flip_pending)
+        return fail(EBUSY);
+
+    int ret = pan(fb, slot);
+    if (ret)
+        return ret;
+    if (!fb->active && !fb->fake)
+        ioctl(fb->node_fd, FBIOBLANK, FB_BLANK_UNBLANK);
+    fb->active = 1;
+    fb->front = slot;
+    return 0;
+}
+
+// the mode can only be the one the node is in, fbdev cannot change it here
+static int fbdev_set_crtc(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t x, uint32_t y,
+                          uint32_t *connectors, int count, drmModeModeInfo *mode)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (crtc_id != FBDEV_CRTC_ID)
+        return fail(ENOENT);
+
+    pthread_mutex_lock(&fb->lock);
+    int ret;
+    if (!fb_id)
+    {
+        ret = 0;
+        if (!fb->fake)
+            ioctl(fb->node_fd, FBIOBLANK, FB_BLANK_POWERDOWN);
+        fb->active = 0;
+    }
+    else if (!mode || mode->hdisplay != fb->mode.hdisplay || mode->vdisplay != fb->mode.vdisplay ||
+             mode->clock != fb->mode.clock || x || y || count != 1 || connectors[0] != FBDEV_CONNECTOR_ID)
+    {
+        ret = fail(EINVAL);
+    }
+    else
+    {
+        ret = show_locked(fb, fb_id);
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return ret;
+}
+
+static int fbdev_set_plane(struct kms_device *dev, uint32_t plane_id, uint32_t crtc_id, uint32_t fb_id,
+                           int32_t crtc_x, int32_t crtc_y, uint32_t crtc_w, uint32_t crtc_h,
+                           uint32_t src_x, uint32_t src_y, uint32_t src_w, uint32_t src_h)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (plane_id != FBDEV_PLANE_ID || crtc_id != FBDEV_CRTC_ID)
+        return fail(ENOENT);
+
+    // the primary plane covers the whole screen or nothing
+    if (!fb_id || crtc_x || crtc_y || crtc_w != fb->var.xres || crtc_h != fb->var.yres || src_x || src_y ||
+        src_w != fb->var.xres << 16 || src_h != fb->var.yres << 16)
+        return fail(EINVAL);
+
+    pthread_mutex_lock(&fb->lock);
+    int ret = fb->active ? show_locked(fb, fb_id) : fail(EINVAL);
+    pthread_mutex_unlock(&fb->lock);
+    return ret;
+}
+
+// pan now, the vblank thread completes the flip at the next vblank
+static int fbdev_page_flip(struct kms_device *dev, uint32_t crtc_id, uint32_t fb_id, uint32_t flags, void *user_data)
+{
+    struct fbdev_kms *fb = dev->priv;
+    if (crtc_id != FBDEV_CRTC_ID)
+        return fail(ENOENT);
+    if (flags & DRM_MODE_PAGE_FLIP_ASYNC)
+        return fail(EINVAL);
+
+    pthread_mutex_lock(&fb->lock);
+    int ret = fb->active ? show_locked(fb, fb_id) : fail(EINVAL);
+    if (!ret)
+    {
+        fb->flip_pending = 1;
+        fb->want_event = (flags & DRM_MODE_PAGE_FLIP_EVENT) != 0;
+        fb->event_data = user_data;
+        fb->vblank_wanted = 1;
+        pthread_cond_signal(&fb->cond);
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return ret;
+}
+
+static int fbdev_set_cursor2(struct kms_device *dev, uint32_t crtc_id, uint32_t handle, uint32_t width,
+                             uint32_t height, int32_t hot_x, int32_t hot_y)
+{
+    return fail(ENXIO);
+}
+
+static int fbdev_move_cursor(struct kms_device *dev, uint32_t crtc_id, int32_t x, int32_t y)
+{
+    return fail(ENXIO);
+}
+
+static int fbdev_atomic_commit(struct kms_device *dev, const struct kms_prop *props, int count, uint32_t flags,
+                               void *user_data)
+{
+    return fail(EOPNOTSUPP);
+}
+
+static int fbdev_handle_event(struct kms_device *dev, drmEventContext *ev)
+{
+    struct fbdev_kms *fb = dev->priv;
+    uint64_t count;
+
+    if (read(fb->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        return -1;
+
+    pthread_mutex_lock(&fb->lock);
+    int ready = fb->event_ready;
+    uint32_t sequence = fb->event_sequence;
+    uint64_t ns = fb->event_ns;
+    void *data = fb->event_data;
+    if (ready)
+    {
+        fb->event_ready = 0;
+        fb->flip_pending = 0;
+    }
+    pthread_mutex_unlock(&fb->lock);
+
+    if (!ready)
+        return 0;
+
+    unsigned int sec = (unsigned int)(ns / 1000000000ull);
+    unsigned int usec = (unsigned int)(ns % 1000000000ull / 1000);
+    if (ev->version >= 3 && ev->page_flip_handler2)
+        ev->page_flip_handler2(fb->event_fd, sequence, sec, usec, FBDEV_CRTC_ID, data);
+    else if (ev->page_flip_handler)
+        ev->page_flip_handler(fb->event_fd, sequence, sec, usec, data);
+    return 0;
+}
+
+// the eventfd itself is closed by kms_close
+static void fbdev_close(struct kms_device *dev)
+{
+    struct fbdev_kms *fb = dev->priv;
+
+    if (fb->thread_started)
+    {
+        pthread_mutex_lock(&fb->lock);
+        fb->stop = 1;
+        pthread_cond_signal(&fb->cond);
+        pthread_mutex_unlock(&fb->lock);
+        pthread_join(fb->thread, NULL);
+    }
+
+    // leave the console where it was, on the first screen
+    if (fb->slot_count && !fb->fake)
+        put_var(fb, &fb->saved);
+    if (fb->mem_fd >= 0 && fb->mem_fd != fb->node_fd)
+        close(fb->mem_fd);
+    if (fb->node_fd >= 0)
+        close(fb->node_fd);
+    pthread_cond_destroy(&fb->cond);
+    pthread_mutex_destroy(&fb->lock);
+    free(fb);
+}
+
+static const struct kms_ops fbdev_ops = {
+    .name = "fbdev",
+    .close = fbdev_close,
+    .set_client_cap = fbdev_set_client_cap,
+    .get_cap = fbdev_get_cap,
+    .get_resources = fbdev_get_resources,
+    .get_connector = fbdev_get_connector,
+    .get_connector_current = fbdev_get_connector, // nothing to probe
+    .get_encoder = fbdev_get_encoder,
+    .get_crtc = fbdev_get_crtc,
+    .get_plane_resources = fbdev_get_plane_resources,
+    .get_plane = fbdev_get_plane,
+    .get_object_properties = fbdev_get_object_properties,
+    .get_property = fbdev_get_property,
+    .get_property_blob = fbdev_get_property_blob,
+    .create_property_blob = fbdev_create_property_blob,
+    .destroy_property_blob = fbdev_destroy_property_blob,
+    .create_dumb = fbdev_create_dumb,
+    .map_dumb = fbdev_map_dumb,
+    .destroy_dumb = fbdev_destroy_dumb,
+    .prime_fd_to_handle = fbdev_prime_fd_to_handle,
+    .prime_handle_to_fd = fbdev_prime_handle_to_fd,
+    .close_handle = fbdev_destroy_dumb,
+    .add_fb = fbdev_add_fb,
+    .add_fb2 = fbdev_add_fb2,
+    .rm_fb = fbdev_rm_fb,
+    .dirty_fb = fbdev_dirty_fb,
+    .set_crtc = fbdev_set_crtc,
+    .set_plane = fbdev_set_plane,
+    .page_flip = fbdev_page_flip,
+    .set_cursor2 = fbdev_set_cursor2,
+    .move_cursor = fbdev_move_cursor,
+    .atomic_commit = fbdev_atomic_commit,
+    .handle_event = fbdev_handle_event,
+};
+
+// screeninfo a driver would report for "WxH[@R][,rgb565][,double]", the
+// memfd is sized for the slots it allows
+static int open_fake(struct fbdev_kms *fb, const char *spec)
+{
+    unsigned int width = 1920, height = 1080, refresh = 60;
+    int rgb565 = 0, slots = FBDEV_MAX_SLOTS;
+
+    const char *p = spec && *spec ? spec : FBDEV_FAKE_MODE;
+    while (*p)
+    {
+        int used = 0;
+        if (strncmp(p, "rgb565", 6) == 0)
+        {
+            rgb565 = 1;
+            used = 6;
+        }
+        else if (strncmp(p, "double", 6) == 0)
+        {
+            slots = 2;
+            used = 6;
+        }
+        else if (sscanf(p, "%ux%u%n@%u%n", &width, &height, &used, &refresh, &used) < 2)
+            used = 0;
+        if (!used || (p[used] && p[used] != ',') || !width || !height || width > FBDEV_MAX_SIZE ||
+            height > FBDEV_MAX_SIZE || !refresh)
+        {
+            fprintf(stderr, "Bad fake fbdev spec: %s\n", spec);
+            return -EINVAL;
+        }
+        p += used;
+        if (*p == ',')
+            p++;
+    }
+
+    struct fb_var_screeninfo *var = &fb->var;
+    int format = rgb565 ? 3 : 0;
+    var->xres = var->xres_virtual = width;
+    var->yres = var->yres_virtual = height;
+    var->bits_per_pixel = fbdev_formats[format].bpp;
+    var->red = (struct fb_bitfield){fbdev_formats[format].red[0], fbdev_formats[format].red[1], 0};
+    var->green = (struct fb_bitfield){fbdev_formats[format].green[0], fbdev_formats[format].green[1], 0};
+    var->blue = (struct fb_bitfield){fbdev_formats[format].blue[0], fbdev_formats[format].blue[1], 0};
+    var->right_margin = 48;
+    var->hsync_len = 32;
+    var->left_margin = 80;
+    var->lower_margin = 3;
+    var->vsync_len = 5;
+    var->upper_margin = 32;
+    var->pixclock = (uint32_t)(1000000000000ull / ((uint64_t)(width + 160) * (height + 40) * refresh));
+    var->width = var->height = ~0u;
+
+    // drivers pad lines to their own alignment, 64 bytes here
+    fb->line_length = (width * var->bits_per_pixel / 8 + 63) & ~63u;
+    uint32_t rows = 4096 / gcd(fb->line_length, 4096);
+    fb->smem_len = (uint64_t)slots * ((height + rows - 1) / rows * rows) * fb->line_length;
+
+    fb->mem_fd = memfd_create("fake-fbdev", MFD_CLOEXEC);
+    if (fb->mem_fd < 0)
+        return -errno;
+    if (ftruncate(fb->mem_fd, (off_t)fb->smem_len))
+        return -errno;
+    fb->name = "fake";
+    return 0;
+}
+
+static int open_node(struct fbdev_kms *fb, const char *path)
+{
+    fb->node_fd = fb->mem_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fb->node_fd < 0)
+        return -errno;
+
+    struct fb_fix_screeninfo fix;
+    if (ioctl(fb->node_fd, FBIOGET_VSCREENINFO, &fb->var) || ioctl(fb->node_fd, FBIOGET_FSCREENINFO, &fix))
+        return -errno;
+    if (fix.type != FB_TYPE_PACKED_PIXELS || fix.visual != FB_VISUAL_TRUECOLOR)
+    {
+        fprintf(stderr, "%s is not a packed truecolor framebuffer\n", path);
+        return -ENOTSUP;
+    }
+    fb->line_length = fix.line_length;
+    fb->smem_len = fix.smem_len;
+    fb->can_wait = 1;
+    fb->name = path;
+    return 0;
+}
+
+// path is an fbdev node, NULL for /dev/fb0, or "fake[:...]" (see above)
+int kms_fbdev_open(const char *path)
+{
+    if (!path || !*path)
+        path = FBDEV_DEFAULT_NODE;
+
+    struct fbdev_kms *fb = calloc(1, sizeof(*fb));
+    if (!fb)
+        return -ENOMEM;
+    pthread_mutex_init(&fb->lock, NULL);
+    pthread_cond_init(&fb->cond, NULL);
+    fb->node_fd = fb->mem_fd = fb->event_fd = -1;
+    fb->fake = strcmp(path, "fake") == 0 || strncmp(path, "fake:", 5) == 0;
+
+    int ret = fb->fake ? open_fake(fb, path[4] ? path + 5 : NULL) : open_node(fb, path);
+    if (!ret)
+    {
+        fb->saved = fb->var;
+        fb->format = var_format(&fb->var);
+        if (fb->format < 0)
+        {
+            fprintf(stderr, "fbdev %s: no DRM format for %u bpp r%u:%u g%u:%u b%u:%u\n", fb->name,
+                    fb->var.bits_per_pixel, fb->var.red.offset, fb->var.red.length, fb->var.green.offset,
+                    fb->var.green.length, fb->var.blue.offset, fb->var.blue.length);
+            ret = -ENOTSUP;
+        }
+    }
+    if (!ret && (ret = setup_slots(fb)) != 0)
+        fprintf(stderr, "fbdev %s: cannot pan between two screens (%s)\n", fb->name, strerror(-ret));
+    if (ret)
+    {
+        fbdev_close(&(struct kms_device){.priv = fb});
+        return ret;
+    }
+
+    var_mode(&fb->mode, &fb->var);
+    fb->period_ns = (uint64_t)fb->mode.htotal * fb->mode.vtotal * 1000000ull / fb->mode.clock;
+    fb->base_ns = now_ns();
+
+    fb->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fb->event_fd < 0)
+    {
+        ret = -errno;
+        fbdev_close(&(struct kms_device){.priv = fb});
+        return ret;
+    }
+    ret = -pthread_create(&fb->thread, NULL, vblank_thread, fb);
+    fb->thread_started = ret == 0;
+    if (!ret)
+        ret = kms_register(fb->event_fd, &fbdev_ops, fb);
+    if (ret)
+    {
+        close(fb->event_fd);
+        fbdev_close(&(struct kms_device){.priv = fb});
+        return ret;
+    }
+
+    fprintf(stderr, "fbdev %s: %ux%u@%u %.4s, %d buffers of %u lines, line length %u\n", fb->name,
+            fb->var.xres, fb->var.yres, fb->mode.vrefresh, (const char *)&fbdev_formats[fb->format].format,
+            fb->slot_count, fb->slot_rows, fb->line_length);
+    return fb->event_fd;
+}
@@ -0,0 +1,154 @@
+#include "mode.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// refresh in mHz from the timings, vrefresh is rounded to whole Hz
+uint32_t mode_refresh_mhz(const drmModeModeInfo *mode)
+{
+    uint64_t frame = (uint64_t)mode->htotal * mode->vtotal;
+    if (!frame || !mode->clock)
+        return mode->vrefresh * 1000;
+
+    if (mode->flags & DRM_MODE_FLAG_DBLSCAN)
+        frame *= 2;
+    if (mode->vscan > 1)
+        frame *= mode->vscan;
+    uint64_t mhz = ((uint64_t)mode->clock * 1000000 + frame / 2) / frame;
+    if (mode->flags & DRM_MODE_FLAG_INTERLACE)
+        mhz *= 2;
+    return (uint32_t)mhz;
+}
+
+// parse a spec like "1920x1080@59.94,clock<=300000". returns 0 or -EINVAL
+int mode_spec_parse(const char *text, struct mode_spec *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+    if (!text)
+        return 0;
+
+    const char *p = text;
+    while (*p)
+    {
+        unsigned int a, b;
+        double hz;
+        int used = 0;
+
+        if (strncmp(p, "preferred", 9) == 0)
+        {
+            spec->preferred = 1;
+            used = 9;
+        }
+        else if (sscanf(p, "clock<=%u%n", &a, &used) == 1)
+        {
+            spec->max_clock = a;
+        }
+        else if (sscanf(p, "clock>=%u%n", &a, &used) == 1)
+        {
+            spec->min_clock = a;
+        }
+        else if (sscanf(p, "%ux%u%n", &a, &b, &used) == 2 && a && b)
+        {
+            spec->width = a;
+            spec->height = b;
+        }
+        else if (*p != '@')
+        {
+            used = 0;
+        }
+
+        // a refresh on its own or after the size
+        if (p[used] == '@')
+        {
+            int hz_used = 0;
+            if (sscanf(p + used, "@%lf%n", &hz, &hz_used) != 1 || hz <= 0 || hz > 1000)
+                return -EINVAL;
+            spec->refresh_mhz = (uint32_t)(hz * 1000 + 0.5);
+            used += hz_used;
+        }
+
+        if (!used || (p[used] && p[used] != ','))
+            return -EINVAL;
+        p += used;
+        if (*p == ',')
+            p++;
+    }
+    return 0;
+}
+
+static uint32_t refresh_distance(const drmModeModeInfo *mode, uint32_t refresh_mhz)
+{
+    uint32_t mhz = mode_refresh_mhz(mode);
+    return mhz > refresh_mhz ? mhz - refresh_mhz : refresh_mhz - mhz;
+}
+
+// whether a beats b under spec, see mode.h for the order
+static int better_mode(const drmModeModeInfo *a, const drmModeModeInfo *b, const struct mode_spec *spec)
+{
+    if (spec->refresh_mhz)
+    {
+        uint32_t da = refresh_distance(a, spec->refresh_mhz), db = refresh_distance(b, spec->refresh_mhz);
+        if (da != db)
+            return da < db;
+    }
+
+    int pa = !!(a->type & DRM_MODE_TYPE_PREFERRED), pb = !!(b->type & DRM_MODE_TYPE_PREFERRED);
+    if (pa != pb)
+        return pa;
+
+    uint32_t area_a = (uint32_t)a->hdisplay * a->vdisplay, area_b = (uint32_t)b->hdisplay * b->vdisplay;
+    if (area_a != area_b)
+        return area_a > area_b;
+
+    return mode_refresh_mhz(a) > mode_refresh_mhz(b);
+}
+
+// the best of the connector's modes that pass spec, NULL if none does
+const drmModeModeInfo *mode_select(const drmModeConnector *connector, const struct mode_spec *spec)
+{
+    const drmModeModeInfo *best = NULL;
+    for (int i = 0; i < connector->count_modes; i++)
+    {
+        const drmModeModeInfo *mode = &connector->modes[i];
+        if ((spec->width && (mode->hdisplay != spec->width || mode->vdisplay != spec->height)) ||
+            (spec->preferred && !(mode->type & DRM_MODE_TYPE_PREFERRED)) ||
+            (spec->min_clock && mode->clock < spec->min_clock) ||
+            (spec->max_clock && mode->clock > spec->max_clock))
+            continue;
+
+        if (!best || better_mode(mode, best, spec))
+            best = mode;
+    }
+    return best;
+}
+
+// same timings, whatever the name and type flags say
+int mode_same(const drmModeModeInfo *a, const drmModeModeInfo *b)
+{
+    return a->clock == b->clock && a->hdisplay == b->hdisplay && a->vdisplay == b->vdisplay &&
+           a->htotal == b->htotal && a->vtotal == b->vtotal && a->flags == b->flags;
+}
+
+// the mode $PLANES_MODE asks for, the preferred one when it is unset or
+// matches nothing on this connector
+const drmModeModeInfo *mode_pick(const drmModeConnector *connector)
+{
+    struct mode_spec spec;
+    const char *text = getenv("PLANES_MODE");
+    if (mode_spec_parse(text, &spec))
+    {
+        fprintf(stderr, "Bad PLANES_MODE: %s\n", text);
+        memset(&spec, 0, sizeof(spec));
+    }
+
+    const drmModeModeInfo *mode = mode_select(connector, &spec);
+    if (!mode)
+    {
+        fprintf(stderr, "No mode on connector %u matches %s, using the preferred one\n", connector->connector_id, text);
+        memset(&spec, 0, sizeof(spec));
+        mode = mode_select(connector, &spec);
+    }
+    return mode;
+}
@@ -0,0 +1,42 @@
+#ifndef MODE_H
+#define MODE_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// Picks a connector mode from a spec instead of taking modes[0], and turns
+// on variable refresh where the sink supports it.
+//
+// A spec is a comma separated list of constraints, all of them optional:
+//   "WxH"         exact active size
+//   "@R"          closest refresh to R Hz (also "WxH@R", R may be fractional)
+//   "preferred"   only the mode the sink flags as preferred
+//   "clock<=KHZ"  pixel clock bounds in kHz ("clock>=KHZ" for the lower one),
+//                 for links or encoders that cannot take the fastest modes
+// Among the modes that pass, the closest refresh wins if one was asked for,
+// then the preferred mode, then the largest, then the fastest. An empty spec
+// is the preferred mode. mode_pick reads the spec from $PLANES_MODE.
+//
+// With VRR_ENABLED set on a CRTC whose connector reports vrr_capable the
+// vblank is stretched until the next frame arrives, anywhere between the
+// mode's refresh and the panel's lowest one (atomic_vrr_capable and
+// atomic_set_vrr). Frames no longer wait for a fixed beat, src/pacer.c
+// presents them as soon as they are ready.
+struct mode_spec
+{
+    uint32_t width; // 0 for any size
+    uint32_t height;
+    uint32_t refresh_mhz; // 0 for any refresh
+    uint32_t min_clock;   // kHz, 0 for no bound
+    uint32_t max_clock;
+    int preferred;
+};
+
+int mode_spec_parse(const char *text, struct mode_spec *spec);
+const drmModeModeInfo *mode_select(const drmModeConnector *connector, const struct mode_spec *spec);
+const drmModeModeInfo *mode_pick(const drmModeConnector *connector);
+uint32_t mode_refresh_mhz(const drmModeModeInfo *mode);
+int mode_same(const drmModeModeInfo *a, const drmModeModeInfo *b);
+
+#endif
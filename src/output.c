@@ -0,0 +1,423 @@
+#include "output.h"
+#include "kms.h"
+#include "mode.h"
+#include "plane_alloc.h"
+#include "trace.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+
+// the event thread wakes up this often to see whether it should exit
+#define OUTPUT_EVENT_POLL_MS 100
+#define OUTPUT_MAX_CRTCS 32
+
+// Kuhn's augmenting path: give connector c a CRTC from its mask, moving the
+// connector that holds it to another of its CRTCs if that is what it takes
+static int claim_crtc(const uint32_t *masks, int *owner, int crtc_count, int c, uint32_t *visited)
+{
+    for (int i = 0; i < crtc_count; i++)
+    {
+        if (!(masks[c] & (1u << i)) || (*visited & (1u << i)))
+            continue;
+
+        *visited |= 1u << i;
+        if (owner[i] < 0 || claim_crtc(masks, owner, crtc_count, owner[i], visited))
+        {
+            owner[i] = c;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int init_output(struct output_manager *mgr, struct output *out, const drmModeConnector *connector,
+                       uint32_t crtc_id, int crtc_index, struct plane_table *planes, uint32_t *used_planes)
+{
+    int drm_fd = mgr->drm_fd;
+
+    out->manager = mgr;
+    out->index = mgr->count;
+    out->connector_id = connector->connector_id;
+    out->crtc_id = crtc_id;
+    out->crtc_index = crtc_index;
+    out->mode = *mode_pick(connector);
+
+    // the first primary plane that can sit on this CRTC and is not taken yet
+    const struct plane_info *primary = NULL;
+    for (int i = 0; i < planes->count && !primary; i++)
+    {
+        const struct plane_info *plane = &planes->planes[i];
+        if (plane->type == DRM_PLANE_TYPE_PRIMARY && (plane->possible_crtcs & (1u << crtc_index)) &&
+            !(*used_planes & (1u << i)))
+        {
+            primary = plane;
+            *used_planes |= 1u << i;
+        }
+    }
+    if (!primary)
+    {
+        fprintf(stderr, "No primary plane for CRTC %u\n", crtc_id);
+        return -ENODEV;
+    }
+    out->primary = primary->props;
+
+    int ret = atomic_get_crtc_props(drm_fd, crtc_id, &out->crtc_props);
+    if (!ret)
+        ret = atomic_get_connector_props(drm_fd, connector->connector_id, &out->connector_props);
+    if (ret)
+    {
+        fprintf(stderr, "Cannot look up properties of CRTC %u / connector %u\n", crtc_id, connector->connector_id);
+        return ret;
+    }
+
+    ret = swapchain_init(&out->sc, drm_fd, OUTPUT_BUFFERS, out->mode.hdisplay, out->mode.vdisplay, DRM_FORMAT_XRGB8888);
+    if (ret)
+        return ret;
+
+    atomic_req_init(&out->req);
+    frame_loop_init(&out->loop, drm_fd, NULL, NULL);
+    frame_loop_add_swapchain(&out->loop, &out->sc);
+    pthread_mutex_init(&out->lock, NULL);
+    pthread_cond_init(&out->flipped, NULL);
+    return 0;
+}
+
+// give every connected connector a CRTC and set up an output for it, nothing
+// is shown yet. returns the number of outputs or -errno.
+int output_manager_probe(struct output_manager *mgr, int drm_fd)
+{
+    memset(mgr, 0, sizeof(*mgr));
+    mgr->drm_fd = drm_fd;
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+        return -errno;
+
+    struct plane_table planes;
+    int ret = plane_table_load(drm_fd, &planes);
+    if (ret)
+    {
+        drmModeFreeResources(resources);
+        return ret;
+    }
+
+    int crtc_count = resources->count_crtcs < OUTPUT_MAX_CRTCS ? resources->count_crtcs : OUTPUT_MAX_CRTCS;
+    drmModeConnector *connectors[OUTPUT_MAX];
+    uint32_t masks[OUTPUT_MAX];
+    int current[OUTPUT_MAX];
+    int owner[OUTPUT_MAX_CRTCS];
+    int connector_count = 0;
+
+    for (int i = 0; i < crtc_count; i++)
+        owner[i] = -1;
+
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        drmModeConnector *connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (!connector || connector->connection != DRM_MODE_CONNECTED || connector->count_modes == 0)
+        {
+            drmModeFreeConnector(connector);
+            continue;
+        }
+        if (connector_count == OUTPUT_MAX)
+        {
+            fprintf(stderr, "More than %d connected outputs, ignoring connector %u\n", OUTPUT_MAX,
+                    connector->connector_id);
+            drmModeFreeConnector(connector);
+            continue;
+        }
+
+        // the CRTCs any of its encoders can drive, and the one driving it now
+        int c = connector_count++;
+        connectors[c] = connector;
+        masks[c] = 0;
+        current[c] = -1;
+        for (int j = 0; j < connector->count_encoders; j++)
+        {
+            drmModeEncoder *encoder = kms_get_encoder(drm_fd, connector->encoders[j]);
+            if (!encoder)
+                continue;
+            masks[c] |= encoder->possible_crtcs;
+            if (encoder->encoder_id == connector->encoder_id)
+            {
+                for (int k = 0; k < crtc_count; k++)
+                {
+                    if (resources->crtcs[k] == encoder->crtc_id)
+                        current[c] = k;
+                }
+            }
+            drmModeFreeEncoder(encoder);
+        }
+        masks[c] &= crtc_count < 32 ? (1u << crtc_count) - 1 : ~0u;
+    }
+
+    // keep what is already lit, then match the rest around it
+    for (int c = 0; c < connector_count; c++)
+    {
+        if (current[c] >= 0 && (masks[c] & (1u << current[c])) && owner[current[c]] < 0)
+            owner[current[c]] = c;
+    }
+    for (int c = 0; c < connector_count; c++)
+    {
+        int matched = 0;
+        for (int i = 0; i < crtc_count; i++)
+            matched |= owner[i] == c;
+
+        uint32_t visited = 0;
+        if (!matched && !claim_crtc(masks, owner, crtc_count, c, &visited))
+            fprintf(stderr, "No free CRTC for connector %u\n", connectors[c]->connector_id);
+    }
+
+    // outputs in connector order, so the numbering stays stable across runs
+    uint32_t used_planes = 0;
+    ret = 0;
+    for (int c = 0; c < connector_count && !ret; c++)
+    {
+        for (int i = 0; i < crtc_count; i++)
+        {
+            if (owner[i] != c)
+                continue;
+            ret = init_output(mgr, &mgr->outputs[mgr->count], connectors[c], resources->crtcs[i], i, &planes,
+                              &used_planes);
+            if (!ret)
+                mgr->count++;
+        }
+    }
+
+    for (int c = 0; c < connector_count; c++)
+        drmModeFreeConnector(connectors[c]);
+    plane_table_free(&planes);
+    drmModeFreeResources(resources);
+
+    if (ret)
+    {
+        output_manager_destroy(mgr);
+        return ret;
+    }
+    return mgr->count;
+}
+
+// flip events of every output arrive here, user_data is the output that committed
+static void flip_handler(int drm_fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                         unsigned int crtc_id, void *user_data)
+{
+    struct output *out = user_data;
+
+    pthread_mutex_lock(&out->lock);
+    frame_loop_flip_event(&out->loop, sequence, tv_sec, tv_usec, crtc_id);
+    pthread_cond_signal(&out->flipped);
+    pthread_mutex_unlock(&out->lock);
+}
+
+static void *event_thread(void *arg)
+{
+    struct output_manager *mgr = arg;
+    drmEventContext ev = {.version = 3, .page_flip_handler2 = flip_handler};
+    struct pollfd pfd = {.fd = mgr->drm_fd, .events = POLLIN};
+
+    while (!__atomic_load_n(&mgr->stop_events, __ATOMIC_ACQUIRE))
+    {
+        int ret = poll(&pfd, 1, OUTPUT_EVENT_POLL_MS);
+        if (ret < 0 && errno != EINTR)
+        {
+            perror("poll failed");
+            break;
+        }
+        if (ret > 0 && kms_handle_event(mgr->drm_fd, &ev))
+        {
+            fprintf(stderr, "Cannot read DRM events\n");
+            break;
+        }
+    }
+    return NULL;
+}
+
+// put the newest rendered frame on the primary plane. called with the lock held.
+static int commit_frame(struct output *out)
+{
+    int drm_fd = out->manager->drm_fd;
+    struct sc_buffer *next = swapchain_next_ready(&out->sc);
+
+    out->queued = NULL;
+    atomic_req_add(&out->req, out->primary.plane_id, out->primary.fb_id, next->fb_id);
+    atomic_set_damage(drm_fd, &out->req, &out->primary, &out->sc.submit_damage);
+    int ret = atomic_commit(drm_fd, &out->req, ATOMIC_FLIP_FLAGS, out);
+    if (ret)
+    {
+        fprintf(stderr, "Atomic commit on CRTC %u failed: %s\n", out->crtc_id, strerror(-ret));
+        swapchain_cancel(&out->sc, next);
+        return ret;
+    }
+    swapchain_submit(&out->sc, next);
+    frame_loop_begin_flip(&out->loop);
+    return 0;
+}
+
+// draw the next frame; the lock is dropped while drawing
+static void render_frame(struct output *out, struct damage *frame_damage)
+{
+    struct output_manager *mgr = out->manager;
+    struct sc_buffer *buf = swapchain_acquire(&out->sc);
+
+    // copying the stale rects reads the other buffers, so it stays under the lock
+    swapchain_repair(&out->sc, buf);
+    pthread_mutex_unlock(&out->lock);
+
+    uint64_t start = trace_begin();
+    damage_clear(frame_damage);
+    mgr->render(out, buf, frame_damage, mgr->data);
+    trace_end("render", start, (uint32_t)out->index);
+
+    pthread_mutex_lock(&out->lock);
+    swapchain_queue(&out->sc, buf, frame_damage);
+    out->queued = buf;
+    out->frames++;
+}
+
+// one frame ahead at most: render, wait for the flip before, commit, repeat
+static void *output_thread(void *arg)
+{
+    struct output *out = arg;
+    struct output_manager *mgr = out->manager;
+    struct damage frame_damage;
+    damage_init(&frame_damage, out->mode.hdisplay, out->mode.vdisplay);
+
+    pthread_mutex_lock(&out->lock);
+    while (!__atomic_load_n(&mgr->stop, __ATOMIC_ACQUIRE) && !out->error)
+    {
+        if (out->queued && !out->loop.flip_pending)
+            out->error = commit_frame(out);
+        else if (!out->queued && swapchain_can_acquire(&out->sc))
+            render_frame(out, &frame_damage);
+        else
+            pthread_cond_wait(&out->flipped, &out->lock);
+    }
+    pthread_mutex_unlock(&out->lock);
+    return NULL;
+}
+
+// light up every output with one modeset commit, then start drawing.
+// render runs on the output's own thread. returns 0 or -errno.
+int output_manager_start(struct output_manager *mgr, output_render_fn render, void *data)
+{
+    struct atomic_req req;
+    struct damage frame_damage;
+    int ret = 0;
+
+    mgr->render = render;
+    mgr->data = data;
+    atomic_req_init(&req);
+
+    // the first frame is drawn here and shown by the modeset itself
+    for (int i = 0; i < mgr->count && !ret; i++)
+    {
+        struct output *out = &mgr->outputs[i];
+        uint32_t w = out->mode.hdisplay, h = out->mode.vdisplay;
+        struct sc_buffer *buf = swapchain_acquire(&out->sc);
+
+        damage_init(&frame_damage, w, h);
+        render(out, buf, &frame_damage, data);
+        swapchain_queue(&out->sc, buf, NULL);
+
+        ret = atomic_set_mode(mgr->drm_fd, &req, &out->crtc_props, &out->connector_props, &out->mode,
+                              &out->mode_blob_id);
+        if (!ret)
+            ret = atomic_set_plane(&req, &out->primary, out->crtc_id, swapchain_next_ready(&out->sc)->fb_id, 0, 0,
+                                   w, h, 0, 0, w << 16, h << 16);
+    }
+    if (!ret)
+        ret = atomic_commit(mgr->drm_fd, &req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+    if (ret)
+    {
+        fprintf(stderr, "Modeset of %d outputs failed: %s\n", mgr->count, strerror(-ret));
+        atomic_req_reset(mgr->drm_fd, &req);
+        return ret;
+    }
+
+    for (int i = 0; i < mgr->count; i++)
+    {
+        struct output *out = &mgr->outputs[i];
+        swapchain_submit(&out->sc, swapchain_next_ready(&out->sc));
+        swapchain_flip_done(&out->sc);
+    }
+
+    mgr->stop = mgr->stop_events = 0;
+    mgr->threads = 0;
+    ret = pthread_create(&mgr->event_thread, NULL, event_thread, mgr);
+    if (ret)
+        return -ret;
+    mgr->running = 1;
+
+    for (int i = 0; i < mgr->count; i++)
+    {
+        ret = pthread_create(&mgr->outputs[i].thread, NULL, output_thread, &mgr->outputs[i]);
+        if (ret)
+        {
+            output_manager_stop(mgr);
+            return -ret;
+        }
+        mgr->threads++;
+    }
+    return 0;
+}
+
+// stop drawing and wait until nothing is in flight any more
+void output_manager_stop(struct output_manager *mgr)
+{
+    if (!mgr->running)
+        return;
+
+    __atomic_store_n(&mgr->stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < mgr->threads; i++)
+    {
+        struct output *out = &mgr->outputs[i];
+        pthread_mutex_lock(&out->lock);
+        pthread_cond_signal(&out->flipped);
+        pthread_mutex_unlock(&out->lock);
+        pthread_join(out->thread, NULL);
+    }
+
+    // the event thread is still needed for the flips the threads left pending
+    for (int i = 0; i < mgr->count; i++)
+    {
+        struct output *out = &mgr->outputs[i];
+        pthread_mutex_lock(&out->lock);
+        while (out->loop.flip_pending)
+            pthread_cond_wait(&out->flipped, &out->lock);
+        pthread_mutex_unlock(&out->lock);
+    }
+
+    __atomic_store_n(&mgr->stop_events, 1, __ATOMIC_RELEASE);
+    pthread_join(mgr->event_thread, NULL);
+    mgr->running = 0;
+}
+
+void output_manager_destroy(struct output_manager *mgr)
+{
+    output_manager_stop(mgr);
+
+    for (int i = 0; i < mgr->count; i++)
+    {
+        struct output *out = &mgr->outputs[i];
+        swapchain_destroy(&out->sc);
+        if (out->mode_blob_id)
+            kms_destroy_property_blob(mgr->drm_fd, out->mode_blob_id);
+        pthread_mutex_destroy(&out->lock);
+        pthread_cond_destroy(&out->flipped);
+    }
+    mgr->count = 0;
+}
+
+void output_manager_print(const struct output_manager *mgr, FILE *file)
+{
+    for (int i = 0; i < mgr->count; i++)
+    {
+        const struct output *out = &mgr->outputs[i];
+        fprintf(file, "Output %d: connector %u on CRTC %u, %ux%u@%u, %llu frames rendered\n", out->index,
+                out->connector_id, out->crtc_id, out->mode.hdisplay, out->mode.vdisplay, out->mode.vrefresh,
+                (unsigned long long)out->frames);
+        frame_histogram_print(&out->loop.hist, file);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "atomic.h"
+#include "damage.h"
+#include "frame_loop.h"
+#include "swapchain.h"
+
+// Drives every connected display of one device at once.
+//
+// output_manager_probe maps each connected connector to a CRTC its encoders
+// can drive (encoder possible_crtcs), keeping the CRTC a connector already
+// uses where it can so no output needs a full modeset it could avoid. The
+// CRTCs are handed out as a bipartite matching, a connector that could only
+// take a CRTC claimed by a more flexible one gets it back.
+//
+// Every output then gets its own swapchain on its primary plane and its own
+// render thread. A thread draws a frame, commits it and waits for its own
+// flip event before drawing the next one, so each head runs at its own
+// refresh rate and a slow one never holds the others back.
+//
+// All outputs share the one DRM fd, so a single event thread reads it and
+// hands every flip event to the output that made the commit. Swapchain
+// state is only touched with the output's lock held; the buffer being
+// rendered is not, so drawing itself runs without any lock.
+#define OUTPUT_MAX 8
+#define OUTPUT_BUFFERS 3
+
+struct output;
+
+// draw the next frame into buf. buf->damage is what is stale in it, add what
+// is drawn to frame_damage (both start out as the whole buffer the first time)
+typedef void (*output_render_fn)(struct output *out, struct sc_buffer *buf, struct damage *frame_damage, void *data);
+
+struct output
+{
+    struct output_manager *manager;
+    int index;
+    uint32_t connector_id;
+    uint32_t crtc_id;
+    int crtc_index;
+    drmModeModeInfo mode;
+    uint32_t mode_blob_id;
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_props primary;
+
+    struct swapchain sc;
+    struct frame_loop loop;
+    struct atomic_req req;
+    struct sc_buffer *queued; // rendered, waiting for the pending flip to finish
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t flipped;
+    uint64_t frames;
+    int error;
+};
+
+struct output_manager
+{
+    int drm_fd;
+    int count;
+    struct output outputs[OUTPUT_MAX];
+
+    output_render_fn render;
+    void *data;
+
+    pthread_t event_thread;
+    int threads;     // output threads running
+    int stop;        // render threads finish their frame and exit
+    int stop_events; // set once no flip is pending any more
+    int running;
+};
+
+int output_manager_probe(struct output_manager *mgr, int drm_fd);
+int output_manager_start(struct output_manager *mgr, output_render_fn render, void *data);
+void output_manager_stop(struct output_manager *mgr);
+void output_manager_destroy(struct output_manager *mgr);
+void output_manager_print(const struct output_manager *mgr, FILE *file);
+
+#endif
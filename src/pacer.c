@@ -0,0 +1,107 @@
+#include "pacer.h"
+
+#include <math.h>
+#include <string.h>
+
+// slack before a fixed vblank on top of twice the render time deviation
+#define PACER_MARGIN_US 500
+// the bottom of the VRR range on most panels, KMS does not say
+#define PACER_VRR_MIN_HZ 48
+
+void pacer_init(struct pacer *p, const drmModeModeInfo *mode, int vrr)
+{
+    memset(p, 0, sizeof(*p));
+    p->vrr = vrr;
+    p->margin_us = vrr ? 0 : PACER_MARGIN_US;
+
+    uint64_t frame = (uint64_t)mode->htotal * mode->vtotal;
+    if (mode->clock && frame)
+        p->period_us = frame * 1000 / mode->clock;
+    else
+        p->period_us = 1000000 / (mode->vrefresh ? mode->vrefresh : 60);
+    p->max_period_us = vrr ? 1000000 / PACER_VRR_MIN_HZ : p->period_us;
+}
+
+// when to start rendering the next frame, 0 or a time already past means now
+uint64_t pacer_start_us(const struct pacer *p)
+{
+    if (!p->last_flip_us)
+        return 0;
+
+    uint64_t estimate = p->render_avg_us;
+    if (p->vrr)
+    {
+        // aim at the earliest flip, but keep a slow frame from running past
+        // the longest one: the panel then refreshes on its own and the frame
+        // waits for that to finish
+        uint64_t start = p->last_flip_us + p->period_us;
+        uint64_t latest = p->last_flip_us + p->max_period_us;
+        uint64_t slow = estimate + 2 * p->render_dev_us;
+        if (start > estimate)
+            start -= estimate;
+        if (latest > slow && start > latest - slow)
+            start = latest - slow;
+        return start;
+    }
+
+    // the earliest vblank the frame can make, a later one if it takes longer than a period
+    estimate += 2 * p->render_dev_us + p->margin_us;
+    uint64_t periods = estimate / p->period_us + 1;
+    uint64_t target = p->last_flip_us + periods * p->period_us;
+    return target > estimate ? target - estimate : 0;
+}
+
+// a frame whose rendering started at start_us was ready at ready_us
+void pacer_rendered(struct pacer *p, uint64_t start_us, uint64_t ready_us)
+{
+    uint64_t render_us = ready_us - start_us;
+    if (!p->render_avg_us)
+    {
+        p->render_avg_us = render_us;
+    }
+    else
+    {
+        uint64_t dev = render_us > p->render_avg_us ? render_us - p->render_avg_us : p->render_avg_us - render_us;
+        p->render_dev_us = (p->render_dev_us * 7 + dev) / 8;
+        p->render_avg_us = (p->render_avg_us * 7 + render_us) / 8;
+    }
+    p->ready_us = ready_us;
+}
+
+// the flip event of the last committed frame came in
+void pacer_flipped(struct pacer *p, uint64_t flip_us)
+{
+    if (p->ready_us)
+    {
+        uint64_t latency = flip_us > p->ready_us ? flip_us - p->ready_us : 0;
+        p->frames++;
+        p->latency_total_us += latency;
+        if (latency > p->latency_max_us)
+            p->latency_max_us = latency;
+        p->ready_us = 0;
+    }
+
+    if (p->last_flip_us)
+    {
+        double interval = (double)(flip_us - p->last_flip_us);
+        p->intervals++;
+        p->interval_sum += interval;
+        p->interval_sq_sum += interval * interval;
+    }
+    p->last_flip_us = flip_us;
+}
+
+void pacer_print(const struct pacer *p, FILE *out)
+{
+    if (!p->frames || !p->intervals)
+        return;
+
+    double mean = p->interval_sum / p->intervals;
+    double variance = p->interval_sq_sum / p->intervals - mean * mean;
+    fprintf(out, "Pacing (%s, %.2f ms period): render %.2f +- %.2f ms\n", p->vrr ? "VRR" : "fixed refresh",
+            p->period_us / 1000.0, p->render_avg_us / 1000.0, p->render_dev_us / 1000.0);
+    fprintf(out, "  ready to flip %.2f ms avg, %.2f ms max\n", (double)p->latency_total_us / p->frames / 1000.0,
+            p->latency_max_us / 1000.0);
+    fprintf(out, "  flip interval %.2f ms avg, %.2f ms stddev\n", mean / 1000.0,
+            sqrt(variance > 0 ? variance : 0) / 1000.0);
+}
@@ -0,0 +1,56 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// Decides when to start rendering the next frame so it reaches the screen
+// with as little delay as possible, for a loop that renders one frame,
+// commits it and waits for its flip before starting the next.
+//
+// At a fixed refresh a frame can only go out at a vblank. Starting right
+// after the last flip means a frame that is ready early sits around until
+// the vblank; so rendering starts as late as the estimated render time
+// allows, with a safety margin because missing the vblank costs a whole
+// period.
+//
+// With VRR the panel waits for the frame instead: a commit is scanned out as
+// soon as it arrives, as long as a mode period has passed since the last
+// one. Missing that costs nothing but the overrun, so there is no margin and
+// a slow frame is shown the moment it is done rather than a period later.
+// Only a frame later than the longest interval the panel holds (a 48 Hz
+// floor is assumed) has to wait for the refresh the panel starts on its own.
+//
+// The pacer keeps an average of the render time and of how much it varies,
+// both in microseconds of CLOCK_MONOTONIC like the flip timestamps, and
+// tracks the delay from a frame being ready to it being flipped and the
+// spread of the flip intervals.
+struct pacer
+{
+    int vrr;
+    uint64_t period_us;     // the mode's refresh interval, the shortest one with VRR
+    uint64_t max_period_us; // the longest one the panel waits before refreshing anyway
+    uint64_t margin_us;     // slack kept before a fixed vblank
+
+    uint64_t render_avg_us;
+    uint64_t render_dev_us; // mean deviation from the average
+    uint64_t last_flip_us;
+    uint64_t ready_us;      // when the frame being flipped was ready, 0 if none
+
+    uint64_t frames;
+    uint64_t latency_total_us;
+    uint64_t latency_max_us;
+    uint64_t intervals;
+    double interval_sum;
+    double interval_sq_sum;
+};
+
+void pacer_init(struct pacer *p, const drmModeModeInfo *mode, int vrr);
+uint64_t pacer_start_us(const struct pacer *p);
+void pacer_rendered(struct pacer *p, uint64_t start_us, uint64_t ready_us);
+void pacer_flipped(struct pacer *p, uint64_t flip_us);
+void pacer_print(const struct pacer *p, FILE *out);
+
+#endif
@@ -0,0 +1,403 @@
+#include "pixel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86 1
+#include <immintrin.h>
+#endif
+
+#define ROW(base, pitch, y) ((uint32_t *)((uint8_t *)(base) + (size_t)(y) * (pitch)))
+#define CROW(base, pitch, y) ((const uint32_t *)((const uint8_t *)(base) + (size_t)(y) * (pitch)))
+
+// exact round(x / 255) for x in [0, 255 * 255], shared by every path so the
+// SIMD kernels match the scalar reference bit for bit
+static inline uint32_t div255(uint32_t x)
+{
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+static inline uint32_t blend_pixel(uint32_t s, uint32_t d)
+{
+    uint32_t inv = 255 - (s >> 24);
+    uint32_t out = 0;
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t c = ((s >> shift) & 0xFF) + div255(((d >> shift) & 0xFF) * inv);
+        if (c > 255)
+            c = 255;
+        out |= c << shift;
+    }
+    return out;
+}
+
+// scalar reference kernels
+
+static void fill_scalar(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *row = ROW(dst, pitch, y);
+        for (uint32_t x = 0; x < width; x++)
+            row[x] = color;
+    }
+}
+
+static void blit_scalar(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(ROW(dst, dst_pitch, y), CROW(src, src_pitch, y), (size_t)width * 4);
+}
+
+static void blend_scalar(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        for (uint32_t x = 0; x < width; x++)
+            d[x] = blend_pixel(s[x], d[x]);
+    }
+}
+
+static const struct pixel_kernels kernels_scalar = {
+    .name = "scalar",
+    .fill = fill_scalar,
+    .blit = blit_scalar,
+    .blend = blend_scalar,
+};
+
+#ifdef PIXEL_X86
+
+// Streaming stores need an aligned destination, so each row is split into a
+// scalar head up to the vector alignment, the vector body and a scalar tail.
+static inline uint32_t head_pixels(const uint32_t *row, uint32_t width, uintptr_t align)
+{
+    uint32_t head = (uint32_t)(((align - ((uintptr_t)row & (align - 1))) & (align - 1)) / 4);
+    return head > width ? width : head;
+}
+
+// SSE2
+
+__attribute__((target("sse2"))) static void fill_sse2(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+{
+    __m128i v = _mm_set1_epi32((int)color);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *row = ROW(dst, pitch, y);
+        uint32_t x = head_pixels(row, width, 16);
+
+        for (uint32_t i = 0; i < x; i++)
+            row[i] = color;
+        for (; x + 4 <= width; x += 4)
+            _mm_stream_si128((__m128i *)(row + x), v);
+        for (; x < width; x++)
+            row[x] = color;
+    }
+    _mm_sfence();
+}
+
+__attribute__((target("sse2"))) static void blit_sse2(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        uint32_t x = head_pixels(d, width, 16);
+
+        for (uint32_t i = 0; i < x; i++)
+            d[i] = s[i];
+        for (; x + 4 <= width; x += 4)
+            _mm_stream_si128((__m128i *)(d + x), _mm_loadu_si128((const __m128i *)(s + x)));
+        for (; x < width; x++)
+            d[x] = s[x];
+    }
+    _mm_sfence();
+}
+
+// one 16 bit half (two pixels) of the blend: src + div255(dst * (255 - src.a))
+__attribute__((target("sse2"))) static inline __m128i blend_half_sse2(__m128i s16, __m128i d16)
+{
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(d16, inv), _mm_set1_epi16(128));
+    t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    return t;
+}
+
+__attribute__((target("sse2"))) static inline __m128i blend4_sse2(__m128i s, __m128i d)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = blend_half_sse2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+    __m128i hi = blend_half_sse2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+    return _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+}
+
+__attribute__((target("sse2"))) static void blend_sse2(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        uint32_t x = 0;
+
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i sv = _mm_loadu_si128((const __m128i *)(s + x));
+            __m128i dv = _mm_loadu_si128((const __m128i *)(d + x));
+            _mm_storeu_si128((__m128i *)(d + x), blend4_sse2(sv, dv));
+        }
+        for (; x < width; x++)
+            d[x] = blend_pixel(s[x], d[x]);
+    }
+}
+
+static const struct pixel_kernels kernels_sse2 = {
+    .name = "sse2",
+    .fill = fill_sse2,
+    .blit = blit_sse2,
+    .blend = blend_sse2,
+};
+
+// AVX2
+
+__attribute__((target("avx2"))) static void fill_avx2(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+{
+    __m256i v = _mm256_set1_epi32((int)color);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *row = ROW(dst, pitch, y);
+        uint32_t x = head_pixels(row, width, 32);
+
+        for (uint32_t i = 0; i < x; i++)
+            row[i] = color;
+        for (; x + 16 <= width; x += 16)
+        {
+            _mm256_stream_si256((__m256i *)(row + x), v);
+            _mm256_stream_si256((__m256i *)(row + x + 8), v);
+        }
+        for (; x + 8 <= width; x += 8)
+            _mm256_stream_si256((__m256i *)(row + x), v);
+        for (; x < width; x++)
+            row[x] = color;
+    }
+    _mm_sfence();
+}
+
+__attribute__((target("avx2"))) static void blit_avx2(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        uint32_t x = head_pixels(d, width, 32);
+
+        for (uint32_t i = 0; i < x; i++)
+            d[i] = s[i];
+        for (; x + 8 <= width; x += 8)
+            _mm256_stream_si256((__m256i *)(d + x), _mm256_loadu_si256((const __m256i *)(s + x)));
+        for (; x < width; x++)
+            d[x] = s[x];
+    }
+    _mm_sfence();
+}
+
+__attribute__((target("avx2"))) static inline __m256i blend_half_avx2(__m256i s16, __m256i d16)
+{
+    __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(d16, inv), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2"))) static void blend_avx2(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    __m256i zero = _mm256_setzero_si256();
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        uint32_t x = 0;
+
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i sv = _mm256_loadu_si256((const __m256i *)(s + x));
+            __m256i dv = _mm256_loadu_si256((const __m256i *)(d + x));
+            __m256i lo = blend_half_avx2(_mm256_unpacklo_epi8(sv, zero), _mm256_unpacklo_epi8(dv, zero));
+            __m256i hi = blend_half_avx2(_mm256_unpackhi_epi8(sv, zero), _mm256_unpackhi_epi8(dv, zero));
+            _mm256_storeu_si256((__m256i *)(d + x), _mm256_adds_epu8(sv, _mm256_packus_epi16(lo, hi)));
+        }
+        for (; x < width; x++)
+            d[x] = blend_pixel(s[x], d[x]);
+    }
+}
+
+static const struct pixel_kernels kernels_avx2 = {
+    .name = "avx2",
+    .fill = fill_avx2,
+    .blit = blit_avx2,
+    .blend = blend_avx2,
+};
+
+// AVX-512
+
+__attribute__((target("avx512f"))) static void fill_avx512(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+{
+    __m512i v = _mm512_set1_epi32((int)color);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *row = ROW(dst, pitch, y);
+        uint32_t x = head_pixels(row, width, 64);
+
+        for (uint32_t i = 0; i < x; i++)
+            row[i] = color;
+        for (; x + 16 <= width; x += 16)
+            _mm512_stream_si512((void *)(row + x), v);
+        for (; x < width; x++)
+            row[x] = color;
+    }
+    _mm_sfence();
+}
+
+__attribute__((target("avx512f"))) static void blit_avx512(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        uint32_t x = head_pixels(d, width, 64);
+
+        for (uint32_t i = 0; i < x; i++)
+            d[i] = s[i];
+        for (; x + 16 <= width; x += 16)
+            _mm512_stream_si512((void *)(d + x), _mm512_loadu_si512((const void *)(s + x)));
+        for (; x < width; x++)
+            d[x] = s[x];
+    }
+    _mm_sfence();
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline __m512i blend_half_avx512(__m512i s16, __m512i d16)
+{
+    __m512i a = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m512i inv = _mm512_sub_epi16(_mm512_set1_epi16(255), a);
+    __m512i t = _mm512_add_epi16(_mm512_mullo_epi16(d16, inv), _mm512_set1_epi16(128));
+    return _mm512_srli_epi16(_mm512_add_epi16(t, _mm512_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void blend_avx512(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    __m512i zero = _mm512_setzero_si512();
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint32_t *d = ROW(dst, dst_pitch, y);
+        const uint32_t *s = CROW(src, src_pitch, y);
+        uint32_t x = 0;
+
+        for (; x + 16 <= width; x += 16)
+        {
+            __m512i sv = _mm512_loadu_si512((const void *)(s + x));
+            __m512i dv = _mm512_loadu_si512((const void *)(d + x));
+            __m512i lo = blend_half_avx512(_mm512_unpacklo_epi8(sv, zero), _mm512_unpacklo_epi8(dv, zero));
+            __m512i hi = blend_half_avx512(_mm512_unpackhi_epi8(sv, zero), _mm512_unpackhi_epi8(dv, zero));
+            _mm512_storeu_si512((void *)(d + x), _mm512_adds_epu8(sv, _mm512_packus_epi16(lo, hi)));
+        }
+        for (; x < width; x++)
+            d[x] = blend_pixel(s[x], d[x]);
+    }
+}
+
+static const struct pixel_kernels kernels_avx512 = {
+    .name = "avx512",
+    .fill = fill_avx512,
+    .blit = blit_avx512,
+    .blend = blend_avx512,
+};
+
+#endif
+
+// every kernel set this CPU can run, fastest first
+int pixel_kernels_supported(const struct pixel_kernels **list, int max)
+{
+    int count = 0;
+
+#ifdef PIXEL_X86
+    __builtin_cpu_init();
+    if (count < max && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        list[count++] = &kernels_avx512;
+    if (count < max && __builtin_cpu_supports("avx2"))
+        list[count++] = &kernels_avx2;
+    if (count < max && __builtin_cpu_supports("sse2"))
+        list[count++] = &kernels_sse2;
+#endif
+    if (count < max)
+        list[count++] = &kernels_scalar;
+
+    return count;
+}
+
+const struct pixel_kernels *pixel_kernels_scalar(void)
+{
+    return &kernels_scalar;
+}
+
+// look up a supported kernel set by name, NULL if this CPU cannot run it
+const struct pixel_kernels *pixel_kernels_by_name(const char *name)
+{
+    const struct pixel_kernels *list[4];
+    int count = pixel_kernels_supported(list, 4);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(list[i]->name, name) == 0)
+            return list[i];
+    }
+    return NULL;
+}
+
+// best kernel set for this CPU, PLANES_PIXEL_KERNELS=<name> forces a specific one
+const struct pixel_kernels *pixel_kernels_get(void)
+{
+    static const struct pixel_kernels *selected;
+
+    const struct pixel_kernels *k = __atomic_load_n(&selected, __ATOMIC_ACQUIRE);
+    if (k)
+        return k;
+
+    const char *forced = getenv("PLANES_PIXEL_KERNELS");
+    if (forced)
+        k = pixel_kernels_by_name(forced);
+    if (!k)
+        pixel_kernels_supported(&k, 1);
+
+    __atomic_store_n(&selected, k, __ATOMIC_RELEASE);
+    return k;
+}
+
+void pixel_fill(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color)
+{
+    pixel_kernels_get()->fill(dst, pitch, width, height, color);
+}
+
+void pixel_fill_rect(void *dst, uint32_t pitch, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color)
+{
+    pixel_kernels_get()->fill(ROW(dst, pitch, y) + x, pitch, width, height, color);
+}
+
+void pixel_blit(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    pixel_kernels_get()->blit(dst, dst_pitch, src, src_pitch, width, height);
+}
+
+void pixel_blend(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    pixel_kernels_get()->blend(dst, dst_pitch, src, src_pitch, width, height);
+}
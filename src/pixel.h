@@ -0,0 +1,35 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 32bpp pixel kernels. Every kernel walks rows using the buffer's pitch in
+// bytes, so padded dumb buffers (pitch > width * 4) are handled correctly.
+//
+// fill and blit write with non-temporal stores on the SIMD paths. That is
+// what write-combined scanout memory wants, but it also means the written
+// lines are not in the cache afterwards.
+//
+// blend is ARGB8888 src-over with premultiplied alpha, the same blend mode
+// KMS planes default to: dst = src + dst * (255 - src.a) / 255. It reads
+// dst, so it belongs on cached memory, not directly on a dumb buffer map.
+struct pixel_kernels
+{
+    const char *name;
+    void (*fill)(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color);
+    void (*blit)(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height);
+    void (*blend)(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height);
+};
+
+const struct pixel_kernels *pixel_kernels_get(void);
+const struct pixel_kernels *pixel_kernels_by_name(const char *name);
+const struct pixel_kernels *pixel_kernels_scalar(void);
+int pixel_kernels_supported(const struct pixel_kernels **list, int max);
+
+void pixel_fill(void *dst, uint32_t pitch, uint32_t width, uint32_t height, uint32_t color);
+void pixel_fill_rect(void *dst, uint32_t pitch, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color);
+void pixel_blit(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height);
+void pixel_blend(void *dst, uint32_t dst_pitch, const void *src, uint32_t src_pitch, uint32_t width, uint32_t height);
+
+#endif
@@ -0,0 +1,475 @@
+#include "plane_alloc.h"
+#include "tiling.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <drm_fourcc.h>
+
+// IN_FORMATS lists every format/modifier pair the plane can scan out
+static void parse_in_formats(int drm_fd, uint32_t blob_id, struct plane_info *info)
+{
+    drmModePropertyBlobRes *blob = kms_get_property_blob(drm_fd, blob_id);
+    if (!blob)
+        return;
+
+    const struct drm_format_modifier_blob *hdr = blob->data;
+    const uint32_t *formats = (const uint32_t *)((const uint8_t *)hdr + hdr->formats_offset);
+    const struct drm_format_modifier *mods = (const struct drm_format_modifier *)((const uint8_t *)hdr + hdr->modifiers_offset);
+
+    // each modifier entry covers up to 64 formats starting at mods[i].offset
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < hdr->count_modifiers; i++)
+        count += __builtin_popcountll(mods[i].formats);
+
+    info->modifiers = calloc(count ? count : 1, sizeof(*info->modifiers));
+    if (!info->modifiers)
+    {
+        drmModeFreePropertyBlob(blob);
+        return;
+    }
+
+    for (uint32_t i = 0; i < hdr->count_modifiers; i++)
+    {
+        for (int bit = 0; bit < 64; bit++)
+        {
+            if (!(mods[i].formats & (1ULL << bit)))
+                continue;
+            if (mods[i].offset + bit >= hdr->count_formats)
+                continue;
+
+            struct plane_format_mod *fm = &info->modifiers[info->modifier_count++];
+            fm->format = formats[mods[i].offset + bit];
+            fm->modifier = mods[i].modifier;
+        }
+    }
+
+    drmModeFreePropertyBlob(blob);
+}
+
+static int load_plane(int drm_fd, uint32_t plane_id, struct plane_info *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->plane_id = plane_id;
+    info->type = DRM_PLANE_TYPE_OVERLAY;
+    info->can_scale = -1;
+
+    drmModePlane *plane = kms_get_plane(drm_fd, plane_id);
+    if (!plane)
+        return -errno;
+
+    info->possible_crtcs = plane->possible_crtcs;
+    info->format_count = plane->count_formats;
+    info->formats = calloc(plane->count_formats ? plane->count_formats : 1, sizeof(uint32_t));
+    if (info->formats)
+        memcpy(info->formats, plane->formats, plane->count_formats * sizeof(uint32_t));
+    drmModeFreePlane(plane);
+
+    if (!info->formats)
+        return -ENOMEM;
+
+    int ret = atomic_get_plane_props(drm_fd, plane_id, &info->props);
+    if (ret)
+        return ret;
+
+    drmModeObjectProperties *props = kms_get_object_properties(drm_fd, plane_id, DRM_MODE_OBJECT_PLANE);
+    if (!props)
+        return -errno;
+
+    for (uint32_t i = 0; i < props->count_props; i++)
+    {
+        drmModePropertyRes *prop = kms_get_property(drm_fd, props->props[i]);
+        if (!prop)
+            continue;
+
+        if (strcmp(prop->name, "type") == 0)
+        {
+            info->type = props->prop_values[i];
+        }
+        else if (strcmp(prop->name, "zpos") == 0)
+        {
+            info->zpos_prop = prop->prop_id;
+            info->zpos_mutable = !(prop->flags & DRM_MODE_PROP_IMMUTABLE);
+            if (prop->count_values >= 2)
+            {
+                info->zpos_min = prop->values[0];
+                info->zpos_max = prop->values[1];
+            }
+            // an immutable zpos is pinned at its current value
+            if (!info->zpos_mutable)
+                info->zpos_min = info->zpos_max = props->prop_values[i];
+        }
+        else if (strcmp(prop->name, "IN_FORMATS") == 0 && props->prop_values[i])
+        {
+            parse_in_formats(drm_fd, props->prop_values[i], info);
+        }
+        else if (strcmp(prop->name, "SCALING_FILTER") == 0)
+        {
+            // only planes with a scaler expose a filter choice
+            info->can_scale = 1;
+        }
+
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+
+    // cursor planes never scale
+    if (info->type == DRM_PLANE_TYPE_CURSOR)
+        info->can_scale = 0;
+
+    return 0;
+}
+
+// enumerate every plane once, needs DRM_CLIENT_CAP_UNIVERSAL_PLANES and ATOMIC
+int plane_table_load(int drm_fd, struct plane_table *table)
+{
+    memset(table, 0, sizeof(*table));
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+        return -errno;
+
+    for (int i = 0; i < resources->count_crtcs && i < PLANE_TABLE_MAX_CRTCS; i++)
+        table->crtc_ids[table->crtc_count++] = resources->crtcs[i];
+    drmModeFreeResources(resources);
+
+    drmModePlaneRes *plane_res = kms_get_plane_resources(drm_fd);
+    if (!plane_res)
+        return -errno;
+
+    for (uint32_t i = 0; i < plane_res->count_planes && table->count < PLANE_TABLE_MAX; i++)
+    {
+        struct plane_info *info = &table->planes[table->count];
+        int ret = load_plane(drm_fd, plane_res->planes[i], info);
+        if (ret)
+        {
+            fprintf(stderr, "Skipping plane %u: %s\n", plane_res->planes[i], strerror(-ret));
+            free(info->formats);
+            free(info->modifiers);
+            continue;
+        }
+        table->count++;
+    }
+
+    drmModeFreePlaneResources(plane_res);
+    return 0;
+}
+
+void plane_table_free(struct plane_table *table)
+{
+    for (int i = 0; i < table->count; i++)
+    {
+        free(table->planes[i].formats);
+        free(table->planes[i].modifiers);
+    }
+    table->count = 0;
+}
+
+int plane_table_crtc_index(const struct plane_table *table, uint32_t crtc_id)
+{
+    for (int i = 0; i < table->crtc_count; i++)
+    {
+        if (table->crtc_ids[i] == crtc_id)
+            return i;
+    }
+    return -1;
+}
+
+int plane_supports_format(const struct plane_info *plane, uint32_t format, uint64_t modifier)
+{
+    // without IN_FORMATS only implicit/linear layouts can be assumed
+    if (!plane->modifier_count)
+    {
+        if (modifier != DRM_FORMAT_MOD_LINEAR && modifier != DRM_FORMAT_MOD_INVALID)
+            return 0;
+
+        for (uint32_t i = 0; i < plane->format_count; i++)
+        {
+            if (plane->formats[i] == format)
+                return 1;
+        }
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < plane->modifier_count; i++)
+    {
+        if (plane->modifiers[i].format != format)
+            continue;
+        if (plane->modifiers[i].modifier == modifier || modifier == DRM_FORMAT_MOD_INVALID)
+            return 1;
+    }
+    return 0;
+}
+
+// the layout a CPU drawn buffer for this plane should have: the first tiled
+// modifier from tiling_preferred_modifiers that IN_FORMATS lists for format,
+// linear when there is none (or no IN_FORMATS at all). $PLANES_TILING
+// (linear, x-tiled, y-tiled) narrows the choice to one layout.
+uint64_t plane_pick_modifier(const struct plane_info *plane, uint32_t format)
+{
+    int count;
+    const uint64_t *modifiers = tiling_preferred_modifiers(&count);
+    const char *forced = getenv("PLANES_TILING");
+    const struct tiling_info *tiling = forced && *forced ? tiling_info_by_name(forced) : NULL;
+    if (forced && *forced && !tiling)
+        fprintf(stderr, "Unknown PLANES_TILING %s, ignoring it\n", forced);
+    if (tiling)
+    {
+        modifiers = &tiling->modifier;
+        count = tiling->tile_width ? 1 : 0;
+    }
+    for (int i = 0; i < count && plane->modifier_count; i++)
+    {
+        if (plane_supports_format(plane, format, modifiers[i]))
+            return modifiers[i];
+    }
+    return DRM_FORMAT_MOD_LINEAR;
+}
+
+// plane_test_fn for real hardware, ctx points at the drm fd
+int plane_atomic_test(void *ctx, struct atomic_req *req)
+{
+    return atomic_test(*(int *)ctx, req, DRM_MODE_ATOMIC_ALLOW_MODESET) == 0;
+}
+
+int plane_alloc_add_layer(struct atomic_req *req, const struct plane_info *plane, uint32_t crtc_id,
+                          const struct layer *layer, int zpos)
+{
+    int ret = atomic_set_plane(req, &plane->props, crtc_id, layer->fb_id, layer->x, layer->y, layer->w, layer->h,
+                               0, 0, layer->src_w << 16, layer->src_h << 16);
+    if (ret == 0 && plane->zpos_prop && plane->zpos_mutable)
+        ret = atomic_req_add(req, plane->plane_id, plane->zpos_prop, zpos);
+    return ret;
+}
+
+static int layer_scaled(const struct layer *layer)
+{
+    return layer->src_w != layer->w || layer->src_h != layer->h;
+}
+
+static int layers_overlap(const struct layer *a, const struct layer *b)
+{
+    return a->x < b->x + (int32_t)b->w && b->x < a->x + (int32_t)a->w &&
+           a->y < b->y + (int32_t)b->h && b->y < a->y + (int32_t)a->h;
+}
+
+// static checks that do not need the driver: CRTC, format, scaling, stacking
+static int plane_fits(const struct plane_info *plane, int crtc_index, const struct layer *layer, int64_t below_zpos)
+{
+    if (!(plane->possible_crtcs & (1u << crtc_index)))
+        return 0;
+    if (!plane_supports_format(plane, layer->format, layer->modifier))
+        return 0;
+    if (layer_scaled(layer) && plane->can_scale == 0)
+        return 0;
+    if (plane->zpos_prop && (int64_t)plane->zpos_max <= below_zpos)
+        return 0;
+    return 1;
+}
+
+// zpos to use for a plane that has to sit above below_zpos
+static int64_t pick_zpos(const struct plane_info *plane, int64_t below_zpos)
+{
+    if (!plane->zpos_prop)
+        return below_zpos + 1;
+    if (!plane->zpos_mutable || (int64_t)plane->zpos_min > below_zpos)
+        return plane->zpos_min;
+    return below_zpos + 1;
+}
+
+// rebuild the request from scratch for the current assignment
+static int build_request(struct plane_table *table, uint32_t crtc_id, const struct layer *layers, int layer_count,
+                         const int *plane_of, const struct atomic_req *base, struct atomic_req *out)
+{
+    *out = *base;
+    out->blob_count = 0;
+
+    int64_t zpos = -1;
+    for (int i = 0; i < layer_count; i++)
+    {
+        if (plane_of[i] < 0)
+            continue;
+
+        const struct plane_info *plane = &table->planes[plane_of[i]];
+        zpos = pick_zpos(plane, zpos);
+        if (plane_alloc_add_layer(out, plane, crtc_id, &layers[i], (int)zpos))
+            return -ENOSPC;
+    }
+    return 0;
+}
+
+// Assign layers to hardware planes. layers[0] is the background and must land
+// on the primary plane, it is also the buffer every composited layer gets
+// flattened into. Each other layer is tried on the free planes with a
+// TEST_ONLY commit. A layer that fits nowhere is composited, and any
+// hardware layer below it that it overlaps is composited too, so the
+// stacking order survives.
+//
+// On success *req holds the base request plus every hardware layer.
+int plane_alloc_assign(struct plane_table *table, uint32_t crtc_id, struct layer *layers, int layer_count,
+                       plane_test_fn test, void *test_ctx, struct atomic_req *req, struct plane_alloc_result *result)
+{
+    int crtc_index = plane_table_crtc_index(table, crtc_id);
+    if (crtc_index < 0 || layer_count < 1 || layer_count > PLANE_TABLE_MAX)
+        return -EINVAL;
+
+    int plane_of[PLANE_TABLE_MAX];
+    int used[PLANE_TABLE_MAX] = {0};
+    struct atomic_req base = *req;
+    struct atomic_req trial;
+
+    for (int i = 0; i < layer_count; i++)
+    {
+        plane_of[i] = -1;
+        layers[i].plane_id = 0;
+    }
+
+    // the background takes the primary plane
+    for (int p = 0; p < table->count && plane_of[0] < 0; p++)
+    {
+        struct plane_info *plane = &table->planes[p];
+        if (plane->type != DRM_PLANE_TYPE_PRIMARY || !plane_fits(plane, crtc_index, &layers[0], -1))
+            continue;
+
+        plane_of[0] = p;
+        if (build_request(table, crtc_id, layers, 1, plane_of, &base, &trial) == 0 && test(test_ctx, &trial))
+            used[p] = 1;
+        else
+            plane_of[0] = -1;
+    }
+
+    if (plane_of[0] < 0)
+    {
+        fprintf(stderr, "No primary plane accepts the background layer\n");
+        return -ENODEV;
+    }
+
+    // overlays first, cursor planes only once the overlays are gone
+    int64_t zpos = pick_zpos(&table->planes[plane_of[0]], -1);
+    for (int i = 1; i < layer_count; i++)
+    {
+        for (int pass = 0; pass < 2 && plane_of[i] < 0; pass++)
+        {
+            uint32_t wanted = pass == 0 ? DRM_PLANE_TYPE_OVERLAY : DRM_PLANE_TYPE_CURSOR;
+
+            for (int p = 0; p < table->count && plane_of[i] < 0; p++)
+            {
+                struct plane_info *plane = &table->planes[p];
+                if (used[p] || plane->type != wanted || !plane_fits(plane, crtc_index, &layers[i], zpos))
+                    continue;
+
+                plane_of[i] = p;
+                if (build_request(table, crtc_id, layers, i + 1, plane_of, &base, &trial) == 0 && test(test_ctx, &trial))
+                {
+                    used[p] = 1;
+                    zpos = pick_zpos(plane, zpos);
+                    if (layer_scaled(&layers[i]))
+                        plane->can_scale = 1;
+                }
+                else
+                {
+                    plane_of[i] = -1;
+                }
+            }
+        }
+    }
+
+    // a composited layer ends up in the background buffer, below every
+    // overlay, so hardware layers under it that it overlaps must come down too
+    int changed = 1;
+    while (changed)
+    {
+        changed = 0;
+        for (int k = 1; k < layer_count; k++)
+        {
+            if (plane_of[k] >= 0)
+                continue;
+
+            for (int i = 1; i < k; i++)
+            {
+                if (plane_of[i] >= 0 && layers_overlap(&layers[i], &layers[k]))
+                {
+                    used[plane_of[i]] = 0;
+                    plane_of[i] = -1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    // demotion changed the plane set, make sure the driver still agrees
+    if (build_request(table, crtc_id, layers, layer_count, plane_of, &base, &trial) || !test(test_ctx, &trial))
+    {
+        for (int i = 1; i < layer_count; i++)
+            plane_of[i] = -1;
+        if (build_request(table, crtc_id, layers, layer_count, plane_of, &base, &trial) || !test(test_ctx, &trial))
+            return -EINVAL;
+    }
+
+    memset(result, 0, sizeof(*result));
+    for (int i = 0; i < layer_count; i++)
+    {
+        if (plane_of[i] >= 0)
+        {
+            layers[i].plane_id = table->planes[plane_of[i]].plane_id;
+            result->hw_layers++;
+        }
+        else
+        {
+            result->composited_layers++;
+        }
+    }
+    if (result->composited_layers)
+        result->composite_plane_id = layers[0].plane_id;
+
+    trial.blob_count = req->blob_count;
+    memcpy(trial.blobs, req->blobs, sizeof(trial.blobs));
+    *req = trial;
+    return 0;
+}
+
+// put the layers back on the planes an earlier plane_alloc_assign gave them
+// (plane_ids[i], 0 for composited), without any TEST_ONLY commit. the caller
+// tests the finished request once and falls back to plane_alloc_assign when
+// the driver no longer agrees. -ENOENT when a plane is not in the table.
+int plane_alloc_reuse(struct plane_table *table, uint32_t crtc_id, struct layer *layers, int layer_count,
+                      const uint32_t *plane_ids, struct atomic_req *req, struct plane_alloc_result *result)
+{
+    if (layer_count < 1 || layer_count > PLANE_TABLE_MAX || !plane_ids[0])
+        return -EINVAL;
+
+    int plane_of[PLANE_TABLE_MAX];
+    for (int i = 0; i < layer_count; i++)
+    {
+        plane_of[i] = -1;
+        for (int p = 0; p < table->count && plane_ids[i]; p++)
+        {
+            if (table->planes[p].plane_id == plane_ids[i])
+                plane_of[i] = p;
+        }
+        if (plane_ids[i] && plane_of[i] < 0)
+            return -ENOENT;
+    }
+
+    struct atomic_req out;
+    if (build_request(table, crtc_id, layers, layer_count, plane_of, req, &out))
+        return -ENOSPC;
+
+    memset(result, 0, sizeof(*result));
+    for (int i = 0; i < layer_count; i++)
+    {
+        layers[i].plane_id = plane_ids[i];
+        if (plane_ids[i])
+            result->hw_layers++;
+        else
+            result->composited_layers++;
+    }
+    if (result->composited_layers)
+        result->composite_plane_id = layers[0].plane_id;
+
+    out.blob_count = req->blob_count;
+    memcpy(out.blobs, req->blobs, sizeof(out.blobs));
+    *req = out;
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef PLANE_ALLOC_H
+#define PLANE_ALLOC_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "atomic.h"
+
+#define PLANE_TABLE_MAX 32
+#define PLANE_TABLE_MAX_CRTCS 8
+
+struct plane_format_mod
+{
+    uint32_t format;
+    uint64_t modifier;
+};
+
+// Everything the allocator needs to know about a plane, read once at startup.
+struct plane_info
+{
+    uint32_t plane_id;
+    uint32_t type;           // DRM_PLANE_TYPE_*
+    uint32_t possible_crtcs; // bit i means resources->crtcs[i]
+
+    uint32_t format_count;
+    uint32_t *formats;
+    uint32_t modifier_count; // format/modifier pairs from IN_FORMATS, 0 if absent
+    struct plane_format_mod *modifiers;
+
+    uint32_t zpos_prop;      // 0 if the plane has no zpos
+    int zpos_mutable;
+    uint64_t zpos_min;
+    uint64_t zpos_max;
+
+    int can_scale;           // 1 yes, 0 no, -1 unknown until a TEST_ONLY commit says so
+
+    struct plane_props props;
+};
+
+struct plane_table
+{
+    int count;
+    struct plane_info planes[PLANE_TABLE_MAX];
+    int crtc_count;
+    uint32_t crtc_ids[PLANE_TABLE_MAX_CRTCS];
+};
+
+// One thing to show. x/y/w/h are CRTC coordinates, src_w/src_h the size of
+// the fb region to scan out. Layers are ordered bottom (index 0) to top.
+struct layer
+{
+    uint32_t fb_id;
+    uint32_t format;
+    uint64_t modifier;
+    int32_t x;
+    int32_t y;
+    uint32_t w;
+    uint32_t h;
+    uint32_t src_w;
+    uint32_t src_h;
+
+    // filled in by plane_alloc_assign: the plane it got, or 0 when the layer
+    // has to be flattened into the primary plane's buffer on the CPU
+    uint32_t plane_id;
+};
+
+// Decides whether a request would be accepted. Real hardware uses an atomic
+// TEST_ONLY commit, the table and this hook together make a mock device.
+typedef int (*plane_test_fn)(void *ctx, struct atomic_req *req);
+
+struct plane_alloc_result
+{
+    int hw_layers;
+    int composited_layers;
+    uint32_t composite_plane_id; // plane showing the CPU composite, 0 if none needed
+};
+
+int plane_table_load(int drm_fd, struct plane_table *table);
+void plane_table_free(struct plane_table *table);
+int plane_table_crtc_index(const struct plane_table *table, uint32_t crtc_id);
+int plane_supports_format(const struct plane_info *plane, uint32_t format, uint64_t modifier);
+uint64_t plane_pick_modifier(const struct plane_info *plane, uint32_t format);
+int plane_atomic_test(void *ctx, struct atomic_req *req);
+
+int plane_alloc_assign(struct plane_table *table, uint32_t crtc_id, struct layer *layers, int layer_count,
+                       plane_test_fn test, void *test_ctx, struct atomic_req *req, struct plane_alloc_result *result);
+int plane_alloc_reuse(struct plane_table *table, uint32_t crtc_id, struct layer *layers, int layer_count,
+                      const uint32_t *plane_ids, struct atomic_req *req, struct plane_alloc_result *result);
+int plane_alloc_add_layer(struct atomic_req *req, const struct plane_info *plane, uint32_t crtc_id,
+                          const struct layer *layer, int zpos);
+
+#endif
@@ -0,0 +1,324 @@
+#include "remote.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define REMOTE_MAX_FDS 4
+
+// name alone goes in $XDG_RUNTIME_DIR (or /tmp), anything with a slash is a path
+int remote_socket_path(const char *name, char *path, int size)
+{
+    if (!name || !*name)
+        name = REMOTE_SOCKET_NAME;
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    int len;
+    if (strchr(name, '/'))
+        len = snprintf(path, size, "%s", name);
+    else
+        len = snprintf(path, size, "%s/%s", dir && *dir ? dir : "/tmp", name);
+    return len < 0 || len >= size ? -ENAMETOOLONG : 0;
+}
+
+// one message, with fds riding along as SCM_RIGHTS. returns 0 or -errno
+int remote_send(int sock, const struct remote_msg *msg, const int *fds, int fd_count)
+{
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * REMOTE_MAX_FDS)];
+    } control;
+    struct iovec iov = {.iov_base = (void *)msg, .iov_len = sizeof(*msg)};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (fd_count > REMOTE_MAX_FDS)
+        return -EINVAL;
+    if (fd_count > 0)
+    {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    if (sendmsg(sock, &mh, MSG_NOSIGNAL) < 0)
+        return -errno;
+    return 0;
+}
+
+// returns 1 with a message, 0 when the peer hung up, -errno otherwise.
+// fds beyond max_fds and fds of a malformed message are closed.
+int remote_recv(int sock, struct remote_msg *msg, int *fds, int max_fds, int *fd_count)
+{
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int) * REMOTE_MAX_FDS)];
+    } control;
+    struct iovec iov = {.iov_base = msg, .iov_len = sizeof(*msg)};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                        .msg_controllen = sizeof(control.buf)};
+
+    *fd_count = 0;
+    ssize_t n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    if (n < 0)
+        return -errno;
+    if (n == 0)
+        return 0;
+
+    int bad = n != sizeof(*msg) || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC));
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < count; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (!bad && *fd_count < max_fds)
+                fds[(*fd_count)++] = fd;
+            else
+                close(fd);
+        }
+    }
+
+    if (bad)
+    {
+        for (int i = 0; i < *fd_count; i++)
+            close(fds[i]);
+        *fd_count = 0;
+        return -EPROTO;
+    }
+    return 1;
+}
+
+// copy out every published update the daemon has not applied yet, at most
+// max. they stay in the ring until remote_ring_release, so anything the
+// daemon wants the client to see first (busy) can be written before.
+// returns the count or -EPROTO when the client wrote a nonsensical head.
+int remote_ring_drain(struct remote_shm *shm, struct remote_update *updates, int max)
+{
+    uint32_t tail = shm->tail;
+    uint32_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+    if (head - tail > REMOTE_RING_SIZE)
+        return -EPROTO;
+
+    int count = 0;
+    for (; tail != head && count < max; tail++)
+        updates[count++] = shm->ring[tail % REMOTE_RING_SIZE];
+    return count;
+}
+
+void remote_ring_release(struct remote_shm *shm, int count)
+{
+    __atomic_store_n(&shm->tail, shm->tail + (uint32_t)count, __ATOMIC_RELEASE);
+}
+
+// wait for the reply to a request, frame messages in between are dropped
+static int wait_reply(struct remote_client *c, uint32_t type, struct remote_msg *reply, int *fds, int max_fds,
+                      int *fd_count)
+{
+    for (;;)
+    {
+        int ret = remote_recv(c->sock, reply, fds, max_fds, fd_count);
+        if (ret <= 0)
+            return ret ? ret : -EPIPE;
+        if (reply->type == type)
+            return reply->status;
+
+        for (int i = 0; i < *fd_count; i++)
+            close(fds[i]);
+    }
+}
+
+// connect to the daemon at path (see remote_socket_path) and map the shared ring
+int remote_client_connect(struct remote_client *c, const char *path)
+{
+    memset(c, 0, sizeof(*c));
+    c->doorbell = -1;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -ENAMETOOLONG;
+    strcpy(addr.sun_path, path);
+
+    c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->sock < 0)
+        return -errno;
+    if (connect(c->sock, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        int err = errno;
+        close(c->sock);
+        return -err;
+    }
+
+    struct remote_msg msg = {.type = REMOTE_HELLO, .version = REMOTE_VERSION};
+    int fds[2], fd_count = 0;
+    int ret = remote_send(c->sock, &msg, NULL, 0);
+    if (!ret)
+        ret = wait_reply(c, REMOTE_WELCOME, &msg, fds, 2, &fd_count);
+    if (!ret && fd_count != 2)
+        ret = -EPROTO;
+    if (!ret)
+    {
+        c->shm = mmap(NULL, sizeof(*c->shm), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        if (c->shm == MAP_FAILED)
+        {
+            ret = -errno;
+            c->shm = NULL;
+        }
+    }
+    if (fd_count > 0)
+        close(fds[0]);
+    if (fd_count > 1)
+        c->doorbell = fds[1];
+
+    if (ret)
+    {
+        remote_client_close(c);
+        return ret;
+    }
+    c->width = msg.width;
+    c->height = msg.height;
+    c->refresh_mhz = msg.refresh_mhz;
+    c->head = c->shm->head;
+    return 0;
+}
+
+// the daemon takes the client's layers off screen when the socket closes
+void remote_client_close(struct remote_client *c)
+{
+    if (c->shm)
+        munmap(c->shm, sizeof(*c->shm));
+    if (c->doorbell >= 0)
+        close(c->doorbell);
+    if (c->sock >= 0)
+        close(c->sock);
+    c->shm = NULL;
+    c->doorbell = c->sock = -1;
+}
+
+// register a memfd or dma-buf under index. the daemon imports it right away,
+// so the status says whether it can be shown at all. fd stays the caller's.
+int remote_client_add_buffer(struct remote_client *c, uint32_t index, int fd, uint32_t width, uint32_t height,
+                             uint32_t format, uint32_t pitch, uint32_t offset)
+{
+    if (index >= REMOTE_MAX_BUFFERS)
+        return -EINVAL;
+
+    struct remote_msg msg = {.type = REMOTE_ADD_BUFFER, .buffer = index, .width = width, .height = height,
+                             .format = format, .pitch = pitch, .offset = offset};
+    int ret = remote_send(c->sock, &msg, &fd, 1);
+    if (ret)
+        return ret;
+
+    // a reply carries no fds, any that came along are closed by remote_recv
+    int fd_count;
+    ret = wait_reply(c, REMOTE_REPLY, &msg, NULL, 0, &fd_count);
+    if (!ret)
+        c->buffers |= 1u << index;
+    return ret;
+}
+
+int remote_client_remove_buffer(struct remote_client *c, uint32_t index)
+{
+    if (index >= REMOTE_MAX_BUFFERS)
+        return -EINVAL;
+
+    struct remote_msg msg = {.type = REMOTE_REMOVE_BUFFER, .buffer = index};
+    int ret = remote_send(c->sock, &msg, NULL, 0);
+    if (ret)
+        return ret;
+
+    int fd_count;
+    ret = wait_reply(c, REMOTE_REPLY, &msg, NULL, 0, &fd_count);
+    if (!ret)
+        c->buffers &= ~(1u << index);
+    return ret;
+}
+
+// a registered buffer among first .. first + count - 1 the daemon is not
+// reading from and no pending update refers to, safe to draw into.
+// returns its index or -EBUSY.
+int remote_client_free_buffer(struct remote_client *c, uint32_t first, uint32_t count)
+{
+    // busy is written before tail, once every update is applied it covers them
+    if (__atomic_load_n(&c->shm->tail, __ATOMIC_ACQUIRE) == c->head)
+        c->queued = 0;
+    uint32_t busy = __atomic_load_n(&c->shm->busy, __ATOMIC_ACQUIRE) | c->queued;
+
+    for (uint32_t i = first; i < first + count && i < REMOTE_MAX_BUFFERS; i++)
+    {
+        if ((c->buffers & (1u << i)) && !(busy & (1u << i)))
+            return (int)i;
+    }
+    return -EBUSY;
+}
+
+// stage one layer change, the daemon sees nothing before remote_client_commit.
+// -EAGAIN when the ring is full, the daemon is a frame or more behind.
+int remote_client_update(struct remote_client *c, const struct remote_update *update)
+{
+    if (update->layer >= REMOTE_MAX_LAYERS ||
+        (update->buffer != REMOTE_NO_BUFFER &&
+         (update->buffer >= REMOTE_MAX_BUFFERS || !(c->buffers & (1u << update->buffer)))))
+        return -EINVAL;
+    if (c->head - __atomic_load_n(&c->shm->tail, __ATOMIC_ACQUIRE) >= REMOTE_RING_SIZE)
+        return -EAGAIN;
+
+    c->shm->ring[c->head % REMOTE_RING_SIZE] = *update;
+    c->head++;
+    if (update->buffer != REMOTE_NO_BUFFER)
+        c->queued |= 1u << update->buffer;
+    return 0;
+}
+
+// publish every staged update at once, they go out in the same commit
+int remote_client_commit(struct remote_client *c)
+{
+    if (__atomic_load_n(&c->shm->head, __ATOMIC_RELAXED) == c->head)
+        return 0;
+
+    __atomic_store_n(&c->shm->head, c->head, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(c->doorbell, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        return -errno;
+    return 0;
+}
+
+// wait up to timeout_ms (-1 forever) for the next REMOTE_FRAME.
+// returns 1 with frame filled in, 0 on timeout, -errno (-EPIPE when the daemon is gone).
+int remote_client_wait_frame(struct remote_client *c, int timeout_ms, struct remote_msg *frame)
+{
+    for (;;)
+    {
+        struct pollfd pfd = {.fd = c->sock, .events = POLLIN};
+        int ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return ret < 0 ? -errno : 0;
+
+        int fds[REMOTE_MAX_FDS], fd_count;
+        ret = remote_recv(c->sock, frame, fds, REMOTE_MAX_FDS, &fd_count);
+        if (ret <= 0)
+            return ret ? ret : -EPIPE;
+        for (int i = 0; i < fd_count; i++)
+            close(fds[i]);
+        if (frame->type == REMOTE_FRAME)
+            return 1;
+    }
+}
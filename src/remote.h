@@ -0,0 +1,116 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdint.h>
+
+// Protocol between the compositor daemon (planes_server.c) and the client
+// processes that put layers on its display.
+//
+// A client connects to the daemon's Unix socket and says hello. The reply
+// carries two fds: a memfd with the client's struct remote_shm and an
+// eventfd, the doorbell. Buffers are registered one by one, each message
+// carrying the buffer's memfd or dma-buf, and are referred to by their
+// index from then on. Messages are fixed size, fds travel as SCM_RIGHTS.
+//
+// Per frame layer changes do not go through the socket. The client writes
+// them into the ring in its shared memory, publishes them all at once with
+// remote_client_commit and rings the doorbell. The ring has a single
+// producer and a single consumer, head and tail are the only shared
+// variables and each has one writer. The daemon drains every client's ring
+// when the CRTC is free, so all changes that arrived during a frame go out
+// in one commit on the next vblank.
+//
+// The daemon keeps a mask of the client's buffers it still reads from (on
+// screen or in the commit in flight) in the shared memory and sends a
+// REMOTE_FRAME message when a commit with the client's changes has been
+// flipped, the signal to draw the next frame.
+#define REMOTE_VERSION 1
+#define REMOTE_SOCKET_NAME "planes-0"
+#define REMOTE_MAX_LAYERS 4   // per client
+#define REMOTE_MAX_BUFFERS 16 // per client, one bit each in busy
+#define REMOTE_RING_SIZE 64   // power of two
+#define REMOTE_NO_BUFFER UINT32_MAX
+
+enum remote_msg_type
+{
+    REMOTE_HELLO = 1,     // client: version
+    REMOTE_WELCOME,       // daemon: status, width/height/refresh of the display, shm + doorbell fds
+    REMOTE_ADD_BUFFER,    // client: buffer index and layout, one fd
+    REMOTE_REMOVE_BUFFER, // client: buffer index, freed once the daemon is done with it
+    REMOTE_REPLY,         // daemon: status of the add/remove
+    REMOTE_FRAME,         // daemon: a commit with this client's changes is on screen
+};
+
+struct remote_msg
+{
+    uint32_t type;
+    int32_t status; // 0 or -errno in replies
+    uint32_t version;
+    uint32_t buffer;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format; // DRM_FORMAT_*, ARGB8888 blends over what is below
+    uint32_t pitch;
+    uint32_t offset;
+    uint32_t refresh_mhz;
+    uint64_t sequence; // REMOTE_FRAME: vblank sequence and flip time, CLOCK_MONOTONIC
+    uint64_t time_us;
+};
+
+// One change to one of the client's layers. z orders the layers of every
+// client on the display, equal z goes by connection order.
+struct remote_update
+{
+    uint32_t layer;
+    uint32_t buffer; // REMOTE_NO_BUFFER hides the layer
+    int32_t x;
+    int32_t y;
+    uint32_t w; // on screen, 0 is the buffer's own size
+    uint32_t h;
+    int32_t z;
+    uint32_t pad;
+};
+
+struct remote_shm
+{
+    uint32_t head;      // written by the client, updates up to here are published
+    uint32_t pad0[15];  // head and tail on their own cache lines
+    uint32_t tail;      // written by the daemon, updates up to here are applied
+    uint32_t pad1[15];
+    uint32_t busy;      // buffers the daemon reads from, bit per index
+    uint32_t pad2;
+    uint64_t presented; // sequence of the last flip with this client's changes
+    struct remote_update ring[REMOTE_RING_SIZE];
+};
+
+struct remote_client
+{
+    int sock;
+    int doorbell;
+    struct remote_shm *shm;
+    uint32_t width; // of the display
+    uint32_t height;
+    uint32_t refresh_mhz;
+    uint32_t head;   // staged, published by remote_client_commit
+    uint32_t queued; // buffers in updates the daemon may not have applied yet
+    uint32_t buffers; // registered
+};
+
+int remote_socket_path(const char *name, char *path, int size);
+int remote_send(int sock, const struct remote_msg *msg, const int *fds, int fd_count);
+int remote_recv(int sock, struct remote_msg *msg, int *fds, int max_fds, int *fd_count);
+
+int remote_ring_drain(struct remote_shm *shm, struct remote_update *updates, int max);
+void remote_ring_release(struct remote_shm *shm, int count);
+
+int remote_client_connect(struct remote_client *c, const char *path);
+void remote_client_close(struct remote_client *c);
+int remote_client_add_buffer(struct remote_client *c, uint32_t index, int fd, uint32_t width, uint32_t height,
+                             uint32_t format, uint32_t pitch, uint32_t offset);
+int remote_client_remove_buffer(struct remote_client *c, uint32_t index);
+int remote_client_free_buffer(struct remote_client *c, uint32_t first, uint32_t count);
+int remote_client_update(struct remote_client *c, const struct remote_update *update);
+int remote_client_commit(struct remote_client *c);
+int remote_client_wait_frame(struct remote_client *c, int timeout_ms, struct remote_msg *frame);
+
+#endif
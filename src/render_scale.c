@@ -0,0 +1,115 @@
+#include "render_scale.h"
+
+#include <string.h>
+
+// render size per step in eighths of the full size
+static const uint32_t step_eighths[RENDER_SCALE_STEPS] = {8, 7, 6, 5, 4};
+
+// even sizes keep 4:2:0 formats and most scalers happy
+static uint32_t scaled(uint32_t full, int step)
+{
+    uint32_t size = (full * step_eighths[step] / 8) & ~1u;
+    return size ? size : full;
+}
+
+static uint64_t step_area(int step)
+{
+    return (uint64_t)step_eighths[step] * step_eighths[step];
+}
+
+static void set_step(struct render_scale *rs, int step)
+{
+    rs->step = step;
+    rs->render_w = scaled(rs->full_w, step);
+    rs->render_h = scaled(rs->full_h, step);
+}
+
+// the plane on crtc_id at full size, showing the rendered part of fb_id
+static int set_plane(const struct render_scale *rs, struct atomic_req *req, const struct plane_props *props,
+                     uint32_t crtc_id, uint32_t fb_id)
+{
+    return atomic_set_plane(req, props, crtc_id, fb_id, 0, 0, rs->full_w, rs->full_h,
+                            0, 0, rs->render_w << 16, rs->render_h << 16);
+}
+
+void render_scale_init(struct render_scale *rs, uint32_t full_w, uint32_t full_h, uint64_t budget_us)
+{
+    memset(rs, 0, sizeof(*rs));
+    rs->full_w = full_w;
+    rs->full_h = full_h;
+    rs->budget_us = budget_us;
+    set_step(rs, 0);
+}
+
+// find the smallest scale the plane takes with TEST_ONLY commits of base
+// plus the plane at each size, fb_id being a full size buffer. flags are
+// those of the commit base is meant for (ALLOW_MODESET for the first one).
+// returns the number of scales usable, 1 means no scaling.
+int render_scale_probe(struct render_scale *rs, int drm_fd, const struct atomic_req *base, struct plane_info *plane,
+                       uint32_t crtc_id, uint32_t fb_id, uint32_t flags)
+{
+    rs->max_step = 0;
+    if (plane->can_scale == 0)
+        return 1;
+
+    struct atomic_req trial;
+    for (int step = RENDER_SCALE_STEPS - 1; step > 0; step--)
+    {
+        struct render_scale probe = *rs;
+        set_step(&probe, step);
+
+        trial = *base;
+        if (set_plane(&probe, &trial, &plane->props, crtc_id, fb_id) == 0 &&
+            atomic_test(drm_fd, &trial, flags) == 0)
+        {
+            rs->max_step = step;
+            break;
+        }
+    }
+
+    plane->can_scale = rs->max_step > 0;
+    return rs->max_step + 1;
+}
+
+// feed the time the last frame took to render. returns 1 when the render
+// size changed, the next frame is drawn at render_w x render_h.
+int render_scale_update(struct render_scale *rs, uint64_t render_us)
+{
+    rs->frames[rs->step]++;
+    rs->avg_us = rs->avg_us ? (rs->avg_us * 7 + render_us) / 8 : render_us;
+
+    if (rs->settle)
+    {
+        rs->settle--;
+        return 0;
+    }
+
+    int step = rs->step;
+    if (rs->avg_us > rs->budget_us && step < rs->max_step)
+        step++;
+    else if (step > 0 && rs->avg_us * step_area(step - 1) / step_area(step) < rs->budget_us * 3 / 4)
+        step--;
+
+    if (step == rs->step)
+        return 0;
+
+    // render time goes with the pixel count, start the new step from that guess
+    rs->avg_us = rs->avg_us * step_area(step) / step_area(rs->step);
+    set_step(rs, step);
+    rs->settle = RENDER_SCALE_SETTLE;
+    rs->changes++;
+    return 1;
+}
+
+void render_scale_print(const struct render_scale *rs, FILE *out)
+{
+    fprintf(out, "Render scale: %d of %d scales usable, %llu changes, budget %.2f ms\n", rs->max_step + 1,
+            RENDER_SCALE_STEPS, (unsigned long long)rs->changes, rs->budget_us / 1000.0);
+    for (int i = 0; i < RENDER_SCALE_STEPS; i++)
+    {
+        if (!rs->frames[i])
+            continue;
+        fprintf(out, "  %3u%% %5ux%-5u | %8llu frames\n", step_eighths[i] * 100 / 8, scaled(rs->full_w, i),
+                scaled(rs->full_h, i), (unsigned long long)rs->frames[i]);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef RENDER_SCALE_H
+#define RENDER_SCALE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "atomic.h"
+#include "plane_alloc.h"
+
+// Picks the resolution to render at so that rendering a frame fits a time
+// budget, and lets the plane's scaler stretch the result to the full size.
+//
+// Frames are drawn into the top left render_w x render_h of full size
+// buffers and the plane scans that region out through its SRC rectangle
+// (16.16 fixed point), so changing the scale never reallocates anything.
+// Scales go from 8/8 down to 4/8 of each axis, a quarter of the pixels at
+// the bottom. Which of them the plane takes is found out with TEST_ONLY
+// commits (render_scale_probe), a plane without a scaler stays at 8/8.
+//
+// The render time is averaged over a few frames. Over budget the next
+// smaller scale is used, when the next larger one is expected to fit with
+// room to spare it goes back up. After each change the scale is left alone
+// for RENDER_SCALE_SETTLE frames so it does not flap.
+#define RENDER_SCALE_STEPS 5
+#define RENDER_SCALE_SETTLE 16
+
+struct render_scale
+{
+    uint32_t full_w;
+    uint32_t full_h;
+    uint32_t render_w;
+    uint32_t render_h;
+
+    int step;     // 0 is full size, each step is 1/8 less per axis
+    int max_step; // the smallest scale the plane accepted
+    uint64_t budget_us;
+    uint64_t avg_us;
+    uint32_t settle;
+
+    uint64_t frames[RENDER_SCALE_STEPS]; // frames rendered at each step
+    uint64_t changes;
+};
+
+void render_scale_init(struct render_scale *rs, uint32_t full_w, uint32_t full_h, uint64_t budget_us);
+int render_scale_probe(struct render_scale *rs, int drm_fd, const struct atomic_req *base, struct plane_info *plane,
+                       uint32_t crtc_id, uint32_t fb_id, uint32_t flags);
+int render_scale_update(struct render_scale *rs, uint64_t render_us);
+void render_scale_print(const struct render_scale *rs, FILE *out);
+
+#endif
@@ -0,0 +1,274 @@
+#include "scene.h"
+
+#include <errno.h>
+#include <string.h>
+
+static void release(struct scene *scene, const struct plane_info *plane)
+{
+    for (int i = 0; i < scene->released_count; i++)
+    {
+        if (scene->released[i] == plane)
+            return;
+    }
+    scene->released[scene->released_count++] = plane;
+}
+
+void scene_init(struct scene *scene, uint32_t crtc_id)
+{
+    memset(scene, 0, sizeof(*scene));
+    scene->crtc_id = crtc_id;
+}
+
+// a new layer showing fb_id unscaled at (0, 0), stacked by z. the handle, or
+// -ENOSPC when every slot is taken
+int scene_layer_create(struct scene *scene, uint32_t fb_id, uint32_t format, uint64_t modifier, uint32_t width,
+                       uint32_t height, int32_t z)
+{
+    int layer = 0;
+    while (layer < scene->count && scene->used[layer])
+        layer++;
+    if (layer == SCENE_MAX_LAYERS)
+        return -ENOSPC;
+    if (layer == scene->count)
+        scene->count++;
+
+    scene->used[layer] = 1;
+    scene->dirty[layer] = SCENE_DIRTY_PLANE;
+    scene->fb_id[layer] = fb_id;
+    scene->format[layer] = format;
+    scene->modifier[layer] = modifier;
+    scene->x[layer] = 0;
+    scene->y[layer] = 0;
+    scene->w[layer] = scene->src_w[layer] = width;
+    scene->h[layer] = scene->src_h[layer] = height;
+    scene->z[layer] = z;
+    scene->alpha[layer] = SCENE_ALPHA_OPAQUE;
+    scene->plane[layer] = NULL;
+    scene->shown_x[layer] = scene->shown_y[layer] = 0;
+    scene->shown_w[layer] = scene->shown_h[layer] = 0;
+    scene->layout_dirty = 1;
+    return layer;
+}
+
+void scene_layer_destroy(struct scene *scene, int layer)
+{
+    if (scene->plane[layer])
+        release(scene, scene->plane[layer]);
+    scene->used[layer] = 0;
+    scene->dirty[layer] = 0;
+    scene->plane[layer] = NULL;
+    scene->layout_dirty = 1;
+    while (scene->count && !scene->used[scene->count - 1])
+        scene->count--;
+}
+
+void scene_layer_move(struct scene *scene, int layer, int32_t x, int32_t y)
+{
+    if (scene->x[layer] == x && scene->y[layer] == y)
+        return;
+    scene->x[layer] = x;
+    scene->y[layer] = y;
+    scene->dirty[layer] |= SCENE_DIRTY_POSITION;
+}
+
+// the size on screen, the buffer is scaled to it when the plane can scale
+void scene_layer_resize(struct scene *scene, int layer, uint32_t width, uint32_t height)
+{
+    if (scene->w[layer] == width && scene->h[layer] == height)
+        return;
+    scene->w[layer] = width;
+    scene->h[layer] = height;
+    scene->dirty[layer] |= SCENE_DIRTY_SIZE;
+}
+
+// a new stacking order needs a new plane assignment, the zpos goes out with it
+void scene_layer_set_z(struct scene *scene, int layer, int32_t z)
+{
+    if (scene->z[layer] == z)
+        return;
+    scene->z[layer] = z;
+    scene->dirty[layer] |= SCENE_DIRTY_Z;
+    scene->layout_dirty = 1;
+}
+
+// plane alpha, 0 transparent to SCENE_ALPHA_OPAQUE. planes without an alpha
+// property show the layer opaque
+void scene_layer_set_alpha(struct scene *scene, int layer, uint16_t alpha)
+{
+    if (scene->alpha[layer] == alpha)
+        return;
+    scene->alpha[layer] = alpha;
+    scene->dirty[layer] |= SCENE_DIRTY_ALPHA;
+}
+
+// the next buffer to show, src_w x src_h of it is scanned out
+void scene_layer_set_buffer(struct scene *scene, int layer, uint32_t fb_id, uint32_t src_w, uint32_t src_h)
+{
+    if (scene->fb_id[layer] != fb_id)
+    {
+        scene->fb_id[layer] = fb_id;
+        scene->dirty[layer] |= SCENE_DIRTY_FB;
+    }
+    if (scene->src_w[layer] != src_w || scene->src_h[layer] != src_h)
+    {
+        scene->src_w[layer] = src_w;
+        scene->src_h[layer] = src_h;
+        scene->dirty[layer] |= SCENE_DIRTY_SIZE;
+    }
+}
+
+// the layers bottom to top (by z, then by handle) the way plane_alloc_assign
+// takes them, handles[i] is the layer layers[i] came from. the count
+int scene_layers(const struct scene *scene, struct layer *layers, int *handles)
+{
+    int count = 0;
+    for (int l = 0; l < scene->count; l++)
+    {
+        if (!scene->used[l])
+            continue;
+
+        // insertion sort, a scene is a handful of layers
+        int i = count++;
+        while (i > 0 && scene->z[handles[i - 1]] > scene->z[l])
+        {
+            layers[i] = layers[i - 1];
+            handles[i] = handles[i - 1];
+            i--;
+        }
+        memset(&layers[i], 0, sizeof(layers[i]));
+        layers[i].fb_id = scene->fb_id[l];
+        layers[i].format = scene->format[l];
+        layers[i].modifier = scene->modifier[l];
+        layers[i].x = scene->x[l];
+        layers[i].y = scene->y[l];
+        layers[i].w = scene->w[l];
+        layers[i].h = scene->h[l];
+        layers[i].src_w = scene->src_w[l];
+        layers[i].src_h = scene->src_h[l];
+        layers[i].plane_id = scene->plane[l] ? scene->plane[l]->plane_id : 0;
+        handles[i] = l;
+    }
+    return count;
+}
+
+// take over the planes a plane_alloc_assign (or reuse) of scene_layers' output
+// picked. a layer on another plane than before goes out in full with the next
+// commit, a plane nobody has any more is switched off by it
+void scene_bind(struct scene *scene, const struct plane_table *table, const struct layer *layers, const int *handles,
+                int count)
+{
+    const struct plane_info *before[SCENE_MAX_LAYERS];
+    memcpy(before, scene->plane, sizeof(before));
+
+    for (int i = 0; i < count; i++)
+    {
+        const struct plane_info *plane = NULL;
+        for (int p = 0; p < table->count && layers[i].plane_id; p++)
+        {
+            if (table->planes[p].plane_id == layers[i].plane_id)
+                plane = &table->planes[p];
+        }
+
+        int l = handles[i];
+        if (scene->plane[l] != plane)
+            scene->dirty[l] |= SCENE_DIRTY_PLANE;
+        scene->plane[l] = plane;
+    }
+
+    for (int l = 0; l < scene->count; l++)
+    {
+        if (!before[l])
+            continue;
+        int kept = 0;
+        for (int k = 0; k < scene->count && !kept; k++)
+            kept = scene->used[k] && scene->plane[k] == before[l];
+        if (!kept)
+            release(scene, before[l]);
+    }
+    scene->layout_dirty = 0;
+}
+
+// add the old and new rect of every composited layer that changed since the
+// last scene_committed, what the caller has to composite again
+void scene_damage(const struct scene *scene, struct damage *damage)
+{
+    for (int l = 0; l < scene->count; l++)
+    {
+        if (!scene->dirty[l] || !scene->used[l] || scene->plane[l])
+            continue;
+        damage_add(damage, scene->shown_x[l], scene->shown_y[l], (int32_t)scene->shown_w[l], (int32_t)scene->shown_h[l]);
+        damage_add(damage, scene->x[l], scene->y[l], (int32_t)scene->w[l], (int32_t)scene->h[l]);
+    }
+}
+
+// queue what changed since the last scene_committed, only the dirty fields of
+// layers on planes: an FB_ID for a new buffer, CRTC_X/Y for a move. the
+// number of property writes added, 0 when nothing on a plane changed
+int scene_commit(const struct scene *scene, struct atomic_req *req)
+{
+    int before = req->count;
+    int ret = 0;
+
+    for (int i = 0; i < scene->released_count; i++)
+    {
+        // a plane released and bound again in the same frame stays on
+        int kept = 0;
+        for (int l = 0; l < scene->count && !kept; l++)
+            kept = scene->used[l] && scene->plane[l] == scene->released[i];
+        if (!kept)
+            ret |= atomic_disable_plane(req, &scene->released[i]->props);
+    }
+
+    for (int l = 0; l < scene->count; l++)
+    {
+        uint32_t dirty = scene->dirty[l];
+        const struct plane_info *plane = scene->plane[l];
+        if (!dirty || !plane)
+            continue;
+
+        // moved away and back since the last commit
+        if ((dirty & SCENE_DIRTY_POSITION) && scene->x[l] == scene->shown_x[l] && scene->y[l] == scene->shown_y[l])
+            dirty &= ~SCENE_DIRTY_POSITION;
+
+        const struct plane_props *props = &plane->props;
+        if (dirty & SCENE_DIRTY_PLANE)
+        {
+            ret |= atomic_set_plane(req, props, scene->crtc_id, scene->fb_id[l], scene->x[l], scene->y[l],
+                                    scene->w[l], scene->h[l], 0, 0, scene->src_w[l] << 16, scene->src_h[l] << 16);
+            if (props->alpha)
+                ret |= atomic_req_add(req, props->plane_id, props->alpha, scene->alpha[l]);
+            continue;
+        }
+        if (dirty & SCENE_DIRTY_FB)
+            ret |= atomic_req_add(req, props->plane_id, props->fb_id, scene->fb_id[l]);
+        if (dirty & SCENE_DIRTY_POSITION)
+            ret |= atomic_move_plane(req, props, scene->x[l], scene->y[l]);
+        if (dirty & SCENE_DIRTY_SIZE)
+        {
+            ret |= atomic_req_add(req, props->plane_id, props->crtc_w, scene->w[l]);
+            ret |= atomic_req_add(req, props->plane_id, props->crtc_h, scene->h[l]);
+            ret |= atomic_req_add(req, props->plane_id, props->src_w, (uint64_t)scene->src_w[l] << 16);
+            ret |= atomic_req_add(req, props->plane_id, props->src_h, (uint64_t)scene->src_h[l] << 16);
+        }
+        if ((dirty & SCENE_DIRTY_ALPHA) && props->alpha)
+            ret |= atomic_req_add(req, props->plane_id, props->alpha, scene->alpha[l]);
+    }
+    return ret ? -ENOSPC : req->count - before;
+}
+
+// the commit built by scene_commit went through, its state is the new baseline.
+// after a failed commit the dirty bits stay and the next one sends it all again
+void scene_committed(struct scene *scene)
+{
+    for (int l = 0; l < scene->count; l++)
+    {
+        if (!scene->dirty[l])
+            continue;
+        scene->dirty[l] = 0;
+        scene->shown_x[l] = scene->x[l];
+        scene->shown_y[l] = scene->y[l];
+        scene->shown_w[l] = scene->w[l];
+        scene->shown_h[l] = scene->h[l];
+    }
+    scene->released_count = 0;
+}
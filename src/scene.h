@@ -0,0 +1,89 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+
+#include "atomic.h"
+#include "damage.h"
+#include "plane_alloc.h"
+
+// The layers on one CRTC, kept from frame to frame. Programs change a layer
+// with the scene_layer_* calls and scene_commit turns whatever changed since
+// the last successful commit into property writes, nothing else. A frame in
+// which nothing changed adds no writes, so the caller sends no commit at all.
+//
+// Layers are stored one array per field, indexed by the layer handle. The
+// per frame diff walks the dirty masks and only touches the fields a bit
+// points at, so a scene of mostly idle layers costs a few cache lines.
+//
+// Plane assignment stays with plane_alloc: scene_layers gives it the layers
+// bottom to top and scene_bind records what it decided. Adding, removing or
+// restacking a layer sets layout_dirty, the caller assigns again before the
+// next commit. Layers without a plane are composited by the caller,
+// scene_damage reports the area they changed.
+#define SCENE_MAX_LAYERS PLANE_TABLE_MAX
+#define SCENE_ALPHA_OPAQUE 0xFFFF
+
+enum scene_dirty
+{
+    SCENE_DIRTY_FB = 1 << 0,
+    SCENE_DIRTY_POSITION = 1 << 1,
+    SCENE_DIRTY_SIZE = 1 << 2,
+    SCENE_DIRTY_Z = 1 << 3,
+    SCENE_DIRTY_ALPHA = 1 << 4,
+    SCENE_DIRTY_PLANE = 1 << 5, // moved to another plane, every property goes out
+};
+
+struct scene
+{
+    uint32_t crtc_id;
+    int count;        // handles below this have been handed out, some may be free again
+    int layout_dirty; // plane assignment is out of date
+
+    uint8_t used[SCENE_MAX_LAYERS];
+    uint32_t dirty[SCENE_MAX_LAYERS];
+
+    uint32_t fb_id[SCENE_MAX_LAYERS];
+    uint32_t format[SCENE_MAX_LAYERS];
+    uint64_t modifier[SCENE_MAX_LAYERS];
+    int32_t x[SCENE_MAX_LAYERS];
+    int32_t y[SCENE_MAX_LAYERS];
+    uint32_t w[SCENE_MAX_LAYERS];
+    uint32_t h[SCENE_MAX_LAYERS];
+    uint32_t src_w[SCENE_MAX_LAYERS];
+    uint32_t src_h[SCENE_MAX_LAYERS];
+    int32_t z[SCENE_MAX_LAYERS];
+    uint16_t alpha[SCENE_MAX_LAYERS];
+    const struct plane_info *plane[SCENE_MAX_LAYERS]; // NULL when composited
+
+    // the rect on screen after the last successful commit, for damage
+    int32_t shown_x[SCENE_MAX_LAYERS];
+    int32_t shown_y[SCENE_MAX_LAYERS];
+    uint32_t shown_w[SCENE_MAX_LAYERS];
+    uint32_t shown_h[SCENE_MAX_LAYERS];
+
+    // planes whose layer went away, switched off by the next commit
+    int released_count;
+    const struct plane_info *released[SCENE_MAX_LAYERS];
+};
+
+void scene_init(struct scene *scene, uint32_t crtc_id);
+
+int scene_layer_create(struct scene *scene, uint32_t fb_id, uint32_t format, uint64_t modifier, uint32_t width,
+                       uint32_t height, int32_t z);
+void scene_layer_destroy(struct scene *scene, int layer);
+void scene_layer_move(struct scene *scene, int layer, int32_t x, int32_t y);
+void scene_layer_resize(struct scene *scene, int layer, uint32_t width, uint32_t height);
+void scene_layer_set_z(struct scene *scene, int layer, int32_t z);
+void scene_layer_set_alpha(struct scene *scene, int layer, uint16_t alpha);
+void scene_layer_set_buffer(struct scene *scene, int layer, uint32_t fb_id, uint32_t src_w, uint32_t src_h);
+
+int scene_layers(const struct scene *scene, struct layer *layers, int *handles);
+void scene_bind(struct scene *scene, const struct plane_table *table, const struct layer *layers, const int *handles,
+                int count);
+
+void scene_damage(const struct scene *scene, struct damage *damage);
+int scene_commit(const struct scene *scene, struct atomic_req *req);
+void scene_committed(struct scene *scene);
+
+#endif
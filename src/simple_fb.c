@@ -1,5 +1,6 @@
 // SIMPLE BUFFER PROGRAM TO FILL THE SCREEN WITH A COLOR
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -8,11 +9,36 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include "pixel.h"
 
-int main(){
+// build: gcc simple_fb.c pixel.c -o simple_fb
+// one buffer, drawn while it is on screen. "drm_fb fbdev:/dev/fb0" drives the
+// same node double buffered, flipping by panning (kms_fbdev.c)
 
-	// fb_fd -> frame buffer file descriptor wiht read & write permissions
-	int fb_fd = open("/dev/fb0", O_RDWR);
+// scale an 8 bit channel down to the field the fbdev format gives it
+static uint32_t pack_channel(uint32_t value, const struct fb_bitfield *field)
+{
+	if(field->length == 0)
+		return 0;
+	if(field->length < 8)
+		value >>= 8 - field->length;
+	return value << field->offset;
+}
+
+// the same colour in whatever layout the framebuffer uses, 565 included
+static uint32_t pack_color(const struct fb_var_screeninfo *vinfo, uint8_t r, uint8_t g, uint8_t b)
+{
+	return pack_channel(r, &vinfo->red) | pack_channel(g, &vinfo->green) | pack_channel(b, &vinfo->blue) |
+	       pack_channel(0xFF, &vinfo->transp);
+}
+
+
+int main(int argc, char **argv){
+
+	// fb_fd -> frame buffer file descriptor wiht read & write permissions,
+	// /dev/fb0 unless another fbdev node is given
+	const char *device = argc > 1 ? argv[1] : "/dev/fb0";
+	int fb_fd = open(device, O_RDWR);
 	
 	if(fb_fd == -1 ) {
 		perror("Error opening the file buffer! :( ");
@@ -27,19 +53,41 @@ int main(){
 		exit(2);
 	}
 
+	// the fixed information gives us the real row stride of the framebuffer
+	struct fb_fix_screeninfo finfo;
+
+	if(ioctl(fb_fd, FBIOGET_FSCREENINFO, &finfo)) {
+		perror("Error reading fixed information");
+		exit(2);
+	}
+
+	if(vinfo.bits_per_pixel != 32 && vinfo.bits_per_pixel != 16) {
+		fprintf(stderr, "Only 32 and 16 bits per pixel are supported, got %u\n", vinfo.bits_per_pixel);
+		exit(2);
+	}
+
+	// blue, packed the way the driver says instead of assuming XRGB8888
+	uint32_t color = pack_color(&vinfo, 0x00, 0x00, 0xFF);
+
 	// calculate screen size in bytes
-	int screensize = vinfo.yres_virtual * vinfo.xres_virtual * vinfo.bits_per_pixel / 8;
+	int screensize = vinfo.yres_virtual * finfo.line_length;
 	
 	char *fbp = (char *)mmap(0, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, fb_fd, 0);
-	if((int) fbp == -1 ) {
+	if(fbp == MAP_FAILED ) {
 		perror("Error mapping frame buffer device to memory");
 		exit(3);
 	}
 
-	for(int i = 0; i < screensize ; i+=2 ){
-		fbp[i] = 0xFF;
-		fbp[i+1] = 0x00;
-		fbp[i+2] = 0x00;
+	// fill the visible area a row at a time, honouring the line length.
+	// at 16 bpp two pixels are filled as one 32 bit word
+	if(vinfo.bits_per_pixel == 32) {
+		pixel_fill(fbp, finfo.line_length, vinfo.xres, vinfo.yres_virtual, color);
+	} else {
+		pixel_fill(fbp, finfo.line_length, vinfo.xres / 2, vinfo.yres_virtual, color | color << 16);
+		if(vinfo.xres % 2) {
+			for(uint32_t y = 0; y < vinfo.yres_virtual; y++)
+				((uint16_t *)(fbp + (size_t)y * finfo.line_length))[vinfo.xres - 1] = (uint16_t)color;
+		}
 	}
 
 	munmap(fbp, screensize);
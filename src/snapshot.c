@@ -0,0 +1,290 @@
+#include "snapshot.h"
+#include "kms.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC 0x534e4c50 // "PLNS"
+#define SNAPSHOT_MAX_SIZE (1u << 20)
+#define FNV_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+struct snapshot_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout; // struct sizes of the build that wrote it
+    uint32_t size;   // payload bytes after the header
+    uint64_t checksum;
+};
+
+struct buffer
+{
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ p[i]) * FNV_PRIME;
+    return hash;
+}
+
+static uint32_t layout(void)
+{
+    return (uint32_t)(sizeof(struct plane_info) | sizeof(struct snapshot) << 12);
+}
+
+// the snapshot file for program on this device. $PLANES_SNAPSHOT is the file
+// itself ("off" disables snapshots), otherwise it goes in
+// $XDG_CACHE_HOME/planes (or ~/.cache/planes), named after program and driver
+int snapshot_path(const char *program, int drm_fd, char *path, int size)
+{
+    const char *forced = getenv("PLANES_SNAPSHOT");
+    if (forced && *forced)
+    {
+        if (strcmp(forced, "off") == 0)
+            return -ENOENT;
+        return snprintf(path, size, "%s", forced) >= size ? -ENAMETOOLONG : 0;
+    }
+
+    char driver[32];
+    uint64_t edid_hash;
+    snapshot_key(drm_fd, 0, driver, sizeof(driver), &edid_hash);
+
+    const char *cache = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char dir[256];
+    int len;
+    if (cache && *cache)
+        len = snprintf(dir, sizeof(dir), "%s/planes", cache);
+    else if (home && *home)
+        len = snprintf(dir, sizeof(dir), "%s/.cache/planes", home);
+    else
+        return -ENOENT;
+    if (len >= (int)sizeof(dir))
+        return -ENAMETOOLONG;
+
+    // ~/.cache may not exist yet either
+    for (char *slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        mkdir(dir, 0700);
+        *slash = '/';
+    }
+    if (mkdir(dir, 0700) && errno != EEXIST)
+        return -errno;
+    return snprintf(path, size, "%s/%s-%s.snap", dir, program, driver) >= size ? -ENAMETOOLONG : 0;
+}
+
+// what a snapshot has to match: the driver behind drm_fd (the backend name
+// for fake and fbdev devices) and the EDID of connector_id, 0 skips the EDID.
+// reads the EDID the kernel already has, the monitor is not probed.
+int snapshot_key(int drm_fd, uint32_t connector_id, char *driver, int driver_size, uint64_t *edid_hash)
+{
+    const char *backend = kms_backend_name(drm_fd);
+    drmVersion *version = strcmp(backend, "drm") == 0 ? drmGetVersion(drm_fd) : NULL;
+    snprintf(driver, driver_size, "%s", version ? version->name : backend);
+    drmFreeVersion(version);
+
+    *edid_hash = FNV_BASIS;
+    if (!connector_id)
+        return 0;
+
+    drmModeObjectProperties *props = kms_get_object_properties(drm_fd, connector_id, DRM_MODE_OBJECT_CONNECTOR);
+    if (!props)
+        return -ENOENT;
+    for (uint32_t i = 0; i < props->count_props; i++)
+    {
+        drmModePropertyRes *prop = kms_get_property(drm_fd, props->props[i]);
+        if (!prop)
+            continue;
+        if (strcmp(prop->name, "EDID") == 0 && props->prop_values[i])
+        {
+            drmModePropertyBlobRes *blob = kms_get_property_blob(drm_fd, (uint32_t)props->prop_values[i]);
+            if (blob)
+                *edid_hash = fnv1a(FNV_BASIS, blob->data, blob->length);
+            drmModeFreePropertyBlob(blob);
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+    return 0;
+}
+
+static int put(struct buffer *buf, const void *data, size_t size)
+{
+    if (buf->pos + size > buf->size)
+    {
+        size_t grown = buf->size ? buf->size * 2 : 4096;
+        while (grown < buf->pos + size)
+            grown *= 2;
+        uint8_t *data_grown = realloc(buf->data, grown);
+        if (!data_grown)
+            return -ENOMEM;
+        buf->data = data_grown;
+        buf->size = grown;
+    }
+    memcpy(buf->data + buf->pos, data, size);
+    buf->pos += size;
+    return 0;
+}
+
+static int get(struct buffer *buf, void *data, size_t size)
+{
+    if (size > buf->size - buf->pos)
+        return -EINVAL;
+    memcpy(data, buf->data + buf->pos, size);
+    buf->pos += size;
+    return 0;
+}
+
+// write the snapshot to a temporary file and rename it over path, a crash
+// halfway leaves the old snapshot (or none), never a torn one
+int snapshot_save(const char *path, const struct snapshot *snap)
+{
+    struct snapshot_header header = {.magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .layout = layout()};
+    struct buffer buf = {0};
+    struct snapshot fixed = *snap;
+
+    // the format/modifier arrays follow their plane, the pointers mean nothing on disk
+    for (int i = 0; i < fixed.planes.count; i++)
+    {
+        fixed.planes.planes[i].formats = NULL;
+        fixed.planes.planes[i].modifiers = NULL;
+    }
+    int ret = put(&buf, &header, sizeof(header));
+    if (!ret)
+        ret = put(&buf, &fixed, sizeof(fixed));
+    for (int i = 0; i < snap->planes.count && !ret; i++)
+    {
+        const struct plane_info *plane = &snap->planes.planes[i];
+        ret = put(&buf, plane->formats, sizeof(*plane->formats) * plane->format_count);
+        if (!ret)
+            ret = put(&buf, plane->modifiers, sizeof(*plane->modifiers) * plane->modifier_count);
+    }
+    if (ret)
+    {
+        free(buf.data);
+        return ret;
+    }
+
+    header.size = (uint32_t)(buf.pos - sizeof(header));
+    header.checksum = fnv1a(FNV_BASIS, buf.data + sizeof(header), header.size);
+    memcpy(buf.data, &header, sizeof(header));
+
+    char tmp[512];
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp))
+    {
+        free(buf.data);
+        return -ENAMETOOLONG;
+    }
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        ret = -errno;
+        free(buf.data);
+        return ret;
+    }
+    if (write(fd, buf.data, buf.pos) != (ssize_t)buf.pos)
+        ret = errno ? -errno : -EIO;
+    if (close(fd) && !ret)
+        ret = -errno;
+    if (!ret && rename(tmp, path))
+        ret = -errno;
+    if (ret)
+        unlink(tmp);
+    free(buf.data);
+    return ret;
+}
+
+// read path and check it against the device: -ENOENT without a snapshot,
+// -ESTALE when it belongs to another driver, monitor, connector or build,
+// -EINVAL when it is damaged. *snap only holds anything on success.
+int snapshot_load(int drm_fd, const char *path, struct snapshot *snap)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    struct stat st;
+    struct buffer buf = {0};
+    int ret = 0;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct snapshot_header) || st.st_size > SNAPSHOT_MAX_SIZE)
+        ret = -EINVAL;
+    if (!ret)
+    {
+        buf.size = (size_t)st.st_size;
+        buf.data = malloc(buf.size);
+        if (!buf.data)
+            ret = -ENOMEM;
+        else if (read(fd, buf.data, buf.size) != (ssize_t)buf.size)
+            ret = -EINVAL;
+    }
+    close(fd);
+
+    struct snapshot_header header;
+    if (!ret)
+        ret = get(&buf, &header, sizeof(header));
+    if (!ret && (header.magic != SNAPSHOT_MAGIC || header.size != buf.size - sizeof(header) ||
+                 header.checksum != fnv1a(FNV_BASIS, buf.data + sizeof(header), header.size)))
+        ret = -EINVAL;
+    if (!ret && (header.version != SNAPSHOT_VERSION || header.layout != layout()))
+        ret = -ESTALE;
+    if (!ret)
+        ret = get(&buf, snap, sizeof(*snap));
+    if (ret)
+    {
+        free(buf.data);
+        return ret;
+    }
+
+    int count = snap->planes.count;
+    snap->planes.count = 0;
+    if (count < 0 || count > PLANE_TABLE_MAX || snap->layer_count < 0 || snap->layer_count > PLANE_TABLE_MAX)
+        ret = -EINVAL;
+    for (int i = 0; i < count && !ret; i++)
+    {
+        struct plane_info *plane = &snap->planes.planes[i];
+        plane->formats = NULL;
+        plane->modifiers = NULL;
+        if (plane->format_count > SNAPSHOT_MAX_SIZE || plane->modifier_count > SNAPSHOT_MAX_SIZE)
+        {
+            ret = -EINVAL;
+            break;
+        }
+        plane->formats = calloc(plane->format_count ? plane->format_count : 1, sizeof(*plane->formats));
+        plane->modifiers = calloc(plane->modifier_count ? plane->modifier_count : 1, sizeof(*plane->modifiers));
+        snap->planes.count++;
+        if (!plane->formats || !plane->modifiers)
+            ret = -ENOMEM;
+        if (!ret)
+            ret = get(&buf, plane->formats, sizeof(*plane->formats) * plane->format_count);
+        if (!ret)
+            ret = get(&buf, plane->modifiers, sizeof(*plane->modifiers) * plane->modifier_count);
+    }
+    free(buf.data);
+
+    // the same driver and the same monitor on the same connector
+    char driver[sizeof(snap->driver)];
+    uint64_t edid_hash;
+    if (!ret && snapshot_key(drm_fd, snap->connector_id, driver, sizeof(driver), &edid_hash))
+        ret = -ESTALE;
+    if (!ret && (strncmp(driver, snap->driver, sizeof(driver)) || edid_hash != snap->edid_hash))
+        ret = -ESTALE;
+    if (ret)
+        snapshot_free(snap);
+    return ret;
+}
+
+void snapshot_free(struct snapshot *snap)
+{
+    plane_table_free(&snap->planes);
+}
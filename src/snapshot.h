@@ -0,0 +1,43 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include "atomic.h"
+#include "plane_alloc.h"
+
+// What a program found out about the display the last time it started: the
+// connector and CRTC, the mode, every property ID and the plane table, plus
+// which plane each layer ended up on. Loaded at the next start it replaces
+// GetResources, the connector probe (which reads the EDID over the wire),
+// the plane enumeration and the plane_alloc search; one TEST_ONLY commit of
+// the first frame confirms it still holds.
+//
+// The file is keyed by the driver name, the connector and a hash of its
+// EDID, so another driver, another monitor or a moved cable reads as stale
+// and the program falls back to full discovery. The plane table is stored
+// as raw structs, a build with different struct layouts reads as stale too.
+#define SNAPSHOT_VERSION 1
+
+struct snapshot
+{
+    char driver[32];
+    uint64_t edid_hash;
+    uint32_t connector_id;
+    uint32_t crtc_id;
+    drmModeModeInfo mode;
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    int layer_count;
+    uint32_t layer_planes[PLANE_TABLE_MAX]; // plane of each layer, 0 when composited
+    struct plane_table planes;
+};
+
+int snapshot_path(const char *program, int drm_fd, char *path, int size);
+int snapshot_key(int drm_fd, uint32_t connector_id, char *driver, int driver_size, uint64_t *edid_hash);
+int snapshot_load(int drm_fd, const char *path, struct snapshot *snap);
+int snapshot_save(const char *path, const struct snapshot *snap);
+void snapshot_free(struct snapshot *snap);
+
+#endif
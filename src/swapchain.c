@@ -0,0 +1,324 @@
+#include "swapchain.h"
+#include "dumb_buffer.h"
+#include "format.h"
+#include "kms.h"
+#include "tiling.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+static int init_buffers(struct swapchain *sc, int drm_fd, struct buffer_pool *pool, int count,
+                        uint32_t width, uint32_t height, uint32_t format, uint64_t modifier)
+{
+    if (count < 2 || count > SWAPCHAIN_MAX_BUFFERS)
+    {
+        fprintf(stderr, "Swapchain needs 2 to %d buffers, got %d\n", SWAPCHAIN_MAX_BUFFERS, count);
+        return -EINVAL;
+    }
+
+    memset(sc, 0, sizeof(*sc));
+    sc->drm_fd = drm_fd;
+    sc->pool = pool;
+    damage_init(&sc->submit_damage, width, height);
+
+    for (int i = 0; i < count; i++)
+    {
+        struct sc_buffer *buf = &sc->buffers[i];
+        int ret;
+        if (pool)
+        {
+            ret = buffer_pool_get(pool, width, height, format, &buf->pooled);
+            if (!ret)
+            {
+                buf->create_dumb = buf->pooled->create_dumb;
+                buf->map = buf->pooled->map;
+                buf->fb_id = buf->pooled->fb_id;
+            }
+        }
+        else
+        {
+            buf->create_dumb.width = width;
+            buf->create_dumb.height = height;
+            ret = create_dumb_buffer_modifier(drm_fd, format, modifier, &buf->create_dumb, &buf->map, &buf->fb_id);
+        }
+        if (ret)
+        {
+            swapchain_destroy(sc);
+            return ret;
+        }
+        buf->create_dumb.width = width;
+        buf->create_dumb.height = height;
+        buf->format = format;
+        buf->modifier = modifier;
+        buf->state = BUFFER_FREE;
+        sc->count++;
+
+        // fresh buffers hold garbage, every pixel has to be drawn once
+        damage_init(&buf->damage, width, height);
+        damage_add_all(&buf->damage);
+    }
+
+    return 0;
+}
+
+// allocate count dumb buffers of the same size and format, all start out free.
+// returns 0 or -errno.
+int swapchain_init(struct swapchain *sc, int drm_fd, int count, uint32_t width, uint32_t height, uint32_t format)
+{
+    return init_buffers(sc, drm_fd, NULL, count, width, height, format, DRM_FORMAT_MOD_LINEAR);
+}
+
+// same with a tiled layout (tiling.h), drawn through tiling_swizzle or
+// compositor_render_tiled. -EINVAL when the driver takes no such framebuffer.
+int swapchain_init_modifier(struct swapchain *sc, int drm_fd, int count, uint32_t width, uint32_t height,
+                            uint32_t format, uint64_t modifier)
+{
+    return init_buffers(sc, drm_fd, NULL, count, width, height, format, modifier);
+}
+
+// same, with the buffers taken from a pool. resizing a layer is then a
+// destroy + init that mostly hits buffers the pool already has.
+int swapchain_init_pooled(struct swapchain *sc, struct buffer_pool *pool, int count, uint32_t width, uint32_t height, uint32_t format)
+{
+    return init_buffers(sc, pool->drm_fd, pool, count, width, height, format, DRM_FORMAT_MOD_LINEAR);
+}
+
+// buffers go back to their pool, or to the driver when the swapchain owns them
+void swapchain_destroy(struct swapchain *sc)
+{
+    for (int i = 0; i < sc->count; i++)
+    {
+        struct sc_buffer *buf = &sc->buffers[i];
+        if (buf->pooled)
+            buffer_pool_put(sc->pool, buf->pooled);
+        else
+            destroy_dumb_buffer(sc->drm_fd, &buf->create_dumb, buf->map, buf->fb_id);
+    }
+    sc->count = 0;
+}
+
+// hand out a buffer nobody is scanning out or waiting to scan out.
+// returns NULL when every buffer is busy, the caller should wait for a flip.
+struct sc_buffer *swapchain_acquire(struct swapchain *sc)
+{
+    for (int i = 0; i < sc->count; i++)
+    {
+        if (sc->buffers[i].state == BUFFER_FREE)
+        {
+            sc->buffers[i].state = BUFFER_RENDERING;
+            return &sc->buffers[i];
+        }
+    }
+
+    // with every other buffer busy, recycle the oldest frame that never got shown
+    struct sc_buffer *oldest = NULL;
+    int ready = 0;
+    for (int i = 0; i < sc->count; i++)
+    {
+        struct sc_buffer *buf = &sc->buffers[i];
+        if (buf->state != BUFFER_READY)
+            continue;
+
+        ready++;
+        if (!oldest || buf->frame < oldest->frame)
+            oldest = buf;
+    }
+
+    // never drop the only ready frame, it is what gets shown next
+    if (oldest && ready > 1)
+    {
+        oldest->state = BUFFER_RENDERING;
+        return oldest;
+    }
+
+    return NULL;
+}
+
+// same test as swapchain_acquire without taking the buffer
+int swapchain_can_acquire(const struct swapchain *sc)
+{
+    int ready = 0;
+    for (int i = 0; i < sc->count; i++)
+    {
+        if (sc->buffers[i].state == BUFFER_FREE)
+            return 1;
+        ready += sc->buffers[i].state == BUFFER_READY;
+    }
+    return ready > 1;
+}
+
+// the buffer holding the most recent frame, whatever state it is in
+static struct sc_buffer *newest_frame(struct swapchain *sc, const struct sc_buffer *exclude)
+{
+    struct sc_buffer *newest = NULL;
+    for (int i = 0; i < sc->count; i++)
+    {
+        struct sc_buffer *buf = &sc->buffers[i];
+        if (buf == exclude || !buf->frame)
+            continue;
+        if (buf->state == BUFFER_FREE || buf->state == BUFFER_RENDERING)
+            continue;
+        if (!newest || buf->frame > newest->frame)
+            newest = buf;
+    }
+    return newest;
+}
+
+// bring an acquired buffer up to date by copying only its stale rects from the
+// newest frame. afterwards buf->damage is what the caller still has to draw
+// itself, which is everything when there is no earlier frame to copy from.
+// multi-planar buffers cannot be repaired this way, that returns -ENOTSUP.
+int swapchain_repair(struct swapchain *sc, struct sc_buffer *buf)
+{
+    struct sc_buffer *src = newest_frame(sc, buf);
+    if (!src || damage_is_empty(&buf->damage))
+        return 0;
+
+    int rects = buf->damage.count;
+    const struct tiling_info *tiling = tiling_info_get(buf->modifier);
+    if (tiling->tile_width)
+    {
+        // both buffers have the same layout, whole rows of tiles are copied as they are
+        uint32_t tile_pixels = tiling->tile_width / 4;
+        for (int i = 0; i < buf->damage.count; i++)
+        {
+            const struct drm_mode_rect *r = &buf->damage.rects[i];
+            uint32_t x1 = (uint32_t)r->x1 / tile_pixels, x2 = ((uint32_t)r->x2 + tile_pixels - 1) / tile_pixels;
+            size_t bytes = (size_t)(x2 - x1) * tiling->tile_width * tiling->tile_height;
+            for (uint32_t y = (uint32_t)r->y1 / tiling->tile_height * tiling->tile_height; y < (uint32_t)r->y2;
+                 y += tiling->tile_height)
+            {
+                uint64_t offset = tiling_offset(tiling, buf->create_dumb.pitch, x1 * tiling->tile_width, y);
+                memcpy((uint8_t *)buf->map + offset, (const uint8_t *)src->map + offset, bytes);
+            }
+        }
+    }
+    else if (buf->create_dumb.bpp == 32)
+    {
+        damage_blit(&buf->damage, buf->map, buf->create_dumb.pitch, src->map, src->create_dumb.pitch);
+    }
+    else
+    {
+        // planes of a multi-planar buffer are not tracked by the damage rects
+        const struct format_info *info = format_info_get(buf->format);
+        if (info->plane_count > 1)
+            return -ENOTSUP;
+        for (int i = 0; i < buf->damage.count; i++)
+        {
+            const struct drm_mode_rect *r = &buf->damage.rects[i];
+            size_t bytes = (size_t)(r->x2 - r->x1) * info->cpp[0];
+            for (int32_t y = r->y1; y < r->y2; y++)
+                memcpy((uint8_t *)buf->map + (size_t)y * buf->create_dumb.pitch + (size_t)r->x1 * info->cpp[0],
+                       (const uint8_t *)src->map + (size_t)y * src->create_dumb.pitch + (size_t)r->x1 * info->cpp[0],
+                       bytes);
+        }
+    }
+    damage_clear(&buf->damage);
+    return rects;
+}
+
+// rendering into buf is finished, it can be shown from now on.
+// frame_damage is what changed since the previous frame, NULL for everything.
+void swapchain_queue(struct swapchain *sc, struct sc_buffer *buf, const struct damage *frame_damage)
+{
+    buf->state = BUFFER_READY;
+    buf->frame = ++sc->frame_counter;
+    damage_clear(&buf->damage);
+
+    for (int i = 0; i < sc->count; i++)
+    {
+        struct damage *d = &sc->buffers[i].damage;
+        if (&sc->buffers[i] == buf)
+            continue;
+        if (frame_damage)
+            damage_union(d, frame_damage);
+        else
+            damage_add_all(d);
+    }
+
+    if (frame_damage)
+        damage_union(&sc->submit_damage, frame_damage);
+    else
+        damage_add_all(&sc->submit_damage);
+}
+
+// newest finished frame, older finished frames are dropped (mailbox semantics)
+struct sc_buffer *swapchain_next_ready(struct swapchain *sc)
+{
+    struct sc_buffer *newest = NULL;
+    for (int i = 0; i < sc->count; i++)
+    {
+        struct sc_buffer *buf = &sc->buffers[i];
+        if (buf->state == BUFFER_READY && (!newest || buf->frame > newest->frame))
+            newest = buf;
+    }
+
+    for (int i = 0; i < sc->count; i++)
+    {
+        struct sc_buffer *buf = &sc->buffers[i];
+        if (buf->state == BUFFER_READY && buf != newest)
+            buf->state = BUFFER_FREE;
+    }
+
+    return newest;
+}
+
+// buf has been committed and will be latched at the next vblank.
+// the caller passes sc->submit_damage along with the commit before this.
+void swapchain_submit(struct swapchain *sc, struct sc_buffer *buf)
+{
+    buf->state = BUFFER_PENDING;
+    damage_clear(&sc->submit_damage);
+}
+
+// give a buffer back without showing it, e.g. after a failed commit
+void swapchain_cancel(struct swapchain *sc, struct sc_buffer *buf)
+{
+    buf->state = BUFFER_FREE;
+}
+
+// called from the flip event: pending becomes front, the old front is free again.
+// returns 1 if this swapchain had a flip pending.
+int swapchain_flip_done(struct swapchain *sc)
+{
+    struct sc_buffer *pending = NULL;
+    for (int i = 0; i < sc->count; i++)
+    {
+        if (sc->buffers[i].state == BUFFER_PENDING)
+            pending = &sc->buffers[i];
+    }
+
+    if (!pending)
+        return 0;
+
+    for (int i = 0; i < sc->count; i++)
+    {
+        if (sc->buffers[i].state == BUFFER_FRONT)
+            sc->buffers[i].state = BUFFER_FREE;
+    }
+
+    pending->state = BUFFER_FRONT;
+    return 1;
+}
+
+struct sc_buffer *swapchain_front(struct swapchain *sc)
+{
+    for (int i = 0; i < sc->count; i++)
+    {
+        if (sc->buffers[i].state == BUFFER_FRONT)
+            return &sc->buffers[i];
+    }
+    return NULL;
+}
+
+int swapchain_has_pending(const struct swapchain *sc)
+{
+    for (int i = 0; i < sc->count; i++)
+    {
+        if (sc->buffers[i].state == BUFFER_PENDING)
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef SWAPCHAIN_H
+#define SWAPCHAIN_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "buffer_pool.h"
+#include "damage.h"
+
+#define SWAPCHAIN_MAX_BUFFERS 4
+
+// Life cycle of a buffer: FREE -> RENDERING -> READY -> PENDING -> FRONT -> FREE.
+// Only FREE buffers are ever handed out for rendering, so the app never writes
+// into memory that is being scanned out or is about to be.
+enum buffer_state
+{
+    BUFFER_FREE,
+    BUFFER_RENDERING,
+    BUFFER_READY,
+    BUFFER_PENDING,
+    BUFFER_FRONT,
+};
+
+struct sc_buffer
+{
+    struct drm_mode_create_dumb create_dumb; // width/height as requested, a pooled fb can be larger
+    uint32_t format;                         // DRM_FORMAT_*
+    uint64_t modifier;                       // layout of map, see tiling.h
+    void *map;
+    uint32_t fb_id;
+    enum buffer_state state;
+    uint64_t frame;
+    struct damage damage; // where this buffer is older than the newest frame
+    struct pool_buffer *pooled;
+};
+
+struct swapchain
+{
+    int drm_fd;
+    struct buffer_pool *pool; // buffers come from and go back to this pool, NULL if owned
+    int count;
+    struct sc_buffer buffers[SWAPCHAIN_MAX_BUFFERS];
+    uint64_t frame_counter;
+    struct damage submit_damage; // changes since the last submitted frame, for FB_DAMAGE_CLIPS
+};
+
+int swapchain_init(struct swapchain *sc, int drm_fd, int count, uint32_t width, uint32_t height, uint32_t format);
+int swapchain_init_modifier(struct swapchain *sc, int drm_fd, int count, uint32_t width, uint32_t height,
+                            uint32_t format, uint64_t modifier);
+int swapchain_init_pooled(struct swapchain *sc, struct buffer_pool *pool, int count, uint32_t width, uint32_t height, uint32_t format);
+void swapchain_destroy(struct swapchain *sc);
+
+struct sc_buffer *swapchain_acquire(struct swapchain *sc);
+int swapchain_can_acquire(const struct swapchain *sc);
+int swapchain_repair(struct swapchain *sc, struct sc_buffer *buf);
+void swapchain_queue(struct swapchain *sc, struct sc_buffer *buf, const struct damage *frame_damage);
+struct sc_buffer *swapchain_next_ready(struct swapchain *sc);
+void swapchain_submit(struct swapchain *sc, struct sc_buffer *buf);
+void swapchain_cancel(struct swapchain *sc, struct sc_buffer *buf);
+int swapchain_flip_done(struct swapchain *sc);
+
+struct sc_buffer *swapchain_front(struct swapchain *sc);
+int swapchain_has_pending(const struct swapchain *sc);
+
+#endif
@@ -0,0 +1,194 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// one cache line per slice so owners and thieves do not false-share
+struct slice
+{
+    _Atomic uint32_t next;
+    uint32_t end;
+} __attribute__((aligned(64)));
+
+struct thread_pool
+{
+    int size; // worker count including the thread calling thread_pool_run
+    pthread_t threads[THREAD_POOL_MAX];
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int busy;
+    int quit;
+
+    pool_task_fn fn;
+    void *ctx;
+    struct slice slices[THREAD_POOL_MAX];
+};
+
+struct worker_arg
+{
+    struct thread_pool *pool;
+    int index;
+};
+
+// owners and thieves both claim tasks with fetch_add, so a slice is shared
+// without locks and every index below end runs exactly once
+static void drain(struct thread_pool *pool, int worker, int victim)
+{
+    struct slice *s = &pool->slices[victim];
+
+    while (1)
+    {
+        uint32_t i = atomic_fetch_add_explicit(&s->next, 1, memory_order_relaxed);
+        if (i >= s->end)
+            return;
+        pool->fn(pool->ctx, worker, i);
+    }
+}
+
+static void work(struct thread_pool *pool, int worker)
+{
+    drain(pool, worker, worker);
+    for (int i = 1; i < pool->size; i++)
+        drain(pool, worker, (worker + i) % pool->size);
+}
+
+static void *worker_main(void *data)
+{
+    struct worker_arg arg = *(struct worker_arg *)data;
+    struct thread_pool *pool = arg.pool;
+    uint64_t seen = 0;
+
+    free(data);
+
+    while (1)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        work(pool, arg.index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// threads <= 0 picks one worker per online CPU
+struct thread_pool *thread_pool_create(int threads)
+{
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    if (threads > THREAD_POOL_MAX)
+        threads = THREAD_POOL_MAX;
+
+    struct thread_pool *pool = aligned_alloc(64, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // the caller of thread_pool_run is worker 0
+    pool->size = 1;
+    for (int i = 1; i < threads; i++)
+    {
+        struct worker_arg *arg = malloc(sizeof(*arg));
+        if (!arg)
+            break;
+        arg->pool = pool;
+        arg->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, arg))
+        {
+            perror("pthread_create failed");
+            free(arg);
+            break;
+        }
+        pool->size++;
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->size; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool);
+}
+
+int thread_pool_size(const struct thread_pool *pool)
+{
+    return pool->size;
+}
+
+// run fn(ctx, worker, i) for every i in [0, count) and return once all are done
+void thread_pool_run(struct thread_pool *pool, uint32_t count, pool_task_fn fn, void *ctx)
+{
+    if (!count)
+        return;
+
+    pool->fn = fn;
+    pool->ctx = ctx;
+
+    uint32_t per = count / pool->size;
+    uint32_t extra = count % pool->size;
+    uint32_t begin = 0;
+    for (int i = 0; i < pool->size; i++)
+    {
+        uint32_t len = per + (i < (int)extra ? 1 : 0);
+        atomic_store_explicit(&pool->slices[i].next, begin, memory_order_relaxed);
+        pool->slices[i].end = begin + len;
+        begin += len;
+    }
+
+    if (pool->size == 1)
+    {
+        work(pool, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy = pool->size - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,21 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+
+#define THREAD_POOL_MAX 64
+
+// Runs `count` independent tasks across a fixed set of threads. Each thread
+// starts on its own contiguous slice of the task range and, once that is
+// drained, steals from the slices of the others, so an uneven slice (a tile
+// with many layers) does not leave the rest of the pool idle.
+typedef void (*pool_task_fn)(void *ctx, int worker, uint32_t index);
+
+struct thread_pool;
+
+struct thread_pool *thread_pool_create(int threads);
+void thread_pool_destroy(struct thread_pool *pool);
+int thread_pool_size(const struct thread_pool *pool);
+void thread_pool_run(struct thread_pool *pool, uint32_t count, pool_task_fn fn, void *ctx);
+
+#endif
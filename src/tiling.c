@@ -0,0 +1,145 @@
+#include "tiling.h"
+#include "pixel.h"
+
+#include <drm_fourcc.h>
+#include <stddef.h>
+#include <string.h>
+
+static const struct tiling_info tilings[] = {
+    {"linear", DRM_FORMAT_MOD_LINEAR, 0, 1, 0},
+    {"x-tiled", I915_FORMAT_MOD_X_TILED, 512, 8, 512},
+    {"y-tiled", I915_FORMAT_MOD_Y_TILED, 128, 32, 16},
+};
+#define TILING_COUNT (int)(sizeof(tilings) / sizeof(tilings[0]))
+
+// tiled layouts to try for a CPU drawn scanout buffer, best first. X-tiling
+// is scanned out by every plane that takes modifiers at all, Y-tiling is
+// friendlier to vertical walks but missing on older sprite planes.
+static const uint64_t preferred[] = {I915_FORMAT_MOD_X_TILED, I915_FORMAT_MOD_Y_TILED};
+
+const struct tiling_info *tiling_info_get(uint64_t modifier)
+{
+    for (int i = 0; i < TILING_COUNT; i++)
+    {
+        if (tilings[i].modifier == modifier)
+            return &tilings[i];
+    }
+    return NULL;
+}
+
+const struct tiling_info *tiling_info_by_name(const char *name)
+{
+    for (int i = 0; i < TILING_COUNT; i++)
+    {
+        if (strcmp(tilings[i].name, name) == 0)
+            return &tilings[i];
+    }
+    return NULL;
+}
+
+const uint64_t *tiling_preferred_modifiers(int *count)
+{
+    *count = (int)(sizeof(preferred) / sizeof(preferred[0]));
+    return preferred;
+}
+
+// round a buffer size in pixels up to whole tiles, the pitch then holds a
+// whole number of tiles and the last tile row is backed by memory
+void tiling_align(const struct tiling_info *info, uint32_t cpp, uint32_t *width, uint32_t *height)
+{
+    if (!info->tile_width)
+        return;
+    uint32_t tile_pixels = info->tile_width / cpp;
+    *width = (*width + tile_pixels - 1) / tile_pixels * tile_pixels;
+    *height = (*height + info->tile_height - 1) / info->tile_height * info->tile_height;
+}
+
+// byte offset of the byte x_bytes into row y of a surface with this pitch,
+// the pitch has to be a multiple of the tile width
+uint64_t tiling_offset(const struct tiling_info *info, uint32_t pitch, uint32_t x_bytes, uint32_t y)
+{
+    if (!info->tile_width)
+        return (uint64_t)y * pitch + x_bytes;
+
+    uint32_t tw = info->tile_width, th = info->tile_height;
+    uint64_t tile = (uint64_t)(y / th) * (pitch / tw) + x_bytes / tw;
+    uint32_t within = x_bytes % tw;
+    return tile * tw * th + (uint64_t)(within / info->span) * info->span * th + (uint64_t)(y % th) * info->span +
+           within % info->span;
+}
+
+// copy a rect between a tiled surface and a linear image, one contiguous
+// column piece at a time. band by band and tile by tile, so the tiled side is
+// walked in address order
+static void walk(const struct tiling_info *info, uint8_t *tiled, uint32_t pitch, uint32_t x, uint32_t y,
+                 uint8_t *linear, uint32_t linear_pitch, uint32_t width, uint32_t height, int to_tiled)
+{
+    uint32_t span = info->span, th = info->tile_height;
+    uint32_t x1 = x * 4, x2 = (x + width) * 4, y2 = y + height;
+
+    for (uint32_t band = y / th * th; band < y2; band += th)
+    {
+        uint32_t r1 = band > y ? band : y;
+        uint32_t r2 = band + th < y2 ? band + th : y2;
+        for (uint32_t col = x1 / span * span; col < x2; col += span)
+        {
+            uint32_t c1 = col > x1 ? col : x1;
+            uint32_t c2 = col + span < x2 ? col + span : x2;
+            uint8_t *t = tiled + tiling_offset(info, pitch, c1, r1);
+            uint8_t *l = linear + (size_t)(r1 - y) * linear_pitch + (c1 - x1);
+
+            // rows of a column piece are span bytes apart. Y-tile columns are
+            // a single 16 byte store per row, too narrow to be worth a kernel call
+            if (to_tiled && span >= 64)
+            {
+                pixel_blit(t, span, l, linear_pitch, (c2 - c1) / 4, r2 - r1);
+                continue;
+            }
+            if (to_tiled && c2 - c1 == 16)
+            {
+                for (uint32_t row = 0; row < r2 - r1; row++)
+                    memcpy(t + (size_t)row * 16, l + (size_t)row * linear_pitch, 16);
+                continue;
+            }
+            for (uint32_t row = 0; row < r2 - r1; row++)
+            {
+                if (to_tiled)
+                    memcpy(t + (size_t)row * span, l + (size_t)row * linear_pitch, c2 - c1);
+                else
+                    memcpy(l + (size_t)row * linear_pitch, t + (size_t)row * span, c2 - c1);
+            }
+        }
+    }
+}
+
+// write a linear 32bpp image of width x height pixels into the tiled surface
+// dst at (x, y). linear and X-tiled rows go out through pixel_blit's
+// non-temporal stores, which is what a scanout buffer map wants.
+void tiling_swizzle(const struct tiling_info *info, void *dst, uint32_t dst_pitch, uint32_t x, uint32_t y,
+                    const void *src, uint32_t src_pitch, uint32_t width, uint32_t height)
+{
+    if (!width || !height)
+        return;
+    if (!info->tile_width)
+    {
+        pixel_blit((uint8_t *)dst + (size_t)y * dst_pitch + (size_t)x * 4, dst_pitch, src, src_pitch, width, height);
+        return;
+    }
+    walk(info, dst, dst_pitch, x, y, (uint8_t *)src, src_pitch, width, height, 1);
+}
+
+// the reverse: read the rect at (x, y) of a tiled surface into a linear image
+void tiling_deswizzle(const struct tiling_info *info, void *dst, uint32_t dst_pitch, const void *src,
+                      uint32_t src_pitch, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    if (!width || !height)
+        return;
+    if (!info->tile_width)
+    {
+        for (uint32_t row = 0; row < height; row++)
+            memcpy((uint8_t *)dst + (size_t)row * dst_pitch,
+                   (const uint8_t *)src + (size_t)(y + row) * src_pitch + (size_t)x * 4, (size_t)width * 4);
+        return;
+    }
+    walk(info, (uint8_t *)src, src_pitch, x, y, dst, dst_pitch, width, height, 0);
+}
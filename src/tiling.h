@@ -0,0 +1,37 @@
+#ifndef TILING_H
+#define TILING_H
+
+#include <stdint.h>
+
+// Tiled framebuffer layouts the CPU can write. A tiled surface is a grid of
+// tiles, each tile_width bytes by tile_height rows stored in one contiguous
+// 4 KiB block, tiles in row-major order across the pitch. Inside a tile the
+// bytes are split into columns span bytes wide, each column stored top to
+// bottom. X-tiling has one 512 byte column (plain rows), Y-tiling eight
+// 16 byte columns, so a vertical walk stays inside a few cache lines.
+//
+// Only the layouts without bit 6 swizzling are described here, which is what
+// the display engine uses on every i915 generation that exposes modifiers.
+// Compressed (CCS) modifiers need an aux surface the CPU cannot write.
+struct tiling_info
+{
+    const char *name;
+    uint64_t modifier;
+    uint32_t tile_width;  // bytes, 0 for linear
+    uint32_t tile_height; // rows
+    uint32_t span;        // bytes of a tile row stored contiguously
+};
+
+const struct tiling_info *tiling_info_get(uint64_t modifier);
+const struct tiling_info *tiling_info_by_name(const char *name);
+const uint64_t *tiling_preferred_modifiers(int *count);
+
+void tiling_align(const struct tiling_info *info, uint32_t cpp, uint32_t *width, uint32_t *height);
+uint64_t tiling_offset(const struct tiling_info *info, uint32_t pitch, uint32_t x_bytes, uint32_t y);
+
+void tiling_swizzle(const struct tiling_info *info, void *dst, uint32_t dst_pitch, uint32_t x, uint32_t y,
+                    const void *src, uint32_t src_pitch, uint32_t width, uint32_t height);
+void tiling_deswizzle(const struct tiling_info *info, void *dst, uint32_t dst_pitch, const void *src,
+                      uint32_t src_pitch, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+#endif
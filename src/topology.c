@@ -0,0 +1,562 @@
+#include "topology.h"
+#include "kms.h"
+
+#include <errno.h>
+#include <linux/netlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#define UEVENT_BUFFER_SIZE 4096
+
+// property ids are global to the device, their names are read once each
+static int remember_prop_name(struct topology *topo, uint32_t prop_id)
+{
+    for (int i = 0; i < topo->prop_name_count; i++)
+    {
+        if (topo->prop_names[i].id == prop_id)
+            return 0;
+    }
+    if (topo->prop_name_count == TOPO_MAX_PROP_NAMES)
+        return -ENOSPC;
+
+    topo->ioctls++;
+    drmModePropertyRes *prop = kms_get_property(topo->drm_fd, prop_id);
+    if (!prop)
+        return -errno;
+
+    struct topo_prop_name *entry = &topo->prop_names[topo->prop_name_count++];
+    entry->id = prop_id;
+    entry->flags = prop->flags;
+    memcpy(entry->name, prop->name, sizeof(entry->name));
+    entry->name[sizeof(entry->name) - 1] = '\0';
+    drmModeFreeProperty(prop);
+    return 0;
+}
+
+static int load_props(struct topology *topo, uint32_t object_id, uint32_t object_type, struct topo_props *out)
+{
+    out->count = 0;
+    topo->ioctls++;
+    drmModeObjectProperties *props = kms_get_object_properties(topo->drm_fd, object_id, object_type);
+    if (!props)
+        return -errno;
+
+    for (uint32_t i = 0; i < props->count_props && out->count < TOPO_MAX_PROPS; i++)
+    {
+        if (remember_prop_name(topo, props->props[i]))
+            continue;
+        out->props[out->count].id = props->props[i];
+        out->props[out->count].value = props->prop_values[i];
+        out->count++;
+    }
+    drmModeFreeObjectProperties(props);
+    return 0;
+}
+
+// copy a connector as libdrm returned it. returns 1 if anything a user of
+// the topology would care about changed.
+static int store_connector(struct topology *topo, struct topo_connector *tc, const drmModeConnector *connector)
+{
+    int changed = tc->id != connector->connector_id || tc->connection != connector->connection ||
+                  tc->encoder_id != connector->encoder_id || tc->mode_count != connector->count_modes ||
+                  (tc->mode_count && memcmp(tc->modes, connector->modes, sizeof(*tc->modes) * tc->mode_count));
+
+    tc->id = connector->connector_id;
+    tc->type = connector->connector_type;
+    tc->type_id = connector->connector_type_id;
+    tc->connection = connector->connection;
+    tc->mm_width = connector->mmWidth;
+    tc->mm_height = connector->mmHeight;
+    tc->encoder_id = connector->encoder_id;
+    tc->encoder_count = 0;
+    for (int i = 0; i < connector->count_encoders && i < TOPO_MAX_CONNECTOR_ENCODERS; i++)
+        tc->encoders[tc->encoder_count++] = connector->encoders[i];
+
+    if (changed)
+    {
+        free(tc->modes);
+        tc->modes = NULL;
+        tc->mode_count = 0;
+        if (connector->count_modes > 0)
+        {
+            tc->modes = malloc(sizeof(*tc->modes) * connector->count_modes);
+            if (!tc->modes)
+                return -ENOMEM;
+            memcpy(tc->modes, connector->modes, sizeof(*tc->modes) * connector->count_modes);
+            tc->mode_count = connector->count_modes;
+        }
+        tc->generation = ++topo->generation;
+    }
+
+    load_props(topo, tc->id, DRM_MODE_OBJECT_CONNECTOR, &tc->props);
+    return changed;
+}
+
+// probe says whether the driver may be asked to detect the sink again
+static int load_connector(struct topology *topo, struct topo_connector *tc, uint32_t connector_id, int probe)
+{
+    topo->ioctls++;
+    drmModeConnector *connector = probe ? kms_get_connector(topo->drm_fd, connector_id)
+                                        : kms_get_connector_current(topo->drm_fd, connector_id);
+
+    // nobody has probed this one yet, the cached state has no modes
+    if (connector && !probe && connector->connection == DRM_MODE_CONNECTED && connector->count_modes == 0)
+    {
+        drmModeFreeConnector(connector);
+        topo->ioctls++;
+        connector = kms_get_connector(topo->drm_fd, connector_id);
+    }
+    if (!connector)
+        return -errno;
+
+    int ret = store_connector(topo, tc, connector);
+    drmModeFreeConnector(connector);
+    return ret;
+}
+
+static int load_crtc(struct topology *topo, struct topo_crtc *tc, uint32_t crtc_id)
+{
+    topo->ioctls++;
+    drmModeCrtc *crtc = kms_get_crtc(topo->drm_fd, crtc_id);
+    if (!crtc)
+        return -errno;
+
+    tc->id = crtc->crtc_id;
+    tc->fb_id = crtc->buffer_id;
+    tc->mode_valid = crtc->mode_valid;
+    tc->mode = crtc->mode;
+    drmModeFreeCrtc(crtc);
+    return load_props(topo, tc->id, DRM_MODE_OBJECT_CRTC, &tc->props);
+}
+
+static int load_encoder(struct topology *topo, struct topo_encoder *te, uint32_t encoder_id)
+{
+    topo->ioctls++;
+    drmModeEncoder *encoder = kms_get_encoder(topo->drm_fd, encoder_id);
+    if (!encoder)
+        return -errno;
+
+    te->id = encoder->encoder_id;
+    te->type = encoder->encoder_type;
+    te->crtc_id = encoder->crtc_id;
+    te->possible_crtcs = encoder->possible_crtcs;
+    drmModeFreeEncoder(encoder);
+    return 0;
+}
+
+static int load_plane(struct topology *topo, struct topo_plane *tp, uint32_t plane_id)
+{
+    topo->ioctls++;
+    drmModePlane *plane = kms_get_plane(topo->drm_fd, plane_id);
+    if (!plane)
+        return -errno;
+
+    tp->id = plane->plane_id;
+    tp->possible_crtcs = plane->possible_crtcs;
+    tp->crtc_id = plane->crtc_id;
+    tp->fb_id = plane->fb_id;
+    tp->format_count = 0;
+    tp->formats = NULL;
+    if (plane->count_formats)
+    {
+        tp->formats = malloc(sizeof(uint32_t) * plane->count_formats);
+        if (!tp->formats)
+        {
+            drmModeFreePlane(plane);
+            return -ENOMEM;
+        }
+        memcpy(tp->formats, plane->formats, sizeof(uint32_t) * plane->count_formats);
+        tp->format_count = plane->count_formats;
+    }
+    drmModeFreePlane(plane);
+    return load_props(topo, tp->id, DRM_MODE_OBJECT_PLANE, &tp->props);
+}
+
+// read every object once. returns 0 or -errno.
+int topology_init(struct topology *topo, int drm_fd)
+{
+    memset(topo, 0, sizeof(*topo));
+    topo->drm_fd = drm_fd;
+
+    topo->ioctls++;
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+        return -errno;
+
+    int ret = 0;
+    for (int i = 0; i < resources->count_crtcs && i < TOPO_MAX_CRTCS && !ret; i++)
+    {
+        ret = load_crtc(topo, &topo->crtcs[i], resources->crtcs[i]);
+        topo->crtc_count += !ret;
+    }
+    for (int i = 0; i < resources->count_encoders && i < TOPO_MAX_ENCODERS && !ret; i++)
+    {
+        ret = load_encoder(topo, &topo->encoders[i], resources->encoders[i]);
+        topo->encoder_count += !ret;
+    }
+    for (int i = 0; i < resources->count_connectors && i < TOPO_MAX_CONNECTORS && !ret; i++)
+    {
+        ret = load_connector(topo, &topo->connectors[i], resources->connectors[i], 0);
+        if (ret >= 0)
+        {
+            topo->connector_count++;
+            ret = 0;
+        }
+    }
+    drmModeFreeResources(resources);
+
+    if (!ret)
+    {
+        topo->ioctls++;
+        drmModePlaneRes *plane_res = kms_get_plane_resources(drm_fd);
+        if (!plane_res)
+            ret = -errno;
+        for (uint32_t i = 0; plane_res && i < plane_res->count_planes && i < TOPO_MAX_PLANES && !ret; i++)
+        {
+            ret = load_plane(topo, &topo->planes[i], plane_res->planes[i]);
+            topo->plane_count += !ret;
+        }
+        drmModeFreePlaneResources(plane_res);
+    }
+
+    if (ret)
+        topology_free(topo);
+    return ret;
+}
+
+void topology_free(struct topology *topo)
+{
+    for (int i = 0; i < topo->connector_count; i++)
+        free(topo->connectors[i].modes);
+    for (int i = 0; i < topo->plane_count; i++)
+        free(topo->planes[i].formats);
+    topo->connector_count = 0;
+    topo->plane_count = 0;
+}
+
+static struct topo_connector *find_connector(struct topology *topo, uint32_t connector_id)
+{
+    for (int i = 0; i < topo->connector_count; i++)
+    {
+        if (topo->connectors[i].id == connector_id)
+            return &topo->connectors[i];
+    }
+    return NULL;
+}
+
+// the sink on this connector may have changed: probe it and, if it is now
+// driven through another encoder, re-read that encoder too.
+// returns 1 if the connector changed, 0 if not, or -errno.
+int topology_refresh_connector(struct topology *topo, uint32_t connector_id)
+{
+    struct topo_connector *tc = find_connector(topo, connector_id);
+    if (!tc)
+        return topology_refresh_connectors(topo);
+
+    int changed = load_connector(topo, tc, connector_id, 1);
+    for (int i = 0; changed > 0 && i < topo->encoder_count; i++)
+    {
+        if (topo->encoders[i].id == tc->encoder_id)
+            load_encoder(topo, &topo->encoders[i], tc->encoder_id);
+    }
+    return changed;
+}
+
+// the kernel did not say which connector changed, or connectors came and went
+// (DP MST): probe every connector, keeping the ones that are still there.
+// returns the number of connectors that changed or -errno.
+int topology_refresh_connectors(struct topology *topo)
+{
+    topo->ioctls++;
+    drmModeRes *resources = kms_get_resources(topo->drm_fd);
+    if (!resources)
+        return -errno;
+
+    // drop connectors that are gone, the rest keep their slot
+    int kept = 0;
+    for (int i = 0; i < topo->connector_count; i++)
+    {
+        int present = 0;
+        for (int j = 0; j < resources->count_connectors; j++)
+            present |= resources->connectors[j] == topo->connectors[i].id;
+        if (!present)
+        {
+            free(topo->connectors[i].modes);
+            topo->generation++;
+            continue;
+        }
+        topo->connectors[kept++] = topo->connectors[i];
+    }
+    topo->connector_count = kept;
+
+    int changed = 0;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        struct topo_connector *tc = find_connector(topo, resources->connectors[i]);
+        if (!tc)
+        {
+            if (topo->connector_count == TOPO_MAX_CONNECTORS)
+                continue;
+            tc = &topo->connectors[topo->connector_count++];
+            memset(tc, 0, sizeof(*tc));
+        }
+
+        int ret = load_connector(topo, tc, resources->connectors[i], 1);
+        if (ret > 0)
+            changed++;
+    }
+    drmModeFreeResources(resources);
+    return changed;
+}
+
+const struct topo_crtc *topology_crtc(const struct topology *topo, uint32_t crtc_id)
+{
+    for (int i = 0; i < topo->crtc_count; i++)
+    {
+        if (topo->crtcs[i].id == crtc_id)
+            return &topo->crtcs[i];
+    }
+    return NULL;
+}
+
+const struct topo_encoder *topology_encoder(const struct topology *topo, uint32_t encoder_id)
+{
+    for (int i = 0; i < topo->encoder_count; i++)
+    {
+        if (topo->encoders[i].id == encoder_id)
+            return &topo->encoders[i];
+    }
+    return NULL;
+}
+
+const struct topo_connector *topology_connector(const struct topology *topo, uint32_t connector_id)
+{
+    return find_connector((struct topology *)topo, connector_id);
+}
+
+const struct topo_plane *topology_plane(const struct topology *topo, uint32_t plane_id)
+{
+    for (int i = 0; i < topo->plane_count; i++)
+    {
+        if (topo->planes[i].id == plane_id)
+            return &topo->planes[i];
+    }
+    return NULL;
+}
+
+static const struct topo_prop_name *find_prop_name(const struct topology *topo, uint32_t prop_id)
+{
+    for (int i = 0; i < topo->prop_name_count; i++)
+    {
+        if (topo->prop_names[i].id == prop_id)
+            return &topo->prop_names[i];
+    }
+    return NULL;
+}
+
+const char *topology_prop_name(const struct topology *topo, uint32_t prop_id)
+{
+    const struct topo_prop_name *entry = find_prop_name(topo, prop_id);
+    return entry ? entry->name : NULL;
+}
+
+// look a property up by name. returns 0 and the value, or -ENOENT.
+int topology_prop(const struct topology *topo, const struct topo_props *props, const char *name, uint64_t *value)
+{
+    for (int i = 0; i < props->count; i++)
+    {
+        const char *prop_name = topology_prop_name(topo, props->props[i].id);
+        if (prop_name && strcmp(prop_name, name) == 0)
+        {
+            *value = props->props[i].value;
+            return 0;
+        }
+    }
+    return -ENOENT;
+}
+
+// kernel uevents, the same ones udev sees before it adds its own keys.
+// returns a nonblocking netlink socket or -errno.
+int topology_uevent_open(void)
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -errno;
+
+    struct sockaddr_nl addr = {.nl_family = AF_NETLINK, .nl_groups = 1};
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    return fd;
+}
+
+// a uevent is "action@devpath" followed by KEY=value strings, all NUL
+// terminated. returns 1 for a DRM hotplug event, 0 for anything else.
+int topology_parse_uevent(const char *buf, size_t len, struct topo_uevent *ev)
+{
+    int drm = 0;
+
+    memset(ev, 0, sizeof(*ev));
+    for (size_t i = 0; i < len; i += strnlen(buf + i, len - i) + 1)
+    {
+        const char *key = buf + i;
+        if (strncmp(key, "SUBSYSTEM=", 10) == 0)
+            drm = strcmp(key + 10, "drm") == 0;
+        else if (strcmp(key, "HOTPLUG=1") == 0)
+            ev->hotplug = 1;
+        else if (strncmp(key, "CONNECTOR=", 10) == 0)
+            ev->connector_id = (uint32_t)strtoul(key + 10, NULL, 10);
+        else if (strncmp(key, "MAJOR=", 6) == 0)
+            ev->major = (uint32_t)strtoul(key + 6, NULL, 10);
+        else if (strncmp(key, "MINOR=", 6) == 0)
+            ev->minor = (uint32_t)strtoul(key + 6, NULL, 10);
+    }
+    return drm && ev->hotplug;
+}
+
+// read every queued uevent and refresh what the ones for this device name.
+// devices that are not a character device (the fake backend) take every
+// DRM hotplug event as theirs. returns the number of connectors that
+// changed or -errno.
+int topology_handle_uevents(struct topology *topo, int uevent_fd)
+{
+    char buf[UEVENT_BUFFER_SIZE];
+    struct stat st;
+    int is_node = fstat(topo->drm_fd, &st) == 0 && S_ISCHR(st.st_mode);
+    int changed = 0;
+
+    for (;;)
+    {
+        ssize_t len = recv(uevent_fd, buf, sizeof(buf), 0);
+        if (len < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? changed : -errno;
+
+        struct topo_uevent ev;
+        if (!topology_parse_uevent(buf, (size_t)len, &ev))
+            continue;
+        if (is_node && (ev.major != major(st.st_rdev) || ev.minor != minor(st.st_rdev)))
+            continue;
+
+        int ret = ev.connector_id ? topology_refresh_connector(topo, ev.connector_id)
+                                  : topology_refresh_connectors(topo);
+        if (ret > 0)
+            changed += ret;
+    }
+}
+
+static const char *connector_type_name(uint32_t type)
+{
+    static const char *const names[] = {
+        [DRM_MODE_CONNECTOR_Unknown] = "Unknown",     [DRM_MODE_CONNECTOR_VGA] = "VGA",
+        [DRM_MODE_CONNECTOR_DVII] = "DVI-I",          [DRM_MODE_CONNECTOR_DVID] = "DVI-D",
+        [DRM_MODE_CONNECTOR_DVIA] = "DVI-A",          [DRM_MODE_CONNECTOR_Composite] = "Composite",
+        [DRM_MODE_CONNECTOR_SVIDEO] = "SVIDEO",       [DRM_MODE_CONNECTOR_LVDS] = "LVDS",
+        [DRM_MODE_CONNECTOR_Component] = "Component", [DRM_MODE_CONNECTOR_9PinDIN] = "DIN",
+        [DRM_MODE_CONNECTOR_DisplayPort] = "DP",      [DRM_MODE_CONNECTOR_HDMIA] = "HDMI-A",
+        [DRM_MODE_CONNECTOR_HDMIB] = "HDMI-B",        [DRM_MODE_CONNECTOR_TV] = "TV",
+        [DRM_MODE_CONNECTOR_eDP] = "eDP",             [DRM_MODE_CONNECTOR_VIRTUAL] = "Virtual",
+        [DRM_MODE_CONNECTOR_DSI] = "DSI",             [DRM_MODE_CONNECTOR_DPI] = "DPI",
+        [DRM_MODE_CONNECTOR_WRITEBACK] = "Writeback",
+    };
+    if (type < sizeof(names) / sizeof(names[0]) && names[type])
+        return names[type];
+    return "Unknown";
+}
+
+static void dump_mode(const drmModeModeInfo *mode, FILE *out)
+{
+    fprintf(out, "{\"name\":\"%.*s\",\"width\":%u,\"height\":%u,\"refresh\":%u,\"clock\":%u,\"flags\":%u,\"type\":%u}",
+            DRM_DISPLAY_MODE_LEN, mode->name, mode->hdisplay, mode->vdisplay, mode->vrefresh, mode->clock,
+            mode->flags, mode->type);
+}
+
+static void dump_props(const struct topology *topo, const struct topo_props *props, FILE *out)
+{
+    fputs("{", out);
+    for (int i = 0; i < props->count; i++)
+    {
+        const char *name = topology_prop_name(topo, props->props[i].id);
+        fprintf(out, "%s\"%s\":%llu", i ? "," : "", name ? name : "?", (unsigned long long)props->props[i].value);
+    }
+    fputs("}", out);
+}
+
+static void dump_ids(const uint32_t *ids, int count, FILE *out)
+{
+    fputs("[", out);
+    for (int i = 0; i < count; i++)
+        fprintf(out, "%s%u", i ? "," : "", ids[i]);
+    fputs("]", out);
+}
+
+// the whole graph as one JSON object, property values by name
+void topology_dump_json(const struct topology *topo, FILE *out)
+{
+    fprintf(out, "{\"backend\":\"%s\",\"generation\":%llu,\"ioctls\":%llu,\n", kms_backend_name(topo->drm_fd),
+            (unsigned long long)topo->generation, (unsigned long long)topo->ioctls);
+
+    fputs("\"crtcs\":[", out);
+    for (int i = 0; i < topo->crtc_count; i++)
+    {
+        const struct topo_crtc *c = &topo->crtcs[i];
+        fprintf(out, "%s\n {\"id\":%u,\"index\":%d,\"fb\":%u,\"mode\":", i ? "," : "", c->id, i, c->fb_id);
+        if (c->mode_valid)
+            dump_mode(&c->mode, out);
+        else
+            fputs("null", out);
+        fputs(",\"props\":", out);
+        dump_props(topo, &c->props, out);
+        fputs("}", out);
+    }
+
+    fputs("],\n\"encoders\":[", out);
+    for (int i = 0; i < topo->encoder_count; i++)
+    {
+        const struct topo_encoder *e = &topo->encoders[i];
+        fprintf(out, "%s\n {\"id\":%u,\"type\":%u,\"crtc\":%u,\"possible_crtcs\":%u}", i ? "," : "", e->id, e->type,
+                e->crtc_id, e->possible_crtcs);
+    }
+
+    fputs("],\n\"connectors\":[", out);
+    for (int i = 0; i < topo->connector_count; i++)
+    {
+        const struct topo_connector *c = &topo->connectors[i];
+        const char *status = c->connection == DRM_MODE_CONNECTED      ? "connected"
+                             : c->connection == DRM_MODE_DISCONNECTED ? "disconnected"
+                                                                      : "unknown";
+        fprintf(out, "%s\n {\"id\":%u,\"name\":\"%s-%u\",\"status\":\"%s\",\"mm\":[%u,%u],\"encoder\":%u,\"encoders\":",
+                i ? "," : "", c->id, connector_type_name(c->type), c->type_id, status, c->mm_width, c->mm_height,
+                c->encoder_id);
+        dump_ids(c->encoders, c->encoder_count, out);
+        fprintf(out, ",\"generation\":%llu,\"modes\":[", (unsigned long long)c->generation);
+        for (int m = 0; m < c->mode_count; m++)
+        {
+            fputs(m ? "," : "", out);
+            dump_mode(&c->modes[m], out);
+        }
+        fputs("],\"props\":", out);
+        dump_props(topo, &c->props, out);
+        fputs("}", out);
+    }
+
+    fputs("],\n\"planes\":[", out);
+    for (int i = 0; i < topo->plane_count; i++)
+    {
+        const struct topo_plane *p = &topo->planes[i];
+        fprintf(out, "%s\n {\"id\":%u,\"possible_crtcs\":%u,\"crtc\":%u,\"fb\":%u,\"formats\":[", i ? "," : "", p->id,
+                p->possible_crtcs, p->crtc_id, p->fb_id);
+        for (uint32_t f = 0; f < p->format_count; f++)
+            fprintf(out, "%s\"%.4s\"", f ? "," : "", (const char *)&p->formats[f]);
+        fputs("],\"props\":", out);
+        dump_props(topo, &p->props, out);
+        fputs("}", out);
+    }
+    fputs("]}\n", out);
+}
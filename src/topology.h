@@ -0,0 +1,142 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+// An in-memory copy of a device's KMS objects: CRTCs, encoders, connectors
+// and planes with their properties, read once and then kept up to date.
+//
+// Loading it costs one ioctl per object plus one per distinct property, the
+// property names are shared by every object that has them. Connectors are
+// read with GetConnectorCurrent, so startup never waits for an EDID probe;
+// only a connector that shows up connected without modes gets probed.
+//
+// Hotplug uevents (topology_uevent_open) refresh just the connector named in
+// CONNECTOR=, or every connector when the kernel does not say which one.
+// CRTCs, encoders and planes do not change with hotplug and are left alone.
+// Each refresh that changes a connector bumps topology.generation and stamps
+// the connector with it, so users can tell what moved since they last looked.
+#define TOPO_MAX_CRTCS 16
+#define TOPO_MAX_ENCODERS 32
+#define TOPO_MAX_CONNECTORS 32
+#define TOPO_MAX_PLANES 32
+#define TOPO_MAX_PROPS 48
+#define TOPO_MAX_PROP_NAMES 256
+#define TOPO_MAX_CONNECTOR_ENCODERS 8
+
+struct topo_prop
+{
+    uint32_t id;
+    uint64_t value;
+};
+
+struct topo_props
+{
+    int count;
+    struct topo_prop props[TOPO_MAX_PROPS];
+};
+
+struct topo_crtc
+{
+    uint32_t id;
+    uint32_t fb_id;
+    int mode_valid;
+    drmModeModeInfo mode;
+    struct topo_props props;
+};
+
+struct topo_encoder
+{
+    uint32_t id;
+    uint32_t type;
+    uint32_t crtc_id;
+    uint32_t possible_crtcs;
+};
+
+struct topo_connector
+{
+    uint32_t id;
+    uint32_t type;
+    uint32_t type_id;
+    drmModeConnection connection;
+    uint32_t mm_width;
+    uint32_t mm_height;
+    uint32_t encoder_id;
+    int encoder_count;
+    uint32_t encoders[TOPO_MAX_CONNECTOR_ENCODERS];
+    int mode_count;
+    drmModeModeInfo *modes;
+    struct topo_props props;
+    uint64_t generation; // topology generation of the last change
+};
+
+struct topo_plane
+{
+    uint32_t id;
+    uint32_t possible_crtcs;
+    uint32_t crtc_id;
+    uint32_t fb_id;
+    uint32_t format_count;
+    uint32_t *formats;
+    struct topo_props props;
+};
+
+struct topo_prop_name
+{
+    uint32_t id;
+    uint32_t flags; // DRM_MODE_PROP_*
+    char name[DRM_PROP_NAME_LEN];
+};
+
+struct topology
+{
+    int drm_fd;
+    uint64_t generation;
+    uint64_t ioctls; // KMS queries made so far, loading plus refreshes
+
+    int crtc_count;
+    struct topo_crtc crtcs[TOPO_MAX_CRTCS];
+    int encoder_count;
+    struct topo_encoder encoders[TOPO_MAX_ENCODERS];
+    int connector_count;
+    struct topo_connector connectors[TOPO_MAX_CONNECTORS];
+    int plane_count;
+    struct topo_plane planes[TOPO_MAX_PLANES];
+
+    int prop_name_count;
+    struct topo_prop_name prop_names[TOPO_MAX_PROP_NAMES];
+};
+
+// What a uevent says, see topology_parse_uevent.
+struct topo_uevent
+{
+    int hotplug;
+    uint32_t connector_id; // 0 when the event is for the whole device
+    uint32_t major;
+    uint32_t minor;
+};
+
+int topology_init(struct topology *topo, int drm_fd);
+void topology_free(struct topology *topo);
+
+int topology_refresh_connector(struct topology *topo, uint32_t connector_id);
+int topology_refresh_connectors(struct topology *topo);
+
+const struct topo_crtc *topology_crtc(const struct topology *topo, uint32_t crtc_id);
+const struct topo_encoder *topology_encoder(const struct topology *topo, uint32_t encoder_id);
+const struct topo_connector *topology_connector(const struct topology *topo, uint32_t connector_id);
+const struct topo_plane *topology_plane(const struct topology *topo, uint32_t plane_id);
+const char *topology_prop_name(const struct topology *topo, uint32_t prop_id);
+int topology_prop(const struct topology *topo, const struct topo_props *props, const char *name, uint64_t *value);
+
+int topology_uevent_open(void);
+int topology_parse_uevent(const char *buf, size_t len, struct topo_uevent *ev);
+int topology_handle_uevents(struct topology *topo, int uevent_fd);
+
+void topology_dump_json(const struct topology *topo, FILE *out);
+
+#endif
@@ -0,0 +1,334 @@
+#define _GNU_SOURCE // gettid
+#include "trace.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_MAX_NAMES 32
+
+struct trace_ring
+{
+    _Atomic uint64_t head; // total events written, the slot is head % TRACE_RING_SIZE
+    uint32_t tid;
+    struct trace_ring *next;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+int trace_on;
+static const char *trace_path;
+static _Atomic(struct trace_ring *) rings;
+static __thread struct trace_ring *local_ring;
+
+uint64_t trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// first event on a thread allocates its ring and publishes it on the list
+static struct trace_ring *thread_ring(void)
+{
+    if (local_ring)
+        return local_ring;
+
+    struct trace_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        return NULL;
+    ring->tid = (uint32_t)gettid();
+
+    ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&rings, &ring->next, ring, memory_order_release, memory_order_relaxed))
+        ;
+
+    local_ring = ring;
+    return ring;
+}
+
+void trace_record(const char *name, uint32_t type, uint64_t ts_ns, uint64_t dur_ns, uint32_t arg, uint32_t crtc_id)
+{
+    struct trace_ring *ring = thread_ring();
+    if (!ring)
+        return;
+
+    // only this thread writes the ring, readers pick up the head with acquire
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event *ev = &ring->events[head % TRACE_RING_SIZE];
+    ev->ts_ns = ts_ns;
+    ev->dur_ns = dur_ns;
+    ev->name = name;
+    ev->type = type;
+    ev->arg = arg;
+    ev->crtc_id = crtc_id;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// $PLANES_TRACE: unset or "0" off, "1" stats only, otherwise a JSON path too
+void trace_init(void)
+{
+    const char *env = getenv("PLANES_TRACE");
+    if (!env || !*env || strcmp(env, "0") == 0)
+        return;
+
+    if (strcmp(env, "1") != 0)
+        trace_path = env;
+    trace_enable(1);
+}
+
+void trace_enable(int on)
+{
+    trace_on = on;
+}
+
+// forget everything recorded so far, e.g. after a warm-up phase
+void trace_reset(void)
+{
+    for (struct trace_ring *ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next)
+        atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+}
+
+// call fn for every event still held by any ring
+static void for_each_event(void (*fn)(const struct trace_event *ev, uint32_t tid, void *ctx), void *ctx)
+{
+    for (struct trace_ring *ring = atomic_load_explicit(&rings, memory_order_acquire); ring; ring = ring->next)
+    {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (uint64_t i = first; i < head; i++)
+            fn(&ring->events[i % TRACE_RING_SIZE], ring->tid, ctx);
+    }
+}
+
+struct sample_list
+{
+    const char *name;
+    uint32_t type;
+    size_t count;
+    size_t capacity;
+    struct trace_event *events;
+};
+
+static void collect(const struct trace_event *ev, uint32_t tid, void *ctx)
+{
+    struct sample_list *list = ctx;
+    if (ev->type != list->type || (list->name && strcmp(ev->name, list->name) != 0))
+        return;
+
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+        struct trace_event *events = realloc(list->events, capacity * sizeof(*events));
+        if (!events)
+            return;
+        list->events = events;
+        list->capacity = capacity;
+    }
+    list->events[list->count++] = *ev;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_ts(const void *a, const void *b)
+{
+    const struct trace_event *x = a, *y = b;
+    return x->ts_ns < y->ts_ns ? -1 : x->ts_ns > y->ts_ns;
+}
+
+// nearest-rank percentiles over sorted values
+static void fill_stats(uint64_t *values, size_t count, struct trace_stats *stats)
+{
+    qsort(values, count, sizeof(*values), compare_u64);
+    stats->count = count;
+    if (!count)
+        return;
+
+    stats->p50_ns = values[(count * 50 + 99) / 100 - 1];
+    stats->p90_ns = values[(count * 90 + 99) / 100 - 1];
+    stats->p99_ns = values[(count * 99 + 99) / 100 - 1];
+    stats->max_ns = values[count - 1];
+}
+
+// duration percentiles of every span called name
+int trace_span_stats(const char *name, struct trace_stats *stats)
+{
+    struct sample_list list = {.name = name, .type = TRACE_SPAN};
+    memset(stats, 0, sizeof(*stats));
+    for_each_event(collect, &list);
+
+    uint64_t *values = malloc((list.count ? list.count : 1) * sizeof(*values));
+    if (!values)
+    {
+        free(list.events);
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < list.count; i++)
+        values[i] = list.events[i].dur_ns;
+
+    fill_stats(values, list.count, stats);
+    free(values);
+    free(list.events);
+    return 0;
+}
+
+// frame time is the gap between two flips on the same CRTC, every vblank
+// sequence skipped in between is a missed frame
+int trace_frame_stats(struct trace_stats *stats)
+{
+    struct sample_list list = {.type = TRACE_VBLANK};
+    memset(stats, 0, sizeof(*stats));
+    for_each_event(collect, &list);
+    qsort(list.events, list.count, sizeof(*list.events), compare_ts);
+
+    uint64_t *values = malloc((list.count ? list.count : 1) * sizeof(*values));
+    if (!values)
+    {
+        free(list.events);
+        return -ENOMEM;
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < list.count; i++)
+    {
+        // the previous flip on the same CRTC
+        for (size_t j = i; j-- > 0;)
+        {
+            if (list.events[j].crtc_id != list.events[i].crtc_id)
+                continue;
+
+            values[count++] = list.events[i].ts_ns - list.events[j].ts_ns;
+            uint32_t gap = list.events[i].arg - list.events[j].arg;
+            if (gap > 1)
+                stats->missed_vblanks += gap - 1;
+            break;
+        }
+    }
+
+    uint64_t missed = stats->missed_vblanks;
+    fill_stats(values, count, stats);
+    stats->missed_vblanks = missed;
+    free(values);
+    free(list.events);
+    return 0;
+}
+
+struct name_list
+{
+    int count;
+    const char *names[TRACE_MAX_NAMES];
+};
+
+static void collect_names(const struct trace_event *ev, uint32_t tid, void *ctx)
+{
+    struct name_list *list = ctx;
+    if (ev->type != TRACE_SPAN)
+        return;
+
+    for (int i = 0; i < list->count; i++)
+    {
+        if (strcmp(list->names[i], ev->name) == 0)
+            return;
+    }
+    if (list->count < TRACE_MAX_NAMES)
+        list->names[list->count++] = ev->name;
+}
+
+static void print_line(FILE *out, const char *name, const struct trace_stats *stats)
+{
+    fprintf(out, "  %-16s %8llu  p50 %8.3f ms  p90 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", name,
+            (unsigned long long)stats->count, stats->p50_ns / 1e6, stats->p90_ns / 1e6,
+            stats->p99_ns / 1e6, stats->max_ns / 1e6);
+}
+
+void trace_print_stats(FILE *out)
+{
+    struct name_list names = {0};
+    for_each_event(collect_names, &names);
+
+    fprintf(out, "Trace stats:\n");
+    for (int i = 0; i < names.count; i++)
+    {
+        struct trace_stats stats;
+        if (trace_span_stats(names.names[i], &stats) == 0)
+            print_line(out, names.names[i], &stats);
+    }
+
+    struct trace_stats frames;
+    if (trace_frame_stats(&frames) == 0 && frames.count)
+    {
+        print_line(out, "frame", &frames);
+        fprintf(out, "  missed vblanks: %llu\n", (unsigned long long)frames.missed_vblanks);
+    }
+}
+
+struct json_ctx
+{
+    FILE *out;
+    int pid;
+    int first;
+};
+
+static void write_event(const struct trace_event *ev, uint32_t tid, void *ctx)
+{
+    struct json_ctx *json = ctx;
+
+    fprintf(json->out, "%s\n{\"name\":\"%s\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,", json->first ? "" : ",",
+            ev->name, json->pid, tid, ev->ts_ns / 1000.0);
+    json->first = 0;
+
+    switch (ev->type)
+    {
+    case TRACE_SPAN:
+        fprintf(json->out, "\"ph\":\"X\",\"dur\":%.3f,\"args\":{\"arg\":%u}}", ev->dur_ns / 1000.0, ev->arg);
+        break;
+    case TRACE_VBLANK:
+        fprintf(json->out, "\"ph\":\"i\",\"s\":\"p\",\"args\":{\"sequence\":%u,\"crtc\":%u}}", ev->arg, ev->crtc_id);
+        break;
+    default:
+        fprintf(json->out, "\"ph\":\"i\",\"s\":\"t\",\"args\":{\"arg\":%u}}", ev->arg);
+        break;
+    }
+}
+
+// Chrome trace-event format, timestamps in microseconds
+int trace_dump_json(FILE *out)
+{
+    struct json_ctx json = {.out = out, .pid = getpid(), .first = 1};
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for_each_event(write_event, &json);
+    fprintf(out, "\n]}\n");
+
+    return ferror(out) ? -EIO : 0;
+}
+
+// print the stats and write the JSON file trace_init was given, if any
+int trace_finish(void)
+{
+    if (!trace_on)
+        return 0;
+
+    trace_print_stats(stdout);
+    if (!trace_path)
+        return 0;
+
+    FILE *out = fopen(trace_path, "w");
+    if (!out)
+    {
+        perror("Cannot write trace");
+        return -errno;
+    }
+
+    int ret = trace_dump_json(out);
+    fclose(out);
+    if (!ret)
+        printf("Trace written to %s\n", trace_path);
+    return ret;
+}
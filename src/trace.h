@@ -0,0 +1,89 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Lightweight timing instrumentation. Every thread that records gets its own
+// ring of TRACE_RING_SIZE events, written without locks or atomics other
+// than a release store of the head, so recording never contends. Old events
+// are overwritten once a ring wraps.
+//
+// Tracing is off by default and every entry point starts with a single
+// predictable branch on trace_on, so the calls stay compiled into normal
+// builds. trace_init() turns it on from $PLANES_TRACE: "1" collects and
+// prints stats on trace_finish(), anything else is also a path the Chrome
+// trace-event JSON (chrome://tracing, Perfetto) is written to.
+//
+// Stats and dumps read the rings of every thread, call them when the
+// recording threads are idle.
+#define TRACE_RING_SIZE 8192 // power of two
+
+enum trace_type
+{
+    TRACE_SPAN,    // start + duration
+    TRACE_INSTANT, // a point in time, arg carries a value
+    TRACE_VBLANK,  // a flip completed, arg is the vblank sequence
+};
+
+struct trace_event
+{
+    uint64_t ts_ns; // CLOCK_MONOTONIC
+    uint64_t dur_ns;
+    const char *name; // must be a string literal or otherwise outlive the trace
+    uint32_t type;
+    uint32_t arg;
+    uint32_t crtc_id; // TRACE_VBLANK only
+};
+
+struct trace_stats
+{
+    uint64_t count;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+    uint64_t missed_vblanks; // only for frame stats
+};
+
+extern int trace_on;
+
+uint64_t trace_now(void);
+void trace_record(const char *name, uint32_t type, uint64_t ts_ns, uint64_t dur_ns, uint32_t arg, uint32_t crtc_id);
+
+// returns the start time to hand to trace_end, 0 when tracing is off
+static inline uint64_t trace_begin(void)
+{
+    return __builtin_expect(trace_on, 0) ? trace_now() : 0;
+}
+
+static inline void trace_end(const char *name, uint64_t start_ns, uint32_t arg)
+{
+    if (__builtin_expect(start_ns != 0, 0))
+        trace_record(name, TRACE_SPAN, start_ns, trace_now() - start_ns, arg, 0);
+}
+
+static inline void trace_instant(const char *name, uint32_t arg)
+{
+    if (__builtin_expect(trace_on, 0))
+        trace_record(name, TRACE_INSTANT, trace_now(), 0, arg, 0);
+}
+
+// ts_ns is the flip timestamp from the event, not the time it was read
+static inline void trace_vblank(uint32_t crtc_id, uint32_t sequence, uint64_t ts_ns)
+{
+    if (__builtin_expect(trace_on, 0))
+        trace_record("vblank", TRACE_VBLANK, ts_ns, 0, sequence, crtc_id);
+}
+
+void trace_init(void);
+void trace_enable(int on);
+void trace_reset(void);
+
+int trace_span_stats(const char *name, struct trace_stats *stats);
+int trace_frame_stats(struct trace_stats *stats);
+void trace_print_stats(FILE *out);
+int trace_dump_json(FILE *out);
+int trace_finish(void);
+
+#endif
@@ -0,0 +1,237 @@
+#include "writeback.h"
+#include "dumb_buffer.h"
+#include "kms.h"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// the first writeback connector whose encoder can drive crtc_id, 0 if none
+static uint32_t find_connector(int drm_fd, uint32_t crtc_id)
+{
+    drmModeRes *res = kms_get_resources(drm_fd);
+    if (!res)
+        return 0;
+
+    int crtc_index = -1;
+    for (int i = 0; i < res->count_crtcs; i++)
+    {
+        if (res->crtcs[i] == crtc_id)
+            crtc_index = i;
+    }
+
+    uint32_t connector_id = 0;
+    for (int i = 0; i < res->count_connectors && crtc_index >= 0 && !connector_id; i++)
+    {
+        drmModeConnector *connector = kms_get_connector(drm_fd, res->connectors[i]);
+        if (!connector)
+            continue;
+
+        for (int e = 0; e < connector->count_encoders && connector->connector_type == DRM_MODE_CONNECTOR_WRITEBACK; e++)
+        {
+            drmModeEncoder *encoder = kms_get_encoder(drm_fd, connector->encoders[e]);
+            if (encoder && (encoder->possible_crtcs & (1u << crtc_index)))
+                connector_id = connector->connector_id;
+            drmModeFreeEncoder(encoder);
+        }
+        drmModeFreeConnector(connector);
+    }
+
+    drmModeFreeResources(res);
+    return connector_id;
+}
+
+// XRGB8888 if the connector writes it, ARGB8888 otherwise, 0 for neither
+static uint32_t pick_format(int drm_fd, const struct writeback_props *props)
+{
+    drmModeObjectProperties *values = kms_get_object_properties(drm_fd, props->connector_id, DRM_MODE_OBJECT_CONNECTOR);
+    if (!values)
+        return 0;
+
+    uint32_t blob_id = 0;
+    for (uint32_t i = 0; i < values->count_props; i++)
+    {
+        if (values->props[i] == props->pixel_formats)
+            blob_id = (uint32_t)values->prop_values[i];
+    }
+    drmModeFreeObjectProperties(values);
+
+    drmModePropertyBlobRes *blob = kms_get_property_blob(drm_fd, blob_id);
+    if (!blob)
+        return 0;
+
+    uint32_t format = 0;
+    const uint32_t *formats = blob->data;
+    for (uint32_t i = 0; i < blob->length / sizeof(uint32_t); i++)
+    {
+        if (formats[i] == DRM_FORMAT_XRGB8888 || (formats[i] == DRM_FORMAT_ARGB8888 && !format))
+            format = formats[i];
+    }
+    drmModeFreePropertyBlob(blob);
+    return format;
+}
+
+// find a writeback connector for crtc_id and create count capture buffers of
+// width x height, which has to be the size of the mode the CRTC runs.
+// -EOPNOTSUPP when the kernel has no writeback support, -ENODEV when the
+// device has no connector for this CRTC
+int writeback_init(struct writeback *wb, int drm_fd, uint32_t crtc_id, uint32_t width, uint32_t height, int count)
+{
+    memset(wb, 0, sizeof(*wb));
+    wb->drm_fd = drm_fd;
+    wb->crtc_id = crtc_id;
+    for (int i = 0; i < WRITEBACK_MAX_BUFFERS; i++)
+        wb->buffers[i].fence_fd = wb->buffers[i].dmabuf_fd = -1;
+
+    if (count < 1 || count > WRITEBACK_MAX_BUFFERS)
+        return -EINVAL;
+    if (kms_set_client_cap(drm_fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1))
+        return -EOPNOTSUPP;
+
+    uint32_t connector_id = find_connector(drm_fd, crtc_id);
+    if (!connector_id)
+        return -ENODEV;
+    int ret = atomic_get_writeback_props(drm_fd, connector_id, &wb->props);
+    if (ret)
+        return ret;
+
+    wb->format = pick_format(drm_fd, &wb->props);
+    if (!wb->format)
+    {
+        fprintf(stderr, "Writeback connector %u writes neither XRGB8888 nor ARGB8888\n", connector_id);
+        return -ENOTSUP;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        struct capture_buffer *buf = &wb->buffers[i];
+        buf->create_dumb.width = width;
+        buf->create_dumb.height = height;
+        ret = create_dumb_buffer_format(drm_fd, wb->format, &buf->create_dumb, &buf->map, &buf->fb_id);
+        if (ret)
+        {
+            writeback_destroy(wb);
+            return ret;
+        }
+        wb->count++;
+
+        if (kms_prime_handle_to_fd(drm_fd, buf->create_dumb.handle, &buf->dmabuf_fd))
+            buf->dmabuf_fd = -1;
+    }
+    return 0;
+}
+
+void writeback_destroy(struct writeback *wb)
+{
+    for (int i = 0; i < wb->count; i++)
+    {
+        struct capture_buffer *buf = &wb->buffers[i];
+        if (buf->fence_fd >= 0)
+            close(buf->fence_fd);
+        if (buf->dmabuf_fd >= 0)
+            close(buf->dmabuf_fd);
+        destroy_dumb_buffer(wb->drm_fd, &buf->create_dumb, buf->map, buf->fb_id);
+    }
+    wb->count = 0;
+}
+
+// capture the frame req puts on screen into a free buffer, frame is kept with
+// it. NULL when every buffer is still pending or with the caller, the frame
+// goes uncaptured. the first capture attaches the connector, which is a
+// modeset: DRM_MODE_ATOMIC_ALLOW_MODESET is added to *flags
+struct capture_buffer *writeback_queue(struct writeback *wb, struct atomic_req *req, uint64_t frame, uint32_t *flags)
+{
+    struct capture_buffer *buf = NULL;
+    for (int i = 0; i < wb->count && !buf; i++)
+    {
+        if (wb->buffers[i].state == CAPTURE_FREE)
+            buf = &wb->buffers[i];
+    }
+    if (!buf || atomic_set_writeback(req, &wb->props, wb->crtc_id, buf->fb_id, &buf->fence_fd))
+    {
+        wb->missed++;
+        return NULL;
+    }
+
+    buf->state = CAPTURE_QUEUED;
+    buf->fence_fd = -1;
+    buf->frame = frame;
+    if (!wb->attached)
+        *flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    return buf;
+}
+
+// the commit carrying the queued capture returned ret. a failed one leaves
+// the buffer free again
+void writeback_committed(struct writeback *wb, int ret)
+{
+    for (int i = 0; i < wb->count; i++)
+    {
+        struct capture_buffer *buf = &wb->buffers[i];
+        if (buf->state != CAPTURE_QUEUED)
+            continue;
+
+        if (!ret && buf->fence_fd >= 0)
+        {
+            buf->state = CAPTURE_PENDING;
+            wb->attached = 1;
+        }
+        else
+        {
+            buf->state = CAPTURE_FREE;
+            wb->missed++;
+        }
+    }
+}
+
+static struct capture_buffer *oldest_pending(const struct writeback *wb)
+{
+    const struct capture_buffer *oldest = NULL;
+    for (int i = 0; i < wb->count; i++)
+    {
+        const struct capture_buffer *buf = &wb->buffers[i];
+        if (buf->state == CAPTURE_PENDING && (!oldest || buf->frame < oldest->frame))
+            oldest = buf;
+    }
+    return (struct capture_buffer *)oldest;
+}
+
+// the fence writeback_wait waits on next, for a poll loop. -1 when no capture is pending
+int writeback_fence_fd(const struct writeback *wb)
+{
+    const struct capture_buffer *buf = oldest_pending(wb);
+    return buf ? buf->fence_fd : -1;
+}
+
+// the oldest pending capture, once its fence has signalled. waits up to
+// timeout_ms, -1 forever. 0 with the buffer in *buf, -ETIMEDOUT, or
+// -EAGAIN when no capture is pending
+int writeback_wait(struct writeback *wb, int timeout_ms, struct capture_buffer **buf)
+{
+    struct capture_buffer *oldest = oldest_pending(wb);
+    if (!oldest)
+        return -EAGAIN;
+
+    struct pollfd pfd = {.fd = oldest->fence_fd, .events = POLLIN};
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return -errno;
+    if (ret == 0)
+        return -ETIMEDOUT;
+
+    close(oldest->fence_fd);
+    oldest->fence_fd = -1;
+    oldest->state = CAPTURE_DONE;
+    wb->captured++;
+    *buf = oldest;
+    return 0;
+}
+
+// the caller is done with the frame in buf, it can take the next capture
+void writeback_release(struct writeback *wb, struct capture_buffer *buf)
+{
+    buf->state = CAPTURE_FREE;
+}
@@ -0,0 +1,65 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <stdint.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "atomic.h"
+
+// Captures what a CRTC actually scans out, after the display engine has
+// blended its planes, through a writeback connector. vkms has one, so does
+// the fake backend with "writeback" in its mode list.
+//
+// Captures land in a small pool of dumb buffers of the mode's size. A
+// buffer is queued into a commit, the kernel hands back an out fence with
+// the commit and the buffer holds the frame once that fence signals. Until
+// the caller releases it nothing else is written into it, so a slow sink
+// costs captures (missed), never a torn frame. Each buffer is also exported
+// as a dma-buf, an encoder can take the frame from there without a copy.
+//
+// Life cycle of a buffer: FREE -> QUEUED -> PENDING -> DONE -> FREE.
+#define WRITEBACK_MAX_BUFFERS 4
+
+enum capture_state
+{
+    CAPTURE_FREE,
+    CAPTURE_QUEUED,  // in the request being built
+    CAPTURE_PENDING, // committed, waiting for its fence
+    CAPTURE_DONE,    // holds a frame, the caller has it
+};
+
+struct capture_buffer
+{
+    struct drm_mode_create_dumb create_dumb;
+    void *map;
+    uint32_t fb_id;
+    int dmabuf_fd; // -1 when the backend cannot export
+    enum capture_state state;
+    int32_t fence_fd; // out fence of the capture, written by the commit
+    uint64_t frame;   // what the caller passed to writeback_queue
+};
+
+struct writeback
+{
+    int drm_fd;
+    uint32_t crtc_id;
+    struct writeback_props props;
+    uint32_t format;
+    int attached; // the connector is on crtc_id, or will be after the queued commit
+    int count;
+    struct capture_buffer buffers[WRITEBACK_MAX_BUFFERS];
+    uint64_t captured;
+    uint64_t missed; // frames no buffer was free for
+};
+
+int writeback_init(struct writeback *wb, int drm_fd, uint32_t crtc_id, uint32_t width, uint32_t height, int count);
+void writeback_destroy(struct writeback *wb);
+
+struct capture_buffer *writeback_queue(struct writeback *wb, struct atomic_req *req, uint64_t frame, uint32_t *flags);
+void writeback_committed(struct writeback *wb, int ret);
+int writeback_fence_fd(const struct writeback *wb);
+int writeback_wait(struct writeback *wb, int timeout_ms, struct capture_buffer **buf);
+void writeback_release(struct writeback *wb, struct capture_buffer *buf);
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/format.h"
+
+// build: gcc -O2 tests/format_test.c src/format.c src/pixel.c -o format_test
+// usage: ./format_test
+
+#define MAX_WIDTH 257
+#define MAX_PAD 3
+#define MAX_SRC_X 3
+#define HEIGHT 5
+#define MAX_PITCH ((MAX_SRC_X + MAX_WIDTH + MAX_PAD + 1) * 4)
+// rounded to whole lines for aligned_alloc
+#define BUFFER_SIZE ((MAX_PITCH * HEIGHT + 63) & ~63)
+
+/*
+    Runs every converter set format_kernels_supported() returns against the
+    scalar one, byte for byte, the way pixel_test does for the pixel
+    kernels. The SIMD converters work 8 pixels at a time and finish each row
+    with the scalar code, so the widths sit around multiples of 8, and rows
+    are padded so a kernel writing past its width fails too.
+
+      rgb565       every x0/y0 dither phase, colour channels close to 255
+                   where the dither saturates
+      argb2101010  every alpha, the top two bits survive
+      nv12         src_x 0 to 3 and src_y 0 and 1: an odd src_x starts
+                   inside a chroma pair, an odd src_y shares the chroma row
+                   with the row above. Width 0 must not write anything
+
+    HEIGHT is odd and more than one dither period of rows deep in y.
+*/
+
+static const uint32_t widths[] = {0, 1, 2, 3, 5, 7, 8, 9, 15, 16, 17, 23, 24, 25, 33, 64, 100, MAX_WIDTH};
+static const uint32_t pads[] = {0, 1, MAX_PAD}; // extra pixels per row
+
+static uint32_t random_state = 0x9E3779B9;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void fill_random(uint8_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (uint8_t)next_random();
+}
+
+// ARGB pixels, every other one with channels of 248 and up, where adding
+// the dither threshold saturates
+static void fill_source(uint8_t *buf, size_t size)
+{
+    uint32_t *pixels = (uint32_t *)buf;
+    for (size_t i = 0; i < size / 4; i++)
+        pixels[i] = next_random() | (i & 1 ? 0x00F8F8F8 : 0);
+}
+
+// first differing byte offset, -1 if the buffers match
+static long compare(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (a[i] != b[i])
+            return (long)i;
+    }
+    return -1;
+}
+
+// run one converter over the same input with k and the scalar set, returns 1 on a mismatch.
+// phase_x/phase_y are x0/y0 for rgb565 and src_x/src_y for nv12
+static int check_case(const struct format_kernels *k, const char *kernel, uint32_t width, uint32_t pad,
+                      uint32_t phase_x, uint32_t phase_y, const uint8_t *src, uint8_t *expected, uint8_t *actual)
+{
+    const struct format_kernels *scalar = format_kernels_scalar();
+    uint32_t src_pitch = (width + pad) * 4;
+
+    fill_random(expected, BUFFER_SIZE);
+    memcpy(actual, expected, BUFFER_SIZE);
+
+    if (strcmp(kernel, "rgb565") == 0)
+    {
+        uint32_t pitch = (width + pad) * 2;
+        scalar->argb_to_rgb565(expected, pitch, src, src_pitch, width, HEIGHT, phase_x, phase_y);
+        k->argb_to_rgb565(actual, pitch, src, src_pitch, width, HEIGHT, phase_x, phase_y);
+    }
+    else if (strcmp(kernel, "argb2101010") == 0)
+    {
+        scalar->argb_to_argb2101010(expected, src_pitch, src, src_pitch, width, HEIGHT);
+        k->argb_to_argb2101010(actual, src_pitch, src, src_pitch, width, HEIGHT);
+    }
+    else
+    {
+        // luma and chroma rows as wide as the source rect reaches, chroma pairs whole
+        uint32_t pitch = (width + pad) * 4;
+        uint32_t plane_pitch = (phase_x + width + pad + 1) & ~1u;
+        const uint8_t *chroma = src + (size_t)plane_pitch * (phase_y + HEIGHT);
+        scalar->nv12_to_argb(expected, pitch, src, plane_pitch, chroma, plane_pitch, phase_x, phase_y, width, HEIGHT);
+        k->nv12_to_argb(actual, pitch, src, plane_pitch, chroma, plane_pitch, phase_x, phase_y, width, HEIGHT);
+    }
+
+    long at = compare(expected, actual, BUFFER_SIZE);
+    if (at < 0)
+        return 0;
+
+    fprintf(stderr, "%s %s: width %u pad %u phase %u,%u: byte %ld is %02x, scalar wrote %02x\n", k->name, kernel,
+            width, pad, phase_x, phase_y, at, actual[at], expected[at]);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const struct format_kernels *list[4];
+    int count = format_kernels_supported(list, 4);
+    const char *kernels[] = {"rgb565", "argb2101010", "nv12"};
+
+    uint8_t *src = aligned_alloc(64, BUFFER_SIZE);
+    uint8_t *expected = aligned_alloc(64, BUFFER_SIZE);
+    uint8_t *actual = aligned_alloc(64, BUFFER_SIZE);
+    if (!src || !expected || !actual)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int cases = 0, mismatches = 0;
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+        {
+            for (size_t p = 0; p < sizeof(pads) / sizeof(pads[0]); p++)
+            {
+                // 4x4 dither phases, the same x/y values as NV12 source offsets
+                for (uint32_t phase = 0; phase < 16; phase++)
+                {
+                    fill_source(src, BUFFER_SIZE);
+                    for (int n = 0; n < 3; n++)
+                    {
+                        // NV12 only needs src_y 0 and 1, the rest of the phases repeat them
+                        uint32_t phase_y = n == 2 ? phase / 4 % 2 : phase / 4;
+                        mismatches += check_case(list[i], kernels[n], widths[w], pads[p], phase % 4, phase_y, src,
+                                                 expected, actual);
+                        cases++;
+                    }
+                }
+            }
+        }
+
+        printf("%-8s %d cases, %d mismatches\n", list[i]->name, cases, mismatches);
+        if (mismatches)
+            failed = 1;
+    }
+
+    free(src);
+    free(expected);
+    free(actual);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
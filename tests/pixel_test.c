@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/pixel.h"
+
+// build: gcc -O2 tests/pixel_test.c src/pixel.c -o pixel_test
+// usage: ./pixel_test
+
+#define MAX_WIDTH 300
+#define HEIGHT 3
+#define MAX_PITCH ((MAX_WIDTH + 19) * 4)
+// room for a 64 byte start offset, rounded to whole lines for aligned_alloc
+#define BUFFER_SIZE ((MAX_PITCH * HEIGHT + 64 + 63) & ~63)
+
+/*
+    Runs every kernel set pixel_kernels_supported() returns against the
+    scalar one, byte for byte, and reports the first difference of each
+    case. SIMD kernels split each row into a scalar head, a vector body and
+    a scalar tail, so the cases that matter are the seams: starts off the
+    vector alignment, widths just under and over one vector (4, 8 and 16
+    pixels), and pitches with padding between the rows. The padding and the
+    bytes around the rect are part of the comparison, a kernel writing past
+    its row fails too.
+
+    Blend sources get alpha 0, 1, 254 and 255 as well as random values,
+    0 and 255 are where the SIMD paths could shortcut and 1 and 254 where
+    div255 rounding goes wrong first.
+*/
+
+static const uint32_t widths[] = {1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 257, MAX_WIDTH};
+static const uint32_t pads[] = {0, 1, 3, 19}; // extra pixels per row
+static const uint8_t alphas[] = {0, 1, 254, 255};
+
+static uint32_t random_state = 0x2545F491;
+
+static uint32_t next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void fill_random(uint8_t *buf, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = (uint8_t)next_random();
+}
+
+// source pixels, alpha cycles through the edge values and a random one.
+// colour channels may exceed alpha, which exercises the clamp
+static void fill_source(uint8_t *buf, size_t size)
+{
+    uint32_t *pixels = (uint32_t *)buf;
+    for (size_t i = 0; i < size / 4; i++)
+    {
+        uint32_t a = i % 5 < 4 ? alphas[i % 5] : (next_random() & 0xFF);
+        pixels[i] = (a << 24) | (next_random() & 0xFFFFFF);
+    }
+}
+
+// first differing byte offset, -1 if the buffers match
+static long compare(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (a[i] != b[i])
+            return (long)i;
+    }
+    return -1;
+}
+
+// run one kernel over the same input with k and the scalar set, returns 1 on a mismatch
+static int check_case(const struct pixel_kernels *k, const char *kernel, uint32_t width, uint32_t pad,
+                      uint32_t dst_offset, uint32_t src_offset, uint8_t *src, uint8_t *expected, uint8_t *actual)
+{
+    const struct pixel_kernels *scalar = pixel_kernels_scalar();
+    uint32_t pitch = (width + pad) * 4;
+    uint32_t color = next_random();
+
+    fill_random(expected, BUFFER_SIZE);
+    memcpy(actual, expected, BUFFER_SIZE);
+    uint8_t *s = src + src_offset * 4;
+
+    if (strcmp(kernel, "fill") == 0)
+    {
+        scalar->fill(expected + dst_offset * 4, pitch, width, HEIGHT, color);
+        k->fill(actual + dst_offset * 4, pitch, width, HEIGHT, color);
+    }
+    else if (strcmp(kernel, "blit") == 0)
+    {
+        scalar->blit(expected + dst_offset * 4, pitch, s, pitch, width, HEIGHT);
+        k->blit(actual + dst_offset * 4, pitch, s, pitch, width, HEIGHT);
+    }
+    else
+    {
+        scalar->blend(expected + dst_offset * 4, pitch, s, pitch, width, HEIGHT);
+        k->blend(actual + dst_offset * 4, pitch, s, pitch, width, HEIGHT);
+    }
+
+    long at = compare(expected, actual, BUFFER_SIZE);
+    if (at < 0)
+        return 0;
+
+    fprintf(stderr, "%s %s: width %u pitch %u dst +%u src +%u: byte %ld is %02x, scalar wrote %02x\n", k->name,
+            kernel, width, pitch, dst_offset, src_offset, at, actual[at], expected[at]);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    const struct pixel_kernels *list[4];
+    int count = pixel_kernels_supported(list, 4);
+    const char *kernels[] = {"fill", "blit", "blend"};
+
+    uint8_t *src = aligned_alloc(64, BUFFER_SIZE);
+    uint8_t *expected = aligned_alloc(64, BUFFER_SIZE);
+    uint8_t *actual = aligned_alloc(64, BUFFER_SIZE);
+    if (!src || !expected || !actual)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int cases = 0, mismatches = 0;
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+        {
+            for (size_t p = 0; p < sizeof(pads) / sizeof(pads[0]); p++)
+            {
+                // every start inside one 64 byte line, the source shifted independently
+                for (uint32_t offset = 0; offset < 16; offset++)
+                {
+                    fill_source(src, BUFFER_SIZE);
+                    for (int n = 0; n < 3; n++)
+                    {
+                        mismatches += check_case(list[i], kernels[n], widths[w], pads[p], offset, (offset * 7) % 16,
+                                                 src, expected, actual);
+                        cases++;
+                    }
+                }
+            }
+        }
+
+        printf("%-8s %d cases, %d mismatches\n", list[i]->name, cases, mismatches);
+        if (mismatches)
+            failed = 1;
+    }
+
+    free(src);
+    free(expected);
+    free(actual);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,398 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drm_fourcc.h>
+
+#include "../src/plane_alloc.h"
+
+// build: gcc -O2 tests/plane_alloc_test.c src/plane_alloc.c src/atomic.c src/damage.c src/tiling.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c -o plane_alloc_test $(pkg-config --cflags --libs libdrm)
+// usage: ./plane_alloc_test
+
+#define CRTC_ID 50
+#define OTHER_CRTC_ID 51
+
+/*
+    plane_alloc_assign against a mock device: the plane table is filled in
+    by hand and the TEST_ONLY commit is a hook that rejects the layouts a
+    case names, so every run takes the same path without a DRM device.
+
+    The hook reads back from each request which fb every plane shows, which
+    lets the cases check what was never tried as well as where each layer
+    ended up: a plane the static checks rule out (CRTC, format/modifier,
+    zpos, scaling) must not reach the hook at all.
+*/
+
+static int failures;
+
+static void check(int ok, const char *fmt, ...)
+{
+    if (ok)
+        return;
+
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    failures++;
+}
+
+static const uint32_t formats_xrgb[] = {DRM_FORMAT_XRGB8888};
+static const uint32_t formats_rgb[] = {DRM_FORMAT_XRGB8888, DRM_FORMAT_ARGB8888};
+static const uint32_t formats_nv12[] = {DRM_FORMAT_NV12};
+static const struct plane_format_mod modifiers_x_tiled[] = {
+    {DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR},
+    {DRM_FORMAT_XRGB8888, I915_FORMAT_MOD_X_TILED},
+};
+
+// one plane in the mock table. property ids are derived from the table
+// index, zpos_max 0 means no zpos property
+static struct plane_info *add_plane(struct plane_table *table, uint32_t plane_id, uint32_t type,
+                                    const uint32_t *formats, uint32_t format_count, uint64_t zpos_min,
+                                    uint64_t zpos_max, int zpos_mutable, int can_scale)
+{
+    struct plane_info *plane = &table->planes[table->count];
+    uint32_t prop = 100 + 16 * table->count++;
+
+    memset(plane, 0, sizeof(*plane));
+    plane->plane_id = plane_id;
+    plane->type = type;
+    plane->possible_crtcs = 1; // CRTC_ID
+    plane->format_count = format_count;
+    plane->formats = (uint32_t *)formats;
+    plane->can_scale = can_scale;
+    if (zpos_max)
+    {
+        plane->zpos_prop = prop + 15;
+        plane->zpos_mutable = zpos_mutable;
+        plane->zpos_min = zpos_min;
+        plane->zpos_max = zpos_max;
+    }
+
+    uint32_t *ids[] = {&plane->props.fb_id, &plane->props.crtc_id, &plane->props.crtc_x, &plane->props.crtc_y,
+                       &plane->props.crtc_w, &plane->props.crtc_h, &plane->props.src_x, &plane->props.src_y,
+                       &plane->props.src_w, &plane->props.src_h};
+    plane->props.plane_id = plane_id;
+    for (int i = 0; i < 10; i++)
+        *ids[i] = prop + 1 + i;
+    return plane;
+}
+
+static void init_table(struct plane_table *table)
+{
+    memset(table, 0, sizeof(*table));
+    table->crtc_count = 2;
+    table->crtc_ids[0] = CRTC_ID;
+    table->crtc_ids[1] = OTHER_CRTC_ID;
+}
+
+// layer fb ids are 1000 + index, so the hook can tell layers apart
+static struct layer make_layer(int index, uint32_t format, int32_t x, int32_t y, uint32_t w, uint32_t h)
+{
+    struct layer layer = {
+        .fb_id = 1000 + index,
+        .format = format,
+        .modifier = DRM_FORMAT_MOD_LINEAR,
+        .x = x,
+        .y = y,
+        .w = w,
+        .h = h,
+        .src_w = w,
+        .src_h = h,
+    };
+    return layer;
+}
+
+#define MAX_CALLS 64
+
+// the mock driver
+struct mock
+{
+    const struct plane_table *table;
+    int calls;
+    uint32_t reject_fb;          // any layout showing this fb fails
+    uint32_t reject_scaled_on;   // this plane fails every scaled layer
+    int reject_call;             // this call (1-based) fails whatever it asks
+    uint32_t shown[MAX_CALLS][PLANE_TABLE_MAX]; // fb per table plane, per call
+    uint64_t zpos[PLANE_TABLE_MAX];             // of the last call
+};
+
+static int find_prop(const struct atomic_req *req, uint32_t object_id, uint32_t property_id, uint64_t *value)
+{
+    for (int i = 0; i < req->count; i++)
+    {
+        if (req->props[i].object_id == object_id && req->props[i].property_id == property_id)
+        {
+            *value = req->props[i].value;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int mock_test(void *ctx, struct atomic_req *req)
+{
+    struct mock *mock = ctx;
+    int call = mock->calls++;
+    int ok = call + 1 != mock->reject_call;
+
+    for (int p = 0; p < mock->table->count; p++)
+    {
+        const struct plane_info *plane = &mock->table->planes[p];
+        uint64_t fb = 0, crtc_w = 0, src_w = 0;
+
+        find_prop(req, plane->plane_id, plane->props.fb_id, &fb);
+        find_prop(req, plane->plane_id, plane->props.crtc_w, &crtc_w);
+        find_prop(req, plane->plane_id, plane->props.src_w, &src_w);
+        mock->zpos[p] = 0;
+        if (plane->zpos_prop)
+            find_prop(req, plane->plane_id, plane->zpos_prop, &mock->zpos[p]);
+        if (call < MAX_CALLS)
+            mock->shown[call][p] = (uint32_t)fb;
+
+        if (fb && fb == mock->reject_fb)
+            ok = 0;
+        if (fb && plane->plane_id == mock->reject_scaled_on && src_w >> 16 != crtc_w)
+            ok = 0;
+    }
+    return ok;
+}
+
+// was fb_id ever offered on the plane at table index p
+static int tried(const struct mock *mock, int p, uint32_t fb_id)
+{
+    for (int call = 0; call < mock->calls && call < MAX_CALLS; call++)
+    {
+        if (mock->shown[call][p] == fb_id)
+            return 1;
+    }
+    return 0;
+}
+
+static int assign(struct plane_table *table, struct mock *mock, struct layer *layers, int count,
+                  struct plane_alloc_result *result)
+{
+    struct atomic_req req;
+    atomic_req_init(&req);
+    mock->table = table;
+    return plane_alloc_assign(table, CRTC_ID, layers, count, mock_test, mock, &req, result);
+}
+
+// the background goes on the primary plane and is tested alone first, even
+// with an overlay that could show it earlier in the table
+static void test_primary_first(void)
+{
+    struct plane_table table;
+    init_table(&table);
+    add_plane(&table, 60, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 0, 0, 1);
+    add_plane(&table, 61, DRM_PLANE_TYPE_CURSOR, formats_rgb, 2, 0, 0, 0, 0);
+    add_plane(&table, 62, DRM_PLANE_TYPE_PRIMARY, formats_xrgb, 1, 0, 0, 0, 0);
+
+    struct layer layers[] = {
+        make_layer(0, DRM_FORMAT_XRGB8888, 0, 0, 640, 480),
+        make_layer(1, DRM_FORMAT_ARGB8888, 10, 10, 100, 100),
+        make_layer(2, DRM_FORMAT_ARGB8888, 300, 300, 64, 64),
+    };
+    struct mock mock = {0};
+    struct plane_alloc_result result;
+
+    int ret = assign(&table, &mock, layers, 3, &result);
+    check(ret == 0, "primary_first: assign returned %d", ret);
+    check(mock.shown[0][2] == 1000 && !mock.shown[0][0] && !mock.shown[0][1],
+          "primary_first: the first test is not the background alone on the primary");
+    check(layers[0].plane_id == 62, "primary_first: background on plane %u, not the primary", layers[0].plane_id);
+    check(layers[1].plane_id == 60, "primary_first: layer 1 on plane %u, not the overlay", layers[1].plane_id);
+    check(layers[2].plane_id == 61, "primary_first: layer 2 on plane %u, not the cursor plane", layers[2].plane_id);
+    check(result.hw_layers == 3 && result.composited_layers == 0 && result.composite_plane_id == 0,
+          "primary_first: %d hw, %d composited", result.hw_layers, result.composited_layers);
+}
+
+// planes that cannot show a layer's format or modifier, or sit on another
+// CRTC, are skipped without a test
+static void test_format_filter(void)
+{
+    struct plane_table table;
+    init_table(&table);
+    add_plane(&table, 60, DRM_PLANE_TYPE_PRIMARY, formats_xrgb, 1, 0, 0, 0, 0);
+    struct plane_info *other = add_plane(&table, 61, DRM_PLANE_TYPE_OVERLAY, formats_xrgb, 1, 0, 0, 0, 1);
+    other->possible_crtcs = 2; // OTHER_CRTC_ID, would take layer 1 otherwise
+    other->modifiers = (struct plane_format_mod *)modifiers_x_tiled;
+    other->modifier_count = 2;
+    add_plane(&table, 62, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 0, 0, 1);   // linear only
+    add_plane(&table, 63, DRM_PLANE_TYPE_OVERLAY, formats_nv12, 1, 0, 0, 0, 1);
+    struct plane_info *tiled = add_plane(&table, 64, DRM_PLANE_TYPE_OVERLAY, formats_xrgb, 1, 0, 0, 0, 1);
+    tiled->modifiers = (struct plane_format_mod *)modifiers_x_tiled;
+    tiled->modifier_count = 2;
+
+    struct layer layers[] = {
+        make_layer(0, DRM_FORMAT_XRGB8888, 0, 0, 640, 480),
+        make_layer(1, DRM_FORMAT_XRGB8888, 0, 0, 100, 100),
+        make_layer(2, DRM_FORMAT_NV12, 200, 0, 100, 100),
+        make_layer(3, DRM_FORMAT_RGB565, 400, 0, 100, 100),
+    };
+    layers[1].modifier = I915_FORMAT_MOD_X_TILED;
+    struct mock mock = {0};
+    struct plane_alloc_result result;
+
+    int ret = assign(&table, &mock, layers, 4, &result);
+    check(ret == 0, "format_filter: assign returned %d", ret);
+    check(layers[1].plane_id == 64, "format_filter: x-tiled layer on plane %u", layers[1].plane_id);
+    check(layers[2].plane_id == 63, "format_filter: NV12 layer on plane %u", layers[2].plane_id);
+    check(layers[3].plane_id == 0, "format_filter: RGB565 layer on plane %u", layers[3].plane_id);
+    check(!tried(&mock, 1, 1001) && !tried(&mock, 1, 1002), "format_filter: a plane of the other CRTC was tested");
+    check(!tried(&mock, 2, 1001), "format_filter: x-tiled layer tested on a linear only plane");
+    check(!tried(&mock, 2, 1002) && !tried(&mock, 4, 1002), "format_filter: NV12 layer tested on an RGB plane");
+    check(!tried(&mock, 3, 1001), "format_filter: x-tiled layer tested on the NV12 plane");
+    for (int p = 0; p < table.count; p++)
+        check(!tried(&mock, p, 1003), "format_filter: RGB565 layer tested on plane %u", table.planes[p].plane_id);
+    check(result.hw_layers == 3 && result.composited_layers == 1 && result.composite_plane_id == 60,
+          "format_filter: %d hw, %d composited on %u", result.hw_layers, result.composited_layers,
+          result.composite_plane_id);
+}
+
+// a plane whose zpos cannot go above the layer below is never offered, and
+// mutable zpos is written in stacking order
+static void test_zpos_filter(void)
+{
+    struct plane_table table;
+    init_table(&table);
+    add_plane(&table, 60, DRM_PLANE_TYPE_PRIMARY, formats_xrgb, 1, 0, 0, 0, 0);
+    table.planes[0].zpos_prop = 115; // immutable zpos 0
+    add_plane(&table, 61, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 1, 5, 1, 1);
+    add_plane(&table, 62, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 1, 1, 0, 1); // pinned at 1
+    add_plane(&table, 63, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 7, 1, 1);
+
+    struct layer layers[] = {
+        make_layer(0, DRM_FORMAT_XRGB8888, 0, 0, 640, 480),
+        make_layer(1, DRM_FORMAT_ARGB8888, 0, 0, 100, 100),
+        make_layer(2, DRM_FORMAT_ARGB8888, 200, 0, 100, 100),
+    };
+    struct mock mock = {0};
+    struct plane_alloc_result result;
+
+    int ret = assign(&table, &mock, layers, 3, &result);
+    check(ret == 0, "zpos_filter: assign returned %d", ret);
+    check(layers[1].plane_id == 61, "zpos_filter: layer 1 on plane %u", layers[1].plane_id);
+    check(layers[2].plane_id == 63, "zpos_filter: layer 2 on plane %u", layers[2].plane_id);
+    check(!tried(&mock, 2, 1002), "zpos_filter: layer 2 tested on a plane pinned below it");
+    check(mock.zpos[1] == 1 && mock.zpos[3] == 2, "zpos_filter: zpos %llu and %llu, not 1 and 2",
+          (unsigned long long)mock.zpos[1], (unsigned long long)mock.zpos[3]);
+}
+
+// a scaled layer skips planes known not to scale. on a plane without
+// SCALING_FILTER (can_scale -1) the TEST_ONLY result decides and is learnt
+static void test_scale_filter(void)
+{
+    struct plane_table table;
+    init_table(&table);
+    add_plane(&table, 60, DRM_PLANE_TYPE_PRIMARY, formats_xrgb, 1, 0, 0, 0, 0);
+    add_plane(&table, 61, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 0, 0, 0);
+    add_plane(&table, 62, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 0, 0, -1);
+    add_plane(&table, 63, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 0, 0, -1);
+    add_plane(&table, 64, DRM_PLANE_TYPE_CURSOR, formats_rgb, 2, 0, 0, 0, 0);
+
+    struct layer layers[] = {
+        make_layer(0, DRM_FORMAT_XRGB8888, 0, 0, 640, 480),
+        make_layer(1, DRM_FORMAT_ARGB8888, 0, 0, 200, 200),
+    };
+    layers[1].src_w = layers[1].src_h = 100;
+    struct mock mock = {.reject_scaled_on = 62};
+    struct plane_alloc_result result;
+
+    int ret = assign(&table, &mock, layers, 2, &result);
+    check(ret == 0, "scale_filter: assign returned %d", ret);
+    check(!tried(&mock, 1, 1001) && !tried(&mock, 4, 1001), "scale_filter: scaled layer tested on a plane that cannot scale");
+    check(tried(&mock, 2, 1001), "scale_filter: plane with unknown scaling was not tested");
+    check(layers[1].plane_id == 63, "scale_filter: scaled layer on plane %u", layers[1].plane_id);
+    check(table.planes[2].can_scale == -1 && table.planes[3].can_scale == 1,
+          "scale_filter: can_scale %d and %d, not -1 and 1", table.planes[2].can_scale, table.planes[3].can_scale);
+
+    // with no plane left that scales it is composited
+    table.planes[3].can_scale = 0;
+    mock = (struct mock){.reject_scaled_on = 62};
+    ret = assign(&table, &mock, layers, 2, &result);
+    check(ret == 0 && layers[1].plane_id == 0 && result.composite_plane_id == 60,
+          "scale_filter: scaled layer on plane %u with no scaler left", layers[1].plane_id);
+}
+
+// a layer the hook rejects everywhere is composited, and takes the hardware
+// layers below it that it overlaps along, transitively. layers above it and
+// layers it does not touch keep their planes
+static void test_demotion(void)
+{
+    struct plane_table table;
+    init_table(&table);
+    add_plane(&table, 60, DRM_PLANE_TYPE_PRIMARY, formats_xrgb, 1, 0, 0, 0, 0);
+    for (uint32_t id = 61; id <= 65; id++)
+        add_plane(&table, id, DRM_PLANE_TYPE_OVERLAY, formats_rgb, 2, 0, 0, 0, 1);
+
+    struct layer layers[] = {
+        make_layer(0, DRM_FORMAT_XRGB8888, 0, 0, 640, 480),
+        make_layer(1, DRM_FORMAT_ARGB8888, 0, 0, 100, 100),     // apart from the rest
+        make_layer(2, DRM_FORMAT_ARGB8888, 200, 200, 100, 100), // under 3 only
+        make_layer(3, DRM_FORMAT_ARGB8888, 250, 250, 100, 100), // under 4
+        make_layer(4, DRM_FORMAT_ARGB8888, 320, 320, 100, 100), // rejected
+        make_layer(5, DRM_FORMAT_ARGB8888, 300, 300, 100, 100), // above 4
+    };
+    struct mock mock = {.reject_fb = 1004};
+    struct plane_alloc_result result;
+
+    int ret = assign(&table, &mock, layers, 6, &result);
+    check(ret == 0, "demotion: assign returned %d", ret);
+    check(layers[4].plane_id == 0, "demotion: rejected layer on plane %u", layers[4].plane_id);
+    check(layers[3].plane_id == 0, "demotion: layer 3 under the rejected one kept plane %u", layers[3].plane_id);
+    check(layers[2].plane_id == 0, "demotion: layer 2 under layer 3 kept plane %u", layers[2].plane_id);
+    check(layers[1].plane_id == 61, "demotion: layer 1 lost its plane");
+    check(layers[5].plane_id != 0, "demotion: layer 5 above the rejected one lost its plane");
+    check(result.hw_layers == 3 && result.composited_layers == 3 && result.composite_plane_id == 60,
+          "demotion: %d hw, %d composited", result.hw_layers, result.composited_layers);
+
+    // the last test saw exactly the survivors
+    int last = mock.calls - 1;
+    check(mock.shown[last][0] == 1000 && mock.shown[last][1] == 1001 && !mock.shown[last][2] &&
+              !mock.shown[last][3],
+          "demotion: final test still shows demoted layers");
+
+    // when the driver rejects the demoted set as a whole, everything but the
+    // background is composited. calls: background, three overlays, final check
+    struct layer apart[] = {
+        make_layer(0, DRM_FORMAT_XRGB8888, 0, 0, 640, 480),
+        make_layer(1, DRM_FORMAT_ARGB8888, 0, 0, 100, 100),
+        make_layer(2, DRM_FORMAT_ARGB8888, 200, 0, 100, 100),
+        make_layer(3, DRM_FORMAT_ARGB8888, 400, 0, 100, 100),
+    };
+    mock = (struct mock){.reject_call = 5};
+    ret = assign(&table, &mock, apart, 4, &result);
+    check(ret == 0, "demotion: fallback assign returned %d", ret);
+    check(mock.calls == 6, "demotion: %d tests, expected 6", mock.calls);
+    check(apart[0].plane_id == 60 && !apart[1].plane_id && !apart[2].plane_id && !apart[3].plane_id,
+          "demotion: fallback kept hardware layers");
+    check(result.hw_layers == 1 && result.composited_layers == 3 && result.composite_plane_id == 60,
+          "demotion: fallback %d hw, %d composited", result.hw_layers, result.composited_layers);
+
+    // and a background nothing accepts is an error
+    mock = (struct mock){.reject_fb = 1000};
+    ret = assign(&table, &mock, apart, 4, &result);
+    check(ret == -ENODEV, "demotion: rejected background returned %d, not -ENODEV", ret);
+}
+
+int main(int argc, char **argv)
+{
+    test_primary_first();
+    test_format_filter();
+    test_zpos_filter();
+    test_scale_filter();
+    test_demotion();
+
+    if (failures)
+    {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("plane_alloc: all checks passed\n");
+    return EXIT_SUCCESS;
+}
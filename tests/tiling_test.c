@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drm_fourcc.h>
+
+#include "../src/compositor.h"
+#include "../src/tiling.h"
+
+// build: gcc -O2 tests/tiling_test.c src/compositor.c src/thread_pool.c src/pixel.c src/tiling.c src/damage.c src/format.c src/trace.c -o tiling_test -lpthread
+// usage: ./tiling_test
+
+#define WIDTH 333
+#define HEIGHT 201
+#define LAYER_COUNT 4
+
+/*
+    Checks the tiled layouts of tiling.h in three steps, each trusting only
+    the one before it:
+
+      offsets     tiling_offset against the X and Y tile layouts written
+                  out by hand, and every byte of the surface hit exactly once
+      swizzle     tiling_swizzle of odd rects pixel by pixel against
+                  tiling_offset, and tiling_deswizzle reading them back
+      compositor  compositor_render_tiled into each layout, with full and
+                  partial damage, read back and compared with the linear
+                  render of the same layers
+
+    The surfaces are a few tiles in size and not a whole number of tiles,
+    so tile edges and partial tiles are covered.
+*/
+
+static const char *const layouts[] = {"x-tiled", "y-tiled"};
+
+// aligned_alloc wants a whole number of lines
+static void *alloc_lines(size_t size)
+{
+    return aligned_alloc(64, (size + 63) & ~(size_t)63);
+}
+
+// premultiplied gradient, every pixel different
+static uint32_t *make_image(uint32_t w, uint32_t h, uint8_t alpha)
+{
+    uint32_t *pixels = alloc_lines((size_t)w * h * 4);
+    if (!pixels)
+        return NULL;
+
+    for (uint32_t y = 0; y < h; y++)
+    {
+        for (uint32_t x = 0; x < w; x++)
+        {
+            uint32_t r = (x * 255 / w) * alpha / 255;
+            uint32_t g = (y * 255 / h) * alpha / 255;
+            uint32_t b = ((x + y) & 0xFF) * alpha / 255;
+            pixels[(size_t)y * w + x] = ((uint32_t)alpha << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+    return pixels;
+}
+
+// where the byte x_bytes of row y lives, straight from the i915 layouts:
+// X tiles are 512 bytes x 8 rows stored row by row, Y tiles 128 bytes x 32
+// rows stored as eight 16 byte columns, each column top to bottom
+static uint64_t expected_offset(const struct tiling_info *info, uint32_t pitch, uint32_t x_bytes, uint32_t y)
+{
+    if (info->modifier == I915_FORMAT_MOD_X_TILED)
+        return ((uint64_t)(y / 8) * (pitch / 512) + x_bytes / 512) * 4096 + (y % 8) * 512 + x_bytes % 512;
+
+    return ((uint64_t)(y / 32) * (pitch / 128) + x_bytes / 128) * 4096 + (x_bytes % 128) / 16 * 512 +
+           (y % 32) * 16 + x_bytes % 16;
+}
+
+// returns the number of wrong offsets
+static uint64_t check_offsets(const struct tiling_info *info)
+{
+    uint32_t surface_w = 3 * info->tile_width / 4 + 1, surface_h = 2 * info->tile_height + 1;
+    tiling_align(info, 4, &surface_w, &surface_h);
+    uint32_t pitch = surface_w * 4;
+    size_t size = (size_t)pitch * surface_h;
+    uint8_t *hit = calloc(size, 1);
+    if (!hit)
+        return 1;
+
+    uint64_t wrong = 0;
+    for (uint32_t y = 0; y < surface_h; y++)
+    {
+        for (uint32_t x = 0; x < pitch; x++)
+        {
+            uint64_t offset = tiling_offset(info, pitch, x, y);
+            if (offset != expected_offset(info, pitch, x, y) || offset >= size || hit[offset]++)
+                wrong++;
+        }
+    }
+
+    free(hit);
+    return wrong;
+}
+
+// swizzle odd rects into a surface three tiles wide and compare every pixel
+// with where tiling_offset says it goes, then read the rects back.
+// returns the number of wrong pixels
+static uint64_t check_swizzle(const struct tiling_info *info)
+{
+    uint32_t width = 3 * info->tile_width / 4 + 16, height = 3 * info->tile_height + 5;
+    uint32_t surface_w = width, surface_h = height;
+    tiling_align(info, 4, &surface_w, &surface_h);
+    uint32_t pitch = surface_w * 4;
+    uint32_t *surface = calloc((size_t)surface_w * surface_h, 4);
+    uint32_t *image = make_image(width, height, 0xFF);
+    uint32_t *readback = calloc((size_t)width * height, 4);
+    if (!surface || !image || !readback)
+    {
+        free(surface);
+        free(image);
+        free(readback);
+        return 1;
+    }
+
+    static const uint32_t rects[][4] = {{0, 0, 1, 1}, {3, 5, 37, 19}, {1, 1, 0, 0}, {0, 0, 0, 0}};
+    uint64_t wrong = 0;
+    for (int r = 0; r < 4; r++)
+    {
+        // 0 width/height is the rest of the image from x, y
+        uint32_t x = rects[r][0], y = rects[r][1];
+        uint32_t w = rects[r][2] ? rects[r][2] : width - x, h = rects[r][3] ? rects[r][3] : height - y;
+        memset(surface, 0, (size_t)pitch * surface_h);
+        tiling_swizzle(info, surface, pitch, x, y, image, width * 4, w, h);
+        tiling_deswizzle(info, readback, width * 4, surface, pitch, x, y, w, h);
+
+        uint64_t inside = 0;
+        for (uint32_t py = 0; py < surface_h; py++)
+        {
+            for (uint32_t px = 0; px < surface_w; px++)
+            {
+                uint32_t got = surface[tiling_offset(info, pitch, px * 4, py) / 4];
+                int in = px >= x && px < x + w && py >= y && py < y + h;
+                wrong += got != (in ? image[(size_t)(py - y) * width + (px - x)] : 0);
+                inside += got != 0;
+            }
+        }
+        for (uint32_t py = 0; py < h; py++)
+            wrong += memcmp(readback + (size_t)py * width, image + (size_t)py * width, (size_t)w * 4) != 0;
+        wrong += inside != (uint64_t)w * h;
+    }
+
+    free(surface);
+    free(image);
+    free(readback);
+    return wrong;
+}
+
+// number of pixels where the tiled frame and the linear one differ
+static uint64_t compare(const struct tiling_info *info, const uint8_t *tiled, uint32_t tiled_pitch,
+                        const uint32_t *linear, uint32_t *row)
+{
+    uint64_t wrong = 0;
+    for (uint32_t y = 0; y < HEIGHT; y++)
+    {
+        tiling_deswizzle(info, row, WIDTH * 4, tiled, tiled_pitch, 0, y, WIDTH, 1);
+        for (uint32_t x = 0; x < WIDTH; x++)
+            wrong += row[x] != linear[(size_t)y * WIDTH + x];
+    }
+    return wrong;
+}
+
+// render the same layers linear and tiled, first in full, then with a
+// window moved and only its old and new rect damaged. returns the number of
+// wrong pixels
+static uint64_t check_compositor(struct compositor *comp, const struct tiling_info *info)
+{
+    uint32_t surface_w = WIDTH, surface_h = HEIGHT;
+    tiling_align(info, 4, &surface_w, &surface_h);
+    uint32_t pitch = surface_w * 4;
+    uint8_t *tiled = alloc_lines((size_t)pitch * surface_h);
+    uint32_t *linear = alloc_lines((size_t)WIDTH * HEIGHT * 4);
+    uint32_t *row = malloc(WIDTH * 4);
+    uint32_t *background = make_image(WIDTH, HEIGHT, 0xFF);
+    uint32_t *window = make_image(97, 61, 0xC0);
+    uint64_t wrong = 1;
+    if (!tiled || !linear || !row || !background || !window)
+        goto out;
+
+    struct comp_layer layers[LAYER_COUNT] = {
+        {.type = COMP_LAYER_IMAGE, .w = WIDTH, .h = HEIGHT, .pixels = background, .pitch = WIDTH * 4},
+        {.type = COMP_LAYER_SOLID, .w = WIDTH, .h = 17, .color = 0xFF202020},
+        {.type = COMP_LAYER_BLEND, .x = 13, .y = 7, .w = 97, .h = 61, .pixels = window, .pitch = 97 * 4},
+        {.type = COMP_LAYER_SOLID, .x = 150, .y = 90, .w = 200, .h = 150, .color = 0x80400000},
+    };
+
+    compositor_render(comp, layers, LAYER_COUNT, linear, WIDTH * 4, WIDTH, HEIGHT, NULL);
+    if (compositor_render_tiled(comp, layers, LAYER_COUNT, tiled, pitch, info->modifier, WIDTH, HEIGHT, NULL))
+        goto out;
+    wrong = compare(info, tiled, pitch, linear, row);
+
+    struct damage damage;
+    damage_init(&damage, WIDTH, HEIGHT);
+    damage_add(&damage, layers[2].x, layers[2].y, 97, 61);
+    layers[2].x = 230;
+    layers[2].y = 120;
+    damage_add(&damage, layers[2].x, layers[2].y, 97, 61);
+    compositor_render(comp, layers, LAYER_COUNT, linear, WIDTH * 4, WIDTH, HEIGHT, &damage);
+    if (compositor_render_tiled(comp, layers, LAYER_COUNT, tiled, pitch, info->modifier, WIDTH, HEIGHT, &damage))
+        wrong++;
+    wrong += compare(info, tiled, pitch, linear, row);
+
+out:
+    free(tiled);
+    free(linear);
+    free(row);
+    free(background);
+    free(window);
+    return wrong;
+}
+
+int main(int argc, char **argv)
+{
+    struct compositor comp;
+    if (compositor_init(&comp, 2, 0, 0))
+        return EXIT_FAILURE;
+
+    int failed = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        const struct tiling_info *info = tiling_info_by_name(layouts[i]);
+        uint64_t offsets = check_offsets(info);
+        uint64_t swizzle = check_swizzle(info);
+        uint64_t composited = check_compositor(&comp, info);
+
+        printf("%s: %llu wrong offsets, %llu wrong swizzled pixels, %llu wrong composited pixels\n", info->name,
+               (unsigned long long)offsets, (unsigned long long)swizzle, (unsigned long long)composited);
+        failed |= offsets || swizzle || composited;
+    }
+
+    compositor_destroy(&comp);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "src/atomic.h"
+#include "src/frame_loop.h"
+#include "src/kms.h"
+#include "src/mode.h"
+#include "src/pacer.h"
+#include "src/plane_alloc.h"
+#include "src/swapchain.h"
+#include "src/trace.h"
+
+// build: gcc vrr_fb.c src/pacer.c src/mode.c src/atomic.c src/buffer_pool.c src/dumb_buffer.c src/swapchain.c src/frame_loop.c src/damage.c src/format.c src/pixel.c src/tiling.c src/plane_alloc.c src/kms.c src/kms_drm.c src/kms_fake.c src/kms_fbdev.c src/trace.c -o vrr_fb -lpthread -lm $(pkg-config --cflags --libs libdrm)
+// usage: ./vrr_fb [device] [--no-vrr]
+//        PLANES_MODE=@144 ./vrr_fb fake:1920x1080@144,vrr
+
+#define SWAPCHAIN_BUFFERS 2
+#define RUN_SECONDS 5
+
+/*
+    Renders frames whose cost swings between 40% and 120% of the refresh
+    interval, like a game whose scenes vary, and presents each one through
+    src/pacer.c. With VRR enabled a frame that overruns the interval is
+    shown as soon as it is done; at a fixed refresh it waits for the next
+    vblank. Run it once with and once without --no-vrr and compare the
+    ready to flip latency and the flip interval spread printed at exit.
+*/
+
+static uint64_t now_us(void)
+{
+    return trace_now() / 1000;
+}
+
+static void sleep_until_us(uint64_t us)
+{
+    struct timespec ts = {.tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        ;
+}
+
+// a flat colour per frame, then busy work until the frame has cost cost_us
+static void render_frame(struct sc_buffer *buf, uint32_t frame, uint64_t start_us, uint64_t cost_us)
+{
+    uint32_t color = 0xFF000000 | (frame * 5 & 0xFF) << 16 | (frame * 3 & 0xFF) << 8 | 0x40;
+    for (uint32_t y = 0; y < buf->create_dumb.height; y++)
+    {
+        uint32_t *row = (uint32_t *)((uint8_t *)buf->map + (size_t)y * buf->create_dumb.pitch);
+        for (uint32_t x = 0; x < buf->create_dumb.width; x++)
+            row[x] = color;
+    }
+
+    while (now_us() - start_us < cost_us)
+        ;
+}
+
+static void on_flip(struct frame_loop *loop, unsigned int sequence, uint64_t flip_us, void *data)
+{
+    pacer_flipped(data, flip_us);
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL;
+    int allow_vrr = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--no-vrr") == 0)
+            allow_vrr = 0;
+        else
+            device = argv[i];
+    }
+
+    trace_init();
+
+    int drm_fd = kms_open(device);
+    if (drm_fd < 0)
+    {
+        fprintf(stderr, "Failed to open DRM device: %s\n", strerror(-drm_fd));
+        return EXIT_FAILURE;
+    }
+
+    if (atomic_init(drm_fd))
+    {
+        fprintf(stderr, "%s does not support atomic modesetting\n", kms_backend_name(drm_fd));
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeRes *resources = kms_get_resources(drm_fd);
+    if (!resources)
+    {
+        perror("drmModeGetResources failed");
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeConnector *connector = NULL;
+    for (int i = 0; i < resources->count_connectors; i++)
+    {
+        connector = kms_get_connector(drm_fd, resources->connectors[i]);
+        if (connector && connector->connection == DRM_MODE_CONNECTED && connector->count_modes > 0)
+            break;
+        drmModeFreeConnector(connector);
+        connector = NULL;
+    }
+    if (!connector)
+    {
+        fprintf(stderr, "No active connector found.\n");
+        drmModeFreeResources(resources);
+        kms_close(drm_fd);
+        return EXIT_FAILURE;
+    }
+
+    drmModeModeInfo mode = *mode_pick(connector);
+    uint32_t crtc_id = resources->crtcs[0];
+
+    struct crtc_props crtc_props;
+    struct connector_props connector_props;
+    struct plane_table planes;
+    if (atomic_get_crtc_props(drm_fd, crtc_id, &crtc_props) ||
+        atomic_get_connector_props(drm_fd, connector->connector_id, &connector_props) ||
+        plane_table_load(drm_fd, &planes))
+    {
+        fprintf(stderr, "Cannot look up CRTC/connector/plane properties\n");
+        return EXIT_FAILURE;
+    }
+
+    int crtc_index = plane_table_crtc_index(&planes, crtc_id);
+    if (crtc_index < 0)
+    {
+        fprintf(stderr, "CRTC %u is not in the plane table\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+    struct plane_info *primary = NULL;
+    for (int i = 0; i < planes.count && !primary; i++)
+    {
+        if (planes.planes[i].type == DRM_PLANE_TYPE_PRIMARY && (planes.planes[i].possible_crtcs & (1u << crtc_index)))
+            primary = &planes.planes[i];
+    }
+    if (!primary)
+    {
+        fprintf(stderr, "No primary plane for CRTC %u\n", crtc_id);
+        return EXIT_FAILURE;
+    }
+
+    struct swapchain sc;
+    if (swapchain_init(&sc, drm_fd, SWAPCHAIN_BUFFERS, mode.hdisplay, mode.vdisplay, DRM_FORMAT_XRGB8888))
+        return EXIT_FAILURE;
+
+    // always a modeset, VRR_ENABLED goes in with the mode
+    struct atomic_req req;
+    atomic_req_init(&req);
+    uint32_t mode_blob_id = 0;
+    if (atomic_set_mode(drm_fd, &req, &crtc_props, &connector_props, &mode, &mode_blob_id))
+        return EXIT_FAILURE;
+    uint32_t commit_flags = ATOMIC_FLIP_FLAGS | DRM_MODE_ATOMIC_ALLOW_MODESET;
+
+    int capable = atomic_vrr_capable(connector, &connector_props);
+    int vrr = allow_vrr && capable && atomic_set_vrr(&req, &crtc_props, 1) == 0;
+    if (!vrr)
+        atomic_set_vrr(&req, &crtc_props, 0);
+    printf("Mode %s %.3f Hz, %u kHz, VRR %s\n", mode.name, mode_refresh_mhz(&mode) / 1000.0, mode.clock,
+           vrr ? "on" : capable ? "off" : "not supported");
+
+    struct pacer pacer;
+    pacer_init(&pacer, &mode, vrr);
+
+    struct frame_loop loop;
+    frame_loop_init(&loop, drm_fd, on_flip, &pacer);
+    frame_loop_add_swapchain(&loop, &sc);
+
+    uint64_t end_us = now_us() + RUN_SECONDS * 1000000ull;
+    uint32_t frame = 0, seed = 1;
+    int ret;
+
+    while (now_us() < end_us)
+    {
+        uint64_t start_us = pacer_start_us(&pacer);
+        if (start_us > now_us())
+            sleep_until_us(start_us);
+
+        struct sc_buffer *buf = swapchain_acquire(&sc);
+        if (!buf)
+        {
+            fprintf(stderr, "No free buffer\n");
+            break;
+        }
+
+        seed = seed * 1103515245 + 12345;
+        uint64_t cost_us = pacer.period_us * (40 + (seed >> 16) % 81) / 100;
+        uint64_t render_start = now_us();
+        render_frame(buf, frame++, render_start, cost_us);
+        pacer_rendered(&pacer, render_start, now_us());
+        swapchain_queue(&sc, buf, NULL);
+
+        struct sc_buffer *next = swapchain_next_ready(&sc);
+        atomic_set_plane(&req, &primary->props, crtc_id, next->fb_id, 0, 0, mode.hdisplay, mode.vdisplay,
+                         0, 0, mode.hdisplay << 16, mode.vdisplay << 16);
+        ret = atomic_commit(drm_fd, &req, commit_flags, &loop);
+        if (ret)
+        {
+            fprintf(stderr, "Atomic commit failed: %s\n", strerror(-ret));
+            swapchain_cancel(&sc, next);
+            break;
+        }
+        swapchain_submit(&sc, next);
+        frame_loop_begin_flip(&loop);
+        commit_flags = ATOMIC_FLIP_FLAGS;
+
+        // one frame in flight, the next one is paced off this flip
+        if (frame_loop_wait_idle(&loop) < 0)
+            break;
+    }
+
+    frame_loop_wait_idle(&loop);
+    frame_histogram_print(&loop.hist, stdout);
+    pacer_print(&pacer, stdout);
+    trace_finish();
+
+    swapchain_destroy(&sc);
+    plane_table_free(&planes);
+    if (mode_blob_id)
+        kms_destroy_property_blob(drm_fd, mode_blob_id);
+    drmModeFreeConnector(connector);
+    drmModeFreeResources(resources);
+    kms_close(drm_fd);
+
+    return EXIT_SUCCESS;
+}